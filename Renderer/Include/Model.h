@@ -24,6 +24,12 @@ using namespace std;
 #include "OVR_CAPI_GL.h"
 #include "TextureLoader.h"
 #include "decoder.h"
+#include "frame_destination.h"
+#include "block_transcoder.h"
+#include "playback.h"
+#include "thread_pool.h"
+#include "frame_streamer.h"
+#include "sequence_reader.h"
 #include <vector>
 using namespace OVR;
 
@@ -50,6 +56,38 @@ struct Vertex
 
 typedef unsigned long long ull;
 
+// The slots of the MPTC decoder in one persistently mapped pixel unpack
+// buffer. Frames are reconstructed right where glCompressedTexSubImage2D
+// reads them, so the driver has no client memory to copy. The mapping is
+// readable and kept in client memory, the decoder reads every frame back
+// as the reference of the next. The texture files streamed by a
+// FrameStreamer are staged in the same way.
+class PboFrameDestination : public MPTC::FrameDestination, public MPTC::StagingBuffers {
+public:
+	PboFrameDestination();
+	~PboFrameDestination();
+
+	void Initialize(uint32_t num_slots, size_t slot_size);
+	void Release();
+
+	uint32_t NumSlots() const { return m_NumSlots; }
+	uint32_t RowPitch() const { return 0; }
+	PhysicalDXTBlock *Slot(uint32_t slot);
+
+	uint32_t NumBuffers() const { return m_NumSlots; }
+	size_t BufferSize() const { return m_SlotSize; }
+	uint8_t *BufferData(uint32_t buffer);
+
+	GLuint Buffer() const { return m_Buffer; }
+	size_t SlotOffset(uint32_t slot) const { return slot * m_SlotSize; }
+
+private:
+	GLuint m_Buffer;
+	uint8_t *m_Data;
+	uint32_t m_NumSlots;
+	size_t m_SlotSize;
+};
+
 class Model{
 public:
 	Model(const char * imagepath);
@@ -67,8 +105,11 @@ public:
 	void InitializeTextures();
 	void InitializeTexture();
 	void InitializeTextureRGB();
-	void InitializeCompressedTexture();
+	void InitializeCompressedTexture(GLenum format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT);
 	void InitializeMPTC();
+	void InitializeTextureArchive();
+	void InitializeFrameStreamer();
+	MPTC::FileSequence TextureFiles() const;
 
 	bool LoadTextureData(const string imagepath);
 	bool LoadTextureDataJPG(const string imagepath);
@@ -78,6 +119,8 @@ public:
 	bool LoadCompressedTextureDXT(const string imagepath);
 	bool LoadCompressedTextureCRN(const string imagepath);
 	bool LoadCompressedTextureGTC(const string imagepath, std::unique_ptr<gpu::GPUContext> &ctx);
+	bool LoadCompressedTextureGTC(const uint8_t *data, size_t length, std::unique_ptr<gpu::GPUContext> &ctx);
+	bool LoadStreamedTexture();
 	void RenderDynamicModel(Matrix4f view, Matrix4f proj);
 	void loadBMP_custom(const char * imagepath, GLuint texID, GLuint pbo);
 
@@ -123,7 +166,39 @@ public:
 
 	//MPTC stuff
 	BufferStruct *ptr_buffer_struct;
-	std::ifstream mptc_file_stream;
+	MPTC::MappedSource mptc_source;
+	PboFrameDestination mptc_destination;
+	// Paces the ring by wall clock, see PlaybackScheduler
+	MPTC::PlaybackScheduler mptc_scheduler;
+	std::vector<MPTC::FrameIndexEntry> mptc_frame_index;
+	GLsync mptc_upload_fence;
+	// Block rows that changed since the last upload, see GetDirtyRowRuns
+	std::vector<MPTCDirtyRows> mptc_dirty_runs;
+	ull mptc_upload_bytes;  // sent by all uploads so far
+	ull mptc_frame_bytes;   // the same uploads as whole frames
+	// Turns the frames into the texture format when it is not DXT1
+	MPTC::FrameTranscoder *mptc_transcoder;
+	std::vector<uint8_t> mptc_transcoded;
+	//CRN stuff
+	// Unpacks the frames that have restart points in bands, created with the
+	// first of them
+	std::unique_ptr<MPTC::ThreadPool> crn_pool;
+	//JPG stuff
+	// Decodes the frames that have restart markers in bands, created with
+	// the first frame
+	std::unique_ptr<MPTC::ThreadPool> jpg_pool;
+	//Texture streaming stuff
+	// Reads and decodes the texture files ahead on prefetch threads, into
+	// the slots of stream_staging
+	MPTC::FrameStreamer stream;
+	std::unique_ptr<MPTC::FrameLoader> stream_loader;
+	// Reads the files ahead for the loader
+	std::unique_ptr<MPTC::SequenceReader> stream_reader;
+	PboFrameDestination stream_staging;
+	MPTC::StagedFrame stream_frame;  // uploaded last
+	GLsync stream_upload_fence;      // of that upload, stream_frame is held until it passes
+	// The texture files packed into one, mapped when nothing else reads it
+	MPTC::FrameArchive texture_archive;
 	//OpenCL context;
 
 	bool DynamicModel;
@@ -26,6 +26,48 @@ namespace stbi {
 //#define MPTC
 #define PBO
 #define MAX_TEXTURES 580
+// Number of decoded frames the MPTC decoder thread may run ahead, tune it
+// with the underrun and producer wait counters printed with the stats
+#define MPTC_BUFFER_SIZE 4
+// Clean block rows between two dirty runs that still go up in one upload
+#define MPTC_DIRTY_MERGE_GAP 4
+// Transcode MPTC frames on the CPU for GPUs without S3TC, to one of the
+// MPTC::TranscodeFormat values
+//#define MPTC_TRANSCODE MPTC::eTranscodeFormat_BC7
+// Presentation time of an MPTC frame. Playback skims ahead once it lags a
+// frame behind the clock and jumps to the next key frame after four.
+#define MPTC_FRAME_MS 70.0
+// Presentation time of a texture file
+#define TEXTURE_FRAME_MS 70.0
+// Read and decode the texture files on prefetch threads, into a persistently
+// mapped upload buffer, so that RenderModel only uploads the frame due.
+// Threads loading at once, and how many frames they may load ahead.
+#define FRAME_STREAMER
+#define FRAME_STREAMER_THREADS 2
+#define FRAME_STREAMER_LOOKAHEAD 4
+// Read the texture files for the prefetch threads in order on an I/O
+// thread, this many ahead, and have the OS start on the ones after them
+#define SEQUENCE_READER
+#define SEQUENCE_READ_AHEAD 8
+#define SEQUENCE_ADVISE_AHEAD 8
+// Read around the page cache, for sequences larger than memory
+//#define SEQUENCE_BYPASS_CACHE
+// Read the texture files from one archive, "<texture path>.mpfa" as
+// mptc_pack writes it, instead of opening a file per frame. The archive is
+// mapped unless the sequence reader reads it.
+//#define FRAME_ARCHIVE
+
+// GTC frames are decoded on the GPU and MPTC has a decoder thread of its own
+#if (defined GTC) || (defined MPTC)
+#undef FRAME_STREAMER
+#endif
+#ifndef FRAME_STREAMER
+#undef SEQUENCE_READER
+#endif
+
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#endif
 
 #ifdef FOURK
 #if (defined GTC) || (defined JPG) || (defined BMP) || (defined CRN) || (defined MPTC)
@@ -266,27 +308,155 @@ GLuint loadShaders(const char * vertex_file_path, const char * fragment_file_pat
 
 
 ///////////////////////////////Loading from MPTC//////////////////////////////
+PboFrameDestination::PboFrameDestination()
+	: m_Buffer(0), m_Data(NULL), m_NumSlots(0), m_SlotSize(0) {
+}
+
+PboFrameDestination::~PboFrameDestination() {
+	Release();
+}
+
+void PboFrameDestination::Initialize(uint32_t num_slots, size_t slot_size) {
+	Release();
+
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	const GLsizeiptr size = static_cast<GLsizeiptr>(num_slots * slot_size);
+
+	CHECK_GL(glGenBuffers, 1, &m_Buffer);
+	CHECK_GL(glBindBuffer, GL_PIXEL_UNPACK_BUFFER, m_Buffer);
+	CHECK_GL(glBufferStorage, GL_PIXEL_UNPACK_BUFFER, size, NULL, flags | GL_CLIENT_STORAGE_BIT);
+	m_Data = (uint8_t *)CHECK_GL(glMapBufferRange, GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+	CHECK_GL(glBindBuffer, GL_PIXEL_UNPACK_BUFFER, 0);
+
+	if (m_Data == NULL) {
+		std::cerr << "Error mapping the MPTC upload buffer" << std::endl;
+		exit(-1);
+	}
+	m_NumSlots = num_slots;
+	m_SlotSize = slot_size;
+}
+
+void PboFrameDestination::Release() {
+	if (m_Buffer == 0)
+		return;
+
+	CHECK_GL(glBindBuffer, GL_PIXEL_UNPACK_BUFFER, m_Buffer);
+	CHECK_GL(glUnmapBuffer, GL_PIXEL_UNPACK_BUFFER);
+	CHECK_GL(glBindBuffer, GL_PIXEL_UNPACK_BUFFER, 0);
+	CHECK_GL(glDeleteBuffers, 1, &m_Buffer);
+	m_Buffer = 0;
+	m_Data = NULL;
+	m_NumSlots = 0;
+	m_SlotSize = 0;
+}
+
+PhysicalDXTBlock *PboFrameDestination::Slot(uint32_t slot) {
+	assert(slot < m_NumSlots);
+	return reinterpret_cast<PhysicalDXTBlock *>(m_Data + SlotOffset(slot));
+}
+
+uint8_t *PboFrameDestination::BufferData(uint32_t buffer) {
+	assert(buffer < m_NumSlots);
+	return m_Data + SlotOffset(buffer);
+}
+
+#ifdef MPTC
+// Texture format the MPTC frames are uploaded as
+static GLenum MPTCTextureFormat() {
+#ifdef MPTC_TRANSCODE
+	switch (MPTC_TRANSCODE) {
+	case MPTC::eTranscodeFormat_ETC2_RGB: return GL_COMPRESSED_RGB8_ETC2;
+	case MPTC::eTranscodeFormat_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	default: return GL_RGBA8;
+	}
+#else
+	return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+#endif
+}
+#endif
+
 bool Model::LoadCompressedTextureMPTC() {
 
+	// The slot of the last upload goes back to the decoder with the next
+	// frame, the GPU has to be done reading it by then. This runs once per
+	// eye, only wait when a new frame is due to be taken from the ring.
+	MPTC::PlaybackClock::time_point now = MPTC::PlaybackClock::now();
+	if (mptc_upload_fence != NULL) {
+		if (CHECK_GL(glClientWaitSync, mptc_upload_fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+			if (!mptc_scheduler.IsFrameDue(now))
+				return false;
+			CHECK_GL(glClientWaitSync, mptc_upload_fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		}
+		CHECK_GL(glDeleteSync, mptc_upload_fence);
+		mptc_upload_fence = NULL;
+	}
+
+	// Frames are decoded on the decoder thread, which times them itself
+	MPTCBufferedFrameStats frame_stats;
+	while (ReadBufferedFrameStats(ptr_buffer_struct, &frame_stats, 1) == 1)
+		m_CPUDecode.push_back(frame_stats.decode.decode_ns);
+
 	PhysicalDXTBlock * curr_dxt;
-	std::chrono::high_resolution_clock::time_point CPUDecode_Start = std::chrono::high_resolution_clock::now();
-	GetBufferedFrame(ptr_buffer_struct, curr_dxt, mptc_file_stream);
-	std::chrono::high_resolution_clock::time_point CPUDecode_End = std::chrono::high_resolution_clock::now();
+	int frame_status = mptc_scheduler.GetFrame(now, curr_dxt);
 
-	std::chrono::nanoseconds CPUDecode_Time = std::chrono::duration_cast<std::chrono::nanoseconds>(CPUDecode_End - CPUDecode_Start);
-	m_CPUDecode.push_back(CPUDecode_Time.count());
+	// No newer frame is due, or the decoder has not finished it, keep the
+	// current texture
+	if (frame_status == kMPTCFrameNotReady)
+		return false;
 
 	std::chrono::high_resolution_clock::time_point GPULoad_Start = std::chrono::high_resolution_clock::now();
 	CHECK_GL(glBindTexture, GL_TEXTURE_2D, TextureID);
 
-	CHECK_GL(glCompressedTexSubImage2D, GL_TEXTURE_2D,    // Type of texture
-		0,                // level (0 being the top level i.e. full size)
-		0, 0,             // Offset
-		kImageWidth,       // Width of the texture
-		kImageHeight,      // Height of the texture,
-		GL_COMPRESSED_RGB_S3TC_DXT1_EXT,          // Data format
-		kImageWidth*kImageHeight / 2, // Type of texture data
-		curr_dxt);     // 
+	// The texture holds the frame handed out before this one, only the block
+	// rows that differ from it go up. After frames were dropped or skipped
+	// the whole frame does.
+	const uint64_t *dirty_map = mptc_scheduler.GetDirtyMap(NULL);
+	uint32_t num_runs = 1;
+	mptc_dirty_runs[0].first_row = 0;
+	mptc_dirty_runs[0].num_rows = kImageHeight / 4;
+	if (dirty_map != NULL) {
+		num_runs = GetDirtyRowRuns(ptr_buffer_struct->ptr_decode_info, dirty_map, MPTC_DIRTY_MERGE_GAP,
+			mptc_dirty_runs.data());
+	}
+#ifdef MPTC_TRANSCODE
+	// The rows are transcoded on the pool and go up from client memory
+	const size_t transcoded_row_bytes = mptc_transcoder->OutputPitch();
+	for (uint32_t run = 0; run < num_runs; run++) {
+		const MPTCDirtyRows &rows = mptc_dirty_runs[run];
+		mptc_transcoder->Transcode(curr_dxt, 0, rows.first_row, rows.first_row + rows.num_rows, mptc_transcoded.data());
+		const GLvoid *data = mptc_transcoded.data() + rows.first_row * transcoded_row_bytes;
+		if (MPTC_TRANSCODE == MPTC::eTranscodeFormat_RGBA8) {
+			CHECK_GL(glTexSubImage2D, GL_TEXTURE_2D, 0, 0, rows.first_row * 4, kImageWidth, rows.num_rows * 4,
+				GL_RGBA, GL_UNSIGNED_BYTE, data);
+		}
+		else {
+			CHECK_GL(glCompressedTexSubImage2D, GL_TEXTURE_2D, 0, 0, rows.first_row * 4, kImageWidth, rows.num_rows * 4,
+				MPTCTextureFormat(), rows.num_rows * transcoded_row_bytes, data);
+		}
+		mptc_upload_bytes += rows.num_rows * transcoded_row_bytes;
+	}
+	mptc_frame_bytes += mptc_transcoder->OutputSize();
+#else
+	// The frame was decoded into the upload buffer, point the upload at its slot
+	assert(curr_dxt == mptc_destination.Slot(ptr_buffer_struct->curr_dxt_idx));
+	CHECK_GL(glBindBuffer, GL_PIXEL_UNPACK_BUFFER, mptc_destination.Buffer());
+	const size_t row_bytes = kImageWidth / 4 * sizeof(PhysicalDXTBlock);
+	for (uint32_t run = 0; run < num_runs; run++) {
+		const MPTCDirtyRows &rows = mptc_dirty_runs[run];
+		CHECK_GL(glCompressedTexSubImage2D, GL_TEXTURE_2D,    // Type of texture
+			0,                // level (0 being the top level i.e. full size)
+			0, rows.first_row * 4,  // Offset
+			kImageWidth,       // Width of the texture
+			rows.num_rows * 4, // Height of the texture,
+			GL_COMPRESSED_RGB_S3TC_DXT1_EXT,          // Data format
+			rows.num_rows * row_bytes, // Type of texture data
+			(const GLvoid *)(mptc_destination.SlotOffset(ptr_buffer_struct->curr_dxt_idx) + rows.first_row * row_bytes));
+		mptc_upload_bytes += rows.num_rows * row_bytes;
+	}
+	mptc_frame_bytes += kImageWidth*kImageHeight / 2;
+	CHECK_GL(glBindBuffer, GL_PIXEL_UNPACK_BUFFER, 0);
+#endif
+	mptc_upload_fence = CHECK_GL(glFenceSync, GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 	std::chrono::high_resolution_clock::time_point GPULoad_End = std::chrono::high_resolution_clock::now();
 	std::chrono::nanoseconds GPULoad_Time = std::chrono::duration_cast<std::chrono::nanoseconds>(GPULoad_End - GPULoad_Start);
 	m_GPULoad.push_back(GPULoad_Time.count());
@@ -417,6 +587,38 @@ bool Model::LoadCompressedTextureDXT(const string imagepath){
 	return true;
 }
 
+// Decodes a JPG to RGBA at dst. With restart markers the MCU rows are
+// decoded in bands that start on them, about two per thread of pool, else
+// by stb on this thread. Either way the pixels are the same. If a band
+// fails the whole frame is decoded again by stb. Returns false only if
+// that fails too, dst then holds a partly written frame.
+static bool DecodeJPG(const unsigned char *data, int size, unsigned char *dst, MPTC::ThreadPool *pool)
+{
+	int x, y, n, mcu_rows, band_rows;
+	stbi_jpeg_bands *bands = pool ? stbi_jpeg_bands_begin(data, size, &x, &y, &n, &mcu_rows, &band_rows) : NULL;
+	if (bands == NULL)
+		return stbi_load_from_memory_into_dst(dst, data, size, &x, &y, &n, 4) != 0;
+
+	const int num_units = (mcu_rows + band_rows - 1) / band_rows;
+	const int num_bands = std::max(1U, pool->NumThreads() * 2);
+	const int rows_per_band = std::max(1, (num_units + num_bands - 1) / num_bands) * band_rows;
+	std::atomic<bool> decoded(true);
+	MPTC::TaskGraph graph;
+	for (int first_row = 0; first_row < mcu_rows; first_row += rows_per_band) {
+		const int end_row = std::min(first_row + rows_per_band, mcu_rows);
+		graph.AddTask([=, &decoded] {
+			if (!stbi_jpeg_bands_decode(bands, dst, 4, first_row, end_row))
+				decoded = false;
+		});
+	}
+	graph.Run(*pool);
+	stbi_jpeg_bands_end(bands);
+	if (decoded)
+		return true;
+	std::cerr << "Error decoding a JPG band, decoding the whole frame instead" << std::endl;
+	return stbi_load_from_memory_into_dst(dst, data, size, &x, &y, &n, 4) != 0;
+}
+
 bool Model::LoadTextureDataJPG(const string fileName){
 
 	unsigned char *ImageDataPtr = (unsigned char *)malloc((kImageHeight * kImageWidth * 4));
@@ -424,7 +626,7 @@ bool Model::LoadTextureDataJPG(const string fileName){
 
 	//CPU LOADING.....
 	std::chrono::high_resolution_clock::time_point CPULoad_Start = std::chrono::high_resolution_clock::now();
-	fread(ImageDataPtr, 1, kImageHeight * kImageWidth * 4, fp);
+	size_t size = fread(ImageDataPtr, 1, kImageHeight * kImageWidth * 4, fp);
 	std::chrono::high_resolution_clock::time_point CPULoad_End = std::chrono::high_resolution_clock::now();
 	std::chrono::nanoseconds CPULoad_Time = std::chrono::duration_cast<std::chrono::nanoseconds>(CPULoad_End - CPULoad_Start);
 	m_CPULoad.push_back(CPULoad_Time.count());
@@ -432,9 +634,17 @@ bool Model::LoadTextureDataJPG(const string fileName){
 	std::chrono::high_resolution_clock::time_point CPUDecode_Start = std::chrono::high_resolution_clock::now();
 
 	int x, y, n;
-	unsigned char *textureData = stbi_load_from_memory(ImageDataPtr, (kImageHeight * kImageWidth * 4), &x, &y, &n, 4);
-	assert(x == kImageWidth);
+	bool is_jpg = stbi_info_from_memory(ImageDataPtr, size, &x, &y, &n) != 0;
+	assert(is_jpg && x == kImageWidth);
 	assert(y == kImageHeight);
+	if (!jpg_pool)
+		jpg_pool.reset(new MPTC::ThreadPool());
+	unsigned char *textureData = (unsigned char *)malloc(kImageHeight * kImageWidth * 4);
+	if (!DecodeJPG(ImageDataPtr, size, textureData, jpg_pool.get())) {
+		std::cerr << "Error decoding " << fileName << std::endl;
+		free(textureData);
+		return false;
+	}
 	std::chrono::high_resolution_clock::time_point CPUDecode_End = std::chrono::high_resolution_clock::now();
 
 	std::chrono::nanoseconds CPUDecode_Time = std::chrono::duration_cast<std::chrono::nanoseconds>(CPUDecode_End - CPUDecode_Start);
@@ -473,7 +683,7 @@ bool Model::LoadTextureDataJPG(const string fileName){
 	m_GPULoad.push_back(gpu_load_time);
 	// Specify our minification and magnification filters
 	
-	stbi_image_free(textureData);
+	free(textureData);
 
 		// Finally, return the texture ID
 	return true;
@@ -517,8 +727,16 @@ bool Model::LoadTextureDataPBO(const string imagepath){
 	
 	std::chrono::high_resolution_clock::time_point CPUDecode_Start = std::chrono::high_resolution_clock::now();
 	int x, y, n;
-
-	stbi_load_from_memory_into_dst(textureData, ImageDataPtr, size, &x, &y, &n, 4);
+	stbi_info_from_memory(ImageDataPtr, size, &x, &y, &n);
+	if (!jpg_pool)
+		jpg_pool.reset(new MPTC::ThreadPool());
+	if (!DecodeJPG(ImageDataPtr, size, textureData, jpg_pool.get())) {
+		std::cerr << "Error decoding " << imagepath << std::endl;
+		CHECK_GL(glUnmapBuffer, GL_PIXEL_UNPACK_BUFFER);
+		CHECK_GL(glBindBuffer, GL_PIXEL_UNPACK_BUFFER, 0);
+		delete[] ImageDataPtr;
+		return false;
+	}
 	std::chrono::high_resolution_clock::time_point CPUDecode_End = std::chrono::high_resolution_clock::now();
 
 	std::chrono::nanoseconds CPUDecode_Time = std::chrono::duration_cast<std::chrono::nanoseconds>(CPUDecode_End - CPUDecode_Start);
@@ -569,26 +787,30 @@ bool Model::LoadTextureDataPBO(const string imagepath){
 }
 
 bool Model::LoadCompressedTextureGTC(const string imagepath, std::unique_ptr<gpu::GPUContext> &ctx) {
- GenTC::GenTCHeader hdr;
-  // Load in compressed data.
-  double start_time = glfwGetTime();
-  std::ifstream is (imagepath.c_str(), std::ifstream::binary);
-  if (!is) {
+  // Mapped, the copy below reads the file
+  MPTC::MappedFile file;
+  if (!file.Open(imagepath)) {
     assert(!"Error opening GenTC texture!");
 	return false;
   }
+  return LoadCompressedTextureGTC(file.Data(), static_cast<size_t>(file.Size()), ctx);
+}
 
-  is.seekg(0, is.end);
-  size_t length = static_cast<size_t>(is.tellg());
-  is.seekg(0, is.beg);
-
+bool Model::LoadCompressedTextureGTC(const uint8_t *data, size_t length, std::unique_ptr<gpu::GPUContext> &ctx) {
+ GenTC::GenTCHeader hdr;
+  // Load in compressed data.
+  double start_time = glfwGetTime();
   static const size_t kHeaderSz = sizeof(hdr);
+  if (length < kHeaderSz) {
+    assert(!"Error reading GenTC texture!");
+	return false;
+  }
   const size_t mem_sz = length - kHeaderSz;
 
   //CPU file load times
   
 
-  is.read(reinterpret_cast<char *>(&hdr), kHeaderSz);
+  memcpy(&hdr, data, kHeaderSz);
 
  
 
@@ -597,16 +819,12 @@ bool Model::LoadCompressedTextureGTC(const string imagepath, std::unique_ptr<gpu
 
   std::chrono::high_resolution_clock::time_point CPULoad_Start =
 	  std::chrono::high_resolution_clock::now();
-  is.read(reinterpret_cast<char *>(cmp_data.data()) + 512, mem_sz);
+  memcpy(cmp_data.data() + 512, data + kHeaderSz, mem_sz);
 
   std::chrono::high_resolution_clock::time_point CPULoad_End = std::chrono::high_resolution_clock::now();
 
   std::chrono::nanoseconds CPULoad_Time = std::chrono::duration_cast<std::chrono::nanoseconds>(CPULoad_End - CPULoad_Start);
   m_CPULoad.push_back(CPULoad_Time.count());
-
-  assert(is);
-  assert(is.tellg() == static_cast<std::streamoff>(length));
-  is.close();
   
   const cl_uint num_blocks = hdr.height * hdr.width / 16;
   cl_uint *offsets = reinterpret_cast<cl_uint *>(cmp_data.data());
@@ -723,6 +941,68 @@ static stbi::crn_uint8 *read_file_into_buffer(const char *pFilename, stbi::crn_u
 	return pSrc_file_data;
 }
 
+// Restart points of the first level of a CRN frame, "<path>.rst" as
+// crn_bench --index writes them, or the side data of the frame in a frame
+// archive:
+//   u32 magic "CRNR", u32 version, u32 size of the CRN file,
+//   u32 rows_per_point, u32 num_points, num_points x crn_restart_point
+// Building them takes about as long as unpacking the frame, so frames
+// without them are unpacked serially.
+static bool ParseCRNRestartPoints(const unsigned char *data, size_t size, stbi::crn_uint32 file_size,
+	std::vector<stbi::crnd::crn_restart_point> *points)
+{
+	static const size_t kHeaderSize = 20;
+	if (data == NULL || size < kHeaderSize)
+		return false;
+
+	uint32_t magic = 0, version = 0, indexed_size = 0, rows_per_point = 0, num_points = 0;
+	memcpy(&magic, data, 4);
+	memcpy(&version, data + 4, 4);
+	memcpy(&indexed_size, data + 8, 4);
+	memcpy(&rows_per_point, data + 12, 4);
+	memcpy(&num_points, data + 16, 4);
+	if (magic != 0x524E5243 || version != 1 || indexed_size != file_size || num_points == 0 ||
+		(size - kHeaderSize) / sizeof(stbi::crnd::crn_restart_point) < num_points)
+		return false;
+
+	points->resize(num_points);
+	memcpy(points->data(), data + kHeaderSize, num_points * sizeof(stbi::crnd::crn_restart_point));
+	return true;
+}
+
+static bool LoadCRNRestartPoints(const string &path, stbi::crn_uint32 file_size,
+	std::vector<stbi::crnd::crn_restart_point> *points)
+{
+	std::ifstream in_stream((path + ".rst").c_str(), std::ios::binary);
+	if (!in_stream.is_open())
+		return false;
+	std::vector<unsigned char> data((std::istreambuf_iterator<char>(in_stream)), std::istreambuf_iterator<char>());
+	return ParseCRNRestartPoints(data.data(), data.size(), file_size, points);
+}
+
+// Unpacks level 0 like crnd_unpack_level, with restart points in one task
+// per band on pool, the bands write the same blocks
+static bool UnpackCRNLevel(stbi::crnd::crnd_unpack_context context, void **dst, stbi::crn_uint32 dst_size,
+	stbi::crn_uint32 row_pitch, const std::vector<stbi::crnd::crn_restart_point> &restart_points,
+	MPTC::ThreadPool *pool)
+{
+	if (restart_points.empty() || pool == NULL)
+		return stbi::crnd::crnd_unpack_level(context, dst, dst_size, row_pitch, 0);
+
+	std::atomic<bool> unpacked(true);
+	MPTC::TaskGraph graph;
+	for (size_t point = 0; point < restart_points.size(); point++) {
+		const stbi::crnd::crn_restart_point *start_point = &restart_points[point];
+		stbi::crn_uint32 end_row = point + 1 < restart_points.size() ? restart_points[point + 1].m_chunk_row : UINT32_MAX;
+		graph.AddTask([=, &unpacked] {
+			if (!stbi::crnd::crnd_unpack_level_rows(context, dst, dst_size, row_pitch, 0, *start_point, end_row))
+				unpacked = false;
+		});
+	}
+	graph.Run(*pool);
+	return unpacked;
+}
+
 bool Model::LoadCompressedTextureCRN(const string imagepath){
 
 	stbi::crn_uint32 src_file_size;
@@ -753,6 +1033,11 @@ bool Model::LoadCompressedTextureCRN(const string imagepath){
 
 
 	stbi::crnd::crnd_unpack_context pContext = stbi::crnd::crnd_unpack_begin(pSrc_file_data, src_file_size);
+
+	// Frames with restart points are unpacked in bands on the pool
+	std::vector<stbi::crnd::crn_restart_point> restart_points;
+	if (LoadCRNRestartPoints(imagepath, src_file_size, &restart_points) && !crn_pool)
+		crn_pool.reset(new MPTC::ThreadPool());
 #ifdef PBO
 
 	GLuint64 gpu_load_time1;
@@ -768,7 +1053,7 @@ bool Model::LoadCompressedTextureCRN(const string imagepath){
 		std::chrono::high_resolution_clock::now();
 
 	void *pTextureData = TextureData;
-	stbi::crnd::crnd_unpack_level(pContext, &pTextureData, total_face_size, row_pitch,0);
+	UnpackCRNLevel(pContext, &pTextureData, total_face_size, row_pitch, restart_points, crn_pool.get());
 	
 	std::chrono::high_resolution_clock::time_point CPUDecode_end =
 		std::chrono::high_resolution_clock::now();
@@ -814,7 +1099,7 @@ bool Model::LoadCompressedTextureCRN(const string imagepath){
 	void *TextureData;
 	TextureData = malloc(kImageWidth*kImageHeight / 2);
 	void *CrunchPtr = TextureData;
-	stbi::crnd::crnd_unpack_level(pContext, &TextureData, total_face_size, row_pitch,0);
+	UnpackCRNLevel(pContext, &TextureData, total_face_size, row_pitch, restart_points, crn_pool.get());
 	std::chrono::high_resolution_clock::time_point cpu_load_end =
 		std::chrono::high_resolution_clock::now();
 	std::chrono::high_resolution_clock::time_point CPUDecode_End = std::chrono::high_resolution_clock::now();
@@ -844,6 +1129,372 @@ bool Model::LoadCompressedTextureCRN(const string imagepath){
 	return true;
 }
 
+//-----------------Streaming texture files------------------//
+#ifdef FRAME_STREAMER
+// Bytes of a frame as it goes up to the texture
+static size_t StreamedFrameSize() {
+#if (defined JPG)
+	return kImageWidth * kImageHeight * 4;
+#elif (defined BMP)
+	return kImageWidth * kImageHeight * 3;
+#else
+	return kImageWidth * kImageHeight / 2;
+#endif
+}
+
+static ull ElapsedNS(std::chrono::high_resolution_clock::time_point start) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Where the texture files come from: the sequence reader when there is
+// one, else the mapped archive when there is one, else a file per frame.
+// files names the frames in messages either way.
+struct FrameSource {
+	MPTC::FileSequence files;
+	MPTC::SequenceReader *reader;
+	const MPTC::FrameArchive *archive;
+	bool is_packed;  // the frames come from an archive, with their side data
+};
+
+// A whole texture file in memory, with its side data when it is packed
+class FrameFile {
+public:
+	explicit FrameFile(const FrameSource &source)
+		: m_Source(source), m_Data(NULL), m_Size(0), m_Aux(NULL), m_AuxSize(0), m_IsAcquired(false) { }
+	~FrameFile() {
+		if (m_IsAcquired)
+			m_Source.reader->Release(m_Frame);
+	}
+
+	bool Read(uint32_t frame_idx) {
+		if (m_Source.reader != NULL) {
+			if (!m_Source.reader->Acquire(frame_idx, &m_Frame))
+				return false;
+			m_IsAcquired = true;
+			m_Data = m_Frame.data;
+			m_Size = m_Frame.size;
+			m_Aux = m_Frame.aux;
+			m_AuxSize = m_Frame.aux_size;
+			return true;
+		}
+
+		if (m_Source.archive != NULL) {
+			m_Data = m_Source.archive->Frame(frame_idx);
+			m_Size = static_cast<size_t>(m_Source.archive->Entry(frame_idx).size);
+			m_Aux = m_Source.archive->Aux(frame_idx);
+			m_AuxSize = m_Source.archive->Entry(frame_idx).aux_size;
+			return m_Size != 0;
+		}
+
+		std::ifstream is(m_Source.files.Path(frame_idx).c_str(), std::ifstream::binary);
+		if (!is)
+			return false;
+		m_Storage.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+		m_Data = m_Storage.data();
+		m_Size = m_Storage.size();
+		return m_Size != 0;
+	}
+
+	const unsigned char *Data() const { return m_Data; }
+	size_t Size() const { return m_Size; }
+	const unsigned char *Aux() const { return m_Aux; }
+	size_t AuxSize() const { return m_AuxSize; }
+
+private:
+	FrameFile &operator=(const FrameFile &);
+	const FrameSource &m_Source;
+	MPTC::SequenceFrame m_Frame;
+	std::vector<unsigned char> m_Storage;
+	const unsigned char *m_Data;
+	size_t m_Size;
+	const unsigned char *m_Aux;
+	size_t m_AuxSize;
+	bool m_IsAcquired;
+};
+
+// Unpacks CRN frames, in bands on pool for the ones with restart points
+class CRNFrameLoader : public MPTC::FrameLoader {
+public:
+	CRNFrameLoader(const FrameSource &source, MPTC::ThreadPool *pool) : m_Source(source), m_Pool(pool) { }
+
+	size_t Load(uint32_t frame_idx, uint8_t *dst, size_t dst_size, MPTC::FrameLoadStats *stats) {
+		const string path = m_Source.files.Path(frame_idx);
+		std::chrono::high_resolution_clock::time_point read_start = std::chrono::high_resolution_clock::now();
+		FrameFile file(m_Source);
+		if (!file.Read(frame_idx)) {
+			std::cerr << "Error reading " << path << std::endl;
+			return 0;
+		}
+		const stbi::crn_uint8 *file_data = file.Data();
+		const stbi::crn_uint32 file_size = static_cast<stbi::crn_uint32>(file.Size());
+		std::vector<stbi::crnd::crn_restart_point> restart_points;
+		if (m_Source.is_packed)
+			ParseCRNRestartPoints(file.Aux(), file.AuxSize(), file_size, &restart_points);
+		else
+			LoadCRNRestartPoints(path, file_size, &restart_points);
+		stats->read_ns = ElapsedNS(read_start);
+
+		std::chrono::high_resolution_clock::time_point decode_start = std::chrono::high_resolution_clock::now();
+		stbi::crn_uint32 face_size = 0;
+		bool unpacked = false;
+		stbi::crnd::crn_texture_info tex_info;
+		if (stbi::crnd::crnd_get_texture_info(file_data, file_size, &tex_info)) {
+			const stbi::crn_uint32 blocks_x = std::max(1U, (tex_info.m_width + 3) >> 2);
+			const stbi::crn_uint32 blocks_y = std::max(1U, (tex_info.m_height + 3) >> 2);
+			const stbi::crn_uint32 row_pitch = blocks_x * stbi::crnd::crnd_get_bytes_per_dxt_block(tex_info.m_format);
+			face_size = row_pitch * blocks_y;
+			stbi::crnd::crnd_unpack_context context = stbi::crnd::crnd_unpack_begin(file_data, file_size);
+			if (context != NULL && face_size <= dst_size) {
+				void *dst_data = dst;
+				unpacked = UnpackCRNLevel(context, &dst_data, face_size, row_pitch, restart_points, m_Pool);
+			}
+			stbi::crnd::crnd_unpack_end(context);
+		}
+		stats->decode_ns = ElapsedNS(decode_start);
+
+		if (!unpacked) {
+			std::cerr << "Error unpacking " << path << std::endl;
+			return 0;
+		}
+		return face_size;
+	}
+
+private:
+	FrameSource m_Source;
+	MPTC::ThreadPool *m_Pool;
+};
+
+// Decodes JPG frames to RGBA, in bands on pool when they have restart
+// markers
+class JPGFrameLoader : public MPTC::FrameLoader {
+public:
+	JPGFrameLoader(const FrameSource &source, MPTC::ThreadPool *pool) : m_Source(source), m_Pool(pool) { }
+
+	size_t Load(uint32_t frame_idx, uint8_t *dst, size_t dst_size, MPTC::FrameLoadStats *stats) {
+		const string path = m_Source.files.Path(frame_idx);
+		std::chrono::high_resolution_clock::time_point read_start = std::chrono::high_resolution_clock::now();
+		FrameFile file(m_Source);
+		if (!file.Read(frame_idx)) {
+			std::cerr << "Error reading " << path << std::endl;
+			return 0;
+		}
+		stats->read_ns = ElapsedNS(read_start);
+
+		std::chrono::high_resolution_clock::time_point decode_start = std::chrono::high_resolution_clock::now();
+		int x, y, n;
+		const int file_size = static_cast<int>(file.Size());
+		if (!stbi_info_from_memory(file.Data(), file_size, &x, &y, &n) ||
+			static_cast<size_t>(x) != kImageWidth || static_cast<size_t>(y) != kImageHeight || StreamedFrameSize() > dst_size) {
+			std::cerr << "Error " << path << " is not a " << kImageWidth << "x" << kImageHeight << " JPG" << std::endl;
+			return 0;
+		}
+		if (!DecodeJPG(file.Data(), file_size, dst, m_Pool)) {
+			std::cerr << "Error decoding " << path << std::endl;
+			return 0;
+		}
+		stats->decode_ns = ElapsedNS(decode_start);
+		return StreamedFrameSize();
+	}
+
+private:
+	FrameSource m_Source;
+	MPTC::ThreadPool *m_Pool;
+};
+
+// Copies the BGR pixels of 24bpp BMP frames
+class BMPFrameLoader : public MPTC::FrameLoader {
+public:
+	explicit BMPFrameLoader(const FrameSource &source) : m_Source(source) { }
+
+	size_t Load(uint32_t frame_idx, uint8_t *dst, size_t dst_size, MPTC::FrameLoadStats *stats) {
+		const string path = m_Source.files.Path(frame_idx);
+		std::chrono::high_resolution_clock::time_point read_start = std::chrono::high_resolution_clock::now();
+		FrameFile file(m_Source);
+		if (!file.Read(frame_idx)) {
+			std::cerr << "Error reading " << path << std::endl;
+			return 0;
+		}
+
+		// The same checks as loadBMP_custom
+		const unsigned char *header = file.Data();
+		size_t image_size = 0;
+		if (file.Size() >= 54 && header[0] == 'B' && header[1] == 'M' &&
+			*(int*)&(header[0x1E]) == 0 && *(int*)&(header[0x1C]) == 24) {
+			size_t data_pos = *(int*)&(header[0x0A]);
+			image_size = *(int*)&(header[0x22]);
+			if (image_size == 0)
+				image_size = kImageWidth * kImageHeight * 3;
+			if (data_pos == 0)
+				data_pos = 54;
+			if (image_size > dst_size || data_pos + image_size > file.Size())
+				image_size = 0;
+			else
+				memcpy(dst, file.Data() + data_pos, image_size);
+		}
+		stats->read_ns = ElapsedNS(read_start);
+		stats->decode_ns = 0;
+
+		if (image_size == 0)
+			std::cerr << "Error " << path << " is not a 24bpp BMP" << std::endl;
+		return image_size;
+	}
+
+private:
+	FrameSource m_Source;
+};
+#endif
+
+MPTC::FileSequence Model::TextureFiles() const {
+	MPTC::FileSequence files;
+	files.first_number = 1;
+	files.num_digits = 3;
+#if (defined JPG)
+	files.prefix = m_TexturePathJPG;
+	files.suffix = ".jpg";
+#elif (defined BMP)
+	files.prefix = m_TexturePathBMP;
+	files.suffix = ".bmp";
+#elif (defined CRN)
+	files.prefix = m_TexturePathCRN;
+	files.suffix = ".crn";
+#elif (defined GTC)
+	files.prefix = m_TexturePathGTC;
+	files.suffix = ".gtc";
+#else
+	files.prefix = m_TexturePathDXT;
+	files.suffix = ".DXT1";
+#endif
+	return files;
+}
+
+void Model::InitializeTextureArchive() {
+#ifdef FRAME_ARCHIVE
+	if (!DynamicModel)
+		return;
+#ifndef SEQUENCE_READER
+	const string path = TextureFiles().prefix + ".mpfa";
+	if (!texture_archive.Open(path) || texture_archive.NumFrames() != MAX_TEXTURES) {
+		std::cerr << "Error opening " << path << ", not a frame archive of " << MAX_TEXTURES << " frames" << std::endl;
+		exit(-1);
+	}
+#endif
+#endif
+}
+
+void Model::InitializeFrameStreamer() {
+#ifdef FRAME_STREAMER
+	stream_upload_fence = NULL;
+	if (!DynamicModel)
+		return;
+
+	FrameSource source;
+	source.files = TextureFiles();
+	source.reader = NULL;
+	source.archive = NULL;
+	source.is_packed = false;
+#ifdef FRAME_ARCHIVE
+	source.archive = texture_archive.IsOpen() ? &texture_archive : NULL;
+	source.is_packed = true;
+#endif
+
+#ifdef SEQUENCE_READER
+	MPTC::SequenceReaderOptions read_options = MPTC::DefaultSequenceReaderOptions();
+	read_options.read_ahead = SEQUENCE_READ_AHEAD;
+	read_options.advise_ahead = SEQUENCE_ADVISE_AHEAD;
+#ifdef SEQUENCE_BYPASS_CACHE
+	read_options.bypass_cache = true;
+#endif
+	stream_reader.reset(new MPTC::SequenceReader());
+#ifdef FRAME_ARCHIVE
+	const string archive_path = source.files.prefix + ".mpfa";
+	if (!stream_reader->OpenArchive(archive_path, read_options) || stream_reader->NumFrames() != MAX_TEXTURES) {
+		std::cerr << "Error opening " << archive_path << ", not a frame archive of " << MAX_TEXTURES << " frames" << std::endl;
+		exit(-1);
+	}
+#else
+	if (!stream_reader->Open(source.files, MAX_TEXTURES, read_options)) {
+		std::cerr << "Error opening the texture sequence " << source.files.prefix << std::endl;
+		exit(-1);
+	}
+#endif
+	source.reader = stream_reader.get();
+#endif
+
+#if (defined JPG)
+	jpg_pool.reset(new MPTC::ThreadPool());
+	stream_loader.reset(new JPGFrameLoader(source, jpg_pool.get()));
+#elif (defined BMP)
+	stream_loader.reset(new BMPFrameLoader(source));
+#elif (defined CRN)
+	crn_pool.reset(new MPTC::ThreadPool());
+	stream_loader.reset(new CRNFrameLoader(source, crn_pool.get()));
+#else
+	if (source.reader != NULL)
+		stream_loader.reset(new MPTC::SequenceFileLoader(source.reader));
+	else if (source.archive != NULL)
+		stream_loader.reset(new MPTC::ArchiveFrameLoader(source.archive));
+	else
+		stream_loader.reset(new MPTC::RawFileLoader(source.files));
+#endif
+
+	// Room for the frames loaded ahead, the one shown and the one whose
+	// upload may still be in flight
+	stream_staging.Initialize(FRAME_STREAMER_LOOKAHEAD + 2, StreamedFrameSize());
+	stream.Start(stream_loader.get(), &stream_staging, MAX_TEXTURES, TEXTURE_FRAME_MS, FRAME_STREAMER_LOOKAHEAD,
+		FRAME_STREAMER_THREADS, MPTC::PlaybackClock::now());
+#endif
+}
+
+bool Model::LoadStreamedTexture() {
+#ifdef FRAME_STREAMER
+	// The buffer of the frame uploaded last goes back to the prefetch
+	// threads once the GPU is done reading it
+	if (stream_upload_fence != NULL &&
+		CHECK_GL(glClientWaitSync, stream_upload_fence, 0, 0) != GL_TIMEOUT_EXPIRED) {
+		CHECK_GL(glDeleteSync, stream_upload_fence);
+		stream_upload_fence = NULL;
+		stream.Release(stream_frame);
+	}
+
+	// No newer frame is due, or the prefetch threads have not loaded it,
+	// keep the current texture
+	MPTC::StagedFrame frame;
+	if (stream.GetFrame(MPTC::PlaybackClock::now(), &frame) == kMPTCFrameNotReady)
+		return false;
+
+	// Uploads are a frame apart, the last one is done by now
+	if (stream_upload_fence != NULL) {
+		CHECK_GL(glClientWaitSync, stream_upload_fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		CHECK_GL(glDeleteSync, stream_upload_fence);
+		stream_upload_fence = NULL;
+		stream.Release(stream_frame);
+	}
+	stream_frame = frame;
+	m_CPULoad.push_back(frame.load.read_ns);
+	m_CPUDecode.push_back(frame.load.decode_ns);
+
+	std::chrono::high_resolution_clock::time_point GPULoad_Start = std::chrono::high_resolution_clock::now();
+	CHECK_GL(glBindTexture, GL_TEXTURE_2D, TextureID);
+	CHECK_GL(glBindBuffer, GL_PIXEL_UNPACK_BUFFER, stream_staging.Buffer());
+	const GLvoid *offset = (const GLvoid *)stream_staging.SlotOffset(frame.buffer);
+#if (defined JPG)
+	CHECK_GL(glTexSubImage2D, GL_TEXTURE_2D, 0, 0, 0, kImageWidth, kImageHeight, GL_RGBA, GL_UNSIGNED_BYTE, offset);
+#elif (defined BMP)
+	CHECK_GL(glTexSubImage2D, GL_TEXTURE_2D, 0, 0, 0, kImageWidth, kImageHeight, GL_BGR, GL_UNSIGNED_BYTE, offset);
+#else
+	CHECK_GL(glCompressedTexSubImage2D, GL_TEXTURE_2D, 0, 0, 0, kImageWidth, kImageHeight,
+		GL_COMPRESSED_RGB_S3TC_DXT1_EXT, frame.size, offset);
+#endif
+	CHECK_GL(glBindBuffer, GL_PIXEL_UNPACK_BUFFER, 0);
+	CHECK_GL(glBindTexture, GL_TEXTURE_2D, 0);
+	stream_upload_fence = CHECK_GL(glFenceSync, GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	m_GPULoad.push_back(ElapsedNS(GPULoad_Start));
+	return true;
+#else
+	return false;
+#endif
+}
+
 //-------------------End of loading Texture functions--------------//
 
 Model::Model(const char * imagepath){
@@ -889,10 +1540,12 @@ void Model::InitializeTextures() {
 	InitializeTextureRGB();
 #elif (defined MPTC)
 	InitializeMPTC();
-	InitializeCompressedTexture();
+	InitializeCompressedTexture(MPTCTextureFormat());
 #else
 	InitializeTexture();
 #endif
+	InitializeTextureArchive();
+	InitializeFrameStreamer();
 }
 
 void Model::InitializeTextureRGB() {
@@ -933,11 +1586,11 @@ void Model::InitializeTexture(){
 
 
 //-------Initialize compressed texture buffers----------------//
-void Model::InitializeCompressedTexture(){
+void Model::InitializeCompressedTexture(GLenum format){
 
 	CHECK_GL(glGenTextures, 1, &TextureID);
 	CHECK_GL(glBindTexture,GL_TEXTURE_2D, TextureID);
-	CHECK_GL(glTexStorage2D, GL_TEXTURE_2D, 1, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, kImageWidth, kImageHeight);
+	CHECK_GL(glTexStorage2D, GL_TEXTURE_2D, 1, format, kImageWidth, kImageHeight);
 	CHECK_GL(glTexParameteri, GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	CHECK_GL(glTexParameteri,GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
@@ -958,17 +1611,42 @@ void Model::InitializeCompressedTexture(){
 void Model::InitializeMPTC()
 {
 	uint32_t num_blocks = kImageHeight / 4 * kImageWidth / 4;
-	mptc_file_stream.exceptions(std::ifstream::failbit | std::ifstream::badbit);
 
-	mptc_file_stream.open(m_MPTC_file_path.c_str(), std::ios::binary);
-	std::cout << "(infile) = " << mptc_file_stream.is_open() << std::endl;
-	std::cout << "(infile.fail()) = " << mptc_file_stream.fail() << std::endl;
+	// The decoder reads the streams straight out of the mapping
+	if (!mptc_source.Open(m_MPTC_file_path)) {
+		std::cerr << "Error mapping " << m_MPTC_file_path << std::endl;
+		exit(-1);
+	}
 	
-	ptr_buffer_struct = (BufferStruct*)malloc(sizeof(BufferStruct));
-	InitBufferedDecode(4, ptr_buffer_struct, mptc_file_stream, num_blocks);
+	// Frames are decoded straight into the pixel unpack buffer
+	mptc_destination.Initialize(MPTC_BUFFER_SIZE, num_blocks * sizeof(PhysicalDXTBlock));
+	mptc_upload_fence = NULL;
+
+	// The index is only needed for key frame jumps, which playback falls
+	// back from to skimming without it
+	const std::vector<MPTC::FrameIndexEntry> *frame_index = &mptc_frame_index;
+	if (!MPTC::LoadFrameIndex(m_MPTC_file_path, mptc_source.Size(), &mptc_frame_index) &&
+		BuildFrameIndex(mptc_source, &mptc_frame_index) != 0) {
+		std::cerr << "Warning " << m_MPTC_file_path << " is cut short, playback won't jump to key frames" << std::endl;
+		frame_index = NULL;
+	}
+	mptc_source.Seek(0);
+	InitBufferedDecode(ptr_buffer_struct, mptc_source, mptc_destination);
+	mptc_scheduler.Init(ptr_buffer_struct, MPTC::DefaultPlaybackPolicy(MPTC_FRAME_MS), frame_index);
+
+	mptc_dirty_runs.resize(kImageHeight / 4);
+	mptc_upload_bytes = 0;
+	mptc_frame_bytes = 0;
+
+#ifdef MPTC_TRANSCODE
+	mptc_transcoder = new MPTC::FrameTranscoder(MPTC_TRANSCODE, kImageHeight, kImageWidth);
+	mptc_transcoded.resize(mptc_transcoder->OutputSize());
+#else
+	mptc_transcoder = NULL;
+#endif
 
 	assert(ptr_buffer_struct->ptr_decode_info != NULL);
-	for (uint8_t idx = 0; idx < 4; idx++)
+	for (uint8_t idx = 0; idx < MPTC_BUFFER_SIZE; idx++)
 		assert(ptr_buffer_struct->buffered_dxts[idx] != NULL);
 }
 
@@ -1192,6 +1870,25 @@ Model::~Model(){
 	CHECK_GL(glDeleteBuffers, 1, &PboID);
 	CHECK_GL(glDeleteVertexArrays, 1, &vertexArrayId);
 
+#ifdef FRAME_STREAMER
+	// The prefetch threads write into the mapping until they stop
+	stream.Stop();
+	if (stream_reader)
+		stream_reader->Close();
+	if (stream_upload_fence != NULL) {
+		CHECK_GL(glDeleteSync, stream_upload_fence);
+	}
+	stream_staging.Release();
+#endif
+
+#ifdef MPTC
+	if (mptc_upload_fence != NULL) {
+		CHECK_GL(glDeleteSync, mptc_upload_fence);
+	}
+	DestroyBufferedDecode(ptr_buffer_struct);
+	mptc_destination.Release();
+	delete mptc_transcoder;
+#endif
 }
 
 void Model::LoadShaders(const char * vertex_file_path, const char * fragment_file_path){
@@ -1231,10 +1928,23 @@ void Model::RenderModel(Matrix4f view, Matrix4f proj, std::unique_ptr<gpu::GPUCo
 		first_frame = false;
 	}
 
+#ifdef MPTC
+	// MPTC playback is paced by its scheduler, which asks for a new frame
+	// whenever one is due
+	if (DynamicModel)
+		LoadCompressedTextureMPTC();
+#endif
+
+#ifdef FRAME_STREAMER
+	// The prefetch threads pace the texture files by wall clock, only the
+	// frame due goes up here
+	if (DynamicModel)
+		LoadStreamedTexture();
+#else
 	bool load_tex = false;
 	std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
 	double elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_frame).count();
-	if (elapsed > 70.0) {
+	if (elapsed > TEXTURE_FRAME_MS) {
 		TextureNumber = (TextureNumber + 1) % MAX_TEXTURES;
 		load_tex = true;
 		last_frame = now;
@@ -1275,16 +1985,18 @@ void Model::RenderModel(Matrix4f view, Matrix4f proj, std::unique_ptr<gpu::GPUCo
 #endif
 
 #ifdef GTC
+#ifdef FRAME_ARCHIVE
+			LoadCompressedTextureGTC(texture_archive.Frame(TextureNumber),
+				static_cast<size_t>(texture_archive.Entry(TextureNumber).size), ctx);
+#else
 			imagepath = m_TexturePathGTC + number + ".gtc";
 			LoadCompressedTextureGTC(imagepath, ctx);
 #endif
-
-#ifdef MPTC
-			LoadCompressedTextureMPTC();
 #endif
 
 		}
 	}
+#endif
 
 	CHECK_GL(glBindTexture, GL_TEXTURE_2D, TextureID);
 	CHECK_GL(glBindVertexArray,vertexArrayId);
@@ -1357,6 +2069,52 @@ void Model::RenderModel(Matrix4f view, Matrix4f proj, std::unique_ptr<gpu::GPUCo
 		printf("GPU Decode Time: %.4f\n", GPU_decode);
 		printf("GPU Load Time:   %.4f\n", GPU_load);
 		printf("FPS:             %.4f\n", FPS);
+
+#ifdef FRAME_STREAMER
+		if (DynamicModel) {
+			MPTC::FrameStreamerStats stream_stats;
+			stream.GetStats(&stream_stats);
+			printf("Stream Frames:   %llu loaded, %llu shown, %llu dropped, %llu skipped, %llu failed\n",
+				(ull)stream_stats.frames_loaded, (ull)stream_stats.frames_shown, (ull)stream_stats.frames_dropped,
+				(ull)stream_stats.frames_skipped, (ull)stream_stats.load_failures);
+			printf("Stream Waits:    %llu late calls, %llu loader waits for a buffer\n",
+				(ull)stream_stats.late_calls, (ull)stream_stats.loader_waits);
+		}
+#endif
+#ifdef SEQUENCE_READER
+		if (stream_reader) {
+			MPTC::SequenceReaderStats read_stats;
+			stream_reader->GetStats(&read_stats);
+			printf("Stream Reads:    %llu files, %.1f MB/s, %llu failed, %llu dropped\n", (ull)read_stats.files_read,
+				read_stats.read_ns != 0 ? read_stats.bytes_read / 1048576.0 / (read_stats.read_ns / 1e9) : 0.0,
+				(ull)read_stats.read_failures, (ull)read_stats.files_dropped);
+			printf("Stream Stalls:   %llu of %llu reads, %.1f ms\n", (ull)read_stats.stalls, (ull)read_stats.acquires,
+				read_stats.stall_ns / 1e6);
+		}
+#endif
+
+#ifdef MPTC
+		MPTCBufferStats buffer_stats;
+		GetBufferedDecodeStats(ptr_buffer_struct, &buffer_stats);
+		printf("MPTC Buffer:     %u slots, %u ready\n", buffer_stats.buffer_sz, buffer_stats.occupancy);
+		printf("MPTC Decoded:    %llu consumed: %llu\n", (ull)buffer_stats.frames_decoded, (ull)buffer_stats.frames_consumed);
+		printf("MPTC Underruns:  %llu decoder waits: %llu\n", (ull)buffer_stats.underruns, (ull)buffer_stats.producer_waits);
+		MPTC::PlaybackStats playback_stats;
+		mptc_scheduler.GetStats(&playback_stats);
+		printf("MPTC Playback:   %llu shown, %llu dropped, %llu skimmed, %llu jumped in %llu key jumps\n",
+			(ull)playback_stats.frames_shown, (ull)playback_stats.frames_dropped, (ull)playback_stats.frames_skimmed,
+			(ull)playback_stats.frames_jumped, (ull)playback_stats.key_jumps);
+		printf("MPTC Lag:        %.1f ms, avg %.1f ms, max %.1f ms\n", playback_stats.lag_ms,
+			playback_stats.avg_lag_ms, playback_stats.max_lag_ms);
+		if (buffer_stats.frames_consumed != 0 && mptc_frame_bytes != 0) {
+			printf("MPTC Dirty:      %.2f%% of blocks\n",
+				100.0 * buffer_stats.dirty_blocks / ((double)buffer_stats.num_blocks * buffer_stats.frames_consumed));
+			printf("MPTC Upload:     %.1f KB/frame, %.1f KB/frame saved (%.2f%%)\n",
+				mptc_upload_bytes / 1024.0 / buffer_stats.frames_consumed,
+				(mptc_frame_bytes - mptc_upload_bytes) / 1024.0 / buffer_stats.frames_consumed,
+				100.0 * (mptc_frame_bytes - mptc_upload_bytes) / mptc_frame_bytes);
+		}
+#endif
 		
 	}
 
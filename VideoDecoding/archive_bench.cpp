@@ -0,0 +1,296 @@
+// Streams a sequence of frames from one file per frame and from a frame
+// archive of the same frames, see frame_archive.h.
+//
+// Usage: archive_bench [dir] [num_frames] [frame_kb] [work_ms] [read_ahead]
+//
+// Writes num_frames files of frame_kb KiB to dir, 3136 KiB by default as a
+// 3584x1792 DXT1 frame, packs them into an archive and reads the sequence
+// back every way the renderer can, spending work_ms on every frame as a
+// decode would: opening every file as RenderModel does, a SequenceReader
+// over the files, the archive mapped with the next read_ahead frames
+// advised, and a SequenceReader over the archive. Before every run the
+// files are evicted from the page cache, where the OS allows, so that
+// every run reads from the disk. Smaller frames show the cost of opening a
+// file per frame best.
+
+#include "frame_archive.h"
+#include "sequence_reader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+static uint8_t PatternByte(uint32_t frame_idx, size_t offset) {
+  return static_cast<uint8_t>((frame_idx * 131 + offset * 7 + (offset >> 12)) & 0xFF);
+}
+
+// Frames vary in size a little, as compressed ones do
+static size_t FrameSize(uint32_t frame_idx, size_t frame_size) {
+  return frame_size - (frame_idx * 2654435761u) % (frame_size / 8 + 1);
+}
+
+static bool WriteFrames(const MPTC::FileSequence &files, uint32_t num_frames, size_t frame_size) {
+  std::vector<uint8_t> frame;
+  for (uint32_t frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+    frame.resize(FrameSize(frame_idx, frame_size));
+    for (size_t i = 0; i < frame.size(); i++)
+      frame[i] = PatternByte(frame_idx, i);
+    std::string path = files.Path(frame_idx);
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp || fwrite(frame.data(), 1, frame.size(), fp) != frame.size()) {
+      std::cerr << "Error writing " << path << std::endl;
+      if (fp)
+        fclose(fp);
+      return false;
+    }
+    fclose(fp);
+  }
+  return true;
+}
+
+static bool PackFrames(const MPTC::FileSequence &files, uint32_t num_frames, size_t frame_size,
+                       const std::string &path) {
+  MPTC::FrameArchiveWriter writer;
+  if (!writer.Open(path, num_frames))
+    return false;
+  std::vector<uint8_t> frame;
+  for (uint32_t frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+    frame.resize(FrameSize(frame_idx, frame_size));
+    for (size_t i = 0; i < frame.size(); i++)
+      frame[i] = PatternByte(frame_idx, i);
+    if (!writer.AddFrame(frame.data(), frame.size(), MPTC::FrameCodecFromSuffix(files.suffix), frame_idx * 70000ULL))
+      return false;
+  }
+  return writer.Finish();
+}
+
+static bool EvictFile(const std::string &path) {
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+  return true;
+#else
+  (void)path;
+  return false;
+#endif
+}
+
+// Drops the files and the archive from the page cache so that the next run
+// reads the disk
+static bool EvictAll(const MPTC::FileSequence &files, uint32_t num_frames, const std::string &archive_path) {
+  bool is_ok = EvictFile(archive_path);
+  for (uint32_t frame_idx = 0; frame_idx < num_frames; frame_idx++)
+    is_ok = EvictFile(files.Path(frame_idx)) && is_ok;
+  return is_ok;
+}
+
+// Samples a page apart, a full compare would cost more than the reads
+static bool CheckFrame(uint32_t frame_idx, const uint8_t *data, size_t size, size_t frame_size) {
+  if (size != FrameSize(frame_idx, frame_size)) {
+    std::cerr << "Error frame " << frame_idx << " has " << size << " bytes" << std::endl;
+    return false;
+  }
+  for (size_t i = 0; i < size; i += 4093) {
+    if (data[i] != PatternByte(frame_idx, i)) {
+      std::cerr << "Error frame " << frame_idx << " differs at byte " << i << std::endl;
+      return false;
+    }
+  }
+  if (data[size - 1] != PatternByte(frame_idx, size - 1)) {
+    std::cerr << "Error frame " << frame_idx << " differs at its end" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+struct RunResult {
+  double total_ms;
+  double stall_ms;
+  double max_stall_ms;
+  uint64_t bytes;
+};
+
+static double Ms(Clock::duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+static void Work(double work_ms) {
+  if (work_ms > 0.0)
+    std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(work_ms));
+}
+
+static void AddStall(Clock::time_point start, RunResult *result) {
+  double stall_ms = Ms(Clock::now() - start);
+  result->stall_ms += stall_ms;
+  result->max_stall_ms = std::max(result->max_stall_ms, stall_ms);
+}
+
+static bool ReadPerFile(const MPTC::FileSequence &files, uint32_t num_frames, size_t frame_size, double work_ms,
+                        RunResult *result) {
+  std::vector<char> buffer;
+  Clock::time_point start = Clock::now();
+  for (uint32_t frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+    Clock::time_point read_start = Clock::now();
+    std::ifstream is(files.Path(frame_idx).c_str(), std::ios::in | std::ifstream::binary);
+    if (!is) {
+      std::cerr << "Error opening " << files.Path(frame_idx) << std::endl;
+      return false;
+    }
+    is.seekg(0, is.end);
+    size_t length = static_cast<size_t>(is.tellg());
+    is.seekg(0, is.beg);
+    buffer.resize(length);
+    is.read(buffer.data(), length);
+    AddStall(read_start, result);
+    result->bytes += length;
+
+    if (!CheckFrame(frame_idx, reinterpret_cast<const uint8_t *>(buffer.data()), length, frame_size))
+      return false;
+    Work(work_ms);
+  }
+  result->total_ms = Ms(Clock::now() - start);
+  return true;
+}
+
+// The frames are touched in place, the first touch of a page is the read
+static bool ReadMapped(const std::string &archive_path, uint32_t num_frames, size_t frame_size, double work_ms,
+                       uint32_t read_ahead, RunResult *result) {
+  Clock::time_point start = Clock::now();
+  MPTC::FrameArchive archive;
+  if (!archive.Open(archive_path) || archive.NumFrames() != num_frames) {
+    std::cerr << "Error opening " << archive_path << std::endl;
+    return false;
+  }
+  archive.WillNeed(0, read_ahead);
+  for (uint32_t frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+    if (frame_idx + read_ahead < num_frames)
+      archive.WillNeed(frame_idx + read_ahead, 1);
+
+    Clock::time_point read_start = Clock::now();
+    const uint8_t *data = archive.Frame(frame_idx);
+    size_t size = static_cast<size_t>(archive.Entry(frame_idx).size);
+    volatile uint8_t sum = 0;
+    for (size_t i = 0; i < size; i += 4096)
+      sum += data[i];
+    AddStall(read_start, result);
+    result->bytes += size;
+
+    if (!CheckFrame(frame_idx, data, size, frame_size))
+      return false;
+    Work(work_ms);
+  }
+  result->total_ms = Ms(Clock::now() - start);
+  return true;
+}
+
+static bool ReadSequence(const MPTC::FileSequence &files, const std::string &archive_path, uint32_t num_frames,
+                         size_t frame_size, double work_ms, const MPTC::SequenceReaderOptions &options,
+                         RunResult *result) {
+  MPTC::SequenceReader reader;
+  Clock::time_point start = Clock::now();
+  bool is_open = archive_path.empty() ?
+    reader.Open(files, num_frames, options) : reader.OpenArchive(archive_path, options);
+  if (!is_open) {
+    std::cerr << "Error opening " << (archive_path.empty() ? files.Path(0) : archive_path) << std::endl;
+    return false;
+  }
+  for (uint32_t frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+    Clock::time_point acquire_start = Clock::now();
+    MPTC::SequenceFrame frame;
+    if (!reader.Acquire(frame_idx, &frame)) {
+      std::cerr << "Error reading frame " << frame_idx << std::endl;
+      return false;
+    }
+    AddStall(acquire_start, result);
+
+    bool is_ok = CheckFrame(frame_idx, frame.data, frame.size, frame_size);
+    reader.Release(frame);
+    if (!is_ok)
+      return false;
+    Work(work_ms);
+  }
+  result->total_ms = Ms(Clock::now() - start);
+  reader.Close();
+
+  MPTC::SequenceReaderStats stats;
+  reader.GetStats(&stats);
+  result->bytes = stats.bytes_read;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  std::string dir = argc > 1 ? argv[1] : ".";
+  uint32_t num_frames = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 48;
+  size_t frame_size = (argc > 3 ? static_cast<size_t>(atoi(argv[3])) : 3136) << 10;
+  double work_ms = argc > 4 ? atof(argv[4]) : 10.0;
+  uint32_t read_ahead = argc > 5 ? static_cast<uint32_t>(atoi(argv[5])) : 4;
+  if (num_frames == 0 || frame_size == 0) {
+    std::cerr << "Usage: " << argv[0] << " [dir] [num_frames] [frame_kb] [work_ms] [read_ahead]" << std::endl;
+    return 1;
+  }
+
+  MPTC::FileSequence files;
+  files.prefix = dir + "/archive_bench_frame";
+  files.suffix = ".DXT1";
+  files.first_number = 1;
+  files.num_digits = 3;
+  std::string archive_path = dir + "/archive_bench.mpfa";
+  if (!WriteFrames(files, num_frames, frame_size))
+    return 1;
+  if (!PackFrames(files, num_frames, frame_size, archive_path)) {
+    std::cerr << "Error writing " << archive_path << std::endl;
+    return 1;
+  }
+
+  bool is_cold = EvictAll(files, num_frames, archive_path);
+  printf("%u frames of up to %zu KiB, %.1f ms of work per frame, %s\n", num_frames, frame_size >> 10, work_ms,
+         is_cold ? "read from the disk" : "the page cache can't be dropped, reads may be warm");
+
+  const char *kRunNames[] = { "per file", "file reader", "mapped", "archive", "archive direct" };
+  bool is_ok = true;
+  for (int run = 0; run < 5 && is_ok; run++) {
+    EvictAll(files, num_frames, archive_path);
+    MPTC::SequenceReaderOptions options = MPTC::DefaultSequenceReaderOptions();
+    options.read_ahead = read_ahead;
+    options.bypass_cache = run == 4;
+
+    RunResult result = RunResult();
+    if (run == 0)
+      is_ok = ReadPerFile(files, num_frames, frame_size, work_ms, &result);
+    else if (run == 2)
+      is_ok = ReadMapped(archive_path, num_frames, frame_size, work_ms, read_ahead, &result);
+    else
+      is_ok = ReadSequence(files, run == 1 ? std::string() : archive_path, num_frames, frame_size, work_ms,
+                           options, &result);
+    if (!is_ok)
+      break;
+
+    double mb = result.bytes / (1024.0 * 1024.0);
+    double busy_ms = result.total_ms - num_frames * work_ms;
+    printf("%-15s %8.1f ms %7.1f MB/s overall  %7.1f ms not working  stalls %7.1f ms total, %6.2f ms max\n",
+           kRunNames[run], result.total_ms, mb / (result.total_ms / 1000.0), busy_ms, result.stall_ms,
+           result.max_stall_ms);
+  }
+
+  for (uint32_t frame_idx = 0; frame_idx < num_frames; frame_idx++)
+    remove(files.Path(frame_idx).c_str());
+  remove(archive_path.c_str());
+  return is_ok ? 0 : 1;
+}
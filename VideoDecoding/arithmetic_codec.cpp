@@ -46,7 +46,6 @@
 
 #include <stdlib.h>
 #include "arithmetic_codec.h"
-#define _DEBUG
 
 // - - Constants - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 namespace entropy {
@@ -275,6 +274,122 @@ unsigned Arithmetic_Codec::decode(Adaptive_Bit_Model & M)
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+void Arithmetic_Codec::encode_bits(const unsigned char * bitmap,
+                                   unsigned number_of_bits,
+                                   Adaptive_Bit_Model & M)
+{
+  for (unsigned n = 0; n < number_of_bits; n++)
+    encode((bitmap[n >> 3] >> (n & 7)) & 1U, M);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// Bulk decoding keeps the interval, the code value and the read pointer in
+// locals for the whole call. The model can only change on its periodic
+// update, so bits are decoded in runs up to the next update with the
+// probability held in a register. While one symbol is much more likely the
+// decision is a well predicted branch, otherwise it is made without one.
+// The renormalization check stays per bit, a single decision can take 13
+// bits off the interval.
+
+const unsigned BM__SkewedProb = 1U << (BM__LengthShift - 3);  // p0 = 1/8
+
+#define AC__RENORM_DEC()                                                     \
+  if (l < AC__MinLength) {                            /* renormalization */ \
+    do {                                                                     \
+      v = (v << 8) | unsigned(*++p);                                         \
+    } while ((l <<= 8) < AC__MinLength);                                     \
+  }
+
+#define AC__DECODE_BIT(p0, skewed, bit)                                      \
+  do {                                                                       \
+    unsigned x = (p0) * (l >> BM__LengthShift);         /* product l x p0 */ \
+    if (skewed) {                                                            \
+      bit = (v >= x);                                        /* decision */ \
+      if (bit) { v -= x; l -= x; } else l = x;        /* update interval */ \
+    }                                                                        \
+    else {                                                                   \
+      bit = (v >= x);                                        /* decision */ \
+      v = bit ? v - x : v;                             /* shift interval */ \
+      l = bit ? l - x : x;                            /* update interval */ \
+    }                                                                        \
+    AC__RENORM_DEC()                                                         \
+  } while (0)
+
+void Arithmetic_Codec::decode_bits(unsigned char * bitmap,
+                                   unsigned number_of_bits,
+                                   Static_Bit_Model & M)
+{
+#ifdef _DEBUG
+  if (mode != 2) AC_Error("decoder not initialized");
+#endif
+
+  unsigned v = value, l = length, bit, byte = 0;
+  unsigned char * p = ac_pointer;
+  const unsigned p0 = M.bit_0_prob;
+  const bool skewed = p0 < BM__SkewedProb || p0 > BM__MaxCount - BM__SkewedProb;
+
+  for (unsigned n = 0; n < number_of_bits; n++) {
+    AC__DECODE_BIT(p0, skewed, bit);
+    byte |= bit << (n & 7);
+    if ((n & 7) == 7) {
+      bitmap[n >> 3] = (unsigned char) byte;
+      byte = 0;
+    }
+  }
+  if (number_of_bits & 7) bitmap[number_of_bits >> 3] = (unsigned char) byte;
+
+  value = v;
+  length = l;
+  ac_pointer = p;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void Arithmetic_Codec::decode_bits(unsigned char * bitmap,
+                                   unsigned number_of_bits,
+                                   Adaptive_Bit_Model & M)
+{
+#ifdef _DEBUG
+  if (mode != 2) AC_Error("decoder not initialized");
+#endif
+
+  unsigned v = value, l = length, bit, byte = 0, ones = 0;
+  unsigned char * p = ac_pointer;
+
+  unsigned n = 0;
+  while (n < number_of_bits) {
+    unsigned run = M.bits_until_update;     // bits until the next model update
+    if (run > number_of_bits - n) run = number_of_bits - n;
+    const unsigned p0 = M.bit_0_prob;
+    const bool skewed = p0 < BM__SkewedProb || p0 > BM__MaxCount - BM__SkewedProb;
+
+    for (unsigned end = n + run; n < end; n++) {
+      AC__DECODE_BIT(p0, skewed, bit);
+      ones += bit;
+      byte |= bit << (n & 7);
+      if ((n & 7) == 7) {
+        bitmap[n >> 3] = (unsigned char) byte;
+        byte = 0;
+      }
+    }
+
+    M.bit_0_count += run - ones;
+    ones = 0;
+    if ((M.bits_until_update -= run) == 0) M.update(); // periodic model update
+  }
+  if (number_of_bits & 7) bitmap[number_of_bits >> 3] = (unsigned char) byte;
+
+  value = v;
+  length = l;
+  ac_pointer = p;
+}
+
+#undef AC__DECODE_BIT
+#undef AC__RENORM_DEC
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 void Arithmetic_Codec::encode(unsigned data,
                               Static_Data_Model & M)
 {
@@ -746,19 +861,29 @@ Adaptive_Data_Model::~Adaptive_Data_Model(void)
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-void Adaptive_Data_Model::set_alphabet(unsigned number_of_symbols)
+void Adaptive_Data_Model::set_alphabet(unsigned number_of_symbols,
+                                       unsigned min_table_bits)
 {
   if ((number_of_symbols < 2) || (number_of_symbols > (1 << 11)))
     AC_Error("invalid number of data symbols");
+  if (min_table_bits > 12)
+    AC_Error("invalid decoder table size");
 
-  if (data_symbols != number_of_symbols) {     // assign memory for data model
+                                     // define size of table for fast decoding
+  unsigned table_bits = 0;
+  if ((number_of_symbols > 16) || (min_table_bits > 0)) {
+    table_bits = 3;
+    while (number_of_symbols > (1U << (table_bits + 2))) ++table_bits;
+    if (table_bits < min_table_bits) table_bits = min_table_bits;
+  }
+
+  if ((data_symbols != number_of_symbols) ||   // assign memory for data model
+      (table_size != (table_bits ? 1U << table_bits : 0))) {
     data_symbols = number_of_symbols;
     last_symbol = data_symbols - 1;
     delete [] distribution;
-                                     // define size of table for fast decoding
-    if (data_symbols > 16) {
-      unsigned table_bits = 3;
-      while (data_symbols > (1U << (table_bits + 2))) ++table_bits;
+
+    if (table_bits) {
       table_size  = 1 << table_bits;
       table_shift = DM__LengthShift - table_bits;
       distribution = new unsigned[2*data_symbols+table_size+2];
@@ -117,7 +117,8 @@ public:
   unsigned model_symbols(void) { return data_symbols; }
 
   void reset(void);                             // reset to equiprobable model
-  void set_alphabet(unsigned number_of_symbols);
+  void set_alphabet(unsigned number_of_symbols,  // a finer decoder table
+                    unsigned min_table_bits = 0);  // saves search steps
 
 private:  //  .  .  .  .  .  .  .  .  .  .  .  .  .  .  .  .  .  .  .  .  .  .
   void     update(bool);
@@ -179,6 +180,19 @@ public:
                   Adaptive_Bit_Model &);
   unsigned decode(Adaptive_Bit_Model &);
 
+                  // number_of_bits bits from / to a packed bitmap, bit n
+                  // is bit (n & 7) of byte (n >> 3); the same code stream
+                  // as coding the bits one by one with the model
+  void     encode_bits(const unsigned char * bitmap,
+                       unsigned number_of_bits,
+                       Adaptive_Bit_Model &);
+  void     decode_bits(unsigned char * bitmap,
+                       unsigned number_of_bits,
+                       Static_Bit_Model &);
+  void     decode_bits(unsigned char * bitmap,
+                       unsigned number_of_bits,
+                       Adaptive_Bit_Model &);
+
   void     encode(unsigned data,
                   Adaptive_Data_Model &);
   unsigned decode(Adaptive_Data_Model &);
@@ -0,0 +1,172 @@
+// Microbenchmark of binary flag decoding with the arithmetic codec.
+//
+// Usage: bit_bench [file.mpt] [num_frames] [num_iterations]
+//
+// Codes flag planes of several densities, and the inter block flags of the
+// first num_frames frames of file.mpt if one is given, three ways: one
+// byte per flag with the 257 symbol data model the MPTC streams use, one
+// flag at a time with an Adaptive_Bit_Model, and the bit model decoded in
+// bulk into a packed bitmap with decode_bits. The bit model decoders have
+// to agree on every bitmap. Prints the coded size and the decode time of
+// each, the best of num_iterations runs.
+
+#include "arithmetic_codec.h"
+#include "decoder.h"
+#include "mptc_reader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+struct FlagPlane {
+  std::string name;
+  std::vector<uint8_t> flags;  // one byte per flag, 0 or 1
+};
+
+// Flags set with probability density, in runs of average length run_length
+static FlagPlane RandomPlane(uint32_t num_flags, double density, double run_length) {
+  FlagPlane plane;
+  char name[64];
+  snprintf(name, sizeof(name), "random %4.1f%% runs %.0f", 100.0 * density, run_length);
+  plane.name = name;
+
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  double p_start = density / (run_length * (1.0 - density));
+  uint8_t flag = 0;
+  for (uint32_t idx = 0; idx < num_flags; idx++) {
+    flag = flag ? uniform(rng) >= 1.0 / run_length : uniform(rng) < p_start;
+    plane.flags.push_back(flag);
+  }
+  return plane;
+}
+
+// Blocks copied from the previous frame, see BuildFrameIndex
+static bool InterFlagPlane(const std::string &path, uint32_t num_frames, FlagPlane *plane) {
+  MPTC::MappedSource source;
+  MPTC::Decoder decoder;
+  if (!source.Open(path) || !decoder.Open(source))
+    return false;
+
+  plane->name = "inter blocks";
+  std::vector<PhysicalDXTBlock> prev(decoder.NumBlocks()), curr(decoder.NumBlocks());
+  for (uint32_t frame = 0; frame < num_frames; frame++) {
+    decoder.DecodeFrame(frame == 0 ? NULL : prev.data(), curr.data());
+    const uint8_t *motion_indices = decoder.DecodeInfo().motion_indices;
+    for (uint32_t block_idx = 0; block_idx < decoder.NumBlocks(); block_idx++) {
+      uint8_t x = motion_indices[2 * block_idx], y = motion_indices[2 * block_idx + 1];
+      plane->flags.push_back((x & 0x80) != 0 && (y & 0x80) != 0 && !(x == 255 && y == 255));
+    }
+    std::swap(prev, curr);
+  }
+  return true;
+}
+
+// Best of num_iterations runs, the others mostly measure the machine
+template <typename DecodeFn>
+static double TimeDecode(uint32_t num_iterations, DecodeFn decode) {
+  double best_ms = 0.0;
+  for (uint32_t iter = 0; iter < num_iterations; iter++) {
+    Clock::time_point start = Clock::now();
+    decode();
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    if (iter == 0 || ms < best_ms)
+      best_ms = ms;
+  }
+  return best_ms;
+}
+
+static bool RunPlane(const FlagPlane &plane, uint32_t num_iterations) {
+  const uint32_t num_flags = static_cast<uint32_t>(plane.flags.size());
+  const uint32_t bitmap_sz = (num_flags + 7) / 8;
+  std::vector<uint8_t> bitmap(bitmap_sz, 0);
+  for (uint32_t idx = 0; idx < num_flags; idx++)
+    bitmap[idx / 8] |= plane.flags[idx] << (idx % 8);
+
+  // Encode both ways, with room for the decoder reading past the end
+  std::vector<uint8_t> byte_code(num_flags + 1024), bit_code(bitmap_sz + 1024);
+  entropy::Arithmetic_Codec byte_encoder(static_cast<unsigned>(byte_code.size()), byte_code.data());
+  entropy::Adaptive_Data_Model data_model(257);
+  byte_encoder.start_encoder();
+  for (uint32_t idx = 0; idx < num_flags; idx++)
+    byte_encoder.encode(plane.flags[idx], data_model);
+  uint32_t byte_sz = byte_encoder.stop_encoder();
+
+  entropy::Arithmetic_Codec bit_encoder(static_cast<unsigned>(bit_code.size()), bit_code.data());
+  entropy::Adaptive_Bit_Model bit_model;
+  bit_encoder.start_encoder();
+  bit_encoder.encode_bits(bitmap.data(), num_flags, bit_model);
+  uint32_t bit_sz = bit_encoder.stop_encoder();
+
+  std::vector<uint8_t> bytes(num_flags), per_bit(bitmap_sz), bulk(bitmap_sz);
+  double byte_ms = TimeDecode(num_iterations, [&] {
+    entropy::Arithmetic_Codec decoder(static_cast<unsigned>(byte_code.size()), byte_code.data());
+    entropy::Adaptive_Data_Model model(257);
+    decoder.start_decoder();
+    for (uint32_t idx = 0; idx < num_flags; idx++)
+      bytes[idx] = static_cast<uint8_t>(decoder.decode(model));
+    decoder.stop_decoder();
+  });
+
+  // The per-symbol path, packed into a bitmap as it goes
+  double per_bit_ms = TimeDecode(num_iterations, [&] {
+    entropy::Arithmetic_Codec decoder(static_cast<unsigned>(bit_code.size()), bit_code.data());
+    entropy::Adaptive_Bit_Model model;
+    decoder.start_decoder();
+    std::fill(per_bit.begin(), per_bit.end(), 0);
+    for (uint32_t idx = 0; idx < num_flags; idx++)
+      per_bit[idx / 8] |= decoder.decode(model) << (idx % 8);
+    decoder.stop_decoder();
+  });
+
+  double bulk_ms = TimeDecode(num_iterations, [&] {
+    entropy::Arithmetic_Codec decoder(static_cast<unsigned>(bit_code.size()), bit_code.data());
+    entropy::Adaptive_Bit_Model model;
+    decoder.start_decoder();
+    decoder.decode_bits(bulk.data(), num_flags, model);
+    decoder.stop_decoder();
+  });
+
+  if (bytes != plane.flags || per_bit != bitmap || bulk != bitmap) {
+    std::cerr << plane.name << ": round trip mismatch!" << std::endl;
+    return false;
+  }
+
+  printf("%-24s %9u flags  bytes: %8u B %7.3f ms   bits: %8u B  per bit %7.3f ms  bulk %7.3f ms (%5.2fx, %6.1f Mflags/s)\n",
+         plane.name.c_str(), num_flags, byte_sz, byte_ms, bit_sz, per_bit_ms, bulk_ms, per_bit_ms / bulk_ms,
+         num_flags / (bulk_ms * 1000.0));
+  return true;
+}
+
+int main(int argc, char **argv) {
+  uint32_t num_frames = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 10;
+  uint32_t num_iterations = argc > 3 ? static_cast<uint32_t>(atoi(argv[3])) : 10;
+
+  std::vector<FlagPlane> planes;
+  const uint32_t kNumFlags = 1 << 20;
+  planes.push_back(RandomPlane(kNumFlags, 0.005, 1.0));
+  planes.push_back(RandomPlane(kNumFlags, 0.05, 1.0));
+  planes.push_back(RandomPlane(kNumFlags, 0.05, 16.0));
+  planes.push_back(RandomPlane(kNumFlags, 0.5, 1.0));
+  planes.push_back(RandomPlane(kNumFlags, 0.9, 64.0));
+  if (argc > 1) {
+    planes.push_back(FlagPlane());
+    if (!InterFlagPlane(argv[1], num_frames, &planes.back())) {
+      std::cerr << "Error decoding " << argv[1] << std::endl;
+      return 1;
+    }
+  }
+
+  for (const FlagPlane &plane : planes) {
+    if (!RunPlane(plane, num_iterations))
+      return 1;
+  }
+  return 0;
+}
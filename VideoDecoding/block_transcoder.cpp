@@ -0,0 +1,745 @@
+#include "block_transcoder.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#define MPTC_TRANSCODE_SSSE3
+#include <tmmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MPTC_TRANSCODE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace MPTC {
+
+const char *TranscodeFormatName(TranscodeFormat format) {
+  switch(format) {
+  case eTranscodeFormat_RGBA8: return "rgba8";
+  case eTranscodeFormat_ETC2_RGB: return "etc2";
+  case eTranscodeFormat_BC7: return "bc7";
+  default: return "unknown";
+  }
+}
+
+uint32_t TranscodedBlockSize(TranscodeFormat format) {
+  switch(format) {
+  case eTranscodeFormat_RGBA8: return 64;
+  case eTranscodeFormat_ETC2_RGB: return 8;
+  case eTranscodeFormat_BC7: return 16;
+  default: return 0;
+  }
+}
+
+static inline uint8_t Clamp8(int value) {
+  return static_cast<uint8_t>(std::min(std::max(value, 0), 255));
+}
+
+// The four colours of a DXT1 block, RGBA, interpolated with exact thirds
+// and halves. Index 3 of a three colour block is opaque black, as for
+// GL_COMPRESSED_RGB_S3TC_DXT1_EXT.
+static void DXT1Palette(const PhysicalDXTBlock &block, uint8_t palette[4][4]) {
+  const uint16_t endpoints[2] = { block.ep1, block.ep2 };
+  for(int ep = 0; ep < 2; ep++) {
+    uint32_t r = (endpoints[ep] >> 11) & 31;
+    uint32_t g = (endpoints[ep] >> 5) & 63;
+    uint32_t b = endpoints[ep] & 31;
+    palette[ep][0] = static_cast<uint8_t>((r << 3) | (r >> 2));
+    palette[ep][1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+    palette[ep][2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+    palette[ep][3] = 255;
+  }
+
+  for(int c = 0; c < 3; c++) {
+    if(block.ep1 > block.ep2) {
+      palette[2][c] = static_cast<uint8_t>((2 * palette[0][c] + palette[1][c]) / 3);
+      palette[3][c] = static_cast<uint8_t>((palette[0][c] + 2 * palette[1][c]) / 3);
+    }
+    else {
+      palette[2][c] = static_cast<uint8_t>((palette[0][c] + palette[1][c]) / 2);
+      palette[3][c] = 0;
+    }
+  }
+  palette[2][3] = palette[3][3] = 255;
+}
+
+// Palette index of texel i, in raster order
+static inline uint32_t DXT1Index(const PhysicalDXTBlock &block, uint32_t i) {
+  return (block.interp >> (2 * i)) & 3;
+}
+
+void DecodeDXT1BlockReference(const PhysicalDXTBlock &block, uint8_t *rgba) {
+  uint8_t palette[4][4];
+  DXT1Palette(block, palette);
+  for(uint32_t i = 0; i < 16; i++)
+    memcpy(rgba + 4 * i, palette[DXT1Index(block, i)], 4);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// RGBA8
+//
+// Every row of a block is one byte of interp, which picks one of 256
+// shuffles of the palette. With SSSE3 a row is a single pshufb, SSE2 selects
+// the palette entries with compares instead.
+
+#if defined(MPTC_TRANSCODE_SSSE3) || defined(MPTC_TRANSCODE_SSE2)
+struct RowShuffles {
+  uint8_t masks[256][16];
+
+  RowShuffles() {
+    for(uint32_t row = 0; row < 256; row++) {
+      for(uint32_t x = 0; x < 4; x++) {
+        uint32_t idx = (row >> (2 * x)) & 3;
+        for(uint32_t c = 0; c < 4; c++)
+          masks[row][4 * x + c] = static_cast<uint8_t>(4 * idx + c);
+      }
+    }
+  }
+};
+
+static const RowShuffles kRowShuffles;
+#endif
+
+class RGBA8Transcoder : public BlockTranscoder {
+ public:
+  TranscodeFormat Format() const { return eTranscodeFormat_RGBA8; }
+
+  void TranscodeRows(const PhysicalDXTBlock *src, uint32_t src_pitch, uint32_t blocks_width,
+                     uint32_t first_row, uint32_t end_row, uint8_t *dst, size_t dst_pitch) const {
+    const size_t texel_pitch = dst_pitch / 4;
+    for(uint32_t y = first_row; y < end_row; y++) {
+      const PhysicalDXTBlock *src_row = src + static_cast<size_t>(y) * src_pitch;
+      uint8_t *dst_row = dst + y * dst_pitch;
+
+      for(uint32_t x = 0; x < blocks_width; x++) {
+        const PhysicalDXTBlock &block = src_row[x];
+        uint8_t palette[4][4];
+        DXT1Palette(block, palette);
+        uint8_t *out = dst_row + 16 * x;
+
+#if defined(MPTC_TRANSCODE_SSSE3)
+        const __m128i colors = _mm_loadu_si128(reinterpret_cast<const __m128i*>(palette));
+        for(uint32_t row = 0; row < 4; row++) {
+          const __m128i *mask = reinterpret_cast<const __m128i*>(kRowShuffles.masks[(block.interp >> (8 * row)) & 0xFF]);
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(out + row * texel_pitch),
+                           _mm_shuffle_epi8(colors, _mm_loadu_si128(mask)));
+        }
+#elif defined(MPTC_TRANSCODE_SSE2)
+        __m128i entries[4], selectors[4];
+        for(int idx = 0; idx < 4; idx++) {
+          uint32_t word;
+          memcpy(&word, palette[idx], 4);
+          entries[idx] = _mm_set1_epi32(static_cast<int32_t>(word));
+          selectors[idx] = _mm_set1_epi32(static_cast<int32_t>(0x03020100u + 0x04040404u * idx));
+        }
+        for(uint32_t row = 0; row < 4; row++) {
+          __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+            kRowShuffles.masks[(block.interp >> (8 * row)) & 0xFF]));
+          __m128i texels = _mm_and_si128(_mm_cmpeq_epi32(mask, selectors[0]), entries[0]);
+          for(int idx = 1; idx < 4; idx++)
+            texels = _mm_or_si128(texels, _mm_and_si128(_mm_cmpeq_epi32(mask, selectors[idx]), entries[idx]));
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(out + row * texel_pitch), texels);
+        }
+#else
+        for(uint32_t i = 0; i < 16; i++)
+          memcpy(out + (i / 4) * texel_pitch + 4 * (i % 4), palette[DXT1Index(block, i)], 4);
+#endif
+      }
+    }
+  }
+};
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// ETC2 RGB
+//
+// Written as ETC1 individual or differential blocks, which every ETC2
+// decoder reads. A DXT1 block has at most four colours, so the errors are
+// worked out per palette entry and weighted by how often it is used rather
+// than per texel.
+
+static const int kETCModifiers[8][2] = {
+  { 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 }, { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 }
+};
+
+// Modifier of pixel index 0..3
+static inline int ETCModifier(uint32_t table, uint32_t idx) {
+  int modifier = kETCModifiers[table][idx & 1];
+  return (idx & 2) ? -modifier : modifier;
+}
+
+// Texel i in raster order is pixel (i % 4, i / 4), which ETC numbers
+// column first
+static inline uint32_t ETCPixel(uint32_t i) {
+  return (i % 4) * 4 + i / 4;
+}
+
+// Texel i belongs to the second sub block
+static inline bool ETCSecondHalf(uint32_t i, bool flip) {
+  return flip ? (i / 4) >= 2 : (i % 4) >= 2;
+}
+
+struct ETCSubBlockFit {
+  uint32_t table;
+  uint8_t modifier[4]; // pixel index for every palette entry
+  uint64_t error;
+};
+
+static ETCSubBlockFit FitETCSubBlock(const uint8_t palette[4][4], const uint32_t counts[4], const int base[3]) {
+  // Only the tables around the one whose large modifier just reaches the
+  // brightness spread of the sub block are worth trying
+  int spread = 0;
+  for(uint32_t entry = 0; entry < 4; entry++) {
+    if(counts[entry] != 0) {
+      int luma = palette[entry][0] + palette[entry][1] + palette[entry][2] - base[0] - base[1] - base[2];
+      spread = std::max(spread, std::abs(luma) / 3);
+    }
+  }
+  uint32_t middle = 0;
+  while(middle < 7 && kETCModifiers[middle][1] < spread)
+    middle++;
+
+  ETCSubBlockFit best;
+  best.error = ~0ULL;
+  for(uint32_t table = middle == 0 ? 0 : middle - 1; table <= std::min(middle + 1, 7u); table++) {
+    ETCSubBlockFit fit;
+    fit.table = table;
+    fit.error = 0;
+    for(uint32_t entry = 0; entry < 4; entry++) {
+      fit.modifier[entry] = 0;
+      if(counts[entry] == 0)
+        continue;
+
+      uint32_t entry_error = ~0U;
+      for(uint32_t idx = 0; idx < 4; idx++) {
+        int modifier = ETCModifier(table, idx);
+        uint32_t error = 0;
+        for(int c = 0; c < 3; c++) {
+          int diff = Clamp8(base[c] + modifier) - palette[entry][c];
+          error += diff * diff;
+        }
+        if(error < entry_error) {
+          entry_error = error;
+          fit.modifier[entry] = static_cast<uint8_t>(idx);
+        }
+      }
+      fit.error += static_cast<uint64_t>(entry_error) * counts[entry];
+    }
+    if(fit.error < best.error)
+      best = fit;
+  }
+  return best;
+}
+
+static void EncodeETCBlock(const PhysicalDXTBlock &block, uint8_t *out) {
+  uint8_t palette[4][4];
+  DXT1Palette(block, palette);
+
+  uint64_t best_bits = 0, best_error = ~0ULL;
+  for(int flip = 0; flip < 2; flip++) {
+    // Texels of each sub block per palette entry, and the average colours
+    uint32_t counts[2][4] = { { 0 } };
+    for(uint32_t i = 0; i < 16; i++)
+      counts[ETCSecondHalf(i, flip != 0)][DXT1Index(block, i)]++;
+
+    int average[2][3];
+    for(int half = 0; half < 2; half++) {
+      for(int c = 0; c < 3; c++) {
+        int sum = 0;
+        for(int entry = 0; entry < 4; entry++)
+          sum += counts[half][entry] * palette[entry][c];
+        average[half][c] = (sum + 4) / 8;
+      }
+    }
+
+    // Differential mode if the 5 bit colours are close enough, 4 bit
+    // colours otherwise
+    int quantized[2][3], base[2][3];
+    bool is_differential = true;
+    for(int c = 0; c < 3; c++) {
+      for(int half = 0; half < 2; half++)
+        quantized[half][c] = (average[half][c] * 31 + 127) / 255;
+      int diff = quantized[1][c] - quantized[0][c];
+      is_differential = is_differential && diff >= -4 && diff <= 3;
+    }
+    for(int half = 0; half < 2; half++) {
+      for(int c = 0; c < 3; c++) {
+        if(is_differential) {
+          base[half][c] = (quantized[half][c] << 3) | (quantized[half][c] >> 2);
+        }
+        else {
+          quantized[half][c] = (average[half][c] * 15 + 127) / 255;
+          base[half][c] = (quantized[half][c] << 4) | quantized[half][c];
+        }
+      }
+    }
+
+    ETCSubBlockFit fits[2] = { FitETCSubBlock(palette, counts[0], base[0]),
+                               FitETCSubBlock(palette, counts[1], base[1]) };
+    uint64_t error = fits[0].error + fits[1].error;
+    if(error >= best_error)
+      continue;
+
+    uint64_t bits = 0;
+    for(int c = 0; c < 3; c++) {
+      int shift = 56 - 8 * c;
+      if(is_differential) {
+        bits |= static_cast<uint64_t>(quantized[0][c]) << (shift + 3);
+        bits |= static_cast<uint64_t>((quantized[1][c] - quantized[0][c]) & 7) << shift;
+      }
+      else {
+        bits |= static_cast<uint64_t>(quantized[0][c]) << (shift + 4);
+        bits |= static_cast<uint64_t>(quantized[1][c]) << shift;
+      }
+    }
+    bits |= static_cast<uint64_t>(fits[0].table) << 37;
+    bits |= static_cast<uint64_t>(fits[1].table) << 34;
+    bits |= static_cast<uint64_t>(is_differential) << 33;
+    bits |= static_cast<uint64_t>(flip) << 32;
+    for(uint32_t i = 0; i < 16; i++) {
+      uint32_t idx = fits[ETCSecondHalf(i, flip != 0)].modifier[DXT1Index(block, i)];
+      uint32_t pixel = ETCPixel(i);
+      bits |= static_cast<uint64_t>(idx >> 1) << (16 + pixel);
+      bits |= static_cast<uint64_t>(idx & 1) << pixel;
+    }
+
+    best_bits = bits;
+    best_error = error;
+  }
+
+  // ETC blocks are big endian
+  for(int byte = 0; byte < 8; byte++)
+    out[byte] = static_cast<uint8_t>(best_bits >> (56 - 8 * byte));
+}
+
+bool DecodeETC2BlockReference(const uint8_t *block, uint8_t *rgba) {
+  uint64_t bits = 0;
+  for(int byte = 0; byte < 8; byte++)
+    bits = (bits << 8) | block[byte];
+
+  bool is_differential = (bits >> 33) & 1;
+  bool flip = (bits >> 32) & 1;
+  int base[2][3];
+  for(int c = 0; c < 3; c++) {
+    int shift = 56 - 8 * c;
+    if(is_differential) {
+      int first = (bits >> (shift + 3)) & 31;
+      int diff = (bits >> shift) & 7;
+      int second = first + (diff >= 4 ? diff - 8 : diff);
+      // An overflow selects the T, H or planar modes of ETC2
+      if(second < 0 || second > 31)
+        return false;
+      base[0][c] = (first << 3) | (first >> 2);
+      base[1][c] = (second << 3) | (second >> 2);
+    }
+    else {
+      int first = (bits >> (shift + 4)) & 15;
+      int second = (bits >> shift) & 15;
+      base[0][c] = (first << 4) | first;
+      base[1][c] = (second << 4) | second;
+    }
+  }
+
+  const uint32_t tables[2] = { static_cast<uint32_t>((bits >> 37) & 7), static_cast<uint32_t>((bits >> 34) & 7) };
+  for(uint32_t i = 0; i < 16; i++) {
+    uint32_t pixel = ETCPixel(i);
+    uint32_t idx = static_cast<uint32_t>((((bits >> (16 + pixel)) & 1) << 1) | ((bits >> pixel) & 1));
+    int half = ETCSecondHalf(i, flip);
+    int modifier = ETCModifier(tables[half], idx);
+    for(int c = 0; c < 3; c++)
+      rgba[4 * i + c] = Clamp8(base[half][c] + modifier);
+    rgba[4 * i + 3] = 255;
+  }
+  return true;
+}
+
+class ETC2Transcoder : public BlockTranscoder {
+ public:
+  TranscodeFormat Format() const { return eTranscodeFormat_ETC2_RGB; }
+
+  void TranscodeRows(const PhysicalDXTBlock *src, uint32_t src_pitch, uint32_t blocks_width,
+                     uint32_t first_row, uint32_t end_row, uint8_t *dst, size_t dst_pitch) const {
+    for(uint32_t y = first_row; y < end_row; y++) {
+      const PhysicalDXTBlock *src_row = src + static_cast<size_t>(y) * src_pitch;
+      for(uint32_t x = 0; x < blocks_width; x++)
+        EncodeETCBlock(src_row[x], dst + y * dst_pitch + 8 * x);
+    }
+  }
+};
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// BC7
+//
+// Four colour DXT1 blocks map onto mode 5 (one subset, 2 bit indices) with
+// the same endpoints, only rounded to 7 bits. Three colour blocks without
+// black do too, with one endpoint pushed out so that the half way colour
+// falls on the 1/3 weight. Everything else, blocks using black or whose
+// pushed endpoint leaves the colour range, is fitted with mode 6.
+
+static const int kBC7Weights2[4] = { 0, 21, 43, 64 };
+static const int kBC7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+static inline int BC7Interpolate(int e0, int e1, int weight) {
+  return ((64 - weight) * e0 + weight * e1 + 32) >> 6;
+}
+
+static inline int Unquantize7(int value) {
+  return (value << 1) | (value >> 6);
+}
+
+// Closest 7 bit mode 5 endpoint to an 8 bit value
+static inline int Quantize7(int value) {
+  int best = value >> 1, best_error = 256;
+  for(int q = std::max(best - 1, 0); q <= std::min(best + 1, 127); q++) {
+    int error = std::abs(Unquantize7(q) - value);
+    if(error < best_error) {
+      best = q;
+      best_error = error;
+    }
+  }
+  return best;
+}
+
+class BC7Bits {
+ public:
+  BC7Bits() : _pos(0) { _words[0] = _words[1] = 0; }
+  explicit BC7Bits(const uint8_t *block) : _pos(0) {
+    memcpy(_words, block, 16);
+  }
+
+  void Put(uint64_t value, uint32_t num_bits) {
+    uint32_t word = _pos / 64, shift = _pos % 64;
+    _words[word] |= value << shift;
+    if(shift + num_bits > 64)
+      _words[1] |= value >> (64 - shift);
+    _pos += num_bits;
+  }
+
+  uint32_t Get(uint32_t num_bits) {
+    uint32_t word = _pos / 64, shift = _pos % 64;
+    uint64_t value = _words[word] >> shift;
+    if(shift + num_bits > 64)
+      value |= _words[1] << (64 - shift);
+    _pos += num_bits;
+    return static_cast<uint32_t>(value & ((1ULL << num_bits) - 1));
+  }
+
+  void Store(uint8_t *block) const { memcpy(block, _words, 16); }
+
+ private:
+  uint64_t _words[2]; // little endian
+  uint32_t _pos;
+};
+
+static void WriteBC7Mode5(int endpoints[2][3], uint32_t indices[16], uint8_t *out) {
+  // The first index has an implied zero top bit
+  if(indices[0] >= 2) {
+    for(int c = 0; c < 3; c++)
+      std::swap(endpoints[0][c], endpoints[1][c]);
+    for(uint32_t i = 0; i < 16; i++)
+      indices[i] = 3 - indices[i];
+  }
+
+  BC7Bits bits;
+  bits.Put(1 << 5, 6);
+  bits.Put(0, 2); // no rotation
+  for(int c = 0; c < 3; c++) {
+    bits.Put(endpoints[0][c], 7);
+    bits.Put(endpoints[1][c], 7);
+  }
+  bits.Put(255, 8);
+  bits.Put(255, 8);
+  for(uint32_t i = 0; i < 16; i++)
+    bits.Put(indices[i], i == 0 ? 1 : 2);
+  bits.Put(0, 31); // alpha indices
+  bits.Store(out);
+}
+
+// Fits the 16 texels with mode 6, endpoints at the corners of their
+// bounding box along the main diagonal of the colours
+static void WriteBC7Mode6(const uint8_t *rgba, uint8_t *out) {
+  int lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 }, mean[3] = { 0, 0, 0 };
+  for(uint32_t i = 0; i < 16; i++) {
+    for(int c = 0; c < 3; c++) {
+      lo[c] = std::min<int>(lo[c], rgba[4 * i + c]);
+      hi[c] = std::max<int>(hi[c], rgba[4 * i + c]);
+      mean[c] += rgba[4 * i + c];
+    }
+  }
+
+  // Channels that fall while the widest one rises run the other way
+  int widest = 0;
+  for(int c = 1; c < 3; c++) {
+    if(hi[c] - lo[c] > hi[widest] - lo[widest])
+      widest = c;
+  }
+  int ends[2][4];
+  for(int c = 0; c < 3; c++) {
+    int covariance = 0;
+    for(uint32_t i = 0; i < 16; i++)
+      covariance += (16 * rgba[4 * i + c] - mean[c]) * (16 * rgba[4 * i + widest] - mean[widest]) / 256;
+    ends[0][c] = covariance < 0 ? hi[c] : lo[c];
+    ends[1][c] = covariance < 0 ? lo[c] : hi[c];
+  }
+
+  // 7 bits per channel and a shared low bit per endpoint, alpha stays at
+  // 254 or 255
+  int endpoints[2][4], pbits[2];
+  for(int ep = 0; ep < 2; ep++) {
+    int best_error = 1 << 30;
+    for(int p = 0; p < 2; p++) {
+      int quantized[4], error = p == 0 ? 1 : 0;
+      for(int c = 0; c < 3; c++) {
+        quantized[c] = std::min(std::max((ends[ep][c] - p + 1) >> 1, 0), 127);
+        int diff = ((quantized[c] << 1) | p) - ends[ep][c];
+        error += diff * diff;
+      }
+      quantized[3] = 127;
+      if(error < best_error) {
+        best_error = error;
+        memcpy(endpoints[ep], quantized, sizeof(quantized));
+        pbits[ep] = p;
+      }
+    }
+  }
+
+  int colors[16][3];
+  for(int idx = 0; idx < 16; idx++) {
+    for(int c = 0; c < 3; c++)
+      colors[idx][c] = BC7Interpolate((endpoints[0][c] << 1) | pbits[0], (endpoints[1][c] << 1) | pbits[1],
+                                      kBC7Weights4[idx]);
+  }
+
+  // Project every texel on the endpoint line and try the weights next to it
+  int axis[3], axis_length = 0;
+  for(int c = 0; c < 3; c++) {
+    axis[c] = colors[15][c] - colors[0][c];
+    axis_length += axis[c] * axis[c];
+  }
+  uint32_t indices[16];
+  for(uint32_t i = 0; i < 16; i++) {
+    int projection = 0;
+    for(int c = 0; c < 3; c++)
+      projection += (rgba[4 * i + c] - colors[0][c]) * axis[c];
+    int nearest = axis_length == 0 ? 0 : (15 * projection + axis_length / 2) / axis_length;
+    nearest = std::min(std::max(nearest, 0), 15);
+
+    int best_error = 1 << 30;
+    for(int idx = std::max(nearest - 1, 0); idx <= std::min(nearest + 1, 15); idx++) {
+      int error = 0;
+      for(int c = 0; c < 3; c++) {
+        int diff = colors[idx][c] - rgba[4 * i + c];
+        error += diff * diff;
+      }
+      if(error < best_error) {
+        best_error = error;
+        indices[i] = idx;
+      }
+    }
+  }
+
+  if(indices[0] >= 8) {
+    for(int c = 0; c < 4; c++)
+      std::swap(endpoints[0][c], endpoints[1][c]);
+    std::swap(pbits[0], pbits[1]);
+    for(uint32_t i = 0; i < 16; i++)
+      indices[i] = 15 - indices[i];
+  }
+
+  BC7Bits bits;
+  bits.Put(1 << 6, 7);
+  for(int c = 0; c < 4; c++) {
+    bits.Put(endpoints[0][c], 7);
+    bits.Put(endpoints[1][c], 7);
+  }
+  bits.Put(pbits[0], 1);
+  bits.Put(pbits[1], 1);
+  for(uint32_t i = 0; i < 16; i++)
+    bits.Put(indices[i], i == 0 ? 3 : 4);
+  bits.Store(out);
+}
+
+static void EncodeBC7Block(const PhysicalDXTBlock &block, uint8_t *out) {
+  uint8_t palette[4][4];
+  DXT1Palette(block, palette);
+
+  if(block.ep1 > block.ep2) {
+    static const uint32_t kMode5Index[4] = { 0, 3, 1, 2 };
+    int endpoints[2][3];
+    uint32_t indices[16];
+    for(int c = 0; c < 3; c++) {
+      endpoints[0][c] = Quantize7(palette[0][c]);
+      endpoints[1][c] = Quantize7(palette[1][c]);
+    }
+    for(uint32_t i = 0; i < 16; i++)
+      indices[i] = kMode5Index[DXT1Index(block, i)];
+    WriteBC7Mode5(endpoints, indices, out);
+    return;
+  }
+
+  bool uses_black = false;
+  for(uint32_t i = 0; i < 16; i++)
+    uses_black = uses_black || DXT1Index(block, i) == 3;
+
+  // near, half way, far at weights 0, 1/3, 2/3 puts the far endpoint at
+  // (3 far - near) / 2
+  for(int near = 0; near < 2 && !uses_black; near++) {
+    int far = 1 - near;
+    int endpoints[2][3];
+    bool fits = true;
+    for(int c = 0; c < 3; c++) {
+      int pushed = (3 * palette[far][c] - palette[near][c] + 1) / 2;
+      fits = fits && pushed >= 0 && pushed <= 255;
+      endpoints[0][c] = Quantize7(palette[near][c]);
+      endpoints[1][c] = Quantize7(Clamp8(pushed));
+    }
+    if(!fits)
+      continue;
+
+    uint32_t mode5_index[3];
+    mode5_index[near] = 0;
+    mode5_index[far] = 2;
+    mode5_index[2] = 1;
+    uint32_t indices[16];
+    for(uint32_t i = 0; i < 16; i++)
+      indices[i] = mode5_index[DXT1Index(block, i)];
+    WriteBC7Mode5(endpoints, indices, out);
+    return;
+  }
+
+  uint8_t rgba[64];
+  DecodeDXT1BlockReference(block, rgba);
+  WriteBC7Mode6(rgba, out);
+}
+
+bool DecodeBC7BlockReference(const uint8_t *block, uint8_t *rgba) {
+  BC7Bits bits(block);
+  if((block[0] & 0x3F) == 0x20) {
+    // Mode 5
+    bits.Get(6);
+    uint32_t rotation = bits.Get(2);
+    int endpoints[2][4];
+    for(int c = 0; c < 3; c++) {
+      endpoints[0][c] = Unquantize7(bits.Get(7));
+      endpoints[1][c] = Unquantize7(bits.Get(7));
+    }
+    endpoints[0][3] = bits.Get(8);
+    endpoints[1][3] = bits.Get(8);
+
+    uint32_t color_indices[16], alpha_indices[16];
+    for(uint32_t i = 0; i < 16; i++)
+      color_indices[i] = bits.Get(i == 0 ? 1 : 2);
+    for(uint32_t i = 0; i < 16; i++)
+      alpha_indices[i] = bits.Get(i == 0 ? 1 : 2);
+
+    for(uint32_t i = 0; i < 16; i++) {
+      uint8_t *texel = rgba + 4 * i;
+      for(int c = 0; c < 3; c++)
+        texel[c] = static_cast<uint8_t>(BC7Interpolate(endpoints[0][c], endpoints[1][c], kBC7Weights2[color_indices[i]]));
+      texel[3] = static_cast<uint8_t>(BC7Interpolate(endpoints[0][3], endpoints[1][3], kBC7Weights2[alpha_indices[i]]));
+      if(rotation != 0)
+        std::swap(texel[rotation - 1], texel[3]);
+    }
+    return true;
+  }
+
+  if((block[0] & 0x7F) == 0x40) {
+    // Mode 6
+    bits.Get(7);
+    int endpoints[2][4];
+    for(int c = 0; c < 4; c++) {
+      endpoints[0][c] = bits.Get(7) << 1;
+      endpoints[1][c] = bits.Get(7) << 1;
+    }
+    uint32_t pbits[2];
+    pbits[0] = bits.Get(1);
+    pbits[1] = bits.Get(1);
+
+    for(uint32_t i = 0; i < 16; i++) {
+      uint32_t idx = bits.Get(i == 0 ? 3 : 4);
+      for(int c = 0; c < 4; c++)
+        rgba[4 * i + c] = static_cast<uint8_t>(BC7Interpolate(endpoints[0][c] | pbits[0], endpoints[1][c] | pbits[1],
+                                                              kBC7Weights4[idx]));
+    }
+    return true;
+  }
+  return false;
+}
+
+class BC7Transcoder : public BlockTranscoder {
+ public:
+  TranscodeFormat Format() const { return eTranscodeFormat_BC7; }
+
+  void TranscodeRows(const PhysicalDXTBlock *src, uint32_t src_pitch, uint32_t blocks_width,
+                     uint32_t first_row, uint32_t end_row, uint8_t *dst, size_t dst_pitch) const {
+    for(uint32_t y = first_row; y < end_row; y++) {
+      const PhysicalDXTBlock *src_row = src + static_cast<size_t>(y) * src_pitch;
+      for(uint32_t x = 0; x < blocks_width; x++)
+        EncodeBC7Block(src_row[x], dst + y * dst_pitch + 16 * x);
+    }
+  }
+};
+
+BlockTranscoder *CreateBlockTranscoder(TranscodeFormat format) {
+  switch(format) {
+  case eTranscodeFormat_RGBA8: return new RGBA8Transcoder;
+  case eTranscodeFormat_ETC2_RGB: return new ETC2Transcoder;
+  case eTranscodeFormat_BC7: return new BC7Transcoder;
+  default:
+    std::cerr << "Error unknown transcode format " << format << "!" << std::endl;
+    exit(-1);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// FrameTranscoder
+
+FrameTranscoder::FrameTranscoder(TranscodeFormat format, uint32_t frame_height, uint32_t frame_width,
+                                 uint32_t num_threads)
+  : _transcoder(CreateBlockTranscoder(format))
+  , _blocks_height(frame_height / 4)
+  , _blocks_width(frame_width / 4)
+  , _output_pitch(static_cast<size_t>(frame_width / 4) * TranscodedBlockSize(format))
+  , _num_bands(0)
+  , _pool(num_threads)
+  , _src(NULL)
+  , _src_pitch(0)
+  , _first_row(0)
+  , _end_row(0)
+  , _dst(NULL) {
+
+  // A couple of bands per thread evens out rows that take longer
+  _num_bands = std::max(std::min(_blocks_height, 2 * _pool.NumThreads()), 1u);
+  for(uint32_t band = 0; band < _num_bands; band++)
+    _graph.AddTask([this, band] { TranscodeBand(band); });
+}
+
+void FrameTranscoder::Transcode(const PhysicalDXTBlock *src, uint32_t src_pitch, uint32_t first_row,
+                                uint32_t end_row, uint8_t *dst) {
+  assert(end_row <= _blocks_height);
+  if(first_row >= end_row)
+    return;
+
+  _src = src;
+  _src_pitch = src_pitch == 0 ? _blocks_width : src_pitch;
+  _first_row = first_row;
+  _end_row = end_row;
+  _dst = dst;
+  _graph.Run(_pool);
+}
+
+void FrameTranscoder::TranscodeBand(uint32_t band) {
+  uint32_t num_rows = _end_row - _first_row;
+  uint32_t band_first = _first_row + static_cast<uint32_t>(static_cast<uint64_t>(num_rows) * band / _num_bands);
+  uint32_t band_end = _first_row + static_cast<uint32_t>(static_cast<uint64_t>(num_rows) * (band + 1) / _num_bands);
+  if(band_first < band_end)
+    _transcoder->TranscodeRows(_src, _src_pitch, _blocks_width, band_first, band_end, _dst, _output_pitch);
+}
+
+}  // namespace MPTC
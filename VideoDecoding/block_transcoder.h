@@ -0,0 +1,94 @@
+#ifndef __MPTC_BLOCK_TRANSCODER_H__
+#define __MPTC_BLOCK_TRANSCODER_H__
+
+#include "decoder.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+
+namespace MPTC {
+
+// Formats decoded DXT1 frames can be turned into, for GPUs or renderers
+// without S3TC
+enum TranscodeFormat {
+  eTranscodeFormat_RGBA8 = 0,    // plain 32 bit texels, for software rendering
+  eTranscodeFormat_ETC2_RGB = 1, // 8 bytes per block, ETC1 compatible modes only
+  eTranscodeFormat_BC7 = 2,      // 16 bytes per block, modes 5 and 6 only
+  kNumTranscodeFormats
+};
+
+const char *TranscodeFormatName(TranscodeFormat format);
+
+// Bytes one 4x4 block takes in format
+uint32_t TranscodedBlockSize(TranscodeFormat format);
+
+// Turns rows of DXT1 blocks into another format. Transcoders keep no state
+// between calls, one instance can serve any number of threads.
+class BlockTranscoder {
+ public:
+  virtual ~BlockTranscoder() { }
+
+  virtual TranscodeFormat Format() const = 0;
+
+  // Transcodes the block rows [first_row, end_row) of a blocks_width wide
+  // frame. Block rows of src are src_pitch blocks apart, those of dst
+  // dst_pitch bytes. RGBA8 writes a plain image, its pixel rows are
+  // dst_pitch / 4 bytes apart.
+  virtual void TranscodeRows(const PhysicalDXTBlock *src, uint32_t src_pitch, uint32_t blocks_width,
+                             uint32_t first_row, uint32_t end_row, uint8_t *dst, size_t dst_pitch) const = 0;
+};
+
+BlockTranscoder *CreateBlockTranscoder(TranscodeFormat format);
+
+// Scalar reference decoders, 16 RGBA texels in raster order. The ETC2 and
+// BC7 ones only know the modes the transcoders write and return false on
+// any other block.
+void DecodeDXT1BlockReference(const PhysicalDXTBlock &block, uint8_t *rgba);
+bool DecodeETC2BlockReference(const uint8_t *block, uint8_t *rgba);
+bool DecodeBC7BlockReference(const uint8_t *block, uint8_t *rgba);
+
+// Transcodes whole frames, or bands of them, on a worker pool. The task
+// graph is built once for the frame size, transcoding allocates nothing.
+class FrameTranscoder {
+ public:
+  // num_threads == 0 sizes the pool from the hardware
+  FrameTranscoder(TranscodeFormat format, uint32_t frame_height, uint32_t frame_width,
+                  uint32_t num_threads = 0);
+
+  TranscodeFormat Format() const { return _transcoder->Format(); }
+
+  // Bytes from one block row of the output to the next, and of all of it
+  size_t OutputPitch() const { return _output_pitch; }
+  size_t OutputSize() const { return _output_pitch * _blocks_height; }
+
+  // Transcodes block rows [first_row, end_row) of src, whose rows are
+  // src_pitch blocks apart (0 packs them tightly), into the same rows of
+  // dst, which holds OutputSize() bytes
+  void Transcode(const PhysicalDXTBlock *src, uint32_t src_pitch, uint32_t first_row, uint32_t end_row,
+                 uint8_t *dst);
+
+ private:
+  FrameTranscoder(const FrameTranscoder &);
+  FrameTranscoder &operator=(const FrameTranscoder &);
+
+  void TranscodeBand(uint32_t band);
+
+  std::unique_ptr<BlockTranscoder> _transcoder;
+  uint32_t _blocks_height, _blocks_width;
+  size_t _output_pitch;
+  uint32_t _num_bands;
+  ThreadPool _pool;
+  TaskGraph _graph;
+
+  // Arguments of the current Transcode()
+  const PhysicalDXTBlock *_src;
+  uint32_t _src_pitch;
+  uint32_t _first_row, _end_row;
+  uint8_t *_dst;
+};
+
+}  // namespace MPTC
+
+#endif  // __MPTC_BLOCK_TRANSCODER_H__
@@ -0,0 +1,694 @@
+#include "container.h"
+#include "decoder.h"
+
+#include "Kernel/OVR_CRC32.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace MPTC {
+
+static uint32_t Crc(const void *data, size_t sz, uint32_t crc = 0) {
+  return OVR::CalculateCRC32(OVR::CRC32_Table_CRC32, data, static_cast<int>(sz), crc);
+}
+
+template<typename T> static void Put(uint8_t *&ptr, T value) {
+  memcpy(ptr, &value, sizeof(T));
+  ptr += sizeof(T);
+}
+
+template<typename T> static T Get(const uint8_t *&ptr) {
+  T value;
+  memcpy(&value, ptr, sizeof(T));
+  ptr += sizeof(T);
+  return value;
+}
+
+static bool IsDataPacket(uint8_t type) {
+  return type == eContainerPacket_Header || type == eContainerPacket_Dictionary ||
+         type == eContainerPacket_Frame;
+}
+
+static void EncodeContainerHeader(const ContainerHeader &header, uint8_t *bytes) {
+  uint8_t *ptr = bytes;
+  Put<uint32_t>(ptr, kContainerMagic);
+  Put<uint8_t>(ptr, header.version);
+  Put<uint8_t>(ptr, header.flags);
+  Put<uint16_t>(ptr, 0);
+  Put<uint32_t>(ptr, header.max_packet_size);
+  Put<uint32_t>(ptr, header.num_frames);
+  Put<uint64_t>(ptr, header.stream_size);
+  Put<uint64_t>(ptr, header.toc_offset);
+  Put<uint32_t>(ptr, Crc(bytes, ptr - bytes));
+}
+
+static bool DecodeContainerHeader(const uint8_t *bytes, ContainerHeader *header) {
+  const uint8_t *ptr = bytes;
+  if (Get<uint32_t>(ptr) != kContainerMagic) {
+    std::cerr << "Error not an MPTC container!" << std::endl;
+    return false;
+  }
+  header->version = Get<uint8_t>(ptr);
+  header->flags = Get<uint8_t>(ptr);
+  Get<uint16_t>(ptr);
+  header->max_packet_size = Get<uint32_t>(ptr);
+  header->num_frames = Get<uint32_t>(ptr);
+  header->stream_size = Get<uint64_t>(ptr);
+  header->toc_offset = Get<uint64_t>(ptr);
+  if (Get<uint32_t>(ptr) != Crc(bytes, kContainerHeaderSize - 4)) {
+    std::cerr << "Error container header CRC mismatch!" << std::endl;
+    return false;
+  }
+  if (header->version > kContainerVersion) {
+    std::cerr << "Error unsupported container version " << static_cast<uint32_t>(header->version) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Checks a packet header, on success packet gets everything but the
+// offsets and the section sizes, which need the data that follows
+static bool DecodePacketHeader(const uint8_t *bytes, uint32_t max_packet_size, ContainerPacket *packet,
+                               uint16_t *num_sections, uint32_t *data_crc) {
+  const uint8_t *ptr = bytes;
+  if (Get<uint32_t>(ptr) != kContainerPacketSync)
+    return false;
+  packet->type = Get<uint8_t>(ptr);
+  packet->flags = Get<uint8_t>(ptr);
+  *num_sections = Get<uint16_t>(ptr);
+  packet->payload_size = Get<uint32_t>(ptr);
+  packet->sequence = Get<uint32_t>(ptr);
+  *data_crc = Get<uint32_t>(ptr);
+  if (Get<uint32_t>(ptr) != Crc(bytes, kContainerPacketHeaderSize - 4))
+    return false;
+  return static_cast<uint64_t>(*num_sections) * 4 + packet->payload_size <= max_packet_size;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// DescriptorInput
+//
+//////////////////////////////////////////////////////////////////////////////
+
+bool DescriptorInput::Read(void *dst, size_t sz) {
+  uint8_t *ptr = reinterpret_cast<uint8_t *>(dst);
+  while (sz > 0) {
+#ifdef _WIN32
+    int chunk = _read(_fd, ptr, static_cast<unsigned int>(std::min<size_t>(sz, 1 << 30)));
+#else
+    ssize_t chunk = read(_fd, ptr, sz);
+#endif
+    if (chunk < 0 && errno == EINTR)
+      continue;
+    if (chunk <= 0)
+      return false;
+    ptr += chunk;
+    sz -= static_cast<size_t>(chunk);
+  }
+  return true;
+}
+
+bool DescriptorInput::Seek(uint64_t offset) {
+#ifdef _WIN32
+  return _lseeki64(_fd, static_cast<__int64>(offset), SEEK_SET) >= 0;
+#else
+  return lseek(_fd, static_cast<off_t>(offset), SEEK_SET) >= 0;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// ContainerSource
+//
+//////////////////////////////////////////////////////////////////////////////
+
+ContainerSource::ContainerSource()
+  : _input(NULL), _packet_pos(0), _input_offset(0), _pending_seek(0), _has_pending_seek(false),
+    _at_end(true), _is_broken(false), _packets_read(0), _bytes_read(0) {
+  memset(&_header, 0, sizeof(_header));
+  _packet.type = 0;
+  _packet.flags = 0;
+  _packet.sequence = ~0U;
+  _packet.payload_size = 0;
+  _packet.packet_offset = 0;
+  _packet.stream_offset = 0;
+}
+
+bool ContainerSource::Open(PacketInput &input) {
+  _input = &input;
+  _at_end = true;
+  _is_broken = true;
+  _locations.clear();
+  _packets_read = 0;
+  _bytes_read = 0;
+
+  uint8_t bytes[kContainerHeaderSize];
+  if (!input.Read(bytes, kContainerHeaderSize)) {
+    std::cerr << "Error container ends before its header!" << std::endl;
+    return false;
+  }
+  if (!DecodeContainerHeader(bytes, &_header))
+    return false;
+  _bytes_read = kContainerHeaderSize;
+  _payload.assign(static_cast<size_t>(_header.max_packet_size) + kStreamPadding, 0);
+  _is_broken = false;
+
+  // Only inputs that can go back to the first packet get to read the table
+  // of contents, streams find their packets as they arrive
+  if ((_header.flags & kContainerFlag_Toc) && input.Seek(_header.toc_offset)) {
+    if (!ReadPacket(_header.toc_offset, 0) || _packet.type != eContainerPacket_Toc ||
+        _packet.payload_size % kContainerTocEntrySize != 0) {
+      std::cerr << "Error broken container table of contents!" << std::endl;
+      return false;
+    }
+
+    const uint8_t *ptr = _payload.data();
+    for (uint32_t entry_idx = 0; entry_idx < _packet.payload_size / kContainerTocEntrySize; entry_idx++) {
+      ContainerTocEntry entry;
+      entry.packet_offset = Get<uint64_t>(ptr);
+      entry.stream_offset = Get<uint64_t>(ptr);
+      entry.type = Get<uint8_t>(ptr);
+      entry.flags = Get<uint8_t>(ptr);
+      Get<uint16_t>(ptr);
+      entry.frame = Get<uint32_t>(ptr);
+      _locations.push_back(entry);
+    }
+    if (!input.Seek(kContainerHeaderSize))
+      return false;
+  }
+
+  _packet.type = 0;
+  _packet.flags = 0;
+  _packet.sequence = ~0U;
+  _packet.payload_size = 0;
+  _packet.packet_offset = 0;
+  _packet.stream_offset = 0;
+  _packet.sections.clear();
+  _packet_pos = 0;
+  _input_offset = kContainerHeaderSize;
+  _has_pending_seek = false;
+  _at_end = false;
+  return true;
+}
+
+bool ContainerSource::ReadPacket(uint64_t packet_offset, uint64_t stream_offset) {
+  uint8_t bytes[kContainerPacketHeaderSize];
+  uint16_t num_sections;
+  uint32_t data_crc;
+  if (!_input->Read(bytes, kContainerPacketHeaderSize)) {
+    std::cerr << "Error container ends inside the packet at " << packet_offset << "!" << std::endl;
+    _is_broken = true;
+    return false;
+  }
+  if (!DecodePacketHeader(bytes, _header.max_packet_size, &_packet, &num_sections, &data_crc)) {
+    std::cerr << "Error broken container packet header at " << packet_offset << "!" << std::endl;
+    _is_broken = true;
+    return false;
+  }
+
+  _packet.sections.resize(num_sections);
+  bool is_ok = (num_sections == 0 || _input->Read(_packet.sections.data(), 4 * num_sections)) &&
+               _input->Read(_payload.data(), _packet.payload_size);
+  if (!is_ok) {
+    std::cerr << "Error container ends inside the packet at " << packet_offset << "!" << std::endl;
+    _is_broken = true;
+    return false;
+  }
+  if (Crc(_payload.data(), _packet.payload_size, Crc(_packet.sections.data(), 4 * num_sections)) != data_crc) {
+    std::cerr << "Error container packet at " << packet_offset << " fails its CRC!" << std::endl;
+    _is_broken = true;
+    return false;
+  }
+
+  // Streams at the end of the payload read zeros past it
+  memset(_payload.data() + _packet.payload_size, 0, kStreamPadding);
+
+  uint64_t packet_size = kContainerPacketHeaderSize + 4 * num_sections + _packet.payload_size;
+  _packet.packet_offset = packet_offset;
+  _packet.stream_offset = stream_offset;
+  _packet_pos = 0;
+  _input_offset = packet_offset + packet_size;
+  _packets_read++;
+  _bytes_read += packet_size;
+  return true;
+}
+
+bool ContainerSource::NextPacket() {
+  if (_at_end || _is_broken)
+    return false;
+
+  for (;;) {
+    uint32_t sequence = _packet.sequence + 1;
+    uint64_t stream_offset = _packet.stream_offset + (IsDataPacket(_packet.type) ? _packet.payload_size : 0);
+    if (!ReadPacket(_input_offset, stream_offset))
+      return false;
+    if (_packet.sequence != sequence) {
+      std::cerr << "Error container packet " << sequence << " is missing!" << std::endl;
+      _is_broken = true;
+      return false;
+    }
+
+    if (_packet.type == eContainerPacket_End) {
+      _at_end = true;
+      return false;
+    }
+    if (!IsDataPacket(_packet.type))
+      continue;
+
+    // Remember where the packet was to seek back to it, the table of
+    // contents may already know
+    if (_locations.empty() || _locations.back().packet_offset < _packet.packet_offset) {
+      ContainerTocEntry entry;
+      entry.packet_offset = _packet.packet_offset;
+      entry.stream_offset = _packet.stream_offset;
+      entry.type = _packet.type;
+      entry.flags = _packet.flags;
+      entry.frame = 0;
+      _locations.push_back(entry);
+    }
+    return true;
+  }
+}
+
+bool ContainerSource::SeekPacket(uint64_t offset) {
+  if (_is_broken)
+    return false;
+
+  // Forward, or within the current packet, works on any input
+  if (offset >= _packet.stream_offset) {
+    while (offset > _packet.stream_offset + _packet.payload_size) {
+      if (!NextPacket())
+        return false;
+    }
+    _packet_pos = static_cast<uint32_t>(offset - _packet.stream_offset);
+    return true;
+  }
+
+  // Back to the last packet that starts at or before offset
+  size_t lo = 0, hi = _locations.size();
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (_locations[mid].stream_offset <= offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0 || !_input->Seek(_locations[lo - 1].packet_offset)) {
+    std::cerr << "Error container input cannot seek back to " << offset << "!" << std::endl;
+    return false;
+  }
+
+  const ContainerTocEntry &entry = _locations[lo - 1];
+  _at_end = false;
+  if (!ReadPacket(entry.packet_offset, entry.stream_offset))
+    return false;
+  return SeekPacket(offset);
+}
+
+bool ContainerSource::Fill() {
+  if (_has_pending_seek) {
+    _has_pending_seek = false;
+    if (!SeekPacket(_pending_seek))
+      return false;
+  }
+
+  while (_packet_pos >= _packet.payload_size) {
+    if (!NextPacket())
+      return false;
+  }
+  return true;
+}
+
+bool ContainerSource::Read(void *dst, uint32_t sz) {
+  uint8_t *ptr = reinterpret_cast<uint8_t *>(dst);
+  while (sz > 0) {
+    if (!Fill())
+      return false;
+
+    uint32_t chunk = std::min(sz, PacketRemaining());
+    memcpy(ptr, _payload.data() + _packet_pos, chunk);
+    _packet_pos += chunk;
+    ptr += chunk;
+    sz -= chunk;
+  }
+  return true;
+}
+
+const uint8_t *ContainerSource::Borrow(uint32_t sz, uint8_t *staging) {
+  // An empty stream must not pull in the next packet, the other streams of
+  // the frame still point into this one
+  if (sz == 0) {
+    if (_has_pending_seek) {
+      _has_pending_seek = false;
+      if (!SeekPacket(_pending_seek))
+        return NULL;
+    }
+    return _payload.data() + _packet_pos;
+  }
+
+  if (!Fill())
+    return NULL;
+
+  if (sz <= PacketRemaining()) {
+    const uint8_t *data = _payload.data() + _packet_pos;
+    _packet_pos += sz;
+    return data;
+  }
+
+  // Streams are never split by the writer, but a hand made container may
+  if (!Read(staging, sz))
+    return NULL;
+  memset(staging + sz, 0, kStreamPadding);
+  return staging;
+}
+
+void ContainerSource::Seek(uint64_t offset) {
+  // Lazy, so that the decoder rewinding after the last frame doesn't fail
+  // on a pipe unless it really asks for another frame
+  _pending_seek = offset;
+  _has_pending_seek = true;
+}
+
+uint64_t ContainerSource::Tell() {
+  if (_has_pending_seek)
+    return _pending_seek;
+  return _packet.stream_offset + _packet_pos;
+}
+
+bool ContainerSource::AtEnd() {
+  return !Fill();
+}
+
+uint64_t ContainerSource::Size() {
+  return _header.stream_size != 0 ? _header.stream_size : ~0ULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Writing
+//
+//////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+class PacketWriter {
+ public:
+  explicit PacketWriter(std::ostream &out) : _out(out), _offset(0), _sequence(0) { }
+
+  uint64_t Offset() const { return _offset; }
+
+  void WriteBytes(const void *data, size_t sz) {
+    _out.write(reinterpret_cast<const char *>(data), sz);
+    _offset += sz;
+  }
+
+  void WritePacket(uint8_t type, uint8_t flags, const std::vector<uint32_t> &sections,
+                   const uint8_t *payload, uint32_t payload_size) {
+    uint32_t sections_sz = static_cast<uint32_t>(4 * sections.size());
+    uint8_t bytes[kContainerPacketHeaderSize];
+    uint8_t *ptr = bytes;
+    Put<uint32_t>(ptr, kContainerPacketSync);
+    Put<uint8_t>(ptr, type);
+    Put<uint8_t>(ptr, flags);
+    Put<uint16_t>(ptr, static_cast<uint16_t>(sections.size()));
+    Put<uint32_t>(ptr, payload_size);
+    Put<uint32_t>(ptr, _sequence++);
+    Put<uint32_t>(ptr, Crc(payload, payload_size, Crc(sections.data(), sections_sz)));
+    Put<uint32_t>(ptr, Crc(bytes, ptr - bytes));
+
+    WriteBytes(bytes, kContainerPacketHeaderSize);
+    WriteBytes(sections.data(), sections_sz);
+    WriteBytes(payload, payload_size);
+  }
+
+ private:
+  PacketWriter &operator=(const PacketWriter &);
+
+  std::ostream &_out;
+  uint64_t _offset;
+  uint32_t _sequence;
+};
+
+}  // namespace
+
+// Splits a frame record into the sizes of its streams, false if they don't
+// add up to the record
+static bool FrameSections(const std::vector<uint8_t> &record, bool is_tiled, uint32_t num_tiles,
+                          std::vector<uint32_t> *sections) {
+  sections->clear();
+  const uint8_t *ptr = record.data() + 4;
+  const uint8_t *end = record.data() + record.size();
+  if (!is_tiled) {
+    for (int stream = 0; stream < kNumMPTCStreams; stream++) {
+      if (end - ptr < 4)
+        return false;
+      uint32_t sz = Get<uint32_t>(ptr);
+      if (static_cast<uint64_t>(end - ptr) < sz)
+        return false;
+      sections->push_back(sz);
+      ptr += sz;
+    }
+    return ptr == end;
+  }
+
+  uint64_t payload_sz = 0;
+  for (uint32_t tile = 0; tile < num_tiles; tile++) {
+    if (end - ptr < 4 * (kNumMPTCStreams + 1))
+      return false;
+    Get<uint32_t>(ptr);
+    for (int stream = 0; stream < kNumMPTCStreams; stream++) {
+      sections->push_back(Get<uint32_t>(ptr));
+      payload_sz += sections->back();
+    }
+  }
+  return payload_sz == static_cast<uint64_t>(end - ptr);
+}
+
+bool WriteContainer(ByteSource &source, std::ostream &out, ContainerHeader *header) {
+  source.Seek(0);
+  if (source.Size() < kMPTCLegacyHeaderSize) {
+    std::cerr << "Error MPTC file is too short!" << std::endl;
+    return false;
+  }
+
+  MPTCDecodeInfo decode_info;
+  InitDecodeInfo(&decode_info);
+  OpenDecodeInfo(source, &decode_info);
+  uint32_t header_size = decode_info.header_size;
+  uint32_t num_frames = decode_info.total_frame_count;
+  uint32_t num_tiles = decode_info.num_tiles;
+  uint32_t unique_interval = decode_info.unique_interval;
+  bool is_tiled = (decode_info.flags & kMPTCFlag_Tiled) != 0;
+  bool is_rans = (decode_info.flags & kMPTCFlag_Rans) != 0;
+  FreeDecodeInfo(&decode_info);
+
+  std::vector<FrameIndexEntry> index;
+  BuildFrameIndex(source, &index);
+  if (index.size() != num_frames || num_frames == 0) {
+    std::cerr << "Error MPTC file holds " << index.size() << " of its " << num_frames << " frames!" << std::endl;
+    return false;
+  }
+
+  ContainerHeader container;
+  container.version = kContainerVersion;
+  container.flags = (is_tiled ? kContainerFlag_Tiled : 0) | (is_rans ? kContainerFlag_Rans : 0);
+  container.num_frames = num_frames;
+  container.stream_size = index.back().frame_offset + index.back().frame_size;
+  container.toc_offset = 0;
+
+  // Every packet is known up front, so the header can carry the largest
+  uint64_t max_packet_size = header_size;
+  uint32_t num_data_packets = 1;
+  for (uint32_t frame = 0; frame < num_frames; frame++) {
+    const FrameIndexEntry &entry = index[frame];
+    uint32_t num_sections = kNumMPTCStreams * (is_tiled ? num_tiles : 1);
+    max_packet_size = std::max<uint64_t>(max_packet_size, entry.frame_size + 4 * num_sections);
+    if (frame % unique_interval == 0) {
+      max_packet_size = std::max<uint64_t>(max_packet_size, entry.frame_offset - entry.palette_offset);
+      num_data_packets++;
+    }
+    num_data_packets++;
+  }
+  max_packet_size = std::max<uint64_t>(max_packet_size, static_cast<uint64_t>(num_data_packets) * kContainerTocEntrySize);
+  if (max_packet_size > 0x7FFFFFFF) {
+    std::cerr << "Error MPTC frame too large for a container!" << std::endl;
+    return false;
+  }
+  container.max_packet_size = static_cast<uint32_t>(max_packet_size);
+
+  std::streampos start = out.tellp();
+  uint8_t header_bytes[kContainerHeaderSize];
+  EncodeContainerHeader(container, header_bytes);
+
+  PacketWriter writer(out);
+  writer.WriteBytes(header_bytes, kContainerHeaderSize);
+
+  std::vector<uint8_t> toc;
+  toc.reserve(static_cast<size_t>(num_data_packets) * kContainerTocEntrySize);
+  std::vector<uint8_t> bytes;
+  std::vector<uint32_t> sections;
+  uint64_t stream_offset = 0;
+
+  for (uint32_t packet = 0; packet < 2 * num_frames + 1; packet++) {
+    // Header, then for every frame its dictionary, if it starts an
+    // interval, and the frame itself
+    uint8_t type = eContainerPacket_Header, flags = 0;
+    uint32_t frame = packet == 0 ? 0 : (packet - 1) / 2;
+    uint64_t end_offset = header_size;
+    sections.clear();
+    if (packet != 0) {
+      const FrameIndexEntry &entry = index[frame];
+      if ((packet - 1) % 2 == 0) {
+        if (frame % unique_interval != 0)
+          continue;
+        type = eContainerPacket_Dictionary;
+        end_offset = entry.frame_offset;
+        if (entry.palette_offset != stream_offset) {
+          std::cerr << "Error MPTC dictionary of frame " << frame << " is not where it was expected!" << std::endl;
+          return false;
+        }
+      }
+      else {
+        type = eContainerPacket_Frame;
+        flags = (entry.flags & kFrameIndexFlag_Key) ? kContainerPacketFlag_Key : 0;
+        end_offset = entry.frame_offset + entry.frame_size;
+      }
+    }
+
+    if (end_offset < stream_offset) {
+      std::cerr << "Error MPTC frame " << frame << " overlaps the data before it!" << std::endl;
+      return false;
+    }
+    bytes.resize(static_cast<size_t>(end_offset - stream_offset));
+    source.Seek(stream_offset);
+    if (!source.Read(bytes.data(), static_cast<uint32_t>(bytes.size()))) {
+      std::cerr << "Error reading MPTC frame " << frame << "!" << std::endl;
+      return false;
+    }
+    if (type == eContainerPacket_Frame && !FrameSections(bytes, is_tiled, num_tiles, &sections)) {
+      std::cerr << "Error MPTC frame " << frame << " has broken stream sizes!" << std::endl;
+      return false;
+    }
+
+    uint8_t entry_bytes[kContainerTocEntrySize];
+    uint8_t *ptr = entry_bytes;
+    Put<uint64_t>(ptr, writer.Offset());
+    Put<uint64_t>(ptr, stream_offset);
+    Put<uint8_t>(ptr, type);
+    Put<uint8_t>(ptr, flags);
+    Put<uint16_t>(ptr, 0);
+    Put<uint32_t>(ptr, frame);
+    toc.insert(toc.end(), entry_bytes, entry_bytes + kContainerTocEntrySize);
+
+    writer.WritePacket(type, flags, sections, bytes.data(), static_cast<uint32_t>(bytes.size()));
+    stream_offset = end_offset;
+  }
+
+  uint64_t toc_offset = writer.Offset();
+  sections.clear();
+  writer.WritePacket(eContainerPacket_Toc, 0, sections, toc.data(), static_cast<uint32_t>(toc.size()));
+  writer.WritePacket(eContainerPacket_End, 0, sections, NULL, 0);
+  source.Seek(0);
+
+  // Point the header at the table of contents when the output can go back
+  if (start != std::streampos(-1) && out.good()) {
+    std::streampos end = out.tellp();
+    container.flags |= kContainerFlag_Toc;
+    container.toc_offset = toc_offset;
+    EncodeContainerHeader(container, header_bytes);
+    out.seekp(start);
+    out.write(reinterpret_cast<const char *>(header_bytes), kContainerHeaderSize);
+    out.seekp(end);
+  }
+
+  if (header != NULL)
+    *header = container;
+  return out.good();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Scanning
+//
+//////////////////////////////////////////////////////////////////////////////
+
+bool ScanContainer(PacketInput &input, ContainerScan *scan) {
+  scan->packets.clear();
+  scan->broken_offsets.clear();
+  scan->has_end = false;
+
+  uint8_t header_bytes[kContainerHeaderSize];
+  ContainerHeader header;
+  if (!input.Read(header_bytes, kContainerHeaderSize) || !DecodeContainerHeader(header_bytes, &header))
+    return false;
+
+  // A window of one packet header slides over the input until it finds a
+  // packet that checks out
+  std::vector<uint8_t> data(static_cast<size_t>(header.max_packet_size));
+  uint8_t window[kContainerPacketHeaderSize];
+  uint64_t offset = kContainerHeaderSize;
+  uint64_t stream_offset = 0;
+  uint32_t window_sz = 0;
+  bool is_resyncing = false;
+  for (;;) {
+    if (!input.Read(window + window_sz, kContainerPacketHeaderSize - window_sz))
+      break;
+    window_sz = kContainerPacketHeaderSize;
+
+    // A broken packet header gives no length to skip, so every byte is
+    // tried as the start of the next packet
+    ContainerPacket packet;
+    uint16_t num_sections;
+    uint32_t data_crc;
+    if (!DecodePacketHeader(window, header.max_packet_size, &packet, &num_sections, &data_crc)) {
+      if (!is_resyncing)
+        scan->broken_offsets.push_back(offset);
+      is_resyncing = true;
+      memmove(window, window + 1, kContainerPacketHeaderSize - 1);
+      window_sz = kContainerPacketHeaderSize - 1;
+      offset++;
+      continue;
+    }
+
+    // A packet whose data is broken is skipped as a whole
+    uint32_t data_sz = 4 * num_sections + packet.payload_size;
+    if (!input.Read(data.data(), data_sz)) {
+      scan->broken_offsets.push_back(offset);
+      break;
+    }
+    if (Crc(data.data(), data_sz) != data_crc) {
+      scan->broken_offsets.push_back(offset);
+      is_resyncing = false;
+      offset += kContainerPacketHeaderSize + data_sz;
+      window_sz = 0;
+      continue;
+    }
+
+    is_resyncing = false;
+    packet.sections.assign(reinterpret_cast<const uint32_t *>(data.data()),
+                           reinterpret_cast<const uint32_t *>(data.data()) + num_sections);
+    packet.packet_offset = offset;
+    packet.stream_offset = stream_offset;
+    if (IsDataPacket(packet.type))
+      stream_offset += packet.payload_size;
+    scan->packets.push_back(packet);
+
+    offset += kContainerPacketHeaderSize + data_sz;
+    window_sz = 0;
+    if (packet.type == eContainerPacket_End) {
+      scan->has_end = true;
+      break;
+    }
+  }
+  return scan->broken_offsets.empty() && scan->has_end;
+}
+
+}  // namespace MPTC
@@ -0,0 +1,219 @@
+#ifndef __MPTC_CONTAINER_H__
+#define __MPTC_CONTAINER_H__
+
+#include "mptc_reader.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// MPTC stream container
+//
+// Wraps an MPTC file, see decoder.h, in self delimiting packets so that it
+// can be streamed from a pipe or socket and every byte is checked before
+// the decoder sees it. All values are little endian. The container starts
+// with
+//
+//   uint32 kContainerMagic
+//   uint8  version (kContainerVersion)
+//   uint8  flags (kContainerFlag_*)
+//   uint16 reserved
+//   uint32 max_packet_size  largest section table plus payload
+//   uint32 num_frames
+//   uint64 stream_size      of the wrapped MPTC file, 0 if not known
+//   uint64 toc_offset       of the table of contents packet, 0 if none
+//   uint32 crc              of the 32 bytes above
+//
+// followed by packets
+//
+//   uint32 kContainerPacketSync
+//   uint8  type (eContainerPacket_*)
+//   uint8  flags (kContainerPacketFlag_*)
+//   uint16 num_sections
+//   uint32 payload_size
+//   uint32 sequence         counts the packets from 0
+//   uint32 data_crc         of the section sizes and the payload
+//   uint32 header_crc       of the 20 bytes above
+//   uint32 section_size[num_sections]
+//   uint8  payload[payload_size]
+//
+// The payloads of the header, dictionary and frame packets, in order, are
+// the MPTC file. Every dictionary and every frame gets its own packet, so
+// a reader fetches a whole frame with one read. The sections of a frame
+// packet are the sizes of its compressed streams, tile by tile, the same
+// as in the frame record.
+//
+// A table of contents packet lists every data packet
+//
+//   num_packets x { uint64 packet_offset, uint64 stream_offset,
+//                   uint8 type, uint8 flags, uint16 reserved,
+//                   uint32 frame }
+//
+// and an end packet without payload closes the container. The table of
+// contents is written after the last frame; toc_offset only points at it
+// when the container was written to a file that could be rewound.
+//
+// Every checksum is the standard CRC-32 of OVR_CRC32.h.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+namespace MPTC {
+
+const uint32_t kContainerMagic = 0x5354504D; // "MPTS"
+const uint8_t kContainerVersion = 1;
+const uint32_t kContainerHeaderSize = 36;
+const uint32_t kContainerPacketSync = 0x4B545043; // "CPTK"
+const uint32_t kContainerPacketHeaderSize = 24;
+const uint32_t kContainerTocEntrySize = 24;
+
+// Flags of the container, the flags of the wrapped file are repeated so
+// that a reader can turn down a stream before fetching any of it
+const uint8_t kContainerFlag_Toc = 0x01;
+const uint8_t kContainerFlag_Tiled = 0x02;
+const uint8_t kContainerFlag_Rans = 0x04;
+
+enum ContainerPacketType {
+  eContainerPacket_Header = 1,
+  eContainerPacket_Dictionary = 2,
+  eContainerPacket_Frame = 3,
+  eContainerPacket_Toc = 4,
+  eContainerPacket_End = 5
+};
+
+// The frame decodes without the previous one
+const uint8_t kContainerPacketFlag_Key = 0x01;
+
+struct ContainerHeader {
+  uint8_t version;
+  uint8_t flags;
+  uint32_t max_packet_size;
+  uint32_t num_frames;
+  uint64_t stream_size;
+  uint64_t toc_offset;
+};
+
+struct ContainerPacket {
+  uint8_t type;
+  uint8_t flags;
+  uint32_t sequence;
+  uint32_t payload_size;
+  uint64_t packet_offset;  // in the container
+  uint64_t stream_offset;  // of the payload in the wrapped file
+  std::vector<uint32_t> sections;
+};
+
+struct ContainerTocEntry {
+  uint64_t packet_offset;
+  uint64_t stream_offset;
+  uint8_t type;
+  uint8_t flags;
+  uint32_t frame;          // for frame packets
+};
+
+// Sequential input a container is read from
+class PacketInput {
+ public:
+  virtual ~PacketInput() { }
+
+  // Reads exactly sz bytes, false if the input ends first
+  virtual bool Read(void *dst, size_t sz) = 0;
+
+  // False for inputs that cannot seek, such as pipes and sockets
+  virtual bool Seek(uint64_t offset) = 0;
+};
+
+// Reads a file descriptor: a file, a pipe or, outside of Windows, a socket.
+// Short reads are retried, the descriptor is not closed.
+class DescriptorInput : public PacketInput {
+ public:
+  explicit DescriptorInput(int fd) : _fd(fd) { }
+
+  bool Read(void *dst, size_t sz);
+  bool Seek(uint64_t offset);
+
+ private:
+  int _fd;
+};
+
+// Presents the MPTC file inside a container to the decoder. Packets are
+// checked against their CRCs as they arrive, and only one packet is held
+// at a time, so memory stays at max_packet_size however long the stream
+// is. Borrowed bytes are only valid until the next packet is loaded, which
+// the decoder never asks for before it is done with a frame.
+//
+// Seeking forward reads and drops packets, which works on any input.
+// Seeking back needs an input that can seek, and a table of contents or a
+// packet that was seen before.
+class ContainerSource : public ByteSource {
+ public:
+  ContainerSource();
+
+  // Reads and checks the container header and, if the input can seek and
+  // the container has one, the table of contents
+  bool Open(PacketInput &input);
+
+  const ContainerHeader &Header() const { return _header; }
+
+  // The packet the stream position is in
+  const ContainerPacket &Packet() const { return _packet; }
+
+  // Bytes of the current packet's payload not read yet
+  uint32_t PacketRemaining() const { return _packet.payload_size - _packet_pos; }
+
+  // A packet was lost, cut short or failed its CRC, nothing more is read
+  bool IsBroken() const { return _is_broken; }
+
+  // Packets loaded and container bytes read so far
+  uint64_t PacketsRead() const { return _packets_read; }
+  uint64_t BytesRead() const { return _bytes_read; }
+
+  // ByteSource
+  bool Read(void *dst, uint32_t sz);
+  const uint8_t *Borrow(uint32_t sz, uint8_t *staging);
+  void Seek(uint64_t offset);
+  uint64_t Tell();
+  bool AtEnd();
+  uint64_t Size();
+
+ private:
+  ContainerSource(const ContainerSource &);
+  ContainerSource &operator=(const ContainerSource &);
+
+  bool ReadPacket(uint64_t packet_offset, uint64_t stream_offset);
+  bool NextPacket();
+  bool SeekPacket(uint64_t offset);
+  bool Fill();
+
+  PacketInput *_input;
+  ContainerHeader _header;
+  ContainerPacket _packet;
+  std::vector<uint8_t> _payload;  // max_packet_size + kStreamPadding
+  uint32_t _packet_pos;
+  uint64_t _input_offset;         // of the packet after the current one
+  uint64_t _pending_seek;         // applied with the next read
+  bool _has_pending_seek;
+  bool _at_end, _is_broken;
+  std::vector<ContainerTocEntry> _locations; // data packets known so far
+  uint64_t _packets_read, _bytes_read;
+};
+
+// Wraps the MPTC file in source into a container written to out. When out
+// can be rewound the header gets the offset of the table of contents. The
+// source is left at its start. Returns false if the file is corrupt.
+bool WriteContainer(ByteSource &source, std::ostream &out, ContainerHeader *header = NULL);
+
+// Walks every packet of a container, resynchronising on the next packet
+// sync after a broken one, and lists the packets and the broken ones
+struct ContainerScan {
+  std::vector<ContainerPacket> packets;
+  std::vector<uint64_t> broken_offsets;
+  bool has_end;
+};
+bool ScanContainer(PacketInput &input, ContainerScan *scan);
+
+}  // namespace MPTC
+
+#endif  // __MPTC_CONTAINER_H__
@@ -0,0 +1,509 @@
+// Unpacks the first level of DXT1 CRN files in bands of chunk rows on the
+// thread pool, see crnd_unpack_level_rows in crn_decomp.h.
+//
+// Usage: crn_bench [--rows N] [--threads N] [--iterations N] [--index]
+//                  [--synthetic WxH] [file.crn ...]
+//
+// Every file is unpacked with crnd_unpack_level on one thread, then the
+// restart points are built every --rows chunk rows (8) and the bands
+// between them are unpacked on pools of 1, 2, 4, ... up to --threads
+// threads (all cores). The bands have to write the same bytes as the
+// serial unpack. Prints the best of --iterations (5) runs of each.
+//
+// Without files it runs on a synthetic CRN of WxH texels (3584x1792, the
+// size of our frames), written with random palettes and a random index
+// stream that has the statistics of a real one, so no encoder is needed.
+//
+// --index writes the restart points of every file to "<file>.rst", which
+// Model::LoadCompressedTextureCRN picks up to unpack the frame in bands:
+//   u32 magic "CRNR", u32 version, u32 size of the CRN file,
+//   u32 rows_per_point, u32 num_points, num_points x crn_restart_point
+
+#include "thread_pool.h"
+
+#include "crn_decomp.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static const uint32_t kRestartIndexMagic = 0x524E5243;
+static const uint32_t kRestartIndexVersion = 1;
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Synthetic CRN files
+//
+//////////////////////////////////////////////////////////////////////////////
+
+// MSB first, as crnd::symbol_codec reads them
+class BitWriter {
+ public:
+  BitWriter() : _bits(0), _num_bits(0) { }
+
+  void PutBits(uint32_t value, uint32_t num_bits) {
+    _bits = (_bits << num_bits) | value;
+    _num_bits += num_bits;
+    while (_num_bits >= 8) {
+      _num_bits -= 8;
+      _bytes.push_back(static_cast<uint8_t>(_bits >> _num_bits));
+    }
+  }
+
+  const std::vector<uint8_t> &Finish() {
+    if (_num_bits > 0)
+      PutBits(0, 8 - _num_bits);
+    return _bytes;
+  }
+
+ private:
+  uint64_t _bits;
+  uint32_t _num_bits;
+  std::vector<uint8_t> _bytes;
+};
+
+// A static Huffman code over the symbols of a stream
+class HuffmanModel {
+ public:
+  explicit HuffmanModel(uint32_t num_symbols) : _freq(num_symbols, 0) { }
+
+  void Count(uint32_t symbol) { _freq[symbol]++; }
+
+  // Code sizes limited to 16 bits, which is the most the decoder takes, by
+  // flattening the statistics until they fit
+  void Build() {
+    std::vector<uint64_t> freq = _freq;
+    for (;;) {
+      ComputeSizes(freq);
+      if (*std::max_element(_sizes.begin(), _sizes.end()) <= 16)
+        break;
+      for (uint64_t &f : freq)
+        f = f == 0 ? 0 : (f + 1) / 2;
+    }
+    _codes = CanonicalCodes(_sizes);
+  }
+
+  // Sizes as decode_receive_static_data_model reads them: all code sizes
+  // are sent as code length symbols 0-16, without the run codes, with a
+  // fixed code of 15 four and 2 five bit codes
+  void Send(BitWriter &writer) const {
+    const uint32_t kNumCodelengthCodes = 21;
+    std::vector<uint8_t> codelength_sizes(kNumCodelengthCodes, 0);
+    for (uint32_t symbol = 0; symbol <= 16; symbol++)
+      codelength_sizes[symbol] = symbol < 15 ? 4 : 5;
+    std::vector<uint16_t> codelength_codes = CanonicalCodes(codelength_sizes);
+
+    writer.PutBits(static_cast<uint32_t>(_sizes.size()),
+                   crnd::math::total_bits(crnd::prefix_coding::cMaxSupportedSyms));
+    writer.PutBits(kNumCodelengthCodes, 5);
+    for (uint32_t i = 0; i < kNumCodelengthCodes; i++)
+      writer.PutBits(codelength_sizes[crnd::g_most_probable_codelength_codes[i]], 3);
+    for (uint8_t size : _sizes)
+      writer.PutBits(codelength_codes[size], codelength_sizes[size]);
+  }
+
+  void Put(BitWriter &writer, uint32_t symbol) const {
+    writer.PutBits(_codes[symbol], _sizes[symbol]);
+  }
+
+ private:
+  void ComputeSizes(const std::vector<uint64_t> &freq) {
+    const size_t num_symbols = freq.size();
+    _sizes.assign(num_symbols, 0);
+
+    typedef std::pair<uint64_t, size_t> Node;
+    std::priority_queue<Node, std::vector<Node>, std::greater<Node> > queue;
+    std::vector<size_t> parent;
+    for (size_t symbol = 0; symbol < num_symbols; symbol++) {
+      parent.push_back(0);
+      if (freq[symbol] > 0)
+        queue.push(Node(freq[symbol], symbol));
+    }
+    if (queue.size() == 1) {
+      _sizes[queue.top().second] = 1;
+      return;
+    }
+
+    while (queue.size() > 1) {
+      Node a = queue.top(); queue.pop();
+      Node b = queue.top(); queue.pop();
+      parent[a.second] = parent[b.second] = parent.size();
+      queue.push(Node(a.first + b.first, parent.size()));
+      parent.push_back(0);
+    }
+
+    // Parents come after their children
+    std::vector<uint32_t> depth(parent.size(), 0);
+    for (size_t node = parent.size() - 1; node-- > 0; )
+      depth[node] = depth[parent[node]] + 1;
+    for (size_t symbol = 0; symbol < num_symbols; symbol++)
+      _sizes[symbol] = freq[symbol] > 0 ? static_cast<uint8_t>(std::min<uint32_t>(depth[symbol], 255)) : 0;
+  }
+
+  // Codes in the order of prefix_coding::decoder_tables, by size, then by
+  // symbol
+  static std::vector<uint16_t> CanonicalCodes(const std::vector<uint8_t> &sizes) {
+    std::vector<uint16_t> codes(sizes.size(), 0);
+    uint32_t code = 0;
+    for (uint32_t size = 1; size <= 16; size++) {
+      for (size_t symbol = 0; symbol < sizes.size(); symbol++) {
+        if (sizes[symbol] == size)
+          codes[symbol] = static_cast<uint16_t>(code++);
+      }
+      code <<= 1;
+    }
+    return codes;
+  }
+
+  std::vector<uint64_t> _freq;
+  std::vector<uint8_t> _sizes;
+  std::vector<uint16_t> _codes;
+};
+
+// Mostly small steps in either direction, modulo range
+static uint32_t SkewedDelta(std::mt19937 &rng, uint32_t range) {
+  std::geometric_distribution<uint32_t> step(0.35);
+  uint32_t delta = std::min(step(rng), range / 2);
+  return (rng() & 1) ? delta : (range - delta) % range;
+}
+
+struct SymbolStream {
+  std::vector<uint8_t> model;
+  std::vector<uint32_t> symbol;
+
+  void Add(HuffmanModel &huffman, uint8_t model_idx, uint32_t sym) {
+    huffman.Count(sym);
+    model.push_back(model_idx);
+    symbol.push_back(sym);
+  }
+
+  std::vector<uint8_t> Write(const std::vector<HuffmanModel*> &models, bool send_models) const {
+    BitWriter writer;
+    if (send_models) {
+      for (HuffmanModel *huffman : models)
+        huffman->Send(writer);
+    }
+    for (size_t idx = 0; idx < symbol.size(); idx++)
+      models[model[idx]]->Put(writer, symbol[idx]);
+    return writer.Finish();
+  }
+};
+
+static std::vector<uint8_t> SyntheticCRN(uint32_t width, uint32_t height) {
+  const uint32_t kNumEndpoints = 4096, kNumSelectors = 8192;
+  std::mt19937 rng(0x43524E);
+
+  // Color endpoints: the six 5:6:5 deltas of every entry
+  HuffmanModel endpoint_dm0(32), endpoint_dm1(64);
+  SymbolStream endpoints;
+  for (uint32_t entry = 0; entry < kNumEndpoints; entry++) {
+    for (uint32_t component = 0; component < 6; component++) {
+      if (component % 3 == 1)
+        endpoints.Add(endpoint_dm1, 1, SkewedDelta(rng, 64));
+      else
+        endpoints.Add(endpoint_dm0, 0, SkewedDelta(rng, 32));
+    }
+  }
+
+  // Color selectors: 8 symbols of two 2 bit deltas each, 7x7 of them
+  HuffmanModel selector_dm(49);
+  SymbolStream selectors;
+  for (uint32_t entry = 0; entry < kNumSelectors * 8; entry++)
+    selectors.Add(selector_dm, 0, SkewedDelta(rng, 7) + 7 * SkewedDelta(rng, 7));
+
+  // The index stream, in the order unpack_dxt1 decodes it: every third
+  // chunk an encoding of the next three, then the endpoint index deltas of
+  // its tiles and 4 selector index deltas
+  const uint32_t blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+  const uint32_t num_chunks = ((blocks_x + 1) / 2) * ((blocks_y + 1) / 2);
+  const uint8_t kEncodingWeights[8] = { 6, 2, 2, 1, 1, 1, 1, 4 };
+  std::discrete_distribution<uint32_t> encoding_dist(kEncodingWeights, kEncodingWeights + 8);
+
+  HuffmanModel chunk_encoding_dm(512), endpoint_delta_dm(kNumEndpoints), selector_delta_dm(kNumSelectors);
+  SymbolStream level;
+  uint32_t encodings[3] = { 0, 0, 0 };
+  for (uint32_t chunk = 0; chunk < num_chunks; chunk++) {
+    if (chunk % 3 == 0) {
+      for (uint32_t &encoding : encodings)
+        encoding = encoding_dist(rng);
+      level.Add(chunk_encoding_dm, 0, encodings[0] | (encodings[1] << 3) | (encodings[2] << 6));
+    }
+    uint32_t num_tiles = crnd::g_crnd_chunk_encoding_num_tiles[encodings[chunk % 3]];
+    for (uint32_t tile = 0; tile < num_tiles; tile++)
+      level.Add(endpoint_delta_dm, 1, SkewedDelta(rng, kNumEndpoints));
+    for (uint32_t block = 0; block < 4; block++)
+      level.Add(selector_delta_dm, 2, SkewedDelta(rng, kNumSelectors));
+  }
+
+  std::vector<HuffmanModel*> endpoint_models = { &endpoint_dm0, &endpoint_dm1 };
+  std::vector<HuffmanModel*> selector_models = { &selector_dm };
+  std::vector<HuffmanModel*> level_models = { &chunk_encoding_dm, &endpoint_delta_dm, &selector_delta_dm };
+  for (HuffmanModel *huffman : { &endpoint_dm0, &endpoint_dm1, &selector_dm,
+                                 &chunk_encoding_dm, &endpoint_delta_dm, &selector_delta_dm })
+    huffman->Build();
+
+  BitWriter tables_writer;
+  for (HuffmanModel *huffman : level_models)
+    huffman->Send(tables_writer);
+  std::vector<uint8_t> tables = tables_writer.Finish();
+  std::vector<uint8_t> endpoint_data = endpoints.Write(endpoint_models, true);
+  std::vector<uint8_t> selector_data = selectors.Write(selector_models, true);
+  std::vector<uint8_t> level_data = level.Write(level_models, false);
+
+  const uint32_t tables_ofs = sizeof(crnd::crn_header);
+  const uint32_t endpoints_ofs = tables_ofs + static_cast<uint32_t>(tables.size());
+  const uint32_t selectors_ofs = endpoints_ofs + static_cast<uint32_t>(endpoint_data.size());
+  const uint32_t level_ofs = selectors_ofs + static_cast<uint32_t>(selector_data.size());
+  const uint32_t data_size = level_ofs + static_cast<uint32_t>(level_data.size());
+
+  // The fields that aren't set stay 0
+  std::vector<uint8_t> file(tables_ofs, 0);
+  crnd::crn_header *header = reinterpret_cast<crnd::crn_header*>(file.data());
+  header->m_sig = crnd::crn_header::cCRNSigValue;
+  header->m_header_size = tables_ofs;
+  header->m_data_size = data_size;
+  header->m_width = width;
+  header->m_height = height;
+  header->m_levels = 1;
+  header->m_faces = 1;
+  header->m_format = cCRNFmtDXT1;
+  header->m_color_endpoints.m_ofs = endpoints_ofs;
+  header->m_color_endpoints.m_size = static_cast<uint32_t>(endpoint_data.size());
+  header->m_color_endpoints.m_num = kNumEndpoints;
+  header->m_color_selectors.m_ofs = selectors_ofs;
+  header->m_color_selectors.m_size = static_cast<uint32_t>(selector_data.size());
+  header->m_color_selectors.m_num = kNumSelectors;
+  header->m_tables_ofs = tables_ofs;
+  header->m_tables_size = static_cast<uint32_t>(tables.size());
+  header->m_level_ofs[0] = level_ofs;
+
+  file.insert(file.end(), tables.begin(), tables.end());
+  file.insert(file.end(), endpoint_data.begin(), endpoint_data.end());
+  file.insert(file.end(), selector_data.begin(), selector_data.end());
+  file.insert(file.end(), level_data.begin(), level_data.end());
+
+  // The checksums as crnd_create_segmented_file computes them
+  header = reinterpret_cast<crnd::crn_header*>(file.data());
+  header->m_data_crc16 = crnd::crc16(file.data() + tables_ofs, data_size - tables_ofs);
+  const uint32_t crc_ofs = static_cast<uint32_t>(reinterpret_cast<const uint8_t*>(&header->m_data_size) - file.data());
+  header->m_header_crc16 = crnd::crc16(file.data() + crc_ofs, tables_ofs - crc_ofs);
+  return file;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Benchmark
+//
+//////////////////////////////////////////////////////////////////////////////
+
+static bool SaveRestartIndex(const std::string &path, uint32_t file_size, uint32_t rows_per_point,
+                             const std::vector<crnd::crn_restart_point> &points) {
+  std::ofstream out_stream((path + ".rst").c_str(), std::ios::binary);
+  if (!out_stream.is_open())
+    return false;
+
+  uint32_t num_points = static_cast<uint32_t>(points.size());
+  out_stream.write(reinterpret_cast<const char*>(&kRestartIndexMagic), 4);
+  out_stream.write(reinterpret_cast<const char*>(&kRestartIndexVersion), 4);
+  out_stream.write(reinterpret_cast<const char*>(&file_size), 4);
+  out_stream.write(reinterpret_cast<const char*>(&rows_per_point), 4);
+  out_stream.write(reinterpret_cast<const char*>(&num_points), 4);
+  out_stream.write(reinterpret_cast<const char*>(points.data()), num_points * sizeof(crnd::crn_restart_point));
+  return out_stream.good();
+}
+
+struct Options {
+  uint32_t rows_per_point;
+  uint32_t max_threads;
+  uint32_t num_iterations;
+  bool write_index;
+};
+
+static double ElapsedMs(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static bool RunFile(const std::string &name, const std::vector<uint8_t> &file, const Options &options) {
+  const uint32_t file_size = static_cast<uint32_t>(file.size());
+  crnd::crn_level_info level_info;
+  if (!crnd::crnd_get_level_info(file.data(), file_size, 0, &level_info)) {
+    std::cerr << "Error " << name << " is not a CRN file" << std::endl;
+    return false;
+  }
+  if (level_info.m_format != cCRNFmtDXT1) {
+    std::cerr << "Skipping " << name << ", only DXT1 levels unpack in bands" << std::endl;
+    return true;
+  }
+
+  crnd::crnd_unpack_context context = crnd::crnd_unpack_begin(file.data(), file_size);
+  if (context == NULL) {
+    std::cerr << "Error unpacking the tables of " << name << std::endl;
+    return false;
+  }
+
+  const uint32_t row_pitch = level_info.m_blocks_x * 8;
+  const uint32_t face_size = row_pitch * level_info.m_blocks_y;
+  const uint32_t num_chunk_rows = level_info.m_faces * ((level_info.m_blocks_y + 1) / 2);
+  std::vector<std::vector<uint8_t> > serial(level_info.m_faces, std::vector<uint8_t>(face_size));
+  std::vector<std::vector<uint8_t> > bands(level_info.m_faces, std::vector<uint8_t>(face_size));
+  std::vector<void*> serial_faces, band_faces;
+  for (uint32_t face = 0; face < level_info.m_faces; face++) {
+    serial_faces.push_back(serial[face].data());
+    band_faces.push_back(bands[face].data());
+  }
+
+  double serial_ms = 0.0;
+  for (uint32_t iter = 0; iter < options.num_iterations; iter++) {
+    Clock::time_point start = Clock::now();
+    if (!crnd::crnd_unpack_level(context, serial_faces.data(), face_size, row_pitch, 0)) {
+      std::cerr << "Error unpacking " << name << std::endl;
+      crnd::crnd_unpack_end(context);
+      return false;
+    }
+    double ms = ElapsedMs(start);
+    serial_ms = iter == 0 ? ms : std::min(serial_ms, ms);
+  }
+
+  std::vector<crnd::crn_restart_point> points((num_chunk_rows + options.rows_per_point - 1) / options.rows_per_point);
+  double scan_ms = 0.0;
+  for (uint32_t iter = 0; iter < options.num_iterations; iter++) {
+    Clock::time_point start = Clock::now();
+    uint32_t num_points = crnd::crnd_get_restart_points(context, 0, options.rows_per_point, points.data(),
+                                                        static_cast<uint32_t>(points.size()));
+    double ms = ElapsedMs(start);
+    scan_ms = iter == 0 ? ms : std::min(scan_ms, ms);
+    if (num_points != points.size()) {
+      std::cerr << "Error building the restart points of " << name << std::endl;
+      crnd::crnd_unpack_end(context);
+      return false;
+    }
+  }
+
+  printf("%s: %ux%u, %u face(s), %u bytes, %u chunk rows, %zu restart points every %u rows\n", name.c_str(),
+         level_info.m_width, level_info.m_height, level_info.m_faces, file_size, num_chunk_rows, points.size(),
+         options.rows_per_point);
+  printf("  serial:     %8.3f ms\n", serial_ms);
+  printf("  scan:       %8.3f ms (%.0f%% of serial)\n", scan_ms, 100.0 * scan_ms / serial_ms);
+
+  // One task per band, the pool balances the bands over the threads
+  bool identical = true;
+  bool band_failed = false;
+  MPTC::TaskGraph graph;
+  for (size_t point = 0; point < points.size(); point++) {
+    uint32_t end_row = point + 1 < points.size() ? points[point + 1].m_chunk_row : num_chunk_rows;
+    const crnd::crn_restart_point *start_point = &points[point];
+    graph.AddTask([&, start_point, end_row] {
+      if (!crnd::crnd_unpack_level_rows(context, band_faces.data(), face_size, row_pitch, 0, *start_point, end_row))
+        band_failed = true;
+    });
+  }
+
+  for (uint32_t num_threads = 1; ; num_threads = std::min(2 * num_threads, options.max_threads)) {
+    MPTC::ThreadPool pool(num_threads);
+    double bands_ms = 0.0;
+    for (uint32_t iter = 0; iter < options.num_iterations; iter++) {
+      for (std::vector<uint8_t> &face : bands)
+        memset(face.data(), 0xCD, face.size());
+      Clock::time_point start = Clock::now();
+      graph.Run(pool);
+      double ms = ElapsedMs(start);
+      bands_ms = iter == 0 ? ms : std::min(bands_ms, ms);
+      identical = identical && !band_failed && bands == serial;
+    }
+    printf("  %2u threads: %8.3f ms  %5.2fx serial  %s\n", num_threads, bands_ms, serial_ms / bands_ms,
+           identical ? "identical" : "DIFFERENT");
+    if (num_threads == options.max_threads)
+      break;
+  }
+  crnd::crnd_unpack_end(context);
+
+  if (!identical) {
+    std::cerr << "Error the bands of " << name << " don't match the serial unpack" << std::endl;
+    return false;
+  }
+  if (options.write_index && !SaveRestartIndex(name, file_size, options.rows_per_point, points)) {
+    std::cerr << "Error writing " << name << ".rst" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static void Usage(const char *program) {
+  std::cerr << "Usage: " << program << " [--rows N] [--threads N] [--iterations N] [--index]"
+            << " [--synthetic WxH] [file.crn ...]" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  options.rows_per_point = 8;
+  options.max_threads = std::max(1U, std::thread::hardware_concurrency());
+  options.num_iterations = 5;
+  options.write_index = false;
+  uint32_t synthetic_width = 3584, synthetic_height = 1792;
+
+  std::vector<std::string> paths;
+  for (int arg = 1; arg < argc; arg++) {
+    std::string option(argv[arg]);
+    bool has_value = arg + 1 < argc;
+    if (option == "--rows" && has_value) {
+      options.rows_per_point = std::max(1, atoi(argv[++arg]));
+    }
+    else if (option == "--threads" && has_value) {
+      options.max_threads = std::max(1, atoi(argv[++arg]));
+    }
+    else if (option == "--iterations" && has_value) {
+      options.num_iterations = std::max(1, atoi(argv[++arg]));
+    }
+    else if (option == "--index") {
+      options.write_index = true;
+    }
+    else if (option == "--synthetic" && has_value) {
+      if (sscanf(argv[++arg], "%ux%u", &synthetic_width, &synthetic_height) != 2 ||
+          synthetic_width == 0 || synthetic_height == 0 || synthetic_width > 65535 || synthetic_height > 65535) {
+        Usage(argv[0]);
+        return 1;
+      }
+    }
+    else if (option.compare(0, 2, "--") == 0) {
+      Usage(argv[0]);
+      return 1;
+    }
+    else {
+      paths.push_back(option);
+    }
+  }
+
+  if (paths.empty()) {
+    std::vector<uint8_t> file = SyntheticCRN(synthetic_width, synthetic_height);
+    if (!crnd::crnd_validate_file(file.data(), static_cast<uint32_t>(file.size()), NULL)) {
+      std::cerr << "Error the synthetic CRN file is broken" << std::endl;
+      return 1;
+    }
+    options.write_index = false;
+    return RunFile("synthetic", file, options) ? 0 : 1;
+  }
+
+  for (const std::string &path : paths) {
+    std::ifstream in_stream(path.c_str(), std::ios::binary);
+    std::vector<uint8_t> file((std::istreambuf_iterator<char>(in_stream)), std::istreambuf_iterator<char>());
+    if (!in_stream.is_open() || file.empty()) {
+      std::cerr << "Error reading " << path << std::endl;
+      return 1;
+    }
+    if (!RunFile(path, file, options))
+      return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,239 @@
+#include "decode_service.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+
+namespace MPTC {
+
+struct DecodeService::Stream {
+  StreamId id;
+  int priority;
+  ServiceClock::time_point deadline;
+  ServiceClock::time_point queued;  // of the frame job in flight
+  BufferStruct *ring;
+  std::unique_ptr<FrameDestination> owned_destination;
+  uint64_t frame_pixels;
+  bool is_decoding, is_removed;
+
+  // Written by the frame jobs and the consumer, read by the stats
+  std::atomic<uint64_t> deadline_misses;
+  std::atomic<uint64_t> decode_ns;
+};
+
+DecodeService::DecodeService(uint32_t num_threads)
+  : _pool(num_threads), _next_id(0), _num_in_flight(0), _is_stopping(false), _start(ServiceClock::now()),
+    _frames_decoded(0), _frames_consumed(0), _deadline_misses(0), _pixels_decoded(0) { }
+
+DecodeService::~DecodeService() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _is_stopping = true;
+  _cv.wait(lock, [this] { return _num_in_flight == 0; });
+
+  for (auto &stream : _streams)
+    DestroyBufferedDecode(stream->ring);
+  _streams.clear();
+}
+
+DecodeService::StreamId DecodeService::AddStream(ByteSource &source, uint8_t buffer_sz, int priority) {
+  // The slots are sized from the header
+  Decoder probe;
+  if (!probe.Open(source)) {
+    std::cerr << "Error MPTC stream too short to hold a header!" << std::endl;
+    exit(-1);
+  }
+  size_t frame_size = static_cast<size_t>(probe.NumBlocks()) * sizeof(PhysicalDXTBlock);
+  probe.Close();
+  source.Seek(0);
+
+  return AddStream(source, new MemoryDestination(buffer_sz, frame_size), true, priority);
+}
+
+DecodeService::StreamId DecodeService::AddStream(ByteSource &source, FrameDestination &destination, int priority) {
+  return AddStream(source, &destination, false, priority);
+}
+
+DecodeService::StreamId DecodeService::AddStream(ByteSource &source, FrameDestination *destination,
+                                                 bool owns_destination, int priority) {
+  std::unique_ptr<Stream> stream(new Stream);
+  stream->priority = priority;
+  stream->deadline = ServiceClock::time_point();
+  if (owns_destination)
+    stream->owned_destination.reset(destination);
+  stream->is_decoding = false;
+  stream->is_removed = false;
+  stream->deadline_misses.store(0);
+  stream->decode_ns.store(0);
+
+  // Reads the header, so outside of the lock
+  InitBufferedDecodeOnPool(stream->ring, source, *destination, _pool);
+  const MPTCDecodeInfo *decode_info = stream->ring->ptr_decode_info;
+  stream->frame_pixels = static_cast<uint64_t>(decode_info->frame_height) * decode_info->frame_width;
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  stream->id = _next_id++;
+  StreamId id = stream->id;
+  _streams.push_back(std::move(stream));
+  Dispatch();
+  return id;
+}
+
+void DecodeService::RemoveStream(StreamId id) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  Stream *stream = FindStream(id);
+  stream->is_removed = true;
+  _cv.wait(lock, [stream] { return !stream->is_decoding; });
+
+  for (size_t idx = 0; idx < _streams.size(); idx++) {
+    if (_streams[idx].get() == stream) {
+      DestroyBufferedDecode(stream->ring);
+      _streams.erase(_streams.begin() + idx);
+      break;
+    }
+  }
+}
+
+DecodeService::Stream *DecodeService::FindStream(StreamId id) {
+  for (auto &stream : _streams) {
+    if (stream->id == id)
+      return stream.get();
+  }
+  assert(!"Unknown MPTC stream");
+  return NULL;
+}
+
+void DecodeService::SetPriority(StreamId id, int priority) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  FindStream(id)->priority = priority;
+}
+
+void DecodeService::SetDeadline(StreamId id, ServiceClock::time_point deadline) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  FindStream(id)->deadline = deadline;
+}
+
+void DecodeService::WaitForFrames(StreamId id, uint32_t num_frames) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  Stream *stream = FindStream(id);
+  num_frames = std::min<uint32_t>(num_frames, stream->ring->buffer_sz - 1);
+  _cv.wait(lock, [stream, num_frames] {
+    uint64_t decoded = stream->ring->frames_decoded.load(std::memory_order_acquire);
+    uint64_t consumed = stream->ring->frames_consumed.load(std::memory_order_relaxed);
+    return decoded - consumed >= num_frames;
+  });
+}
+
+int DecodeService::GetFrame(StreamId id, PhysicalDXTBlock * &curr_dxt) {
+  Stream *stream;
+  ServiceClock::time_point deadline;
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    stream = FindStream(id);
+    deadline = stream->deadline;
+  }
+
+  // Only the consumer touches its side of the ring, no lock needed
+  int result = GetBufferedFrame(stream->ring, curr_dxt);
+  bool is_miss = result != kMPTCFrameReady && ServiceClock::now() >= deadline;
+  if (is_miss)
+    stream->deadline_misses.fetch_add(1, std::memory_order_relaxed);
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (result == kMPTCFrameReady) {
+    // The frame that was held before is free for decoding again
+    _frames_consumed++;
+    Dispatch();
+  }
+  if (is_miss)
+    _deadline_misses++;
+  return result;
+}
+
+const uint64_t *DecodeService::GetDirtyMap(StreamId id, uint32_t *num_dirty_blocks) {
+  Stream *stream;
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    stream = FindStream(id);
+  }
+  return GetBufferedDirtyMap(stream->ring, num_dirty_blocks);
+}
+
+// Called with _mutex held. A stream is runnable when it has no frame in
+// flight and the slot of its next frame is free.
+void DecodeService::Dispatch() {
+  while (!_is_stopping && _num_in_flight < _pool.NumThreads()) {
+    Stream *best = NULL;
+    uint64_t best_waiting = 0;
+    for (auto &stream : _streams) {
+      if (stream->is_decoding || stream->is_removed || !CanDecodeBufferedFrame(stream->ring))
+        continue;
+
+      uint64_t waiting = stream->ring->frames_decoded.load(std::memory_order_relaxed) -
+                         stream->ring->frames_consumed.load(std::memory_order_relaxed);
+      bool is_better = best == NULL || stream->priority > best->priority ||
+        (stream->priority == best->priority &&
+         (stream->deadline < best->deadline || (stream->deadline == best->deadline && waiting < best_waiting)));
+      if (is_better) {
+        best = stream.get();
+        best_waiting = waiting;
+      }
+    }
+    if (best == NULL)
+      return;
+
+    best->is_decoding = true;
+    best->queued = ServiceClock::now();
+    _num_in_flight++;
+    _pool.Enqueue([this, best] { DecodeFrame(best); });
+  }
+}
+
+void DecodeService::DecodeFrame(Stream *stream) {
+  // Handing the stream over through _mutex orders this frame job after
+  // the previous one, whichever worker ran it
+  ServiceClock::time_point start = ServiceClock::now();
+  stream->ring->queue_wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start - stream->queued).count();
+  DecodeBufferedFrame(stream->ring);
+  ServiceClock::duration elapsed = ServiceClock::now() - start;
+  stream->decode_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+                              std::memory_order_relaxed);
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  stream->is_decoding = false;
+  _num_in_flight--;
+  _frames_decoded++;
+  _pixels_decoded += stream->frame_pixels;
+  Dispatch();
+  _cv.notify_all();
+}
+
+void DecodeService::GetStreamStats(StreamId id, ServiceStreamStats *stats) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  Stream *stream = FindStream(id);
+
+  MPTCBufferStats ring_stats;
+  GetBufferedDecodeStats(stream->ring, &ring_stats);
+  stats->priority = stream->priority;
+  stats->frames_decoded = ring_stats.frames_decoded;
+  stats->frames_consumed = ring_stats.frames_consumed;
+  stats->underruns = ring_stats.underruns;
+  stats->deadline_misses = stream->deadline_misses.load(std::memory_order_relaxed);
+  stats->decode_ms = stream->decode_ns.load(std::memory_order_relaxed) / 1.0e6;
+  stats->occupancy = ring_stats.occupancy;
+  stats->buffer_sz = ring_stats.buffer_sz;
+}
+
+void DecodeService::GetStats(ServiceStats *stats) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  stats->num_streams = static_cast<uint32_t>(_streams.size());
+  stats->num_threads = _pool.NumThreads();
+  stats->frames_decoded = _frames_decoded;
+  stats->frames_consumed = _frames_consumed;
+  stats->deadline_misses = _deadline_misses;
+  stats->pixels_decoded = _pixels_decoded;
+  stats->steals = _pool.NumSteals();
+  stats->elapsed_ms = std::chrono::duration<double, std::milli>(ServiceClock::now() - _start).count();
+}
+
+}  // namespace MPTC
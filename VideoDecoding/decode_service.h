@@ -0,0 +1,116 @@
+#ifndef __MPTC_DECODE_SERVICE_H__
+#define __MPTC_DECODE_SERVICE_H__
+
+#include "decoder.h"
+#include "frame_destination.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace MPTC {
+
+typedef std::chrono::steady_clock ServiceClock;
+
+// Counters of one stream of a DecodeService
+struct ServiceStreamStats {
+  int priority;
+  uint64_t frames_decoded, frames_consumed;
+  uint64_t underruns;        // GetFrame calls that found no new frame
+  uint64_t deadline_misses;  // the ones of those at or past the deadline
+  double decode_ms;          // wall time of the stream's frame jobs
+  uint8_t occupancy;         // decoded frames waiting to be consumed
+  uint8_t buffer_sz;
+};
+
+// Counters over all streams, including removed ones
+struct ServiceStats {
+  uint32_t num_streams;
+  uint32_t num_threads;
+  uint64_t frames_decoded, frames_consumed;
+  uint64_t deadline_misses;
+  uint64_t pixels_decoded;
+  uint64_t steals;           // tasks the workers took from each other
+  double elapsed_ms;         // since the service was created
+};
+
+// Decodes any number of MPTC streams on one shared ThreadPool, so that
+// playing several videos at once doesn't start a decoder thread and a
+// pool per video. Every stream has its own ring of decoded frames, see
+// BufferStruct, and at most one frame in flight; a frame job decodes the
+// frame with its tiles and streams spread over the pool like
+// GetFrameMultiThread. No more frame jobs than workers are queued at a
+// time, and whenever a worker becomes free it goes to the stream with the
+// highest priority, then the earliest deadline, then the emptiest ring.
+//
+// Adding and removing streams and the stats can be used from any thread.
+// GetFrame and GetDirtyMap of one stream must come from a single consumer
+// thread, as with GetBufferedFrame.
+class DecodeService {
+ public:
+  typedef uint32_t StreamId;
+
+  // num_threads == 0 sizes the pool from the hardware
+  explicit DecodeService(uint32_t num_threads = 0);
+  ~DecodeService();
+
+  // Starts decoding source into a ring of buffer_sz frames, or into the
+  // slots of destination. The source and destination have to outlive the
+  // stream.
+  StreamId AddStream(ByteSource &source, uint8_t buffer_sz, int priority = 0);
+  StreamId AddStream(ByteSource &source, FrameDestination &destination, int priority = 0);
+
+  // Waits for the stream's frame in flight, then frees its ring
+  void RemoveStream(StreamId stream);
+
+  void SetPriority(StreamId stream, int priority);
+
+  // When the stream's consumer will next ask for a frame, usually the
+  // next vsync. The stream starts with a deadline in the past.
+  void SetDeadline(StreamId stream, ServiceClock::time_point deadline);
+
+  // Blocks until num_frames frames of the stream are waiting, at most all
+  // but one slot, e.g. to fill the ring before playback starts
+  void WaitForFrames(StreamId stream, uint32_t num_frames);
+
+  // As GetBufferedFrame and GetBufferedDirtyMap
+  int GetFrame(StreamId stream, PhysicalDXTBlock * &curr_dxt);
+  const uint64_t *GetDirtyMap(StreamId stream, uint32_t *num_dirty_blocks);
+
+  void GetStreamStats(StreamId stream, ServiceStreamStats *stats);
+  void GetStats(ServiceStats *stats);
+
+  ThreadPool &Pool() { return _pool; }
+
+ private:
+  DecodeService(const DecodeService &);
+  DecodeService &operator=(const DecodeService &);
+
+  struct Stream;
+
+  Stream *FindStream(StreamId stream);
+  StreamId AddStream(ByteSource &source, FrameDestination *destination, bool owns_destination, int priority);
+  void Dispatch();
+  void DecodeFrame(Stream *stream);
+
+  ThreadPool _pool;
+  std::mutex _mutex;
+  std::condition_variable _cv;  // a frame job finished
+
+  // Everything below is guarded by _mutex
+  std::vector<std::unique_ptr<Stream> > _streams;
+  StreamId _next_id;
+  uint32_t _num_in_flight;
+  bool _is_stopping;
+
+  ServiceClock::time_point _start;
+  uint64_t _frames_decoded, _frames_consumed, _deadline_misses, _pixels_decoded;
+};
+
+}  // namespace MPTC
+
+#endif  // __MPTC_DECODE_SERVICE_H__
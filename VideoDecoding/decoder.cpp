@@ -1,5 +1,9 @@
 #include "decoder.h"
 #include "wavelet.h"
+#include "thread_pool.h"
+#include "entropy_codec.h"
+#include "frame_destination.h"
+#include "motion_codec.h"
 
 #include <iostream>
 //#include "stb_image_write.h"
@@ -15,241 +19,747 @@
 #include <atomic>
 #include <typeinfo>
 #include <cassert>
-#include <limits>
 #include <thread>
+#include <chrono>
 #include <functional>
 
 
 
-static void ycocg667_to_rgb565(const int8_t *in, int8_t *out) {
-  int8_t y = in[0];
-  int8_t co = in[1];
-  int8_t cg = in[2];
+void EntropyDecode(const MPTC::EntropyCodec *codec,
+                   MPTC::EntropyDecoderState *state,
+                   uint8_t *compressed_data, 
+                   uint8_t *out_symbols, 
+		   uint32_t compressed_size,
+		   uint32_t out_size) {
 
-  assert(0 <= y && y < 64);
-  assert(-31 <= co && co < 32);
-  assert(-63 <= cg && cg < 64);
+  assert(codec != NULL && "No entropy codec, was the header read?");
+  codec->Decode(state, compressed_data, compressed_size, out_symbols, out_size);
+}
+//////////////////////////////////////////////////////////////////////////////
+//
+// Endpoint reconstruction
+//
+// Every 64x64 wavelet block of the Y, Co and Cg planes of an endpoint is
+// inverted on the stack, converted from YCoCg667 to RGB565 and packed
+// into the DXT blocks while it is still in L1, so no frame sized
+// intermediate planes are written or read back.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MPTC_DECODER_SSE2
+#include <emmintrin.h>
+#endif
 
-  int8_t t = y - (cg / 2);
-  out[1] = cg + t;
-  out[2] = (t - co) / 2;
-  out[0] = out[2] + co;
+const uint32_t BlockSize = 64;
 
-  assert(0 <= out[0] && out[0] < 32);
-  assert(0 <= out[1] && out[1] < 64);
-  assert(0 <= out[2] && out[2] < 32);
+// Loads one BlockSize x BlockSize block of wavelet coefficients stored as
+// coefficient + 128
+static void LoadWaveletBlock(const uint8_t *in, uint32_t width, int16_t *block) {
+  for (size_t y = 0; y < BlockSize; ++y) {
+    const uint8_t *in_row = in + width * y;
+    int16_t *block_row = block + y * BlockSize;
+    size_t x = 0;
+#ifdef MPTC_DECODER_SSE2
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= BlockSize; x += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in_row + x));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(block_row + x), _mm_sub_epi16(_mm_unpacklo_epi8(v, zero), bias));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(block_row + x + 8), _mm_sub_epi16(_mm_unpackhi_epi8(v, zero), bias));
+    }
+#endif
+    for (; x < BlockSize; ++x)
+      block_row[x] = static_cast<int16_t>(in_row[x]) - 128;
+  }
 }
 
+// YCoCg667 to RGB565 for one row of samples. The samples are the 8 bit
+// values of the planes, the wavelet output is truncated to them first. Rows
+// are wavelet block rows, len is a multiple of 8.
+//
+//   t = y - cg / 2, g = cg + t, b = (t - co) / 2, r = b + co
+static void PackEndpointRow(const int16_t *y_row, const int16_t *co_row, const int16_t *cg_row,
+                            uint16_t *out, size_t len) {
+  assert(len % 8 == 0);
+#ifdef MPTC_DECODER_SSE2
+  for (size_t x = 0; x < len; x += 8) {
+    // Sign extend the low byte of every sample
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(y_row + x));
+    __m128i co = _mm_loadu_si128(reinterpret_cast<const __m128i *>(co_row + x));
+    __m128i cg = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cg_row + x));
+    y = _mm_srai_epi16(_mm_slli_epi16(y, 8), 8);
+    co = _mm_srai_epi16(_mm_slli_epi16(co, 8), 8);
+    cg = _mm_srai_epi16(_mm_slli_epi16(cg, 8), 8);
+
+    // Halving rounds toward zero: (v - (v >> 15)) >> 1
+    __m128i t = _mm_sub_epi16(y, _mm_srai_epi16(_mm_sub_epi16(cg, _mm_srai_epi16(cg, 15)), 1));
+    __m128i g = _mm_add_epi16(cg, t);
+    __m128i t_co = _mm_sub_epi16(t, co);
+    __m128i b = _mm_srai_epi16(_mm_sub_epi16(t_co, _mm_srai_epi16(t_co, 15)), 1);
+    __m128i r = _mm_add_epi16(b, co);
+
+    __m128i rgb = _mm_slli_epi16(_mm_and_si128(r, _mm_set1_epi16(0x1F)), 11);
+    rgb = _mm_or_si128(rgb, _mm_slli_epi16(_mm_and_si128(g, _mm_set1_epi16(0x3F)), 5));
+    rgb = _mm_or_si128(rgb, _mm_and_si128(b, _mm_set1_epi16(0x1F)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), rgb);
+  }
+#else
+  for (size_t x = 0; x < len; ++x) {
+    int8_t y = static_cast<int8_t>(y_row[x]);
+    int8_t co = static_cast<int8_t>(co_row[x]);
+    int8_t cg = static_cast<int8_t>(cg_row[x]);
+
+    assert(0 <= y && y < 64);
+    assert(-31 <= co && co < 32);
+    assert(-63 <= cg && cg < 64);
+
+    int8_t t = y - (cg / 2);
+    int8_t g = cg + t;
+    int8_t b = (t - co) / 2;
+    int8_t r = b + co;
+
+    assert(0 <= r && r < 32);
+    assert(0 <= g && g < 64);
+    assert(0 <= b && b < 32);
+
+    out[x] = static_cast<uint16_t>(((r & 0x1F) << 11) | ((g & 0x3F) << 5) | (b & 0x1F));
+  }
+#endif
+}
 
-void EntropyDecode(uint8_t *compressed_data, 
-                   uint8_t *out_symbols, 
-		   uint32_t compressed_size,
-		   uint32_t out_size,
-		   bool is_bit_model) {
+// Rebuilds one band of whole tile rows of endpoint ep_number. The band
+// starts at block first_block and spans num_blocks blocks, a multiple of 64
+// rows of the frame so the wavelet blocks never straddle two bands.
+void ReconstructEndpoints(MPTCDecodeInfo *decode_info, 
+                          PhysicalDXTBlock *curr_frame, int ep_number,
+                          uint32_t first_block, uint32_t num_blocks) {
 
-  entropy::Arithmetic_Codec arith_decoder(compressed_size + 100, compressed_data);
-  if(!is_bit_model) {
-    entropy::Adaptive_Data_Model model(257);
-    arith_decoder.start_decoder();
-    for(size_t sym_idx = 0; sym_idx < out_size; sym_idx++)
-      out_symbols[sym_idx] = arith_decoder.decode(model);
-    arith_decoder.stop_decoder();
-  }
-  else {
-    entropy::Adaptive_Bit_Model model;
-    arith_decoder.start_decoder();
-    for(size_t sym_idx = 0; sym_idx < out_size; sym_idx++)
-      out_symbols[sym_idx] = arith_decoder.decode(model);
-    arith_decoder.stop_decoder();
+  uint32_t width = decode_info->frame_width/4;
+  uint32_t height = num_blocks/width;
+  uint32_t pitch = decode_info->dxt_pitch;
+  assert(ep_number == 1 || ep_number == 2);
+  assert(width % BlockSize == 0 && height % BlockSize == 0);
+
+  // The C planes of a band are its Co rows followed by its Cg rows
+  const uint8_t *wav_Y = (ep_number == 1 ? decode_info->wav_ep1_Y : decode_info->wav_ep2_Y) + first_block;
+  const uint8_t *wav_Co = (ep_number == 1 ? decode_info->wav_ep1_C : decode_info->wav_ep2_C) + 2 * first_block;
+  const uint8_t *wav_Cg = wav_Co + num_blocks;
+
+  static_assert(BlockSize == MPTC::kMaxWaveletBlockDim, "Wavelet blocks must match the fused transform");
+  static const size_t kRowBytes = sizeof(int16_t) * BlockSize;
+  int16_t block_Y[BlockSize * BlockSize];
+  int16_t block_Co[BlockSize * BlockSize];
+  int16_t block_Cg[BlockSize * BlockSize];
+  uint16_t packed[BlockSize];
+
+  for (size_t j = 0; j < height; j += BlockSize) {
+    for (size_t i = 0; i < width; i += BlockSize) {
+      size_t plane_offset = i + width * j;
+
+      LoadWaveletBlock(wav_Y + plane_offset, width, block_Y);
+      LoadWaveletBlock(wav_Co + plane_offset, width, block_Co);
+      LoadWaveletBlock(wav_Cg + plane_offset, width, block_Cg);
+
+      MPTC::InverseWaveletBlock(block_Y, kRowBytes, BlockSize);
+      MPTC::InverseWaveletBlock(block_Co, kRowBytes, BlockSize);
+      MPTC::InverseWaveletBlock(block_Cg, kRowBytes, BlockSize);
+
+      for (size_t y = 0; y < BlockSize; ++y) {
+        PackEndpointRow(block_Y + y * BlockSize, block_Co + y * BlockSize, block_Cg + y * BlockSize,
+                        packed, BlockSize);
+
+        PhysicalDXTBlock *dst = curr_frame + (first_block / width + j + y) * pitch + i;
+        if(ep_number == 1) {
+          for (size_t x = 0; x < BlockSize; ++x)
+            dst[x].ep1 = packed[x];
+        }
+        else {
+          for (size_t x = 0; x < BlockSize; ++x)
+            dst[x].ep2 = packed[x];
+        }
+      }
+    }
   }
-  return;
 }
-const uint32_t BlockSize = 64;
-void IWavelet2D(uint8_t *in, int8_t *out, uint32_t width, uint32_t height) {
 
-    for (size_t j = 0; j < height; j += BlockSize) {
-      for (size_t i = 0; i < width; i += BlockSize) {
-        std::vector<int16_t> block(BlockSize * BlockSize);
+// Rebuilds the interpolation words of block row curr_block_y from its
+// motion indices, which belongs to the band starting at first_block.
+// unique_indices points at the next unique word of the band. Returns the
+// number of unique words used.
+static inline uint32_t ReconstructInterpRow(const uint32_t *unique_indices,
+                                            uint32_t num_unique,
+                                            const MPTCDecodeInfo *decode_info,
+                                            const PhysicalDXTBlock *prev_dxt,
+                                            PhysicalDXTBlock *curr_dxt,
+                                            uint32_t first_block,
+                                            int32_t curr_block_y) {
+  int32_t blocks_width = decode_info->frame_width/4;
+  int32_t pitch = static_cast<int32_t>(decode_info->dxt_pitch);
+  uint32_t curr_unique_idx = 0;
+  uint8_t search_area = decode_info->search_area;
+  const uint8_t *motion = decode_info->motion_indices + 2 * curr_block_y * blocks_width;
+  PhysicalDXTBlock *curr_row = curr_dxt + curr_block_y * pitch;
 
-        // Populate block
-        for (size_t y = 0; y < BlockSize; ++y) {
-          for (size_t x = 0; x < BlockSize; ++x) {
-            size_t local_idx = y * BlockSize + x;
+  for(int32_t curr_block_x = 0; curr_block_x < blocks_width; curr_block_x++) {
+    uint8_t x = motion[2 * curr_block_x];
+    uint8_t y = motion[2 * curr_block_x + 1];
 
-            int16_t pixel = static_cast<int16_t>(in[(i + x)+ width*(j + y)] - 128);
-            assert(static_cast<int64_t>(pixel) <= std::numeric_limits<int16_t>::max());
-            assert(static_cast<int64_t>(pixel) >= std::numeric_limits<int16_t>::min());
-            block[local_idx] = static_cast<int16_t>(pixel);
-          }
-        }
+    if(x == 255 && y == 255) {
+      assert(curr_unique_idx < num_unique);
+      assert( unique_indices != NULL && "Unique Indies pointer cannot be null");
+      curr_row[curr_block_x].interp = unique_indices[curr_unique_idx];
+      curr_unique_idx++;
+    }
+    else if((x&0b10000000)!=0 && (y&0b10000000)!=0) { //Inter block motion, fetch data from previous frame
+      x = (x & 0b01111111);
+      y = (y & 0b01111111);
+      int32_t ref_block_x = curr_block_x + static_cast<int32_t>(x - search_area);
+      int32_t ref_block_y = curr_block_y + static_cast<int32_t>(y - search_area);
 
-        // Do transform
-        static const size_t kRowBytes = sizeof(int16_t) * BlockSize;
-        size_t dim = 2;
-        while (dim <= BlockSize) {
-	  MPTC::InverseWavelet2D(block.data(), kRowBytes, block.data(), kRowBytes, dim);
-          dim *= 2;
-        }
+      assert(prev_dxt != NULL && "Prev Frame cannot be NULL!!");
+      curr_row[curr_block_x].interp = prev_dxt[ref_block_y * pitch + ref_block_x].interp;
+    }
+    else { //Intra block motion, fetch data from own frame
+      int32_t ref_block_x = curr_block_x + static_cast<int32_t>(x - search_area);
+      int32_t ref_block_y = curr_block_y + static_cast<int32_t>(y - 2 * search_area + 1);
 
-        // Output to image...
-        for (size_t y = 0; y < BlockSize; ++y) {
-          for (size_t x = 0; x < BlockSize; ++x) {
-            size_t local_idx = y * BlockSize + x;
-            assert(static_cast<int8_t>(block[local_idx]) <= std::numeric_limits<int8_t>::max());
-            assert(static_cast<int8_t>(block[local_idx]) >= std::numeric_limits<int8_t>::min());
-            out[(i + x) + width*(j + y)] = static_cast<int8_t>(block[local_idx]);
-          }
-        }
-      }
+      // Tiles are decoded concurrently, intra references stay inside the band
+      assert(static_cast<int32_t>(first_block) <= ref_block_y * blocks_width + ref_block_x &&
+             ref_block_y * blocks_width + ref_block_x < curr_block_y * blocks_width + curr_block_x);
+      curr_row[curr_block_x].interp = curr_dxt[ref_block_y * pitch + ref_block_x].interp;
     }
+  }
+  return curr_unique_idx;
+}
+
+// Rebuilds the interpolation words of blocks [first_block, first_block + num_blocks).
+// unique_indices points at the first unique word of the band. The frames
+// are decode_info->dxt_pitch blocks wide.
+void ReconstructDXTFrame(uint32_t *unique_indices,
+                         uint32_t num_unique,
+                         MPTCDecodeInfo *decode_info, 
+                         PhysicalDXTBlock *prev_dxt, 
+                         PhysicalDXTBlock *curr_dxt,
+                         uint32_t first_block,
+                         uint32_t num_blocks) {
 
 
+  int32_t blocks_width = decode_info->frame_width/4;
+  uint32_t curr_unique_idx = 0;
+  int32_t first_row = static_cast<int32_t>(first_block) / blocks_width;
+  int32_t end_row = first_row + static_cast<int32_t>(num_blocks) / blocks_width;
+  for(int32_t curr_block_y = first_row; curr_block_y < end_row; curr_block_y++) {
+    curr_unique_idx += ReconstructInterpRow(unique_indices + curr_unique_idx, num_unique - curr_unique_idx,
+                                            decode_info, prev_dxt, curr_dxt, first_block, curr_block_y);
+  }
 }
 
-void ReconstructEndpoints(MPTCDecodeInfo *decode_info, 
-                          PhysicalDXTBlock *curr_frame, int ep_number) {
+using MPTC::kStreamPadding;
 
-  uint32_t width = decode_info->frame_width/4;
-  uint32_t height = decode_info->frame_height/4;
-  uint32_t num_blocks = decode_info->num_blocks;
-
-  if(ep_number == 1) {
-    //endpoint 1
-    IWavelet2D(decode_info->wav_ep1_Y, decode_info->ep1_Y, width, height);
-    IWavelet2D(decode_info->wav_ep1_C, decode_info->ep1_Co, width, height);
-    IWavelet2D(decode_info->wav_ep1_C + num_blocks, decode_info->ep1_Cg, width, height);
-
-    for (size_t j = 0; j < height; ++j) {
-      for (size_t i = 0; i < width; ++i) {
-        uint32_t physical_idx = j * width + i;  
-        auto pix1 = decode_info->ep1_Y[physical_idx];
-        auto pix2 = decode_info->ep1_Co[physical_idx];
-        auto pix3 = decode_info->ep1_Cg[physical_idx];
-
-        assert(0 <= pix1 && pix1 < 64);
-        assert(-31 <= pix2 && pix2 < 32);
-        assert(-63 <= pix3 && pix3 < 64);
-
-        int8_t ycocg[3] = {
-            static_cast<int8_t>(pix1),
-            static_cast<int8_t>(pix2),
-            static_cast<int8_t>(pix3) };
-        int8_t rgb[3];
-        ycocg667_to_rgb565(ycocg, rgb);
-
-        assert(0 <= rgb[0] && rgb[0] < 32);
-        assert(0 <= rgb[1] && rgb[1] < 64);
-        assert(0 <= rgb[2] && rgb[2] < 32);
-
-        // Pack it in...
-        uint16_t x = 0;
-        x |= static_cast<uint16_t>(rgb[0]);
-        x <<= 6;
-        x |= static_cast<uint16_t>(rgb[1]);
-        x <<= 5;
-        x |= static_cast<uint16_t>(rgb[2]);
-        curr_frame[physical_idx].ep1 = x;
-      }
+//////////////////////////////////////////////////////////////////////////////
+//
+// Decode stats
+//
+//////////////////////////////////////////////////////////////////////////////
+
+typedef std::chrono::high_resolution_clock StageClock;
+
+// Adds the time from its construction to its destruction to *ns, nothing
+// is measured for a NULL ns
+class StageTimer {
+ public:
+  explicit StageTimer(uint64_t *ns) : _ns(ns) {
+    if(_ns != NULL)
+      _start = StageClock::now();
+  }
+  ~StageTimer() {
+    if(_ns != NULL)
+      *_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(StageClock::now() - _start).count();
+  }
+
+ private:
+  uint64_t *_ns;
+  StageClock::time_point _start;
+};
+
+// Every stage of a tile is run by a single task, so its time can be kept
+// in the tile job without synchronisation
+static uint64_t *TileStageNs(MPTCDecodeInfo *decode_info, const MPTCTileJob *tile, int stage) {
+  if(decode_info->frame_stats == NULL)
+    return NULL;
+  return &decode_info->tile_jobs[tile - decode_info->tile_jobs].stage_ns[stage];
+}
+
+static uint64_t *FrameStageNs(MPTCDecodeInfo *decode_info, int stage) {
+  return decode_info->frame_stats == NULL ? NULL : &decode_info->frame_stats->stage_ns[stage];
+}
+
+// Adds the tiles of the frame just decoded to the frame stats
+static void AddFrameStats(MPTCDecodeInfo *decode_info, bool interp_only, StageClock::time_point start) {
+  MPTCFrameStats *stats = decode_info->frame_stats;
+  if(stats == NULL)
+    return;
+
+  for(uint32_t tile_idx = 0; tile_idx < decode_info->num_tiles; tile_idx++) {
+    const MPTCTileJob *tile = &decode_info->tile_jobs[tile_idx];
+    for(int stage = 0; stage < kNumTileStages; stage++)
+      stats->stage_ns[stage] += tile->stage_ns[stage];
+    int num_streams = interp_only ? eStream_MotionIndices + 1 : kNumMPTCStreams;
+    for(int stream = 0; stream < num_streams; stream++)
+      stats->stream_bytes[stream] += tile->comp_sz[stream];
+  }
+
+  stats->decode_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(StageClock::now() - start).count();
+  stats->frames_decoded++;
+  stats->frames_skimmed += interp_only ? 1 : 0;
+}
+
+const char *GetDecodeStageName(int stage) {
+  static const char *kStageNames[kNumDecodeStages] = {
+    "motion", "ep1_y", "ep1_c", "ep2_y", "ep2_c", "interp", "ep1", "ep2", "dirty",
+    "read", "palette", "queue_wait"
+  };
+  assert(0 <= stage && stage < kNumDecodeStages);
+  return kStageNames[stage];
+}
+
+static void ReadOrDie(MPTC::ByteSource &source, void *dst, uint32_t sz) {
+  if(!source.Read(dst, sz)) {
+    std::cerr << "Error unexpected end of MPTC file!" << std::endl;
+    exit(-1);
+  }
+}
+
+static const uint8_t *BorrowOrDie(MPTC::ByteSource &source, uint32_t sz, uint8_t *staging) {
+  const uint8_t *data = source.Borrow(sz, staging);
+  if(data == NULL) {
+    std::cerr << "Error unexpected end of MPTC file!" << std::endl;
+    exit(-1);
+  }
+  return data;
+}
+
+bool GetMPTCFrameSize(std::ifstream &in_stream, uint32_t *frame_height, uint32_t *frame_width) {
+  std::streampos start = in_stream.tellg();
+
+  uint32_t first_word = 0;
+  in_stream.read(reinterpret_cast<char*>(&first_word), 4);
+  if(first_word == kMPTCMagic)
+    in_stream.seekg(start + static_cast<std::streamoff>(kMPTCHeaderPrefixSize));
+  else
+    in_stream.seekg(start);
+
+  in_stream.read(reinterpret_cast<char*>(frame_height), 4);
+  in_stream.read(reinterpret_cast<char*>(frame_width), 4);
+  bool is_ok = in_stream.good();
+
+  in_stream.clear();
+  in_stream.seekg(start);
+  return is_ok;
+}
+
+// Reads the file header, see the layout in decoder.h, and splits the frame
+// into tiles
+static void ReadHeader(MPTC::ByteSource &source, MPTCDecodeInfo *decode_info) {
+
+  uint64_t start = source.Tell();
+  uint32_t first_word = 0;
+  ReadOrDie(source, &first_word, 4);
+
+  if(first_word == kMPTCMagic) {
+    uint16_t tile_rows;
+    ReadOrDie(source, &(decode_info->version), 1);
+    ReadOrDie(source, &(decode_info->flags), 1);
+    ReadOrDie(source, &tile_rows, 2);
+    if(decode_info->version > kMPTCVersionTiled) {
+      std::cerr << "Error unsupported MPTC version " << static_cast<uint32_t>(decode_info->version) << std::endl;
+      exit(-1);
     }
+    decode_info->tile_rows = tile_rows;
+    decode_info->header_size = kMPTCHeaderPrefixSize + kMPTCLegacyHeaderSize;
+  }
+  else {
+    // Legacy file, the first word was already the frame height
+    source.Seek(start);
+    decode_info->version = kMPTCVersionLegacy;
+    decode_info->flags = 0;
+    decode_info->header_size = kMPTCLegacyHeaderSize;
+  }
+
+  ReadOrDie(source, &(decode_info->frame_height), 4);
+  ReadOrDie(source, &(decode_info->frame_width), 4);
+  decode_info->num_blocks = (decode_info->frame_height/4 * decode_info->frame_width/4);
+  if(decode_info->dxt_pitch == 0)
+    decode_info->dxt_pitch = decode_info->frame_width/4;
+  decode_info->dirty_map_pitch = (decode_info->frame_width/4 + 63) / 64;
+  if(decode_info->dxt_pitch < decode_info->frame_width/4) {
+    std::cerr << "Error output pitch of " << decode_info->dxt_pitch << " blocks is narrower than the frame!" << std::endl;
+    exit(-1);
+  }
+  ReadOrDie(source, &(decode_info->unique_interval), 1);
+  ReadOrDie(source, &(decode_info->search_area), 1);
+  ReadOrDie(source, &(decode_info->total_frame_count), 4);
+  ReadOrDie(source, &(decode_info->max_unique_count), 4);
+  ReadOrDie(source, &(decode_info->max_compressed_palette), 4);
+  ReadOrDie(source, &(decode_info->max_compressed_motion_indices), 4);
+  ReadOrDie(source, &(decode_info->max_compressed_ep_Y), 4);
+  ReadOrDie(source, &(decode_info->max_compressed_ep_C), 4);
+  decode_info->is_unique = true;
+  decode_info->curr_frame = 0;
+
+  uint32_t blocks_height = decode_info->frame_height/4;
+  if(decode_info->flags & kMPTCFlag_Tiled) {
+    if(decode_info->tile_rows == 0 || decode_info->tile_rows % 64 != 0) {
+      std::cerr << "Error tile rows must be a multiple of 64, got " << decode_info->tile_rows << std::endl;
+      exit(-1);
+    }
+  }
+  else {
+    decode_info->tile_rows = blocks_height;
+  }
+  decode_info->num_tiles = (blocks_height + decode_info->tile_rows - 1) / decode_info->tile_rows;
 
+  if((decode_info->flags & kMPTCFlag_MotionModel) &&
+     (decode_info->search_area == 0 || decode_info->search_area > 63)) {
+    std::cerr << "Error search area of " << static_cast<uint32_t>(decode_info->search_area)
+              << " blocks cannot be context modelled!" << std::endl;
+    exit(-1);
+  }
 
-  } else if(ep_number == 2) {
-    // endpoint 2
-    IWavelet2D(decode_info->wav_ep2_Y, decode_info->ep2_Y, width, height);
-    IWavelet2D(decode_info->wav_ep2_C, decode_info->ep2_Co, width, height);
-    IWavelet2D(decode_info->wav_ep2_C + num_blocks, decode_info->ep2_Cg, width, height);
-    
+  decode_info->entropy_codec = MPTC::CreateEntropyCodec((decode_info->flags & kMPTCFlag_Rans) ?
+                                                        MPTC::eEntropyCodec_Rans :
+                                                        MPTC::eEntropyCodec_Arithmetic);
+}
 
-    for(size_t j = 0; j < height; ++j) {
-      for(size_t i = 0; i < width; ++i) {
+// Hands out the next piece of the arena, or only counts its size while
+// base is NULL. Pieces start on cache lines so that the planes the workers
+// write don't share any.
+static uint8_t *CarveArena(uint8_t *base, size_t *offset, size_t sz) {
+  const size_t kAlignment = 64;
+  uint8_t *piece = base == NULL ? NULL : base + *offset;
+  *offset += (sz + kAlignment - 1) & ~(kAlignment - 1);
+  return piece;
+}
 
-        uint32_t physical_idx = j * width + i;  
+// Lays out every buffer of the decode info in the arena at base, NULL only
+// computes the arena size. The compressed buffers are only staging for
+// sources that cannot lend their bytes.
+static size_t LayoutDecodeBuffers(MPTCDecodeInfo *decode_info, uint8_t *base) {
+  size_t offset = 0;
+  uint32_t num_states = decode_info->num_tiles * kNumMPTCStreams + 1;
+  decode_info->tile_jobs = reinterpret_cast<MPTCTileJob*>(
+    CarveArena(base, &offset, decode_info->num_tiles * sizeof(MPTCTileJob)));
+  decode_info->stream_states = reinterpret_cast<MPTC::EntropyDecoderState**>(
+    CarveArena(base, &offset, num_states * sizeof(MPTC::EntropyDecoderState*)));
+
+  decode_info->comp_palette = CarveArena(base, &offset, decode_info->max_compressed_palette + kStreamPadding);
+  decode_info->uncomp_palette = CarveArena(base, &offset, decode_info->max_unique_count);
+
+  // All five streams of a frame are resident at once so they can be decoded
+  // in any order
+  decode_info->comp_frame = CarveArena(base, &offset, decode_info->comp_frame_sz + kStreamPadding);
+  decode_info->motion_indices = CarveArena(base, &offset, 2 * decode_info->num_blocks);
+
+  decode_info->wav_ep1_Y = CarveArena(base, &offset, decode_info->num_blocks);
+  decode_info->wav_ep1_C = CarveArena(base, &offset, 2 * decode_info->num_blocks);
+
+  decode_info->wav_ep2_Y = CarveArena(base, &offset, decode_info->num_blocks);
+  decode_info->wav_ep2_C = CarveArena(base, &offset, 2 * decode_info->num_blocks);
+  return offset;
+}
 
-        auto pix1 = decode_info->ep2_Y[physical_idx];
-        auto pix2 = decode_info->ep2_Co[physical_idx];
-        auto pix3 = decode_info->ep2_Cg[physical_idx];
+// Allocates the arena for all further decoding from the header maxima,
+// splits the frame into its tiles and creates one entropy decoder state per
+// stream, so decoding a frame never allocates
+static void AllocateDecodeBuffers(MPTCDecodeInfo *decode_info) {
+  decode_info->comp_frame_sz = decode_info->max_compressed_motion_indices +
+                               2 * decode_info->max_compressed_ep_Y +
+                               2 * decode_info->max_compressed_ep_C;
+
+  decode_info->arena_sz = LayoutDecodeBuffers(decode_info, NULL);
+  decode_info->arena = (uint8_t*)(calloc(decode_info->arena_sz, 1));
+  if(decode_info->arena == NULL) {
+    std::cerr << "Error allocating " << decode_info->arena_sz << " bytes of MPTC decode buffers!" << std::endl;
+    exit(-1);
+  }
+  LayoutDecodeBuffers(decode_info, decode_info->arena);
+
+  uint32_t blocks_width = decode_info->frame_width/4;
+  uint32_t blocks_height = decode_info->frame_height/4;
+  for(uint32_t tile_idx = 0; tile_idx < decode_info->num_tiles; tile_idx++) {
+    uint32_t first_row = tile_idx * decode_info->tile_rows;
+    uint32_t num_rows = std::min(decode_info->tile_rows, blocks_height - first_row);
+    decode_info->tile_jobs[tile_idx].first_block = first_row * blocks_width;
+    decode_info->tile_jobs[tile_idx].num_blocks = num_rows * blocks_width;
+  }
 
-        assert(0 <= pix1 && pix1 < 64);
-        assert(-31 <= pix2 && pix2 < 32);
-        assert(-63 <= pix3 && pix3 < 64);
+  // The motion streams of context modelled files bring their own coder
+  uint32_t num_states = decode_info->num_tiles * kNumMPTCStreams + 1;
+  for(uint32_t state_idx = 0; state_idx < num_states; state_idx++) {
+    bool is_motion = state_idx < num_states - 1 && state_idx % kNumMPTCStreams == eStream_MotionIndices;
+    if(is_motion && (decode_info->flags & kMPTCFlag_MotionModel))
+      decode_info->stream_states[state_idx] = new MPTC::MotionDecoderState(decode_info->search_area);
+    else
+      decode_info->stream_states[state_idx] = decode_info->entropy_codec->CreateDecoderState();
+  }
+}
 
-        int8_t ycocg[3] = {
-            static_cast<int8_t>(pix1),
-            static_cast<int8_t>(pix2),
-            static_cast<int8_t>(pix3) };
-        int8_t rgb[3];
+// Decodes the dictionary at the start of a unique interval
+static void ReadPalette(MPTC::ByteSource &source, MPTCDecodeInfo *decode_info) {
+  decode_info->unique_idx_offset = 0;
+  decode_info->curr_idx = 0;
+  uint32_t compressed_palette_size;
+  const uint8_t *comp_palette;
+  uint32_t unique_count;
+  {
+    StageTimer timer(FrameStageNs(decode_info, eDecodeStage_Read));
+    ReadOrDie(source, &compressed_palette_size, 4);
+    if(compressed_palette_size > decode_info->max_compressed_palette) {
+      std::cerr << "Error compressed palette larger than the header maximum!" << std::endl;
+      exit(-1);
+    }
+    comp_palette = BorrowOrDie(source, compressed_palette_size, decode_info->comp_palette);
+    ReadOrDie(source, &unique_count, 4);
+    if(unique_count > decode_info->max_unique_count) {
+      std::cerr << "Error palette larger than the header maximum!" << std::endl;
+      exit(-1);
+    }
+  }
 
-        ycocg667_to_rgb565(ycocg, rgb);
+  {
+    StageTimer timer(FrameStageNs(decode_info, eDecodeStage_Palette));
+    MPTC::EntropyDecoderState *state = decode_info->stream_states[decode_info->num_tiles * kNumMPTCStreams];
+    EntropyDecode(decode_info->entropy_codec, state, const_cast<uint8_t*>(comp_palette), decode_info->uncomp_palette,
+                  compressed_palette_size, unique_count);
+  }
+  if(decode_info->frame_stats != NULL) {
+    decode_info->frame_stats->palette_bytes += compressed_palette_size;
+    decode_info->frame_stats->palettes_decoded++;
+  }
+  decode_info->is_unique = false;
+}
 
-        assert(0 <= rgb[0] && rgb[0] < 32);
-        assert(0 <= rgb[1] && rgb[1] < 64);
-        assert(0 <= rgb[2] && rgb[2] < 32);
+// Points the tile jobs at every compressed stream of the next frame, either
+// in the source or copied to comp_frame. Returns the number of unique
+// indices of the frame.
+static uint32_t ReadFrameStreams(MPTC::ByteSource &source, MPTCDecodeInfo *decode_info) {
+  StageTimer timer(FrameStageNs(decode_info, eDecodeStage_Read));
+  if(decode_info->frame_stats != NULL) {
+    for(uint32_t tile_idx = 0; tile_idx < decode_info->num_tiles; tile_idx++)
+      memset(decode_info->tile_jobs[tile_idx].stage_ns, 0, sizeof(decode_info->tile_jobs[tile_idx].stage_ns));
+  }
 
-      // Pack it in...
-        uint16_t x = 0;
-        x |= static_cast<uint16_t>(rgb[0]);
-        x <<= 6;
-        x |= static_cast<uint16_t>(rgb[1]);
-        x <<= 5;
-        x |= static_cast<uint16_t>(rgb[2]);
-        curr_frame[physical_idx].ep2 = x;
+  uint32_t num_unique;
+  ReadOrDie(source, &num_unique, 4);
+  uint32_t total_sz = 0;
+
+  if(!(decode_info->flags & kMPTCFlag_Tiled)) {
+    MPTCTileJob *tile = &decode_info->tile_jobs[0];
+    tile->num_unique = num_unique;
+    tile->unique_offset = 0;
+    for(int stream = 0; stream < kNumMPTCStreams; stream++) {
+      ReadOrDie(source, &tile->comp_sz[stream], 4);
+      if(total_sz + tile->comp_sz[stream] > decode_info->comp_frame_sz) {
+        std::cerr << "Error compressed frame larger than the header maximum!" << std::endl;
+        exit(-1);
       }
+      tile->comp[stream] = const_cast<uint8_t*>(
+        BorrowOrDie(source, tile->comp_sz[stream], decode_info->comp_frame + total_sz));
+      total_sz += tile->comp_sz[stream];
     }
+    return num_unique;
   }
 
-        //Endpoint 2
-}
+  // Tiled frame: the index of all tiles first, then the payload in one go
+  uint32_t unique_offset = 0;
+  for(uint32_t tile_idx = 0; tile_idx < decode_info->num_tiles; tile_idx++) {
+    MPTCTileJob *tile = &decode_info->tile_jobs[tile_idx];
+    ReadOrDie(source, &tile->num_unique, 4);
+    ReadOrDie(source, tile->comp_sz, 4 * kNumMPTCStreams);
+    tile->unique_offset = unique_offset;
+    unique_offset += tile->num_unique;
+
+    for(int stream = 0; stream < kNumMPTCStreams; stream++)
+      total_sz += tile->comp_sz[stream];
+  }
 
-void ReconstructDXTFrame(uint32_t *unique_indices,
-                         uint32_t num_unique,
-                         MPTCDecodeInfo *decode_info, 
-                         PhysicalDXTBlock *prev_dxt, 
-                         PhysicalDXTBlock *curr_dxt) {
+  if(total_sz > decode_info->comp_frame_sz || unique_offset != num_unique) {
+    std::cerr << "Error corrupt MPTC tile index!" << std::endl;
+    exit(-1);
+  }
 
+  uint8_t *comp = const_cast<uint8_t*>(BorrowOrDie(source, total_sz, decode_info->comp_frame));
+  for(uint32_t tile_idx = 0; tile_idx < decode_info->num_tiles; tile_idx++) {
+    MPTCTileJob *tile = &decode_info->tile_jobs[tile_idx];
+    for(int stream = 0; stream < kNumMPTCStreams; stream++) {
+      tile->comp[stream] = comp;
+      comp += tile->comp_sz[stream];
+    }
+  }
+  return num_unique;
+}
 
-  int32_t blocks_width = decode_info->frame_width/4;
+// Decodes the context modelled motion stream of a tile row by row. With
+// curr_dxt set, every row's interpolation words are rebuilt right after its
+// motion, while the row is still in the cache.
+static void DecodeTileMotion(MPTCDecodeInfo *decode_info, const MPTCTileJob *tile,
+                             PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt) {
+  StageTimer timer(TileStageNs(decode_info, tile, eDecodeStage_Motion));
+  uint32_t tile_idx = static_cast<uint32_t>(tile - decode_info->tile_jobs);
+  MPTC::MotionDecoderState *state = static_cast<MPTC::MotionDecoderState*>(
+    decode_info->stream_states[tile_idx * kNumMPTCStreams + eStream_MotionIndices]);
+
+  uint32_t blocks_width = decode_info->frame_width/4;
+  int32_t first_row = static_cast<int32_t>(tile->first_block / blocks_width);
+  int32_t end_row = first_row + static_cast<int32_t>(tile->num_blocks / blocks_width);
+  const uint32_t *unique_indices = reinterpret_cast<uint32_t*>(decode_info->uncomp_palette +
+                                                               decode_info->unique_idx_offset) + tile->unique_offset;
   uint32_t curr_unique_idx = 0;
-  uint8_t search_area = decode_info->search_area;
-  for(int32_t physical_idx = 0; physical_idx < decode_info->num_blocks; physical_idx++) {
-    uint8_t x = decode_info->motion_indices[2 * physical_idx];
-    uint8_t y = decode_info->motion_indices[2 * physical_idx + 1];
 
-    if(x == 255 && y == 255) {
-      assert(curr_unique_idx < num_unique);
-      assert( unique_indices != NULL && "Unique Indies pointer cannot be null");
-      curr_dxt[physical_idx].interp = unique_indices[curr_unique_idx];
-      curr_unique_idx++;
+  state->Start(tile->comp[eStream_MotionIndices], tile->comp_sz[eStream_MotionIndices]);
+  for(int32_t row = first_row; row < end_row; row++) {
+    uint8_t *motion = decode_info->motion_indices + 2 * row * blocks_width;
+    state->DecodeRow(row == first_row ? NULL : motion - 2 * blocks_width, motion, blocks_width);
+    if(curr_dxt != NULL) {
+      curr_unique_idx += ReconstructInterpRow(unique_indices + curr_unique_idx, tile->num_unique - curr_unique_idx,
+                                              decode_info, prev_dxt, curr_dxt, tile->first_block, row);
     }
-    else if((x&0b10000000)!=0 && (y&0b10000000)!=0) { //Inter block motion, fetch data from previous frame
-      x = (x & 0b01111111);
-      y = (y & 0b01111111);
-      int32_t motion_x = static_cast<int32_t>(x - search_area);
-      int32_t motion_y = static_cast<int32_t>(y - search_area);
+  }
+  state->Finish();
+}
 
-      int32_t curr_block_x = physical_idx % blocks_width;
-      int32_t curr_block_y = physical_idx / blocks_width;
+// Entropy decodes one stream of a tile into its rows of the decode planes
+static void DecodeTileStream(MPTCDecodeInfo *decode_info, const MPTCTileJob *tile, int stream) {
+  if(stream == eStream_MotionIndices && (decode_info->flags & kMPTCFlag_MotionModel)) {
+    DecodeTileMotion(decode_info, tile, NULL, NULL);
+    return;
+  }
 
-      int32_t ref_block_x = curr_block_x + motion_x;
-      int32_t ref_block_y = curr_block_y + motion_y;
+  StageTimer timer(TileStageNs(decode_info, tile, stream));
+  uint32_t first_block = tile->first_block;
+  uint8_t *out = NULL;
+  uint32_t out_sz = 0;
+
+  switch(stream) {
+    case eStream_MotionIndices:
+      out = decode_info->motion_indices + 2 * first_block;
+      out_sz = 2 * tile->num_blocks;
+      break;
+    case eStream_Ep1_Y:
+      out = decode_info->wav_ep1_Y + first_block;
+      out_sz = tile->num_blocks;
+      break;
+    case eStream_Ep1_C:
+      out = decode_info->wav_ep1_C + 2 * first_block;
+      out_sz = 2 * tile->num_blocks;
+      break;
+    case eStream_Ep2_Y:
+      out = decode_info->wav_ep2_Y + first_block;
+      out_sz = tile->num_blocks;
+      break;
+    case eStream_Ep2_C:
+      out = decode_info->wav_ep2_C + 2 * first_block;
+      out_sz = 2 * tile->num_blocks;
+      break;
+    default:
+      assert(false && "Unknown MPTC stream");
+      return;
+  }
 
-      int ref_physical_idx = ref_block_y * blocks_width + ref_block_x;
-      assert(prev_dxt != NULL && "Prev Frame cannot be NULL!!");
-      curr_dxt[physical_idx].interp = prev_dxt[ref_physical_idx].interp; 
-    }
-    else { //Intra block motion, fetch data from own frame
-        int32_t motion_x = static_cast<int32_t>(x - search_area);
-        int32_t motion_y = static_cast<int32_t>(y - 2 * search_area + 1);
+  // Every stream of every tile has its own state, as they may run concurrently
+  uint32_t tile_idx = static_cast<uint32_t>(tile - decode_info->tile_jobs);
+  MPTC::EntropyDecoderState *state = decode_info->stream_states[tile_idx * kNumMPTCStreams + stream];
+  EntropyDecode(decode_info->entropy_codec, state, tile->comp[stream], out, tile->comp_sz[stream], out_sz);
+}
+
+static void ReconstructTileInterp(MPTCDecodeInfo *decode_info, const MPTCTileJob *tile,
+                                  PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt) {
+  StageTimer timer(TileStageNs(decode_info, tile, eDecodeStage_Interp));
+  uint32_t *unique_indices = reinterpret_cast<uint32_t*>(decode_info->uncomp_palette + decode_info->unique_idx_offset);
+  ReconstructDXTFrame(unique_indices + tile->unique_offset,
+                      tile->num_unique,
+                      decode_info,
+                      prev_dxt,
+                      curr_dxt,
+                      tile->first_block,
+                      tile->num_blocks);
+}
+
+static void ReconstructTileEndpoints(MPTCDecodeInfo *decode_info, const MPTCTileJob *tile,
+                                     PhysicalDXTBlock *curr_dxt, int ep_number) {
+  StageTimer timer(TileStageNs(decode_info, tile, ep_number == 1 ? eDecodeStage_Ep1 : eDecodeStage_Ep2));
+  ReconstructEndpoints(decode_info, curr_dxt, ep_number, tile->first_block, tile->num_blocks);
+}
 
-        int32_t curr_block_x = physical_idx % blocks_width;
-        int32_t curr_block_y = physical_idx / blocks_width;
+// Decodes the motion of a tile and rebuilds its interpolation words, in one
+// pass for context modelled motion
+static void DecodeTileInterp(MPTCDecodeInfo *decode_info, const MPTCTileJob *tile,
+                             PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt) {
+  if(decode_info->flags & kMPTCFlag_MotionModel) {
+    DecodeTileMotion(decode_info, tile, prev_dxt, curr_dxt);
+    return;
+  }
 
-        int32_t ref_block_x = curr_block_x + motion_x;
-        int32_t ref_block_y = curr_block_y + motion_y;
+  DecodeTileStream(decode_info, tile, eStream_MotionIndices);
+  ReconstructTileInterp(decode_info, tile, prev_dxt, curr_dxt);
+}
 
-        int32_t ref_physical_idx = ref_block_y * blocks_width + ref_block_x;
-	curr_dxt[physical_idx].interp = curr_dxt[ref_physical_idx].interp;
+// Compares the finished blocks of a tile with the previous frame and sets
+// their bits of the dirty map, every block is dirty without a previous frame
+static void MarkDirtyBlocks(MPTCDecodeInfo *decode_info, MPTCTileJob *tile,
+                            const PhysicalDXTBlock *prev_dxt, const PhysicalDXTBlock *curr_dxt) {
+  if(decode_info->dirty_map == NULL)
+    return;
+
+  StageTimer timer(TileStageNs(decode_info, tile, eDecodeStage_Dirty));
+  uint32_t blocks_width = decode_info->frame_width/4;
+  uint32_t first_row = tile->first_block / blocks_width;
+  uint32_t end_row = first_row + tile->num_blocks / blocks_width;
+  uint32_t num_dirty = 0;
+  for(uint32_t row = first_row; row < end_row; row++) {
+    uint64_t *words = decode_info->dirty_map + static_cast<size_t>(row) * decode_info->dirty_map_pitch;
+    const PhysicalDXTBlock *curr_row = curr_dxt + static_cast<size_t>(row) * decode_info->dxt_pitch;
+    const PhysicalDXTBlock *prev_row = prev_dxt == NULL ? NULL : prev_dxt + static_cast<size_t>(row) * decode_info->dxt_pitch;
+
+    for(uint32_t word = 0; word < decode_info->dirty_map_pitch; word++) {
+      uint32_t first_x = 64 * word;
+      uint32_t end_x = std::min(first_x + 64, blocks_width);
+      uint64_t bits = 0;
+      for(uint32_t x = first_x; x < end_x; x++) {
+        if(prev_row == NULL || curr_row[x].dxt_block != prev_row[x].dxt_block) {
+          bits |= 1ULL << (x - first_x);
+          num_dirty++;
+        }
+      }
+      words[word] = bits;
     }
   }
+  tile->num_dirty = num_dirty;
+}
+
+// Moves on to the next frame, and back to the first one after the last
+static void FinishFrame(MPTC::ByteSource &source, MPTCDecodeInfo *decode_info, uint32_t num_unique) {
+  if(decode_info->dirty_map != NULL) {
+    decode_info->num_dirty_blocks = 0;
+    for(uint32_t tile_idx = 0; tile_idx < decode_info->num_tiles; tile_idx++)
+      decode_info->num_dirty_blocks += decode_info->tile_jobs[tile_idx].num_dirty;
+  }
+
+  decode_info->unique_idx_offset += 4*num_unique;
+  if(decode_info->curr_idx >= decode_info->unique_interval-1) {
+    decode_info->curr_idx = 0;
+    decode_info->is_unique = true;
+  }
+
+  decode_info->curr_idx++;
+  decode_info->curr_frame++;
+
+  if(decode_info->curr_frame >= decode_info->total_frame_count || source.AtEnd()) {
+    source.Seek(decode_info->header_size);
+    decode_info->is_unique = true;
+    decode_info->curr_frame = 0;
+  }
 }
 
 int GetFrame(std::ifstream &in_stream, PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt, 
@@ -260,158 +770,415 @@ int GetFrame(std::ifstream &in_stream, PhysicalDXTBlock *prev_dxt, PhysicalDXTBl
     exit(-1);
   }
 
-  if(in_stream.eof()) {
+  MPTC::StreamSource source(in_stream);
+  return GetFrame(source, prev_dxt, curr_dxt, decode_info);
+}
+
+// Decodes the next frame on the calling thread. Frames that are only
+// needed as the reference of a later one can skip their endpoints, which
+// leaves curr_dxt with valid interpolation data only. Returns the number of
+// compressed bytes that were entropy decoded.
+static uint64_t DecodeFrame(MPTC::ByteSource &source, PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt,
+                            MPTCDecodeInfo *decode_info, bool interp_only) {
+  StageClock::time_point start = StageClock::now();
+
+  // If unique set then decode the current dictionary
+  if(decode_info->is_unique)
+    ReadPalette(source, decode_info);
+
+
+  // Decode a single frame, one tile after the other
+  uint32_t num_unique = ReadFrameStreams(source, decode_info);
+
+  uint64_t num_bytes = 0;
+  for(uint32_t tile_idx = 0; tile_idx < decode_info->num_tiles; tile_idx++) {
+    MPTCTileJob *tile = &decode_info->tile_jobs[tile_idx];
+
+    // Interpolation Data
+    DecodeTileInterp(decode_info, tile, prev_dxt, curr_dxt);
+    num_bytes += tile->comp_sz[eStream_MotionIndices];
+    if(interp_only)
+      continue;
+
+    for(int stream = eStream_Ep1_Y; stream < kNumMPTCStreams; stream++) {
+      DecodeTileStream(decode_info, tile, stream);
+      num_bytes += tile->comp_sz[stream];
+    }
+
+    // End Point----1
+    ReconstructTileEndpoints(decode_info, tile, curr_dxt, 1);
+
+    // End Point----2
+    ReconstructTileEndpoints(decode_info, tile, curr_dxt, 2);
+
+    MarkDirtyBlocks(decode_info, tile, prev_dxt, curr_dxt);
+  }
+
+  AddFrameStats(decode_info, interp_only, start);
+  FinishFrame(source, decode_info, num_unique);
+  return num_bytes;
+}
+
+int GetFrame(MPTC::ByteSource &source, PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt, 
+            MPTCDecodeInfo *decode_info) {
+
+  if(source.AtEnd()) {
     std::cerr << "Error end of file reached, no more frames!" << std::endl;
     return -1;
   }
   // This is the start read all the frame meta data once and store it in the DecodeInfo for 
   // decoding further frames
   
-  if(decode_info->is_start) {
+  if(decode_info->is_start)
+    OpenDecodeInfo(source, decode_info);
 
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->frame_height)), 4);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->frame_width)), 4);
-    decode_info->num_blocks = (decode_info->frame_height/4 * decode_info->frame_width/4);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->unique_interval)), 1);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->search_area)), 1);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->total_frame_count)), 4);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->max_unique_count)), 4);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->max_compressed_palette)), 4);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->max_compressed_motion_indices)), 4);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->max_compressed_ep_Y)), 4);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->max_compressed_ep_C)), 4);
-    decode_info->is_unique = true;
-    decode_info->curr_frame = 0;
+  DecodeFrame(source, prev_dxt, curr_dxt, decode_info, false);
+  return 0;
+}
 
-    // malloc memories to be used for further decoding of all the frames
-    decode_info->comp_palette = (uint8_t*)(malloc(decode_info->max_compressed_palette));
-    decode_info->uncomp_palette = (uint8_t*)(malloc(decode_info->max_unique_count));
-    decode_info->comp_motion_indices = (uint8_t*)(malloc(decode_info->max_compressed_motion_indices));
-    decode_info->motion_indices = (uint8_t*)(malloc(2 * decode_info->num_blocks));
-    decode_info->comp_ep_Y = (uint8_t*)(malloc(decode_info->max_compressed_ep_Y));
-    decode_info->comp_ep_C = (uint8_t*)(malloc(decode_info->max_compressed_ep_C));
+int SkimFrame(MPTC::ByteSource &source, PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt,
+              MPTCDecodeInfo *decode_info) {
 
-    decode_info->wav_ep1_Y = (uint8_t*)(malloc(decode_info->num_blocks));
-    decode_info->wav_ep1_C = (uint8_t*)(malloc(2 * decode_info->num_blocks));
+  if(source.AtEnd()) {
+    std::cerr << "Error end of file reached, no more frames!" << std::endl;
+    return -1;
+  }
 
-    decode_info->wav_ep2_Y = (uint8_t*)(malloc(decode_info->num_blocks));
-    decode_info->wav_ep2_C = (uint8_t*)(malloc(2 * decode_info->num_blocks));
+  if(decode_info->is_start)
+    OpenDecodeInfo(source, decode_info);
 
-    decode_info->ep1_Y = (int8_t*)(malloc(decode_info->num_blocks));
-    decode_info->ep2_Y = (int8_t*)(malloc(decode_info->num_blocks));
-    decode_info->ep1_Co = (int8_t*)(malloc(decode_info->num_blocks));
-    decode_info->ep2_Co = (int8_t*)(malloc(decode_info->num_blocks));
-    decode_info->ep1_Cg = (int8_t*)(malloc(decode_info->num_blocks));
-    decode_info->ep2_Cg = (int8_t*)(malloc(decode_info->num_blocks));
-    decode_info->is_start = false;
+  DecodeFrame(source, prev_dxt, curr_dxt, decode_info, true);
+  return 0;
+}
 
+// True if no block of the frame is copied from the previous one
+static bool IsKeyFrame(const MPTCDecodeInfo *decode_info) {
+  for(uint32_t block_idx = 0; block_idx < decode_info->num_blocks; block_idx++) {
+    uint8_t x = decode_info->motion_indices[2 * block_idx];
+    uint8_t y = decode_info->motion_indices[2 * block_idx + 1];
+    if((x & 0x80) != 0 && (y & 0x80) != 0 && !(x == 255 && y == 255))
+      return false;
   }
+  return true;
+}
 
+int BuildFrameIndex(MPTC::ByteSource &source, std::vector<MPTC::FrameIndexEntry> *index) {
+
+  MPTCDecodeInfo header;
+  InitDecodeInfo(&header);
+  source.Seek(0);
+  ReadHeader(source, &header);
+  AllocateDecodeBuffers(&header);
+
+  index->clear();
+  index->reserve(header.total_frame_count);
+
+  // Everything but the motion indices is skipped, those are decoded to
+  // find the frames that don't reference the previous one
+  uint64_t palette_offset = 0;
+  uint32_t unique_offset = 0;
+  for(uint32_t frame = 0; frame < header.total_frame_count; frame++) {
+    uint32_t sz;
+
+    if(frame % header.unique_interval == 0) {
+      palette_offset = source.Tell();
+      unique_offset = 0;
+      if(!source.Read(&sz, 4))
+        break;
+      source.Skip(sz + 4);
+    }
 
-  // If unique set then decode the current dictionary
-  if(decode_info->is_unique) {
+    MPTC::FrameIndexEntry entry;
+    entry.frame_offset = source.Tell();
+    entry.palette_offset = palette_offset;
+    entry.unique_offset = unique_offset;
+
+    uint32_t num_unique;
+    if(!source.Read(&num_unique, 4))
+      break;
+
+    bool is_ok = true;
+    if(!(header.flags & kMPTCFlag_Tiled)) {
+      MPTCTileJob *tile = &header.tile_jobs[0];
+      for(int stream = 0; stream < kNumMPTCStreams && is_ok; stream++) {
+        is_ok = source.Read(&tile->comp_sz[stream], 4);
+        if(is_ok && stream == eStream_MotionIndices) {
+          // A stream larger than a whole frame is corrupt, decoding it would
+          // read the buffer of the last frame
+          is_ok = tile->comp_sz[stream] <= header.comp_frame_sz;
+          if(is_ok) {
+            tile->comp[stream] = const_cast<uint8_t*>(source.Borrow(tile->comp_sz[stream], header.comp_frame));
+            is_ok = tile->comp[stream] != NULL;
+          }
+        }
+        else {
+          source.Skip(tile->comp_sz[stream]);
+        }
+      }
+    }
+    else {
+      uint64_t payload_sz = 0;
+      for(uint32_t tile_idx = 0; tile_idx < header.num_tiles && is_ok; tile_idx++) {
+        MPTCTileJob *tile = &header.tile_jobs[tile_idx];
+        is_ok = source.Read(&tile->num_unique, 4) && source.Read(tile->comp_sz, 4 * kNumMPTCStreams);
+        for(int stream = 0; stream < kNumMPTCStreams; stream++)
+          payload_sz += tile->comp_sz[stream];
+      }
 
-    decode_info->unique_idx_offset = 0;
-    decode_info->curr_idx = 0;
-    uint32_t compressed_palette_size;
-    in_stream.read(reinterpret_cast<char*>(&compressed_palette_size), 4);
-    in_stream.read(reinterpret_cast<char*>(decode_info->comp_palette), compressed_palette_size);
-    uint32_t unique_count;
-    in_stream.read(reinterpret_cast<char*>(&unique_count), 4);
-    assert(decode_info->comp_palette != NULL && decode_info->uncomp_palette != NULL);
+      uint8_t *payload = NULL;
+      if(is_ok) {
+        is_ok = payload_sz <= header.comp_frame_sz;
+        if(is_ok) {
+          payload = const_cast<uint8_t*>(source.Borrow(static_cast<uint32_t>(payload_sz), header.comp_frame));
+          is_ok = payload != NULL;
+        }
+      }
+
+      for(uint32_t tile_idx = 0; tile_idx < header.num_tiles && payload != NULL; tile_idx++) {
+        MPTCTileJob *tile = &header.tile_jobs[tile_idx];
+        for(int stream = 0; stream < kNumMPTCStreams; stream++) {
+          tile->comp[stream] = payload;
+          payload += tile->comp_sz[stream];
+        }
+      }
+    }
+
+    // A frame cut short by the end of the file or oversized is not indexed,
+    // nor is anything after it
+    if(!is_ok || source.Tell() > source.Size())
+      break;
 
-    EntropyDecode(decode_info->comp_palette, decode_info->uncomp_palette,
-                  compressed_palette_size, unique_count, false);
-    decode_info->is_unique = false;
-     
-    decode_info->curr_frame++;
+    for(uint32_t tile_idx = 0; tile_idx < header.num_tiles; tile_idx++)
+      DecodeTileStream(&header, &header.tile_jobs[tile_idx], eStream_MotionIndices);
 
+    entry.frame_size = static_cast<uint32_t>(source.Tell() - entry.frame_offset);
+    entry.flags = (frame == 0 || IsKeyFrame(&header)) ? MPTC::kFrameIndexFlag_Key : 0;
+    index->push_back(entry);
+    unique_offset += 4 * num_unique;
   }
 
+  FreeDecodeInfo(&header);
+  source.Seek(0);
+  return index->size() == header.total_frame_count ? 0 : -1;
+}
 
-  // Decode a single frame
-  uint32_t num_unique;
-  in_stream.read(reinterpret_cast<char*>(&num_unique), 4);
-  uint32_t *unique_indices = reinterpret_cast<uint32_t*>(decode_info->uncomp_palette + decode_info->unique_idx_offset);
+// Sets every block of the dirty map, if there is one
+static void MarkAllDirty(MPTCDecodeInfo *decode_info) {
+  if(decode_info->dirty_map == NULL)
+    return;
+
+  uint32_t blocks_width = decode_info->frame_width/4;
+  for(uint32_t row = 0; row < decode_info->frame_height/4; row++) {
+    uint64_t *words = decode_info->dirty_map + static_cast<size_t>(row) * decode_info->dirty_map_pitch;
+    for(uint32_t word = 0; word < decode_info->dirty_map_pitch; word++) {
+      uint32_t num_bits = std::min(64u, blocks_width - 64 * word);
+      words[word] = num_bits == 64 ? ~0ULL : (1ULL << num_bits) - 1;
+    }
+  }
+  decode_info->num_dirty_blocks = decode_info->num_blocks;
+}
 
-  uint32_t comp_motion_indices_sz;
-  in_stream.read(reinterpret_cast<char*>(&comp_motion_indices_sz), 4);
-  in_stream.read(reinterpret_cast<char*>(decode_info->comp_motion_indices), comp_motion_indices_sz);
-   
-  EntropyDecode(decode_info->comp_motion_indices,
-                decode_info->motion_indices,
-		comp_motion_indices_sz,
-		2 * decode_info->num_blocks,
-		false);
-
-  uint32_t comp_Y_sz, comp_C_sz;
-  in_stream.read(reinterpret_cast<char*>(&comp_Y_sz), 4);
-  in_stream.read(reinterpret_cast<char*>(decode_info->comp_ep_Y), comp_Y_sz);
-  EntropyDecode(decode_info->comp_ep_Y,
-                decode_info->wav_ep1_Y,
-		comp_Y_sz,
-		decode_info->num_blocks,
-		false);
-
-
-  in_stream.read(reinterpret_cast<char*>(&comp_C_sz), 4);
-  in_stream.read(reinterpret_cast<char*>(decode_info->comp_ep_C), comp_C_sz);
-  EntropyDecode(decode_info->comp_ep_C,
-                decode_info->wav_ep1_C,
-		comp_C_sz,
-		2 * decode_info->num_blocks,
-		false);
-
-  in_stream.read(reinterpret_cast<char*>(&comp_Y_sz), 4);
-  in_stream.read(reinterpret_cast<char*>(decode_info->comp_ep_Y), comp_Y_sz);
-  EntropyDecode(decode_info->comp_ep_Y,
-                decode_info->wav_ep2_Y,
-		comp_Y_sz,
-		decode_info->num_blocks,
-		false);
-
-
-  in_stream.read(reinterpret_cast<char*>(&comp_C_sz), 4);
-  in_stream.read(reinterpret_cast<char*>(decode_info->comp_ep_C), comp_C_sz);
-  EntropyDecode(decode_info->comp_ep_C,
-                decode_info->wav_ep2_C,
-		comp_C_sz,
-		2 * decode_info->num_blocks,
-		false);
-              
-  // Interpolation Data
-  ReconstructDXTFrame(
-      reinterpret_cast<uint32_t*>(decode_info->uncomp_palette + decode_info->unique_idx_offset),
-      num_unique,
-      decode_info,
-      prev_dxt,
-      curr_dxt);
-
-  // End Point----1
-  ReconstructEndpoints(decode_info, curr_dxt, 1);
-
-  // End Point----2
-  ReconstructEndpoints(decode_info, curr_dxt, 2);
+int SeekFrame(MPTC::ByteSource &source, const std::vector<MPTC::FrameIndexEntry> &index, uint32_t frame,
+              PhysicalDXTBlock *scratch_dxt, PhysicalDXTBlock *curr_dxt, MPTCDecodeInfo *decode_info,
+              MPTCSeekStats *stats) {
 
-  decode_info->unique_idx_offset += 4*num_unique;
-  if(decode_info->curr_idx >= decode_info->unique_interval-1) {
-    decode_info->curr_idx = 0;
-    decode_info->is_unique = true;
-  }
+  std::chrono::high_resolution_clock::time_point start_time = std::chrono::high_resolution_clock::now();
+  if(frame >= index.size())
+    return -1;
 
-  decode_info->curr_idx++;
+  if(decode_info->is_start) {
+    source.Seek(0);
+    OpenDecodeInfo(source, decode_info);
+  }
+  if(index.size() != decode_info->total_frame_count)
+    return -1;
 
-  if(decode_info->curr_frame >= decode_info->total_frame_count) {
-    in_stream.seekg(0, in_stream.beg);
-    in_stream.seekg(34);
+  // Decoding restarts at the closest key frame, which needs no reference
+  uint32_t start_frame = frame;
+  while(start_frame > 0 && !(index[start_frame].flags & MPTC::kFrameIndexFlag_Key))
+    start_frame--;
+
+  MPTCSeekStats seek_stats;
+  memset(&seek_stats, 0, sizeof(seek_stats));
+  seek_stats.target_frame = frame;
+  seek_stats.start_frame = start_frame;
+
+  // Put the decode info in the state it has right before start_frame. In
+  // the middle of a unique interval the dictionary is read on the side.
+  const MPTC::FrameIndexEntry &start_entry = index[start_frame];
+  uint32_t interval_idx = start_frame % decode_info->unique_interval;
+  source.Seek(start_entry.palette_offset);
+  if(interval_idx == 0) {
     decode_info->is_unique = true;
-    decode_info->curr_frame = 0;
+  }
+  else {
+    ReadPalette(source, decode_info);
+    seek_stats.palettes_decoded++;
+    source.Seek(start_entry.frame_offset);
+    decode_info->curr_idx = interval_idx;
+    decode_info->unique_idx_offset = start_entry.unique_offset;
+  }
+  decode_info->curr_frame = start_frame;
+
+  // Only the interpolation data of the frames up to the target is needed.
+  // Alternate between the two buffers so that the target ends up in curr_dxt.
+  PhysicalDXTBlock *prev_dxt = NULL;
+  for(uint32_t frame_idx = start_frame; frame_idx <= frame; frame_idx++) {
+    PhysicalDXTBlock *dxt = ((frame - frame_idx) % 2 == 0) ? curr_dxt : scratch_dxt;
+    if(decode_info->is_unique)
+      seek_stats.palettes_decoded++;
+
+    bool interp_only = frame_idx != frame;
+    seek_stats.bytes_decoded += DecodeFrame(source, prev_dxt, dxt, decode_info, interp_only);
+    if(interp_only)
+      seek_stats.frames_skimmed++;
+    prev_dxt = dxt;
   }
 
+  // The frames in between were never shown, the whole target changed
+  MarkAllDirty(decode_info);
+
+  seek_stats.elapsed_ms = std::chrono::duration<double, std::milli>(
+    std::chrono::high_resolution_clock::now() - start_time).count();
+  if(stats != NULL)
+    *stats = seek_stats;
   return 0;
 }
 
 
+void InitDecodeInfo(MPTCDecodeInfo *decode_info, uint32_t num_threads) {
+  memset(decode_info, 0, sizeof(MPTCDecodeInfo));
+  decode_info->is_start = true;
+  decode_info->num_threads = num_threads;
+}
+
+void OpenDecodeInfo(MPTC::ByteSource &source, MPTCDecodeInfo *decode_info) {
+  ReadHeader(source, decode_info);
+  AllocateDecodeBuffers(decode_info);
+  decode_info->is_start = false;
+}
+
+uint32_t GetDirtyRowRuns(const MPTCDecodeInfo *decode_info, const uint64_t *dirty_map, uint32_t merge_gap,
+                         MPTCDirtyRows *runs) {
+  uint32_t blocks_height = decode_info->frame_height/4;
+  uint32_t num_runs = 0;
+  for(uint32_t row = 0; row < blocks_height; row++) {
+    const uint64_t *words = dirty_map + static_cast<size_t>(row) * decode_info->dirty_map_pitch;
+    bool is_dirty = false;
+    for(uint32_t word = 0; word < decode_info->dirty_map_pitch && !is_dirty; word++)
+      is_dirty = words[word] != 0;
+    if(!is_dirty)
+      continue;
+
+    MPTCDirtyRows *last = num_runs == 0 ? NULL : &runs[num_runs - 1];
+    if(last != NULL && row - (last->first_row + last->num_rows) <= merge_gap) {
+      last->num_rows = row + 1 - last->first_row;
+    }
+    else {
+      runs[num_runs].first_row = row;
+      runs[num_runs].num_rows = 1;
+      num_runs++;
+    }
+  }
+  return num_runs;
+}
+
+void FreeDecodeInfo(MPTCDecodeInfo *decode_info) {
+  // The graph holds tasks that reference the pool, so drop it first
+  delete decode_info->decode_graph;
+  decode_info->decode_graph = NULL;
+
+  if (decode_info->owns_thread_pool)
+    delete decode_info->thread_pool;
+  decode_info->thread_pool = NULL;
+  decode_info->owns_thread_pool = false;
+
+  if (decode_info->arena != NULL) {
+    uint32_t num_states = decode_info->num_tiles * kNumMPTCStreams + 1;
+    for (uint32_t state_idx = 0; state_idx < num_states; state_idx++)
+      delete decode_info->stream_states[state_idx];
+  }
+
+  // Every buffer points into the arena
+  free(decode_info->arena);
+  LayoutDecodeBuffers(decode_info, NULL);
+  decode_info->arena = NULL;
+  decode_info->arena_sz = 0;
+  decode_info->num_tiles = 0;
+
+  delete decode_info->entropy_codec;
+  decode_info->entropy_codec = NULL;
+
+  decode_info->is_multi_thread = false;
+  decode_info->is_start = true;
+}
+
+// Builds the per-frame dependency graph once, with the same tasks for
+// every tile:
+//
+//   motion indices  ----------------------> ReconstructDXTFrame  --+
+//   ep1 Y, ep1 C    ----------------------> ReconstructEndpoints(1) +--> MarkDirtyBlocks
+//   ep2 Y, ep2 C    ----------------------> ReconstructEndpoints(2) +
+//
+// Tiles share no data, so a frame of N tiles exposes 5 * N independent
+// entropy decodes. Context modelled motion is decoded and reconstructed by
+// a single task. All arguments that change from frame to frame are read
+// from decode_info->frame_job and the tile jobs when the tasks run.
+static MPTC::TaskGraph *BuildDecodeGraph(MPTCDecodeInfo *decode_info) {
+  MPTC::TaskGraph *graph = new MPTC::TaskGraph;
+  MPTCFrameJob *job = &decode_info->frame_job;
+
+  for(uint32_t tile_idx = 0; tile_idx < decode_info->num_tiles; tile_idx++) {
+    MPTCTileJob *tile = &decode_info->tile_jobs[tile_idx];
+
+    MPTC::TaskGraph::TaskHandle stream_decode[kNumMPTCStreams];
+    for(int stream = eStream_Ep1_Y; stream < kNumMPTCStreams; stream++) {
+      stream_decode[stream] = graph->AddTask([decode_info, tile, stream] {
+        DecodeTileStream(decode_info, tile, stream);
+      });
+    }
+
+    MPTC::TaskGraph::TaskHandle reconstruct_interp;
+    if(decode_info->flags & kMPTCFlag_MotionModel) {
+      reconstruct_interp = graph->AddTask([decode_info, tile, job] {
+        DecodeTileMotion(decode_info, tile, job->prev_dxt, job->curr_dxt);
+      });
+    }
+    else {
+      stream_decode[eStream_MotionIndices] = graph->AddTask([decode_info, tile] {
+        DecodeTileStream(decode_info, tile, eStream_MotionIndices);
+      });
+      reconstruct_interp = graph->AddTask([decode_info, tile, job] {
+        ReconstructTileInterp(decode_info, tile, job->prev_dxt, job->curr_dxt);
+      });
+      graph->AddDependency(stream_decode[eStream_MotionIndices], reconstruct_interp);
+    }
+
+    MPTC::TaskGraph::TaskHandle reconstruct_ep1 = graph->AddTask([decode_info, tile, job] {
+      ReconstructTileEndpoints(decode_info, tile, job->curr_dxt, 1);
+    });
+
+    MPTC::TaskGraph::TaskHandle reconstruct_ep2 = graph->AddTask([decode_info, tile, job] {
+      ReconstructTileEndpoints(decode_info, tile, job->curr_dxt, 2);
+    });
+
+    graph->AddDependency(stream_decode[eStream_Ep1_Y], reconstruct_ep1);
+    graph->AddDependency(stream_decode[eStream_Ep1_C], reconstruct_ep1);
+    graph->AddDependency(stream_decode[eStream_Ep2_Y], reconstruct_ep2);
+    graph->AddDependency(stream_decode[eStream_Ep2_C], reconstruct_ep2);
+
+    // Nothing to do unless the caller asked for a dirty map
+    MPTC::TaskGraph::TaskHandle mark_dirty = graph->AddTask([decode_info, tile, job] {
+      MarkDirtyBlocks(decode_info, tile, job->prev_dxt, job->curr_dxt);
+    });
+    graph->AddDependency(reconstruct_interp, mark_dirty);
+    graph->AddDependency(reconstruct_ep1, mark_dirty);
+    graph->AddDependency(reconstruct_ep2, mark_dirty);
+  }
+
+  return graph;
+}
+
 void GetFrameMultiThread(std::ifstream &in_stream, 
                         PhysicalDXTBlock *prev_dxt, 
 			PhysicalDXTBlock *curr_dxt, 
@@ -423,294 +1190,524 @@ void GetFrameMultiThread(std::ifstream &in_stream,
     exit(-1);
   }
 
-  if(in_stream.eof()) {
+  MPTC::StreamSource source(in_stream);
+  GetFrameMultiThread(source, prev_dxt, curr_dxt, decode_info);
+}
+
+void GetFrameMultiThread(MPTC::ByteSource &source, 
+                        PhysicalDXTBlock *prev_dxt, 
+			PhysicalDXTBlock *curr_dxt, 
+			MPTCDecodeInfo *decode_info) 
+{
+
+  if(source.AtEnd()) {
     std::cerr << "Error end of file reached, no more frames!" << std::endl;
     exit(-1);
   }
   // This is the start read all the frame meta data once and store it in the DecodeInfo for 
   // decoding further frames
   
-  if(decode_info->is_start) {
-
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->frame_height)), 4);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->frame_width)), 4);
-    decode_info->num_blocks = (decode_info->frame_height/4 * decode_info->frame_width/4);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->unique_interval)), 1);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->search_area)), 1);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->total_frame_count)), 4);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->max_unique_count)), 4);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->max_compressed_palette)), 4);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->max_compressed_motion_indices)), 4);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->max_compressed_ep_Y)), 4);
-    in_stream.read(reinterpret_cast<char*>(&(decode_info->max_compressed_ep_C)), 4);
-    decode_info->is_unique = true;
-    decode_info->curr_frame = 0;
+  if(decode_info->is_start)
+    OpenDecodeInfo(source, decode_info);
+
+  // The pool and the task graph live as long as the decode info, so no
+  // threads are created per frame. The header may already have been read
+  // by GetFrame or SeekFrame.
+  if(!decode_info->is_multi_thread) {
+    if(decode_info->thread_pool == NULL) {
+      decode_info->thread_pool = new MPTC::ThreadPool(decode_info->num_threads);
+      decode_info->owns_thread_pool = true;
+    }
+    if(decode_info->decode_graph == NULL)
+      decode_info->decode_graph = BuildDecodeGraph(decode_info);
     decode_info->is_multi_thread = true;
+  }
+  StageClock::time_point start = StageClock::now();
 
-    // malloc memories to be used for further decoding of all the frames
-    decode_info->comp_palette = (uint8_t*)(malloc(decode_info->max_compressed_palette));
-    decode_info->uncomp_palette = (uint8_t*)(malloc(decode_info->max_unique_count));
-    decode_info->comp_motion_indices = (uint8_t*)(malloc(decode_info->max_compressed_motion_indices));
-    decode_info->motion_indices = (uint8_t*)(malloc(2 * decode_info->num_blocks));
-
-    decode_info->wav_ep1_Y = (uint8_t*)(malloc(decode_info->num_blocks));
-    decode_info->wav_ep1_C = (uint8_t*)(malloc(2 * decode_info->num_blocks));
-
-    decode_info->wav_ep2_Y = (uint8_t*)(malloc(decode_info->num_blocks));
-    decode_info->wav_ep2_C = (uint8_t*)(malloc(2 * decode_info->num_blocks));
-
-    decode_info->ep1_Y = (int8_t*)(malloc(decode_info->num_blocks));
-    decode_info->ep2_Y = (int8_t*)(malloc(decode_info->num_blocks));
-    decode_info->ep1_Co = (int8_t*)(malloc(decode_info->num_blocks));
-    decode_info->ep2_Co = (int8_t*)(malloc(decode_info->num_blocks));
-    decode_info->ep1_Cg = (int8_t*)(malloc(decode_info->num_blocks));
-    decode_info->ep2_Cg = (int8_t*)(malloc(decode_info->num_blocks));
-    decode_info->is_start = false;
-
-    if(decode_info->is_multi_thread) {
-      decode_info->comp_ep1_Y = (uint8_t*)(malloc(decode_info->max_compressed_ep_Y));
-      decode_info->comp_ep1_C = (uint8_t*)(malloc(decode_info->max_compressed_ep_C));
-      decode_info->comp_ep2_Y = (uint8_t*)(malloc(decode_info->max_compressed_ep_Y));
-      decode_info->comp_ep2_C = (uint8_t*)(malloc(decode_info->max_compressed_ep_C));
-    }
+  // If unique set then decode the current dictionary
+  if(decode_info->is_unique)
+    ReadPalette(source, decode_info);
 
+  // Find all the compressed streams of the frame, then let the pool decode
+  // and reconstruct them
+  MPTCFrameJob *job = &decode_info->frame_job;
+  job->prev_dxt = prev_dxt;
+  job->curr_dxt = curr_dxt;
+  job->num_unique = ReadFrameStreams(source, decode_info);
 
-  }
+  decode_info->decode_graph->Run(*decode_info->thread_pool);
 
+  AddFrameStats(decode_info, false, start);
+  FinishFrame(source, decode_info, job->num_unique);
+  return;
+}
 
-  // If unique set then decode the current dictionary
-  if(decode_info->is_unique) {
 
-    decode_info->unique_idx_offset = 0;
-    decode_info->curr_idx = 0;
-    uint32_t compressed_palette_size;
-    in_stream.read(reinterpret_cast<char*>(&compressed_palette_size), 4);
-    in_stream.read(reinterpret_cast<char*>(decode_info->comp_palette), compressed_palette_size);
-    uint32_t unique_count;
-    in_stream.read(reinterpret_cast<char*>(&unique_count), 4);
-    assert(decode_info->comp_palette != NULL && decode_info->uncomp_palette != NULL);
 
-    EntropyDecode(decode_info->comp_palette, decode_info->uncomp_palette,
-                  compressed_palette_size, unique_count, false);
-    decode_info->is_unique = false;
-    decode_info->curr_frame++;
+//////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////        Decoder                //////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////
 
-  }
-  // Decode a single frame
-  uint32_t num_unique;
-  in_stream.read(reinterpret_cast<char*>(&num_unique), 4);
-  uint32_t *unique_indices = reinterpret_cast<uint32_t*>(decode_info->uncomp_palette + decode_info->unique_idx_offset);
+namespace MPTC {
 
-  uint32_t comp_motion_indices_sz;
-  in_stream.read(reinterpret_cast<char*>(&comp_motion_indices_sz), 4);
-  in_stream.read(reinterpret_cast<char*>(decode_info->comp_motion_indices), comp_motion_indices_sz);
- 
-  // Motion Indices Thread
-  std::thread motion_decode(EntropyDecode, // Function pointer or Name
-                            decode_info->comp_motion_indices,
-                            decode_info->motion_indices,
-		            comp_motion_indices_sz,
-                            2 * decode_info->num_blocks,
-                            false);
-
-  uint32_t comp_Y2_sz, comp_C2_sz;
-  uint32_t comp_Y1_sz, comp_C1_sz;
-
-
-  //************************Endpoint 1********************//
-  //Endpoint One(1) Thread for Y channel
-  in_stream.read(reinterpret_cast<char*>(&comp_Y1_sz), 4);
-  in_stream.read(reinterpret_cast<char*>(decode_info->comp_ep1_Y), comp_Y1_sz);
-
-  std::thread ep1_Y_decode(EntropyDecode,
-                           decode_info->comp_ep1_Y,
-                           decode_info->wav_ep1_Y,
-		           comp_Y1_sz,
-		           decode_info->num_blocks,
-                           false);
-
-  // Endpoing One(1) Thread for C channel
-  in_stream.read(reinterpret_cast<char*>(&comp_C1_sz), 4);
-  in_stream.read(reinterpret_cast<char*>(decode_info->comp_ep1_C), comp_C1_sz);
-
-  std::thread ep1_C_decode(EntropyDecode,
-                           decode_info->comp_ep1_C,
-                           decode_info->wav_ep1_C,
-		           comp_C1_sz,
-		           2 * decode_info->num_blocks,
-		           false);
-
-
-
-
-
-  ///******************Endpoint 2**********//
-  // Endpoint Two(2) Thread for Y channel
-  in_stream.read(reinterpret_cast<char*>(&comp_Y2_sz), 4);
-  in_stream.read(reinterpret_cast<char*>(decode_info->comp_ep2_Y), comp_Y2_sz);
-  std::thread ep2_Y_decode(EntropyDecode,
-                           decode_info->comp_ep2_Y,
-                           decode_info->wav_ep2_Y,
-		           comp_Y2_sz,
-		           decode_info->num_blocks,
-                           false);
-
-
-  //Endpoint Two(2) Thread C channel
-  in_stream.read(reinterpret_cast<char*>(&comp_C2_sz), 4);
-  in_stream.read(reinterpret_cast<char*>(decode_info->comp_ep2_C), comp_C2_sz);
-  std::thread ep2_C_decode(EntropyDecode,
-                           decode_info->comp_ep2_C,
-                           decode_info->wav_ep2_C,
-		           comp_C2_sz,
-                           2 * decode_info->num_blocks,
-                           false);
-
-  // Wait for motion indices to be decoded
-  if(motion_decode.joinable())
-    motion_decode.join();
-  else std::cout << "motion decode thread join error!" << std::endl;
-
-   std::thread reconstruct_interp(ReconstructDXTFrame,
-      reinterpret_cast<uint32_t*>(decode_info->uncomp_palette + decode_info->unique_idx_offset),
-      num_unique,
-      decode_info,
-      prev_dxt,
-      curr_dxt
-      );
-
-
-   // Wait for ep1 Y and C decoding
-   if(ep1_Y_decode.joinable())
-     ep1_Y_decode.join(); 
-  else std::cout << "ep1 Y decode thread join error!" << std::endl;
-
-   if(ep1_C_decode.joinable())
-     ep1_C_decode.join();
-   else std::cout << "ep1 C decode thread join error!" << std::endl;
-  
-   std::thread reconstruct_ep1(ReconstructEndpoints,
-                               decode_info, 
-			       curr_dxt, 
-			       1);
-
-   // Wait for ep2 Y and C decoding
-   if(ep2_Y_decode.joinable())
-     ep2_Y_decode.join(); 
-  else std::cout << "ep2 Y decode thread join error!" << std::endl;
-
-   if(ep2_C_decode.joinable())
-     ep2_C_decode.join();
-  else std::cout << "ep2 C decode thread join error!" << std::endl;
-
-
-   std::thread reconstruct_ep2(ReconstructEndpoints,
-                               decode_info,
-			       curr_dxt,
-			       2);
-
-   if(reconstruct_interp.joinable())
-     reconstruct_interp.join();
-   else std::cout << "reconstruct interp thread join error!" << std::endl;
-
-   if(reconstruct_ep1.joinable())
-     reconstruct_ep1.join(); 
-   else std::cout << "reconstruct ep1 thread join error!" << std::endl;
- 
-   if(reconstruct_ep2.joinable())
-     reconstruct_ep2.join();
-   else std::cout << "reconstruct ep2 thread join error!" << std::endl;
-
-   
-   decode_info->unique_idx_offset += 4*num_unique;
-   if(decode_info->curr_idx >= decode_info->unique_interval-1) {
-     decode_info->curr_idx = 0;
-     decode_info->is_unique = true;
-   }
-
-   decode_info->curr_idx++;
-
-   if(decode_info->curr_frame >= decode_info->total_frame_count) {
-     in_stream.seekg(0, in_stream.beg);
-     in_stream.seekg(34);
-     decode_info->is_unique = true;
-     decode_info->curr_frame = 0;
-   }
+Decoder::Decoder() : _source(NULL) {
+  InitDecodeInfo(&_decode_info);
+}
 
-  return;
+Decoder::~Decoder() {
+  Close();
 }
 
+bool Decoder::Open(ByteSource &source, uint32_t num_threads) {
+  Close();
+
+  InitDecodeInfo(&_decode_info, num_threads);
+  if(source.Size() < kMPTCLegacyHeaderSize)
+    return false;
+
+  source.Seek(0);
+  OpenDecodeInfo(source, &_decode_info);
+  _source = &source;
+  return true;
+}
+
+void Decoder::Close() {
+  FreeDecodeInfo(&_decode_info);
+  _source = NULL;
+}
+
+void Decoder::SetRowPitch(uint32_t row_pitch) {
+  assert(IsOpen() && "Decoder is not open");
+  assert(row_pitch % sizeof(PhysicalDXTBlock) == 0);
+
+  uint32_t pitch = row_pitch / sizeof(PhysicalDXTBlock);
+  _decode_info.dxt_pitch = pitch == 0 ? _decode_info.frame_width/4 : pitch;
+  assert(_decode_info.dxt_pitch >= _decode_info.frame_width/4);
+}
+
+int Decoder::DecodeFrame(PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt) {
+  assert(IsOpen() && "Decoder is not open");
+  return GetFrame(*_source, prev_dxt, curr_dxt, &_decode_info);
+}
+
+void Decoder::DecodeFrameMultiThread(PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt) {
+  assert(IsOpen() && "Decoder is not open");
+  GetFrameMultiThread(*_source, prev_dxt, curr_dxt, &_decode_info);
+}
+
+int Decoder::SkimFrame(PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt) {
+  assert(IsOpen() && "Decoder is not open");
+  return ::SkimFrame(*_source, prev_dxt, curr_dxt, &_decode_info);
+}
+
+int Decoder::Seek(const std::vector<FrameIndexEntry> &index, uint32_t frame,
+                  PhysicalDXTBlock *scratch_dxt, PhysicalDXTBlock *curr_dxt, MPTCSeekStats *stats) {
+  assert(IsOpen() && "Decoder is not open");
+  return SeekFrame(*_source, index, frame, scratch_dxt, curr_dxt, &_decode_info, stats);
+}
+
+}  // namespace MPTC
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////        Buffered Decoding      //////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////
 
+// Sleeps for a little longer each time the ring is full or empty, so a
+// waiting thread does not spin on a core the decoder could use
+static void Backoff(uint32_t &num_waits) {
+  if (num_waits < 16)
+    std::this_thread::yield();
+  else
+    std::this_thread::sleep_for(std::chrono::microseconds(std::min(50u * (num_waits - 15), 2000u)));
+  num_waits++;
+}
+
+bool CanDecodeBufferedFrame(BufferStruct *ptr_buffer_struct) {
+  uint8_t decode_idx = ptr_buffer_struct->curr_decode_idx;
+  return ptr_buffer_struct->slot_state[decode_idx].load(std::memory_order_acquire) == eSlotState_Free;
+}
+
+// Looks for a key frame of index at most max_ahead frames after frame
+// number frame, sets key_frame to the first one and returns true if there
+// is one
+static bool NextKeyFrame(const std::vector<MPTC::FrameIndexEntry> &index, uint64_t frame, uint64_t max_ahead,
+                         uint64_t *key_frame) {
+  for(uint64_t ahead = 0; ahead <= max_ahead; ahead++) {
+    if(index[(frame + ahead) % index.size()].flags & MPTC::kFrameIndexFlag_Key) {
+      *key_frame = frame + ahead;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Carries out a pending RequestBufferedSkip, leaving the frame it skipped
+// to decoded into the slot. Returns false if there is nothing to skip.
+static bool DecodeBufferedSkip(BufferStruct *ptr_buffer_struct, PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt) {
+  uint64_t request = ptr_buffer_struct->skip_request.load(std::memory_order_acquire);
+  uint64_t target = request & ~kMPTCSkipToKey;
+  uint64_t next_frame = ptr_buffer_struct->next_frame.load(std::memory_order_relaxed);
+  if(target <= next_frame)
+    return false;
+
+  MPTCDecodeInfo *decode_info = ptr_buffer_struct->ptr_decode_info;
+  const std::vector<MPTC::FrameIndexEntry> *index = ptr_buffer_struct->frame_index.load(std::memory_order_acquire);
+  if((request & kMPTCSkipToKey) && index != NULL && index->size() == decode_info->total_frame_count) {
+    // A key frame needs no reference, decoding restarts right there
+    uint64_t key_frame;
+    if(NextKeyFrame(*index, target, kMPTCMaxKeyJumpFrames, &key_frame) &&
+       SeekFrame(*ptr_buffer_struct->source, *index, static_cast<uint32_t>(key_frame % index->size()),
+                 ptr_buffer_struct->scratch_dxt, curr_dxt, decode_info) == 0) {
+      ptr_buffer_struct->frames_jumped.fetch_add(key_frame - next_frame, std::memory_order_relaxed);
+      ptr_buffer_struct->key_jumps.fetch_add(1, std::memory_order_relaxed);
+      ptr_buffer_struct->next_frame.store(key_frame, std::memory_order_relaxed);
+      return true;
+    }
+  }
+
+  // Only the interpolation data of the frames up to the target is rebuilt.
+  // They alternate between the scratch frame and the slot, the one right
+  // before the target has to end up in the scratch frame.
+  uint64_t num_skimmed = target - next_frame;
+  for(uint64_t frame = next_frame; frame < target; frame++) {
+    PhysicalDXTBlock *dxt = (target - 1 - frame) % 2 == 0 ? ptr_buffer_struct->scratch_dxt : curr_dxt;
+    SkimFrame(*ptr_buffer_struct->source, prev_dxt, dxt, decode_info);
+    prev_dxt = dxt;
+  }
+  GetFrameMultiThread(*ptr_buffer_struct->source, prev_dxt, curr_dxt, decode_info);
+
+  // The frames skimmed were never shown, the whole target changed
+  MarkAllDirty(decode_info);
+  ptr_buffer_struct->frames_skimmed.fetch_add(num_skimmed, std::memory_order_relaxed);
+  ptr_buffer_struct->next_frame.store(target, std::memory_order_relaxed);
+  return true;
+}
+
+// Queues the record of a published frame for ReadBufferedFrameStats, or
+// drops it if the reader is a whole ring behind
+static void PushBufferedFrameStats(BufferStruct *ptr_buffer_struct, const MPTCBufferedFrameStats &record) {
+  uint64_t written = ptr_buffer_struct->stats_written.load(std::memory_order_relaxed);
+  if(written - ptr_buffer_struct->stats_read.load(std::memory_order_acquire) >= kMPTCFrameStatsRingSize) {
+    ptr_buffer_struct->stats_dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  ptr_buffer_struct->frame_stats[written % kMPTCFrameStatsRingSize] = record;
+  ptr_buffer_struct->stats_written.store(written + 1, std::memory_order_release);
+}
+
+void DecodeBufferedFrame(BufferStruct *ptr_buffer_struct) {
+  uint8_t decode_idx = ptr_buffer_struct->curr_decode_idx;
+  std::chrono::high_resolution_clock::time_point start_time = std::chrono::high_resolution_clock::now();
+
+  MPTCBufferedFrameStats record;
+  memset(&record, 0, sizeof(record));
+  record.start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - ptr_buffer_struct->start_time).count();
+  record.decode.stage_ns[eDecodeStage_QueueWait] = ptr_buffer_struct->queue_wait_ns;
+  ptr_buffer_struct->queue_wait_ns = 0;
+  uint64_t key_jumps = ptr_buffer_struct->key_jumps.load(std::memory_order_relaxed);
+
+  // The previous frame stays valid while we read from it: the consumer
+  // never writes a slot and we only overwrite it one lap later
+  PhysicalDXTBlock *prev_dxt = ptr_buffer_struct->has_prev ?
+    ptr_buffer_struct->buffered_dxts[ptr_buffer_struct->prev_decode_idx] : NULL;
+
+  MPTCDecodeInfo *decode_info = ptr_buffer_struct->ptr_decode_info;
+  PhysicalDXTBlock *curr_dxt = ptr_buffer_struct->buffered_dxts[decode_idx];
+  decode_info->dirty_map = ptr_buffer_struct->dirty_maps + static_cast<size_t>(decode_idx) * ptr_buffer_struct->dirty_map_sz;
+  decode_info->frame_stats = &record.decode;
+  if(!DecodeBufferedSkip(ptr_buffer_struct, prev_dxt, curr_dxt))
+    GetFrameMultiThread(*ptr_buffer_struct->source, prev_dxt, curr_dxt, decode_info);
+  decode_info->frame_stats = NULL;
+  ptr_buffer_struct->num_dirty_blocks[decode_idx].store(decode_info->num_dirty_blocks, std::memory_order_relaxed);
+
+  uint64_t frame = ptr_buffer_struct->next_frame.load(std::memory_order_relaxed);
+  ptr_buffer_struct->slot_frames[decode_idx] = frame;
+  ptr_buffer_struct->next_frame.store(frame + 1, std::memory_order_relaxed);
+  ptr_buffer_struct->decode_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::high_resolution_clock::now() - start_time).count(), std::memory_order_relaxed);
+
+  ptr_buffer_struct->slot_state[decode_idx].store(eSlotState_Ready, std::memory_order_release);
+  ptr_buffer_struct->frames_decoded.fetch_add(1, std::memory_order_relaxed);
+
+  record.frame_number = frame;
+  record.is_key_jump = ptr_buffer_struct->key_jumps.load(std::memory_order_relaxed) != key_jumps;
+  for(uint8_t idx = 0; idx < ptr_buffer_struct->buffer_sz; idx++) {
+    if(ptr_buffer_struct->slot_state[idx].load(std::memory_order_relaxed) == eSlotState_Ready)
+      record.occupancy++;
+  }
+  PushBufferedFrameStats(ptr_buffer_struct, record);
+
+  ptr_buffer_struct->prev_decode_idx = decode_idx;
+  ptr_buffer_struct->has_prev = true;
+  ptr_buffer_struct->curr_decode_idx = (decode_idx + 1) % ptr_buffer_struct->buffer_sz;
+}
+
+static void BufferedDecodeLoop(BufferStruct *ptr_buffer_struct) {
+
+  while(!ptr_buffer_struct->stop.load(std::memory_order_acquire)) {
+    // Back-pressure: wait for the consumer to give the slot back
+    uint32_t num_waits = 0;
+    std::chrono::steady_clock::time_point wait_start;
+    while(!CanDecodeBufferedFrame(ptr_buffer_struct)) {
+      if(ptr_buffer_struct->stop.load(std::memory_order_acquire))
+        return;
+      if(num_waits == 0) {
+        ptr_buffer_struct->producer_waits.fetch_add(1, std::memory_order_relaxed);
+        wait_start = std::chrono::steady_clock::now();
+      }
+      Backoff(num_waits);
+    }
+    if(num_waits > 0) {
+      ptr_buffer_struct->queue_wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - wait_start).count();
+    }
+
+    DecodeBufferedFrame(ptr_buffer_struct);
+  }
+}
+
 int InitBufferedDecode(uint8_t buffer_sz, 
                        BufferStruct* &ptr_buffer_struct,
 		       std::ifstream &in_stream,
-		       uint32_t num_blocks) {
-  
+		       uint32_t num_blocks,
+		       uint32_t num_threads) {
+
+  int result = InitBufferedDecode(buffer_sz, ptr_buffer_struct, *new MPTC::StreamSource(in_stream),
+                                  num_blocks, num_threads);
+  ptr_buffer_struct->owns_source = true;
+  return result;
+}
+
+int InitBufferedDecode(uint8_t buffer_sz, 
+                       BufferStruct* &ptr_buffer_struct,
+		       MPTC::ByteSource &source,
+		       uint32_t num_blocks,
+		       uint32_t num_threads) {
+
+  // All slots share one allocation
+  MPTC::MemoryDestination *destination =
+    new MPTC::MemoryDestination(buffer_sz, static_cast<size_t>(num_blocks) * sizeof(PhysicalDXTBlock));
+  int result = InitBufferedDecode(ptr_buffer_struct, source, *destination, num_threads);
+  ptr_buffer_struct->owns_destination = true;
+  return result;
+}
+
+// Everything of the ring but the decoder thread
+static void AllocateRing(BufferStruct* &ptr_buffer_struct,
+                         MPTC::ByteSource &source,
+                         MPTC::FrameDestination &destination,
+                         uint32_t num_threads,
+                         MPTC::ThreadPool *pool) {
+
   // Decode Info
+  uint32_t buffer_sz = destination.NumSlots();
   assert(2 < buffer_sz && buffer_sz < 20 && "!!Buffer Size too Big!!\n");
+  assert(destination.RowPitch() % sizeof(PhysicalDXTBlock) == 0);
 
+  ptr_buffer_struct = new BufferStruct;
   ptr_buffer_struct->ptr_decode_info = (MPTCDecodeInfo*)malloc(sizeof(MPTCDecodeInfo));
-  ptr_buffer_struct->ptr_decode_info->is_start = true;
-  ptr_buffer_struct->buffer_sz = buffer_sz; 
+  InitDecodeInfo(ptr_buffer_struct->ptr_decode_info, num_threads);
+  ptr_buffer_struct->ptr_decode_info->thread_pool = pool;
+  ptr_buffer_struct->ptr_decode_info->dxt_pitch = destination.RowPitch() / sizeof(PhysicalDXTBlock);
+  ptr_buffer_struct->buffer_sz = static_cast<uint8_t>(buffer_sz);
+
+  // Read the header up front, the dirty maps are sized from it
+  OpenDecodeInfo(source, ptr_buffer_struct->ptr_decode_info);
+  ptr_buffer_struct->dirty_map_sz = (ptr_buffer_struct->ptr_decode_info->frame_height/4) *
+    ptr_buffer_struct->ptr_decode_info->dirty_map_pitch;
+  ptr_buffer_struct->dirty_maps = (uint64_t*)calloc(static_cast<size_t>(buffer_sz) * ptr_buffer_struct->dirty_map_sz,
+                                                    sizeof(uint64_t));
+  ptr_buffer_struct->num_dirty_blocks = new std::atomic<uint32_t>[buffer_sz];
 
   ptr_buffer_struct->buffered_dxts = (PhysicalDXTBlock**)malloc(buffer_sz * sizeof(PhysicalDXTBlock*));
+  ptr_buffer_struct->slot_state = new std::atomic<uint8_t>[buffer_sz];
+  ptr_buffer_struct->slot_frames = (uint64_t*)calloc(buffer_sz, sizeof(uint64_t));
+  ptr_buffer_struct->scratch_dxt = (PhysicalDXTBlock*)malloc(static_cast<size_t>(ptr_buffer_struct->ptr_decode_info->frame_height/4) *
+                                                             ptr_buffer_struct->ptr_decode_info->dxt_pitch * sizeof(PhysicalDXTBlock));
 
   for(uint8_t idx = 0; idx < buffer_sz; idx++){
-    ptr_buffer_struct->buffered_dxts[idx] = (PhysicalDXTBlock*)malloc(num_blocks * sizeof(PhysicalDXTBlock));
+    ptr_buffer_struct->buffered_dxts[idx] = destination.Slot(idx);
+    ptr_buffer_struct->slot_state[idx].store(eSlotState_Free, std::memory_order_relaxed);
+    ptr_buffer_struct->num_dirty_blocks[idx].store(0, std::memory_order_relaxed);
   }
 
   ptr_buffer_struct->curr_dxt_idx = 0;
-  GetFrameMultiThread(in_stream,
-                      NULL,
-		      ptr_buffer_struct->buffered_dxts[0],
-		      ptr_buffer_struct->ptr_decode_info
-                     );
+  ptr_buffer_struct->is_holding = false;
+  ptr_buffer_struct->curr_decode_idx = 0;
+  ptr_buffer_struct->prev_decode_idx = 0;
+  ptr_buffer_struct->has_prev = false;
+  ptr_buffer_struct->source = &source;
+  ptr_buffer_struct->owns_source = false;
+  ptr_buffer_struct->destination = &destination;
+  ptr_buffer_struct->owns_destination = false;
+  ptr_buffer_struct->stop.store(false);
+  ptr_buffer_struct->frames_decoded.store(0);
+  ptr_buffer_struct->frames_consumed.store(0);
+  ptr_buffer_struct->underruns.store(0);
+  ptr_buffer_struct->producer_waits.store(0);
+  ptr_buffer_struct->dirty_blocks.store(0);
+  ptr_buffer_struct->next_frame.store(0);
+  ptr_buffer_struct->skip_request.store(0);
+  ptr_buffer_struct->frame_index.store(NULL);
+  ptr_buffer_struct->frames_skimmed.store(0);
+  ptr_buffer_struct->frames_jumped.store(0);
+  ptr_buffer_struct->key_jumps.store(0);
+  ptr_buffer_struct->decode_ns.store(0);
+  ptr_buffer_struct->frame_stats = new MPTCBufferedFrameStats[kMPTCFrameStatsRingSize];
+  ptr_buffer_struct->stats_written.store(0);
+  ptr_buffer_struct->stats_read.store(0);
+  ptr_buffer_struct->stats_dropped.store(0);
+  ptr_buffer_struct->start_time = std::chrono::steady_clock::now();
+  ptr_buffer_struct->queue_wait_ns = 0;
+  ptr_buffer_struct->decode_thread = NULL;
+}
 
-  for(uint8_t idx = 1; idx < buffer_sz - 1; idx++) {
+int InitBufferedDecode(BufferStruct* &ptr_buffer_struct,
+		       MPTC::ByteSource &source,
+		       MPTC::FrameDestination &destination,
+		       uint32_t num_threads) {
+  AllocateRing(ptr_buffer_struct, source, destination, num_threads, NULL);
+  ptr_buffer_struct->decode_thread = new std::thread(BufferedDecodeLoop, ptr_buffer_struct);
 
-    GetFrameMultiThread(in_stream,
-	                ptr_buffer_struct->buffered_dxts[idx - 1],
-			ptr_buffer_struct->buffered_dxts[idx],
-			ptr_buffer_struct->ptr_decode_info
-	               );
+  // Prefill the ring before playback starts
+  uint32_t num_waits = 0;
+  while(ptr_buffer_struct->frames_decoded.load(std::memory_order_acquire) <
+        static_cast<uint64_t>(ptr_buffer_struct->buffer_sz - 1))
+    Backoff(num_waits);
 
+  return 0;
+}
+
+int InitBufferedDecodeOnPool(BufferStruct* &ptr_buffer_struct,
+                             MPTC::ByteSource &source,
+                             MPTC::FrameDestination &destination,
+                             MPTC::ThreadPool &pool) {
+  AllocateRing(ptr_buffer_struct, source, destination, 0, &pool);
+  return 0;
+}
+
+
+int GetBufferedFrame(BufferStruct *ptr_buffer_struct, PhysicalDXTBlock * &curr_dxt) {
+
+  uint8_t next_idx = ptr_buffer_struct->is_holding ?
+    (ptr_buffer_struct->curr_dxt_idx + 1) % ptr_buffer_struct->buffer_sz :
+    ptr_buffer_struct->curr_dxt_idx;
+
+  if(ptr_buffer_struct->slot_state[next_idx].load(std::memory_order_acquire) != eSlotState_Ready) {
+    // Underrun: keep showing whatever we hold and let the decoder catch up
+    ptr_buffer_struct->underruns.fetch_add(1, std::memory_order_relaxed);
+    curr_dxt = ptr_buffer_struct->is_holding ?
+      ptr_buffer_struct->buffered_dxts[ptr_buffer_struct->curr_dxt_idx] : NULL;
+    return kMPTCFrameNotReady;
   }
 
-  ptr_buffer_struct->curr_decode_idx = ptr_buffer_struct->buffer_sz - 1;
-  ptr_buffer_struct->prev_decode_idx = ptr_buffer_struct->buffer_sz - 1 - 1;
+  // Hand the frame we were holding back to the decoder
+  if(ptr_buffer_struct->is_holding)
+    ptr_buffer_struct->slot_state[ptr_buffer_struct->curr_dxt_idx].store(eSlotState_Free, std::memory_order_release);
 
-  return 0;
+  ptr_buffer_struct->slot_state[next_idx].store(eSlotState_Held, std::memory_order_relaxed);
+  ptr_buffer_struct->curr_dxt_idx = next_idx;
+  ptr_buffer_struct->is_holding = true;
+  ptr_buffer_struct->frames_consumed.fetch_add(1, std::memory_order_relaxed);
+  ptr_buffer_struct->dirty_blocks.fetch_add(ptr_buffer_struct->num_dirty_blocks[next_idx].load(std::memory_order_relaxed),
+                                            std::memory_order_relaxed);
+
+  curr_dxt = ptr_buffer_struct->buffered_dxts[next_idx];
+  return kMPTCFrameReady;
+}
+
+bool PeekBufferedFrame(BufferStruct *ptr_buffer_struct, uint64_t *frame_number) {
+  uint8_t next_idx = ptr_buffer_struct->is_holding ?
+    (ptr_buffer_struct->curr_dxt_idx + 1) % ptr_buffer_struct->buffer_sz :
+    ptr_buffer_struct->curr_dxt_idx;
+
+  if(ptr_buffer_struct->slot_state[next_idx].load(std::memory_order_acquire) != eSlotState_Ready)
+    return false;
+  *frame_number = ptr_buffer_struct->slot_frames[next_idx];
+  return true;
 }
 
+uint64_t GetBufferedFrameNumber(BufferStruct *ptr_buffer_struct) {
+  assert(ptr_buffer_struct->is_holding && "No MPTC frame handed out yet");
+  return ptr_buffer_struct->slot_frames[ptr_buffer_struct->curr_dxt_idx];
+}
 
-int GetBufferedFrame(BufferStruct *ptr_buffer_struct, PhysicalDXTBlock * &curr_dxt, std::ifstream  &in_stream) {
+void RequestBufferedSkip(BufferStruct *ptr_buffer_struct, uint64_t frame) {
+  ptr_buffer_struct->skip_request.store(frame, std::memory_order_release);
+}
 
-  curr_dxt = ptr_buffer_struct->buffered_dxts[ptr_buffer_struct->curr_dxt_idx];
+void SetBufferedFrameIndex(BufferStruct *ptr_buffer_struct, const std::vector<MPTC::FrameIndexEntry> *index) {
+  ptr_buffer_struct->frame_index.store(index, std::memory_order_release);
+}
 
-  std::thread th_decode_frame(GetFrameMultiThread,
-                             std::ref(in_stream),
-                             ptr_buffer_struct->buffered_dxts[ptr_buffer_struct->prev_decode_idx],
-			     ptr_buffer_struct->buffered_dxts[ptr_buffer_struct->curr_decode_idx],
-			     ptr_buffer_struct->ptr_decode_info);
+void GetBufferedDecodeStats(BufferStruct *ptr_buffer_struct, MPTCBufferStats *stats) {
+  stats->frames_decoded = ptr_buffer_struct->frames_decoded.load(std::memory_order_relaxed);
+  stats->frames_consumed = ptr_buffer_struct->frames_consumed.load(std::memory_order_relaxed);
+  stats->underruns = ptr_buffer_struct->underruns.load(std::memory_order_relaxed);
+  stats->producer_waits = ptr_buffer_struct->producer_waits.load(std::memory_order_relaxed);
+  stats->buffer_sz = ptr_buffer_struct->buffer_sz;
+  stats->dirty_blocks = ptr_buffer_struct->dirty_blocks.load(std::memory_order_relaxed);
+  stats->num_blocks = ptr_buffer_struct->ptr_decode_info->num_blocks;
+  stats->frames_skimmed = ptr_buffer_struct->frames_skimmed.load(std::memory_order_relaxed);
+  stats->frames_jumped = ptr_buffer_struct->frames_jumped.load(std::memory_order_relaxed);
+  stats->key_jumps = ptr_buffer_struct->key_jumps.load(std::memory_order_relaxed);
+  stats->decode_ms = stats->frames_decoded == 0 ? 0.0 :
+    ptr_buffer_struct->decode_ns.load(std::memory_order_relaxed) / 1.0e6 / stats->frames_decoded;
+  stats->stats_dropped = ptr_buffer_struct->stats_dropped.load(std::memory_order_relaxed);
+
+  stats->occupancy = 0;
+  for(uint8_t idx = 0; idx < ptr_buffer_struct->buffer_sz; idx++) {
+    if(ptr_buffer_struct->slot_state[idx].load(std::memory_order_relaxed) == eSlotState_Ready)
+      stats->occupancy++;
+  }
+}
 
-  
-  if(th_decode_frame.joinable())
-    th_decode_frame.detach();
-  else std::cout << "Get Frame MultiThread not joinable!" << std::endl;
-  
-  ptr_buffer_struct->curr_decode_idx  = 
-    (ptr_buffer_struct->curr_decode_idx + 1) % ptr_buffer_struct->buffer_sz;
+uint32_t ReadBufferedFrameStats(BufferStruct *ptr_buffer_struct, MPTCBufferedFrameStats *stats, uint32_t max_stats) {
+  uint64_t read = ptr_buffer_struct->stats_read.load(std::memory_order_relaxed);
+  uint64_t written = ptr_buffer_struct->stats_written.load(std::memory_order_acquire);
+  uint32_t num_stats = static_cast<uint32_t>(std::min<uint64_t>(written - read, max_stats));
+  for(uint32_t idx = 0; idx < num_stats; idx++)
+    stats[idx] = ptr_buffer_struct->frame_stats[(read + idx) % kMPTCFrameStatsRingSize];
+  ptr_buffer_struct->stats_read.store(read + num_stats, std::memory_order_release);
+  return num_stats;
+}
 
-  ptr_buffer_struct->prev_decode_idx  = 
-    (ptr_buffer_struct->prev_decode_idx + 1) % ptr_buffer_struct->buffer_sz;
+const uint64_t *GetBufferedDirtyMap(BufferStruct *ptr_buffer_struct, uint32_t *num_dirty_blocks) {
+  if(!ptr_buffer_struct->is_holding)
+    return NULL;
 
-  ptr_buffer_struct->curr_dxt_idx = 
-    (ptr_buffer_struct->curr_dxt_idx + 1) % ptr_buffer_struct->buffer_sz;
+  uint8_t idx = ptr_buffer_struct->curr_dxt_idx;
+  if(num_dirty_blocks != NULL)
+    *num_dirty_blocks = ptr_buffer_struct->num_dirty_blocks[idx].load(std::memory_order_relaxed);
+  return ptr_buffer_struct->dirty_maps + static_cast<size_t>(idx) * ptr_buffer_struct->dirty_map_sz;
+}
 
-  return 0;
+void DestroyBufferedDecode(BufferStruct* &ptr_buffer_struct) {
+  if(ptr_buffer_struct == NULL)
+    return;
+
+  ptr_buffer_struct->stop.store(true, std::memory_order_release);
+  if(ptr_buffer_struct->decode_thread != NULL && ptr_buffer_struct->decode_thread->joinable())
+    ptr_buffer_struct->decode_thread->join();
+  delete ptr_buffer_struct->decode_thread;
+
+  FreeDecodeInfo(ptr_buffer_struct->ptr_decode_info);
+  free(ptr_buffer_struct->ptr_decode_info);
+
+  free(ptr_buffer_struct->buffered_dxts);
+  delete [] ptr_buffer_struct->slot_state;
+  free(ptr_buffer_struct->slot_frames);
+  free(ptr_buffer_struct->scratch_dxt);
+  free(ptr_buffer_struct->dirty_maps);
+  delete [] ptr_buffer_struct->num_dirty_blocks;
+  delete [] ptr_buffer_struct->frame_stats;
+
+  if(ptr_buffer_struct->owns_source)
+    delete ptr_buffer_struct->source;
+  if(ptr_buffer_struct->owns_destination)
+    delete ptr_buffer_struct->destination;
+
+  delete ptr_buffer_struct;
+  ptr_buffer_struct = NULL;
 }
- 
@@ -1,8 +1,9 @@
 #ifndef __MPTC_DECODER_H__
-#define __MPTCDECODER_H__
+#define __MPTC_DECODER_H__
 
 
 #include "arithmetic_codec.h"
+#include "mptc_reader.h"
 
 #include <fstream>
 #include <tuple>
@@ -11,10 +12,18 @@
 #include <cmath>
 #include <cstring>
 #include <atomic>
+#include <chrono>
+#include <thread>
 #include <typeinfo>
 #include <cassert>
 
-
+namespace MPTC {
+class ThreadPool;
+class TaskGraph;
+class EntropyCodec;
+class EntropyDecoderState;
+class FrameDestination;
+}
 
 union PhysicalDXTBlock {
   struct {
@@ -42,6 +51,136 @@ struct LogicalDXTBlock {
 };
 
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// MPTC file layout
+//
+// Version 1 (legacy) files start directly with the 34 byte header:
+//
+//   uint32 frame_height, frame_width
+//   uint8  unique_interval, search_area
+//   uint32 total_frame_count, max_unique_count, max_compressed_palette,
+//          max_compressed_motion_indices, max_compressed_ep_Y,
+//          max_compressed_ep_C
+//
+// Newer files prefix it with
+//
+//   uint32 kMPTCMagic
+//   uint8  version
+//   uint8  flags (kMPTCFlag_*)
+//   uint16 tile_rows
+//
+// which cannot be confused with a legacy frame height.
+//
+// Every unique interval starts with its dictionary
+//
+//   uint32 compressed_palette_size, uint8 palette[compressed_palette_size],
+//   uint32 unique_count
+//
+// followed by one record per frame. Legacy frames are
+//
+//   uint32 num_unique
+//   5 x { uint32 size, uint8 data[size] }  motion, ep1 Y, ep1 C, ep2 Y, ep2 C
+//
+// With kMPTCFlag_Tiled the frame is cut into horizontal tiles of tile_rows
+// block rows (a multiple of the 64 row wavelet block). Each tile codes its
+// five streams independently, each with a fresh adaptive model, and a frame
+// index up front gives all the sizes:
+//
+//   uint32 num_unique
+//   num_tiles x { uint32 num_unique, uint32 size[5] }
+//   num_tiles x { 5 x uint8 data[size] }
+//
+// A tile's C streams hold the tile's Co rows followed by its Cg rows, its
+// unique indices follow those of the tiles above it, and intra motion never
+// references a block outside the tile. In tiled files the max_compressed_*
+// header fields are the largest per-frame totals over all tiles.
+//
+// All streams, the dictionary included, are coded with the adaptive
+// arithmetic coder unless kMPTCFlag_Rans selects the static rANS coder of
+// entropy_codec.h. With kMPTCFlag_MotionModel the motion streams are coded
+// with the context models of motion_codec.h instead, whichever coder the
+// other streams use; the decoder then rebuilds the interpolation words of
+// every row as soon as its motion is decoded.
+//
+// For streaming over pipes and sockets the file can be wrapped in the
+// CRC-checked packets of container.h, which the decoder reads through
+// ContainerSource.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+const uint32_t kMPTCMagic = 0x4354504D; // "MPTC"
+const uint32_t kMPTCLegacyHeaderSize = 34;
+const uint32_t kMPTCHeaderPrefixSize = 8;
+const uint8_t kMPTCVersionLegacy = 1;
+const uint8_t kMPTCVersionTiled = 2;
+const uint8_t kMPTCFlag_Tiled = 0x01;
+const uint8_t kMPTCFlag_Rans = 0x02;
+const uint8_t kMPTCFlag_MotionModel = 0x04;
+
+enum MPTCStream {
+  eStream_MotionIndices = 0,
+  eStream_Ep1_Y,
+  eStream_Ep1_C,
+  eStream_Ep2_Y,
+  eStream_Ep2_C,
+  kNumMPTCStreams
+};
+
+// Where the time of decoding a frame goes, see MPTCFrameStats. The tile
+// stages run once per tile and their times are summed over the tiles.
+enum MPTCDecodeStage {
+  eDecodeStage_Motion = 0,  // entropy decoding of the streams, in MPTCStream order
+  eDecodeStage_Ep1_Y,
+  eDecodeStage_Ep1_C,
+  eDecodeStage_Ep2_Y,
+  eDecodeStage_Ep2_C,
+  eDecodeStage_Interp,      // ReconstructDXTFrame, part of eDecodeStage_Motion with kMPTCFlag_MotionModel
+  eDecodeStage_Ep1,         // ReconstructEndpoints
+  eDecodeStage_Ep2,
+  eDecodeStage_Dirty,       // filling in the dirty map
+  kNumTileStages,
+  eDecodeStage_Read = kNumTileStages,  // reading or borrowing the compressed frame and dictionary
+  eDecodeStage_Palette,     // entropy decoding of the dictionary
+  eDecodeStage_QueueWait,   // buffered rings only, waiting for a free slot or a worker of the decode service
+  kNumDecodeStages
+};
+
+// Short name of a stage for reports, e.g. "ep1_y"
+const char *GetDecodeStageName(int stage);
+
+// Filled in by the decode calls while MPTCDecodeInfo::frame_stats is set.
+// Every frame decoded, skimmed or passed on the way to a seek target adds
+// to it, zero it to start over. Stage times are per thread and summed, with
+// several threads they overlap and can add up to more than decode_ns.
+typedef struct _FrameStats {
+  uint64_t stage_ns[kNumDecodeStages];
+  uint64_t decode_ns;                     // wall time of the decode calls
+  uint64_t stream_bytes[kNumMPTCStreams]; // compressed bytes that were entropy decoded
+  uint64_t palette_bytes;
+  uint32_t frames_decoded;                // skimmed ones included
+  uint32_t frames_skimmed;
+  uint32_t palettes_decoded;
+} MPTCFrameStats;
+
+// The compressed streams of one tile of the current frame and where they
+// decode to. Legacy files are decoded as a single tile covering the frame.
+typedef struct _TileJob {
+  uint32_t first_block, num_blocks;
+  uint32_t num_unique;
+  uint32_t unique_offset; // in interp words from the frame's first unique index
+  uint8_t *comp[kNumMPTCStreams];
+  uint32_t comp_sz[kNumMPTCStreams];
+  uint32_t num_dirty; // blocks of the tile that changed, if dirty_map is set
+  uint64_t stage_ns[kNumTileStages]; // of the current frame, if frame_stats is set
+} MPTCTileJob;
+
+// Per-frame arguments of the decode tasks, filled in before they run
+typedef struct _FrameJob {
+  uint32_t num_unique;
+  PhysicalDXTBlock *prev_dxt, *curr_dxt;
+} MPTCFrameJob;
+
 // structure to remember previous decode info
 // Should be passed to the decode function to get the next frame
 typedef struct _DecodeInfo {
@@ -51,11 +190,10 @@ typedef struct _DecodeInfo {
   uint8_t curr_idx; // current frame number within the unique interval, this is less than < unique_interval
   bool is_start, is_unique;
   uint8_t *comp_palette, *uncomp_palette;
-  uint8_t *comp_motion_indices, *motion_indices;
-  uint8_t *comp_ep_Y, *comp_ep_C;
-  uint8_t *comp_ep1_Y, *comp_ep1_C, *comp_ep2_Y, *comp_ep2_C;
+  uint8_t *comp_frame; // all compressed streams of the current frame
+  uint32_t comp_frame_sz;
+  uint8_t *motion_indices;
   uint8_t *wav_ep1_Y, *wav_ep1_C, *wav_ep2_Y, *wav_ep2_C;
-  int8_t  *ep1_Y, *ep1_Co, *ep1_Cg, *ep2_Y, *ep2_Co, *ep2_Cg;
   uint32_t num_blocks, unique_idx_offset;
   uint32_t max_unique_count; // The maximum size of the uncompressed dictionary as uint8_t entries
   uint32_t max_compressed_palette, max_compressed_motion_indices;  // a variable to be stored so we can avoid reallocing dictionary
@@ -63,30 +201,381 @@ typedef struct _DecodeInfo {
 
   uint32_t max_compressed_ep_C, max_compressed_ep_Y;
   bool is_multi_thread;
+
+  // Blocks from one row of a frame buffer to the next, for prev_dxt,
+  // curr_dxt and the seek buffers alike. Decoding straight into upload
+  // memory can use a wider pitch than the frame; 0 before the header is
+  // read means the frame width.
+  uint32_t dxt_pitch;
+
+  // If not NULL every decoded frame sets bit x % 64 of word
+  // y * dirty_map_pitch + x / 64 for each block (x, y) that differs from
+  // the same block of the previous frame, so that only the changed parts
+  // of a texture need to be uploaded. Frames without a previous one, and
+  // frames reached with SeekFrame, are all dirty. The map has
+  // frame_height / 4 * dirty_map_pitch words.
+  uint64_t *dirty_map;
+  uint32_t dirty_map_pitch;
+  uint32_t num_dirty_blocks; // of the last frame
+
+  // If not NULL every decode call adds its timings and byte counts
+  MPTCFrameStats *frame_stats;
                                      // every time a new unique dictionary has to be read
+
+  // Bitstream revision, see the file layout above
+  uint8_t version, flags;
+  uint32_t header_size; // bytes to skip to get back to the first frame
+  uint32_t tile_rows, num_tiles;
+  MPTCTileJob *tile_jobs;
+  MPTC::EntropyCodec *entropy_codec; // selected by the header flags
+  // Reused for every stream: num_tiles x kNumMPTCStreams, then the palette's
+  MPTC::EntropyDecoderState **stream_states;
+
+  // Every buffer above is carved out of this one block, sized from the
+  // header maxima, so nothing is allocated after the header is read
+  uint8_t *arena;
+  size_t arena_sz;
+
+  // Worker pool for GetFrameMultiThread. If thread_pool is NULL on the first
+  // frame a pool of num_threads workers (0 = hardware concurrency) is created
+  // and owned by the decode info, otherwise the caller's pool is used.
+  uint32_t num_threads;
+  MPTC::ThreadPool *thread_pool;
+  bool owns_thread_pool;
+  MPTC::TaskGraph *decode_graph;
+  MPTCFrameJob frame_job;
 } MPTCDecodeInfo;
 
 
+// State of one slot of the buffered decode ring. Only the decoder thread
+// moves a slot from free to ready, only the consumer moves it on to held and
+// back to free. Transitions are published with release stores and observed
+// with acquire loads, so a ready slot is always completely written.
+enum MPTCSlotState {
+  eSlotState_Free = 0,
+  eSlotState_Ready = 1,
+  eSlotState_Held = 2
+};
+
+// Return values of GetBufferedFrame
+const int kMPTCFrameReady = 0;
+const int kMPTCFrameNotReady = 1;
+
+// Counters of the buffered decode ring, see GetBufferedDecodeStats
+typedef struct _BufferStats {
+  uint64_t frames_decoded;   // frames published by the decoder thread
+  uint64_t frames_consumed;  // frames handed out by GetBufferedFrame
+  uint64_t dirty_blocks;     // over all consumed frames, out of num_blocks each
+  uint32_t num_blocks;
+  uint64_t underruns;        // GetBufferedFrame calls that found no new frame
+  uint64_t producer_waits;   // times the decoder thread found the ring full
+  uint64_t frames_skimmed;   // decoded for their interpolation data only, see RequestBufferedSkip
+  uint64_t frames_jumped;    // passed over by jumps to a key frame without decoding them
+  uint64_t key_jumps;
+  double decode_ms;          // average decode time of a frame that was published
+  uint64_t stats_dropped;    // per-frame records lost because ReadBufferedFrameStats fell behind
+  uint8_t occupancy;         // decoded frames waiting to be consumed
+  uint8_t buffer_sz;
+} MPTCBufferStats;
+
+// What the decoder of a buffered decode ring did for one published frame,
+// see ReadBufferedFrameStats
+typedef struct _BufferedFrameStats {
+  uint64_t frame_number;  // as GetBufferedFrameNumber
+  uint64_t start_ns;      // when decoding started, from the setup of the ring
+  MPTCFrameStats decode;  // of the frame and of the frames skimmed on the way to it
+  uint8_t occupancy;      // decoded frames waiting once it was published, itself included
+  bool is_key_jump;       // decoding jumped to the frame, see RequestBufferedSkip
+} MPTCBufferedFrameStats;
+
+// Records a ring keeps for ReadBufferedFrameStats
+const uint32_t kMPTCFrameStatsRingSize = 256;
+
+// Set in a RequestBufferedSkip request to jump to a key frame instead of
+// skimming up to the frame
+const uint64_t kMPTCSkipToKey = 1ULL << 63;
+
+// How many frames past the skip target a key frame jump may land. Further
+// than that the frames up to the target are skimmed instead: with few key
+// frames, e.g. only frame 0, the jump would wrap to the next lap and the
+// consumer would hold its frame until the clock got there.
+const uint64_t kMPTCMaxKeyJumpFrames = 4;
+
+// Single producer / single consumer ring of decoded DXT frames. One
+// persistent decoder thread fills slots ahead of the consumer and waits
+// when the ring is full. Rings set up with InitBufferedDecodeOnPool have no
+// thread of their own, whoever owns them calls DecodeBufferedFrame.
+//
+// Frames are numbered from the start of playback and keep counting when
+// the ring wraps around to the first frame of the file, so that frame n is
+// frame n % total_frame_count of the file.
 typedef struct _BufferStruct {
 
   MPTCDecodeInfo *ptr_decode_info;
-  PhysicalDXTBlock *curr_dxt, *prev_dxt;
   PhysicalDXTBlock **buffered_dxts;
+  std::atomic<uint8_t> *slot_state;
   uint8_t buffer_sz;
-  uint8_t curr_dxt_idx; // points to the current dxt to be returned
+
+  // Consumer side
+  uint8_t curr_dxt_idx; // points to the slot currently handed out
+  bool is_holding;      // true once curr_dxt_idx has been handed out
+
+  // Producer side, only touched by the decoder thread
   uint8_t curr_decode_idx; // points to the decode pointer to be filled in
   uint8_t prev_decode_idx;
+  bool has_prev;
+  MPTC::ByteSource *source;
+  bool owns_source;
+  MPTC::FrameDestination *destination; // holds buffered_dxts
+  bool owns_destination;
+  uint64_t *slot_frames;     // number of the frame in every slot, written before it is published
+  PhysicalDXTBlock *scratch_dxt; // skimmed frames ping-pong between it and the next slot
+
+  // Catch-up requests of the consumer, see RequestBufferedSkip
+  std::atomic<uint64_t> next_frame;  // the frame the decoder works on next
+  std::atomic<uint64_t> skip_request;
+  std::atomic<const std::vector<MPTC::FrameIndexEntry> *> frame_index;
+
+  // Dirty map of every slot, relative to the frame decoded before it
+  uint64_t *dirty_maps;
+  uint32_t dirty_map_sz; // words per slot
+  std::atomic<uint32_t> *num_dirty_blocks;
+  std::atomic<uint64_t> dirty_blocks;
+
+  std::thread *decode_thread; // NULL for rings without a decoder thread
+  std::atomic<bool> stop;
+
+  std::atomic<uint64_t> frames_decoded, frames_consumed;
+  std::atomic<uint64_t> underruns, producer_waits;
+  std::atomic<uint64_t> frames_skimmed, frames_jumped, key_jumps;
+  std::atomic<uint64_t> decode_ns; // of the published frames
+
+  // Per-frame records, a single producer / single consumer ring of its own
+  // that drops records while it is full rather than holding up decoding
+  MPTCBufferedFrameStats *frame_stats;
+  std::atomic<uint64_t> stats_written, stats_read, stats_dropped;
+  std::chrono::steady_clock::time_point start_time;
+  uint64_t queue_wait_ns; // of the next frame, set by whoever calls DecodeBufferedFrame
 
 } BufferStruct;
 
 
+// Reads the frame size of an MPTC file of either layout, leaves the stream
+// where it was
+bool GetMPTCFrameSize(std::ifstream &in_stream, uint32_t *frame_height, uint32_t *frame_width);
+
+// Rebuilds endpoint ep_number (1 or 2) of the blocks [first_block,
+// first_block + num_blocks) from the wavelet planes in decode_info. The
+// range has to cover whole 64 row bands of the frame.
+void ReconstructEndpoints(MPTCDecodeInfo *decode_info, PhysicalDXTBlock *curr_frame, int ep_number,
+                          uint32_t first_block, uint32_t num_blocks);
+
 int GetFrame(std::ifstream &in_stream, PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt,
               MPTCDecodeInfo *decode_info);
 
+// Decodes from any byte source, a MappedSource decodes the streams in place
+// without copying them
+int GetFrame(MPTC::ByteSource &source, PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt,
+              MPTCDecodeInfo *decode_info);
+
 void GetFrameMultiThread(std::ifstream &in_stream, PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt, MPTCDecodeInfo *decode_info);
 
-int InitBufferedDecode(uint8_t buffer_sz, BufferStruct* &ptr_buffer_struct, std::ifstream &in_stream, uint32_t num_blocks);
+void GetFrameMultiThread(MPTC::ByteSource &source, PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt, MPTCDecodeInfo *decode_info);
+
+// Moves past the next frame decoding only its motion indices and
+// interpolation data, for frames that won't be shown. curr_dxt is only good
+// as the previous frame of the next decode, whose dirty map should then be
+// taken as all dirty.
+int SkimFrame(MPTC::ByteSource &source, PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt,
+              MPTCDecodeInfo *decode_info);
+
+// Walks the chunk sizes of the whole file and records where every frame
+// and its dictionary start. Only the motion indices are decoded, to flag
+// the key frames. Leaves the source at the start of the file. Returns -1 if
+// the file holds fewer frames than its header claims or a motion stream is
+// larger than a frame can be; the frames before that are still indexed.
+int BuildFrameIndex(MPTC::ByteSource &source, std::vector<MPTC::FrameIndexEntry> *index);
+
+// Cost of one SeekFrame call
+typedef struct _SeekStats {
+  uint32_t target_frame;
+  uint32_t start_frame;      // key frame decoding restarted from
+  uint32_t frames_skimmed;   // frames decoded for their interpolation data only
+  uint32_t palettes_decoded;
+  uint64_t bytes_decoded;    // compressed bytes that went through the entropy decoder
+  double elapsed_ms;
+} MPTCSeekStats;
+
+// Decodes frame number frame into curr_dxt. Decoding restarts at the
+// closest key frame before it, the frames in between only get their
+// interpolation data rebuilt, ping-ponging between curr_dxt and
+// scratch_dxt. Afterwards GetFrame / GetFrameMultiThread carry on with the
+// next frame, with curr_dxt as its previous frame. Returns -1 if frame is
+// out of range or the index doesn't belong to the file.
+//
+// The cost grows with the distance to the key frame: in legacy files and
+// files written with a key_interval of 0, see EncoderOptions, only frame 0
+// is one and every seek skims from the start of the file.
+int SeekFrame(MPTC::ByteSource &source, const std::vector<MPTC::FrameIndexEntry> &index, uint32_t frame,
+              PhysicalDXTBlock *scratch_dxt, PhysicalDXTBlock *curr_dxt, MPTCDecodeInfo *decode_info,
+              MPTCSeekStats *stats = NULL);
+
+// Zeroes the decode info and marks it as not yet started
+void InitDecodeInfo(MPTCDecodeInfo *decode_info, uint32_t num_threads = 0);
+
+// Reads the header at the current position of source and allocates all
+// decode buffers. GetFrame and the other decode calls do this on their
+// first frame, calling it up front gives access to the header fields.
+void OpenDecodeInfo(MPTC::ByteSource &source, MPTCDecodeInfo *decode_info);
+
+// A run of block rows [first_row, first_row + num_rows) of a dirty map
+typedef struct _DirtyRows {
+  uint32_t first_row, num_rows;
+} MPTCDirtyRows;
+
+// Splits the rows of the dirty map of a frame of the decode info into
+// runs of rows with dirty blocks. Runs at most merge_gap clean rows
+// apart are joined, fewer and larger uploads are usually cheaper. runs
+// needs room for frame_height / 4 entries. Returns the number of runs.
+uint32_t GetDirtyRowRuns(const MPTCDecodeInfo *decode_info, const uint64_t *dirty_map, uint32_t merge_gap,
+                         MPTCDirtyRows *runs);
+
+// Releases everything GetFrame/GetFrameMultiThread allocated, including the
+// worker pool if it is owned by the decode info
+void FreeDecodeInfo(MPTCDecodeInfo *decode_info);
+
+// Allocates a ring of buffer_sz frames and starts the decoder thread, which
+// owns in_stream from now on. Returns once all but one slot are decoded.
+int InitBufferedDecode(uint8_t buffer_sz, BufferStruct* &ptr_buffer_struct, std::ifstream &in_stream, uint32_t num_blocks,
+                       uint32_t num_threads = 0);
+
+// Same as above for any byte source, which has to outlive the ring
+int InitBufferedDecode(uint8_t buffer_sz, BufferStruct* &ptr_buffer_struct, MPTC::ByteSource &source, uint32_t num_blocks,
+                       uint32_t num_threads = 0);
+
+// Decodes straight into the slots of destination, one ring entry per slot,
+// with the destination's row pitch. Both have to outlive the ring. The
+// frames GetBufferedFrame hands out then point into the destination, and
+// curr_dxt_idx is the slot they are in.
+int InitBufferedDecode(BufferStruct* &ptr_buffer_struct, MPTC::ByteSource &source,
+                       MPTC::FrameDestination &destination, uint32_t num_threads = 0);
+
+// Sets up the ring like the call above but starts no decoder thread and
+// decodes nothing yet. Each DecodeBufferedFrame call decodes one frame with
+// its tasks on pool, which any number of rings can share, see
+// decode_service.h.
+int InitBufferedDecodeOnPool(BufferStruct* &ptr_buffer_struct, MPTC::ByteSource &source,
+                             MPTC::FrameDestination &destination, MPTC::ThreadPool &pool);
+
+// True if the slot the next frame decodes into has been given back
+bool CanDecodeBufferedFrame(BufferStruct *ptr_buffer_struct);
+
+// Decodes the next frame into its slot and publishes it. Only one thread
+// at a time may call it, and only while CanDecodeBufferedFrame is true.
+void DecodeBufferedFrame(BufferStruct *ptr_buffer_struct);
+
+// Hands out the next decoded frame and gives the previous one back to the
+// decoder. Returns kMPTCFrameNotReady, and leaves curr_dxt on the frame that
+// is still held (NULL if none), when the decoder has not caught up yet.
+int GetBufferedFrame(BufferStruct *ptr_buffer_struct, PhysicalDXTBlock * &curr_dxt);
+
+// True if GetBufferedFrame would hand out a frame now, frame_number is set
+// to the number of that frame. Does not move the ring.
+bool PeekBufferedFrame(BufferStruct *ptr_buffer_struct, uint64_t *frame_number);
+
+// Number of the frame GetBufferedFrame handed out last
+uint64_t GetBufferedFrameNumber(BufferStruct *ptr_buffer_struct);
+
+// Asks the decoder to carry on at frame number frame rather than with the
+// next one, when the consumer has fallen behind. The frames in between are
+// skimmed, see SkimFrame, or with kMPTCSkipToKey set in frame and a frame
+// index given to SetBufferedFrameIndex, decoding jumps straight to the first
+// key frame at or after frame, if it is at most kMPTCMaxKeyJumpFrames past
+// it. Frames already in the ring are not touched,
+// and a request for a frame the decoder is past is ignored. Only the
+// consumer may call it.
+void RequestBufferedSkip(BufferStruct *ptr_buffer_struct, uint64_t frame);
+
+// Index of the ring's file for key frame jumps, built on the side with
+// BuildFrameIndex. It has to outlive the ring, NULL turns jumps into skims.
+void SetBufferedFrameIndex(BufferStruct *ptr_buffer_struct, const std::vector<MPTC::FrameIndexEntry> *index);
+
+void GetBufferedDecodeStats(BufferStruct *ptr_buffer_struct, MPTCBufferStats *stats);
+
+// Moves up to max_stats records of published frames, oldest first, to
+// stats and returns how many. The ring holds kMPTCFrameStatsRingSize
+// records, call it at least that often to see every frame. Only one thread
+// may call it, it does not have to be the consumer of the frames.
+uint32_t ReadBufferedFrameStats(BufferStruct *ptr_buffer_struct, MPTCBufferedFrameStats *stats, uint32_t max_stats);
+
+// The dirty map, see MPTCDecodeInfo, of the frame GetBufferedFrame handed
+// out last, relative to the one handed out before it. NULL if no frame is
+// held.
+const uint64_t *GetBufferedDirtyMap(BufferStruct *ptr_buffer_struct, uint32_t *num_dirty_blocks);
+
+// Stops the decoder thread and frees the ring
+void DestroyBufferedDecode(BufferStruct* &ptr_buffer_struct);
+
+namespace MPTC {
+
+// Owns everything needed to decode one MPTC file: the decode info, the
+// arena holding all of its buffers, the entropy decoder states and, once a
+// frame is decoded with several threads, the worker pool and task graph.
+// All of it is set up by Open() or the first multi-threaded frame, frames
+// after that decode without any heap allocation. The source has to outlive
+// the decoder.
+class Decoder {
+ public:
+  Decoder();
+  ~Decoder();
+
+  // Reads the header at the start of source and allocates the arena.
+  // Returns false if the source is too short to hold a header.
+  bool Open(ByteSource &source, uint32_t num_threads = 0);
+  void Close();
+
+  bool IsOpen() const { return _source != NULL; }
+  uint32_t FrameHeight() const { return _decode_info.frame_height; }
+  uint32_t FrameWidth() const { return _decode_info.frame_width; }
+  uint32_t NumBlocks() const { return _decode_info.num_blocks; }
+  uint32_t TotalFrameCount() const { return _decode_info.total_frame_count; }
+  size_t ArenaSize() const { return _decode_info.arena_sz; }
+
+  // Bytes from one block row of the frame buffers to the next, a multiple
+  // of sizeof(PhysicalDXTBlock) no smaller than the frame. 0 packs them
+  // tightly, which is the default.
+  void SetRowPitch(uint32_t row_pitch);
+
+  // Frames decoded from now on fill in dirty_map, which needs room for
+  // FrameHeight() / 4 * DecodeInfo().dirty_map_pitch words. NULL stops it.
+  void SetDirtyMap(uint64_t *dirty_map) { _decode_info.dirty_map = dirty_map; }
+  uint32_t NumDirtyBlocks() const { return _decode_info.num_dirty_blocks; }
+
+  // Frames decoded from now on add their timings and byte counts to
+  // frame_stats, see MPTCFrameStats. NULL stops it.
+  void SetFrameStats(MPTCFrameStats *frame_stats) { _decode_info.frame_stats = frame_stats; }
+
+  // Decode the next frame, as GetFrame and GetFrameMultiThread
+  int DecodeFrame(PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt);
+  void DecodeFrameMultiThread(PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt);
+
+  // As SkimFrame
+  int SkimFrame(PhysicalDXTBlock *prev_dxt, PhysicalDXTBlock *curr_dxt);
+
+  // As SeekFrame
+  int Seek(const std::vector<FrameIndexEntry> &index, uint32_t frame,
+           PhysicalDXTBlock *scratch_dxt, PhysicalDXTBlock *curr_dxt, MPTCSeekStats *stats = NULL);
+
+  const MPTCDecodeInfo &DecodeInfo() const { return _decode_info; }
+
+ private:
+  Decoder(const Decoder &);
+  Decoder &operator=(const Decoder &);
+
+  ByteSource *_source;
+  MPTCDecodeInfo _decode_info;
+};
 
-int GetBufferedFrame(BufferStruct *ptr_buffer_struct, PhysicalDXTBlock * &curr_dxt, std::ifstream  &in_stream);
+}  // namespace MPTC
 
 #endif 
@@ -0,0 +1,583 @@
+#include "encoder.h"
+#include "motion_codec.h"
+#include "thread_pool.h"
+#include "wavelet.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#if defined(__AVX2__)
+#define MPTC_ENCODER_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MPTC_ENCODER_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace MPTC {
+
+static const uint32_t kWaveletDim = static_cast<uint32_t>(kMaxWaveletBlockDim);
+
+static void WriteU32(std::ofstream &out_stream, uint32_t value) {
+  out_stream.write(reinterpret_cast<const char*>(&value), 4);
+}
+
+static void WriteBytes(std::ofstream &out_stream, const std::vector<uint8_t> &bytes) {
+  if(!bytes.empty())
+    out_stream.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+Encoder::Encoder()
+  : _frame_height(0), _frame_width(0), _blocks_width(0), _blocks_height(0), _num_blocks(0),
+    _num_tiles(0), _version(kMPTCVersionLegacy), _flags(0), _header_size(0),
+    _max_unique_count(0), _max_compressed_palette(0), _max_compressed_motion_indices(0),
+    _max_compressed_ep_Y(0), _max_compressed_ep_C(0), _motion(NULL), _allow_inter(false),
+    _has_prev(false) {
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+Encoder::~Encoder() {
+  if(_out_stream.is_open())
+    Close();
+}
+
+bool Encoder::Open(const std::string &path, uint32_t frame_height, uint32_t frame_width,
+                   const EncoderOptions &options) {
+  if(frame_height == 0 || frame_width == 0 ||
+     frame_height % (4 * kWaveletDim) != 0 || frame_width % (4 * kWaveletDim) != 0) {
+    std::cerr << "Error the frame size must be a multiple of " << 4 * kWaveletDim << std::endl;
+    return false;
+  }
+  if(options.search_area < 1 || options.search_area > 63 || options.unique_interval < 1) {
+    std::cerr << "Error the search area must be in [1, 63] and the unique interval at least 1" << std::endl;
+    return false;
+  }
+  if(options.tile_rows % kWaveletDim != 0 || options.tile_rows > 0xFFFF) {
+    std::cerr << "Error tile rows must be a multiple of " << kWaveletDim << std::endl;
+    return false;
+  }
+
+  _out_stream.open(path.c_str(), std::ios::binary | std::ios::trunc);
+  if(!_out_stream.is_open()) {
+    std::cerr << "Error opening " << path << std::endl;
+    return false;
+  }
+
+  _path = path;
+  _options = options;
+  _codec.reset(CreateEntropyCodec(options.codec));
+
+  _frame_height = frame_height;
+  _frame_width = frame_width;
+  _blocks_width = frame_width / 4;
+  _blocks_height = frame_height / 4;
+  _num_blocks = _blocks_width * _blocks_height;
+  if(_options.tile_rows > _blocks_height)
+    _options.tile_rows = _blocks_height;
+
+  _flags = 0;
+  if(_options.tile_rows != 0)
+    _flags |= kMPTCFlag_Tiled;
+  if(_options.codec == eEntropyCodec_Rans)
+    _flags |= kMPTCFlag_Rans;
+  if(_options.motion_model)
+    _flags |= kMPTCFlag_MotionModel;
+
+  // Files the original decoder can read stay in the legacy layout
+  _version = _flags == 0 ? kMPTCVersionLegacy : kMPTCVersionTiled;
+  _header_size = kMPTCLegacyHeaderSize + (_version == kMPTCVersionLegacy ? 0 : kMPTCHeaderPrefixSize);
+
+  uint32_t tile_rows = _options.tile_rows == 0 ? _blocks_height : _options.tile_rows;
+  _num_tiles = (_blocks_height + tile_rows - 1) / tile_rows;
+
+  _max_unique_count = _max_compressed_palette = 0;
+  _max_compressed_motion_indices = _max_compressed_ep_Y = _max_compressed_ep_C = 0;
+  _prev_interp.assign(_num_blocks, 0);
+  _curr_interp.assign(_num_blocks, 0);
+  _has_prev = false;
+
+  // The motion search runs in bands of rows, a few per worker so that
+  // uneven rows even out
+  _search_graph.reset();
+  _thread_pool.reset();
+  if(_options.num_threads != 1) {
+    _thread_pool.reset(new ThreadPool(_options.num_threads));
+    uint32_t num_bands = std::min(_blocks_height, 4 * _thread_pool->NumThreads());
+    _search_graph.reset(new TaskGraph);
+    for(uint32_t band = 0; band < num_bands; band++) {
+      uint32_t first_row = band * _blocks_height / num_bands;
+      uint32_t end_row = (band + 1) * _blocks_height / num_bands;
+      _search_graph->AddTask([this, first_row, end_row] { SearchMotionRows(first_row, end_row); });
+    }
+  }
+  _palette.clear();
+  _pending.clear();
+  _index.clear();
+  memset(&_stats, 0, sizeof(_stats));
+
+  // Placeholder, the maxima are only known once every frame is coded
+  WriteHeader();
+  return _out_stream.good();
+}
+
+void Encoder::WriteHeader() {
+  if(_version != kMPTCVersionLegacy) {
+    uint16_t tile_rows = static_cast<uint16_t>(_options.tile_rows);
+    WriteU32(_out_stream, kMPTCMagic);
+    _out_stream.write(reinterpret_cast<const char*>(&_version), 1);
+    _out_stream.write(reinterpret_cast<const char*>(&_flags), 1);
+    _out_stream.write(reinterpret_cast<const char*>(&tile_rows), 2);
+  }
+
+  WriteU32(_out_stream, _frame_height);
+  WriteU32(_out_stream, _frame_width);
+  _out_stream.write(reinterpret_cast<const char*>(&_options.unique_interval), 1);
+  _out_stream.write(reinterpret_cast<const char*>(&_options.search_area), 1);
+  WriteU32(_out_stream, static_cast<uint32_t>(_stats.num_frames));
+  WriteU32(_out_stream, _max_unique_count);
+  WriteU32(_out_stream, _max_compressed_palette);
+  WriteU32(_out_stream, _max_compressed_motion_indices);
+  WriteU32(_out_stream, _max_compressed_ep_Y);
+  WriteU32(_out_stream, _max_compressed_ep_C);
+}
+
+// Index of the first word equal to value in row[begin, end), -1 if none
+static int32_t FindInterp(const uint32_t *row, int32_t begin, int32_t end, uint32_t value) {
+  int32_t idx = begin;
+#if defined(MPTC_ENCODER_AVX2)
+  const __m256i wanted = _mm256_set1_epi32(static_cast<int32_t>(value));
+  for(; idx + 8 <= end; idx += 8) {
+    __m256i words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + idx));
+    int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(words, wanted)));
+    if(mask != 0) {
+      while((mask & 1) == 0) {
+        mask >>= 1;
+        idx++;
+      }
+      return idx;
+    }
+  }
+#elif defined(MPTC_ENCODER_SSE2)
+  const __m128i wanted = _mm_set1_epi32(static_cast<int32_t>(value));
+  for(; idx + 4 <= end; idx += 4) {
+    __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + idx));
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(words, wanted)));
+    if(mask != 0) {
+      while((mask & 1) == 0) {
+        mask >>= 1;
+        idx++;
+      }
+      return idx;
+    }
+  }
+#endif
+  for(; idx < end; idx++) {
+    if(row[idx] == value)
+      return idx;
+  }
+  return -1;
+}
+
+// Picks the motion code of every block in rows [first_row, end_row), see
+// ReconstructDXTFrame. A block is copied from the same spot of the previous
+// frame if possible, then from the closest row earlier in its tile, then
+// from the closest row of the search area of the previous frame, taking
+// the leftmost match of a row. Blocks without a match are marked unique.
+// Only reads the frame, so any set of rows can be searched concurrently.
+void Encoder::SearchMotionRows(uint32_t first_row, uint32_t end_row) {
+  const int32_t search_area = _options.search_area;
+  const int32_t blocks_width = static_cast<int32_t>(_blocks_width);
+  const int32_t blocks_height = static_cast<int32_t>(_blocks_height);
+  const uint32_t tile_rows = _options.tile_rows == 0 ? _blocks_height : _options.tile_rows;
+  const uint32_t *curr = _curr_interp.data();
+  const uint32_t *prev = _prev_interp.data();
+
+  for(int32_t block_y = first_row; block_y < static_cast<int32_t>(end_row); block_y++) {
+    int32_t tile_first_row = static_cast<int32_t>((block_y / tile_rows) * tile_rows);
+
+    for(int32_t block_x = 0; block_x < blocks_width; block_x++) {
+      int32_t physical_idx = block_y * blocks_width + block_x;
+      uint32_t interp = curr[physical_idx];
+      uint8_t *code = _motion + 2 * physical_idx;
+
+      if(_allow_inter && prev[physical_idx] == interp) {
+        code[0] = static_cast<uint8_t>(search_area | 0x80);
+        code[1] = static_cast<uint8_t>(search_area | 0x80);
+        continue;
+      }
+
+      int32_t min_x = std::max(block_x - search_area, 0);
+      int32_t max_x = std::min(block_x + search_area + 1, blocks_width);
+
+      // Intra: this row left of the block, then the rows above in the tile
+      int32_t match_x = -1, match_y = 0;
+      for(int32_t dy = 0; dy >= -search_area && match_x < 0; dy--) {
+        int32_t ref_y = block_y + dy;
+        if(ref_y < tile_first_row)
+          break;
+        match_x = FindInterp(curr + ref_y * blocks_width, min_x, dy == 0 ? block_x : max_x, interp);
+        match_y = dy;
+      }
+      if(match_x >= 0) {
+        code[0] = static_cast<uint8_t>(match_x - block_x + search_area);
+        code[1] = static_cast<uint8_t>(match_y + 2 * search_area - 1);
+        continue;
+      }
+
+      // Inter: rows of the previous frame, closest to the block first
+      for(int32_t dist = 0; dist <= search_area && _allow_inter && match_x < 0; dist++) {
+        for(int32_t sign = -1; sign <= 1 && match_x < 0; sign += 2) {
+          int32_t dy = sign * dist;
+          int32_t ref_y = block_y + dy;
+          if((dist == 0 && sign > 0) || ref_y < 0 || ref_y >= blocks_height)
+            continue;
+          match_x = FindInterp(prev + ref_y * blocks_width, min_x, max_x, interp);
+          match_y = dy;
+        }
+      }
+      if(match_x >= 0) {
+        code[0] = static_cast<uint8_t>((match_x - block_x + search_area) | 0x80);
+        code[1] = static_cast<uint8_t>((match_y + search_area) | 0x80);
+        continue;
+      }
+
+      code[0] = 255;
+      code[1] = 255;
+    }
+  }
+}
+
+// The search takes the first match it finds, the context models of
+// motion_codec.h code the vector they predict from the neighbours in a
+// fraction of the bits. Switches every block that has a predicted vector
+// referencing the same interpolation word to it, in raster order since
+// every switch changes the predictions after it. The modes of the left and
+// top neighbours are tried first, they are the cheapest to code.
+void Encoder::PreferPredictedMotion() {
+  const int32_t search_area = _options.search_area;
+  const int32_t blocks_width = static_cast<int32_t>(_blocks_width);
+  const int32_t blocks_height = static_cast<int32_t>(_blocks_height);
+  const uint32_t tile_rows = _options.tile_rows == 0 ? _blocks_height : _options.tile_rows;
+
+  for(int32_t block_y = 0; block_y < blocks_height; block_y++) {
+    int32_t tile_first_row = static_cast<int32_t>((block_y / tile_rows) * tile_rows);
+
+    for(int32_t block_x = 0; block_x < blocks_width; block_x++) {
+      int32_t physical_idx = block_y * blocks_width + block_x;
+      uint8_t *code = _motion + 2 * physical_idx;
+      if(code[0] == 255 && code[1] == 255)
+        continue;
+
+      const uint8_t *left = block_x == 0 ? NULL : code - 2;
+      const uint8_t *top = block_y == tile_first_row ? NULL : code - 2 * blocks_width;
+      const uint8_t *candidates[3] = { left, top, code };
+      for(const uint8_t *candidate : candidates) {
+        if(candidate == NULL || (candidate[0] == 255 && candidate[1] == 255))
+          continue;
+        bool is_inter = (candidate[0] & 0x80) != 0 && (candidate[1] & 0x80) != 0;
+        if(is_inter && !_allow_inter)
+          continue;
+
+        uint8_t pred[2];
+        PredictMotionIndex(is_inter, left, top, _options.search_area, pred);
+        if(pred[0] == code[0] && pred[1] == code[1])
+          break;
+
+        int32_t ref_x = block_x + (pred[0] & 0x7f) - search_area;
+        int32_t ref_y = block_y + (pred[1] & 0x7f) - (is_inter ? search_area : 2 * search_area - 1);
+        bool is_valid = ref_x >= 0 && ref_x < blocks_width && (is_inter ?
+          ref_y >= 0 && ref_y < blocks_height :
+          ref_y >= tile_first_row && (ref_y < block_y || (ref_y == block_y && ref_x < block_x)));
+        const uint32_t *ref_frame = is_inter ? _prev_interp.data() : _curr_interp.data();
+        if(is_valid && ref_frame[ref_y * blocks_width + ref_x] == _curr_interp[physical_idx]) {
+          code[0] = pred[0];
+          code[1] = pred[1];
+          break;
+        }
+      }
+    }
+  }
+}
+
+// Searches all rows, on the encoder's pool when it has one, then collects
+// the unique blocks in raster order, which is the order the decoder
+// consumes the dictionary in.
+void Encoder::SearchMotion(const PhysicalDXTBlock *frame, bool allow_inter, uint8_t *motion,
+                           std::vector<uint32_t> *palette, uint32_t *tile_num_unique) {
+  std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+  for(uint32_t block_idx = 0; block_idx < _num_blocks; block_idx++)
+    _curr_interp[block_idx] = frame[block_idx].interp;
+  _motion = motion;
+  _allow_inter = allow_inter;
+
+  if(_search_graph)
+    _search_graph->Run(*_thread_pool);
+  else
+    SearchMotionRows(0, _blocks_height);
+  if(_options.motion_model)
+    PreferPredictedMotion();
+
+  const uint32_t tile_rows = _options.tile_rows == 0 ? _blocks_height : _options.tile_rows;
+  const uint32_t tile_blocks = tile_rows * _blocks_width;
+  for(uint32_t tile_idx = 0; tile_idx < _num_tiles; tile_idx++)
+    tile_num_unique[tile_idx] = 0;
+
+  for(uint32_t block_idx = 0; block_idx < _num_blocks; block_idx++) {
+    uint8_t x = motion[2 * block_idx];
+    uint8_t y = motion[2 * block_idx + 1];
+    if(x == 255 && y == 255) {
+      palette->push_back(_curr_interp[block_idx]);
+      tile_num_unique[block_idx / tile_blocks]++;
+      _stats.unique_blocks++;
+    }
+    else if((x & 0x80) != 0 && (y & 0x80) != 0) {
+      _stats.inter_blocks++;
+    }
+    else {
+      _stats.intra_blocks++;
+    }
+  }
+
+  _stats.motion_search_ms += std::chrono::duration<double, std::milli>(
+    std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// RGB565 to the YCoCg variant ReconstructEndpoints inverts:
+//   co = r - b, t = r + b, cg = g - t, y = t + cg / 2
+// so that t = y - cg / 2, g = cg + t, b = (t - co) / 2, r = b + co
+void Encoder::EncodeEndpoints(const PhysicalDXTBlock *frame, int ep_number, uint8_t *wav_Y, uint8_t *wav_C,
+                              PhysicalDXTBlock *reconstruction) {
+  const uint32_t width = _blocks_width;
+  const uint32_t tile_rows = _options.tile_rows == 0 ? _blocks_height : _options.tile_rows;
+  static const size_t kRowBytes = sizeof(int16_t) * kWaveletDim;
+  int16_t blocks[3][kWaveletDim * kWaveletDim];
+
+  for(uint32_t tile_idx = 0; tile_idx < _num_tiles; tile_idx++) {
+    uint32_t first_row = tile_idx * tile_rows;
+    uint32_t num_rows = std::min(tile_rows, _blocks_height - first_row);
+    uint32_t first_block = first_row * width;
+    uint32_t num_blocks = num_rows * width;
+
+    // A tile's C stream is its Co rows followed by its Cg rows
+    uint8_t *planes[3] = { wav_Y + first_block, wav_C + 2 * first_block, wav_C + 2 * first_block + num_blocks };
+
+    for(uint32_t j = 0; j < num_rows; j += kWaveletDim) {
+      for(uint32_t i = 0; i < width; i += kWaveletDim) {
+        size_t plane_offset = i + width * j;
+
+        for(uint32_t y = 0; y < kWaveletDim; y++) {
+          for(uint32_t x = 0; x < kWaveletDim; x++) {
+            const PhysicalDXTBlock &block = frame[first_block + plane_offset + width * y + x];
+            uint16_t ep = ep_number == 1 ? block.ep1 : block.ep2;
+            int32_t r = (ep >> 11) & 0x1F;
+            int32_t g = (ep >> 5) & 0x3F;
+            int32_t b = ep & 0x1F;
+            int32_t co = r - b;
+            int32_t t = r + b;
+            int32_t cg = g - t;
+            blocks[0][y * kWaveletDim + x] = static_cast<int16_t>(t + cg / 2);
+            blocks[1][y * kWaveletDim + x] = static_cast<int16_t>(co);
+            blocks[2][y * kWaveletDim + x] = static_cast<int16_t>(cg);
+          }
+        }
+
+        for(int plane = 0; plane < 3; plane++) {
+          int16_t *coeffs = blocks[plane];
+          ForwardWaveletBlock(coeffs, kRowBytes, kWaveletDim);
+          for(uint32_t y = 0; y < kWaveletDim; y++) {
+            uint8_t *out_row = planes[plane] + plane_offset + width * y;
+            for(uint32_t x = 0; x < kWaveletDim; x++) {
+              int16_t &coeff = coeffs[y * kWaveletDim + x];
+              if(coeff < -128 || coeff > 127) {
+                coeff = std::max<int16_t>(-128, std::min<int16_t>(127, coeff));
+                _stats.clamped_coeffs++;
+              }
+              out_row[x] = static_cast<uint8_t>(coeff + 128);
+            }
+          }
+        }
+
+        if(reconstruction == NULL)
+          continue;
+
+        // What the decoder will rebuild from the clamped coefficients
+        for(int plane = 0; plane < 3; plane++)
+          InverseWaveletBlock(blocks[plane], kRowBytes, kWaveletDim);
+
+        for(uint32_t y = 0; y < kWaveletDim; y++) {
+          for(uint32_t x = 0; x < kWaveletDim; x++) {
+            int8_t yy = static_cast<int8_t>(blocks[0][y * kWaveletDim + x]);
+            int8_t co = static_cast<int8_t>(blocks[1][y * kWaveletDim + x]);
+            int8_t cg = static_cast<int8_t>(blocks[2][y * kWaveletDim + x]);
+            int8_t t = yy - (cg / 2);
+            int8_t g = cg + t;
+            int8_t b = (t - co) / 2;
+            int8_t r = b + co;
+            uint16_t packed = static_cast<uint16_t>(((r & 0x1F) << 11) | ((g & 0x3F) << 5) | (b & 0x1F));
+
+            PhysicalDXTBlock &block = reconstruction[first_block + plane_offset + width * y + x];
+            if(ep_number == 1)
+              block.ep1 = packed;
+            else
+              block.ep2 = packed;
+          }
+        }
+      }
+    }
+  }
+}
+
+void Encoder::AddFrame(const PhysicalDXTBlock *frame, PhysicalDXTBlock *reconstruction) {
+  assert(_out_stream.is_open() && "Encoder is not open");
+
+  // The dictionary of a full interval can be written out with its frames
+  if(_pending.size() == _options.unique_interval)
+    FlushInterval();
+
+  uint64_t frame_idx = _stats.num_frames;
+  bool is_key = frame_idx == 0 ||
+                (_options.key_interval != 0 && frame_idx % _options.key_interval == 0);
+
+  std::vector<uint8_t> motion(2 * _num_blocks);
+  std::vector<uint8_t> wav_ep1_Y(_num_blocks), wav_ep1_C(2 * _num_blocks);
+  std::vector<uint8_t> wav_ep2_Y(_num_blocks), wav_ep2_C(2 * _num_blocks);
+
+  EncodedFrame encoded;
+  encoded.tile_num_unique.resize(_num_tiles);
+  uint64_t inter_blocks = _stats.inter_blocks;
+  SearchMotion(frame, _has_prev && !is_key, motion.data(), &_palette, encoded.tile_num_unique.data());
+  encoded.is_key = _stats.inter_blocks == inter_blocks;
+
+  encoded.num_unique = 0;
+  for(uint32_t tile_idx = 0; tile_idx < _num_tiles; tile_idx++)
+    encoded.num_unique += encoded.tile_num_unique[tile_idx];
+
+  EncodeEndpoints(frame, 1, wav_ep1_Y.data(), wav_ep1_C.data(), reconstruction);
+  EncodeEndpoints(frame, 2, wav_ep2_Y.data(), wav_ep2_C.data(), reconstruction);
+
+  // Every tile codes its own five streams
+  const uint32_t tile_rows = _options.tile_rows == 0 ? _blocks_height : _options.tile_rows;
+  encoded.streams.resize(_num_tiles * kNumMPTCStreams);
+  for(uint32_t tile_idx = 0; tile_idx < _num_tiles; tile_idx++) {
+    uint32_t first_row = tile_idx * tile_rows;
+    uint32_t first_block = first_row * _blocks_width;
+    uint32_t num_blocks = std::min(tile_rows, _blocks_height - first_row) * _blocks_width;
+
+    const uint8_t *planes[kNumMPTCStreams] = {
+      motion.data() + 2 * first_block,
+      wav_ep1_Y.data() + first_block, wav_ep1_C.data() + 2 * first_block,
+      wav_ep2_Y.data() + first_block, wav_ep2_C.data() + 2 * first_block,
+    };
+    const uint32_t plane_sizes[kNumMPTCStreams] = {
+      2 * num_blocks, num_blocks, 2 * num_blocks, num_blocks, 2 * num_blocks
+    };
+
+    std::vector<uint8_t> *streams = &encoded.streams[tile_idx * kNumMPTCStreams];
+    for(int stream = 0; stream < kNumMPTCStreams; stream++) {
+      if(stream == eStream_MotionIndices && _options.motion_model)
+        EncodeMotionStream(planes[stream], _blocks_width, num_blocks / _blocks_width, _options.search_area,
+                           &streams[stream]);
+      else
+        _codec->Encode(planes[stream], plane_sizes[stream], &streams[stream]);
+    }
+    _stats.motion_bytes += streams[eStream_MotionIndices].size();
+  }
+  _pending.push_back(encoded);
+
+  if(reconstruction != NULL) {
+    for(uint32_t block_idx = 0; block_idx < _num_blocks; block_idx++)
+      reconstruction[block_idx].interp = frame[block_idx].interp;
+  }
+
+  _prev_interp.swap(_curr_interp);
+  _has_prev = true;
+
+  _stats.num_frames++;
+  _stats.num_blocks += _num_blocks;
+}
+
+// Writes the dictionary of the pending unique interval and its frames
+void Encoder::FlushInterval() {
+  if(_pending.empty())
+    return;
+
+  uint64_t palette_offset = static_cast<uint64_t>(_out_stream.tellp());
+
+  const uint8_t *palette_bytes = reinterpret_cast<const uint8_t*>(_palette.data());
+  uint32_t unique_count = static_cast<uint32_t>(4 * _palette.size());
+  std::vector<uint8_t> comp_palette;
+  _codec->Encode(palette_bytes, unique_count, &comp_palette);
+
+  WriteU32(_out_stream, static_cast<uint32_t>(comp_palette.size()));
+  WriteBytes(_out_stream, comp_palette);
+  WriteU32(_out_stream, unique_count);
+  _max_unique_count = std::max(_max_unique_count, unique_count);
+  _max_compressed_palette = std::max(_max_compressed_palette, static_cast<uint32_t>(comp_palette.size()));
+
+  uint32_t unique_offset = 0;
+  for(size_t frame = 0; frame < _pending.size(); frame++) {
+    const EncodedFrame &encoded = _pending[frame];
+
+    FrameIndexEntry entry;
+    entry.frame_offset = static_cast<uint64_t>(_out_stream.tellp());
+    entry.palette_offset = palette_offset;
+    entry.unique_offset = unique_offset;
+    entry.flags = encoded.is_key ? kFrameIndexFlag_Key : 0;
+
+    uint32_t totals[kNumMPTCStreams] = { 0, 0, 0, 0, 0 };
+    for(uint32_t tile_idx = 0; tile_idx < _num_tiles; tile_idx++) {
+      for(int stream = 0; stream < kNumMPTCStreams; stream++)
+        totals[stream] += static_cast<uint32_t>(encoded.streams[tile_idx * kNumMPTCStreams + stream].size());
+    }
+    _max_compressed_motion_indices = std::max(_max_compressed_motion_indices, totals[eStream_MotionIndices]);
+    _max_compressed_ep_Y = std::max(_max_compressed_ep_Y, std::max(totals[eStream_Ep1_Y], totals[eStream_Ep2_Y]));
+    _max_compressed_ep_C = std::max(_max_compressed_ep_C, std::max(totals[eStream_Ep1_C], totals[eStream_Ep2_C]));
+
+    WriteU32(_out_stream, encoded.num_unique);
+    if(!(_flags & kMPTCFlag_Tiled)) {
+      for(int stream = 0; stream < kNumMPTCStreams; stream++) {
+        WriteU32(_out_stream, static_cast<uint32_t>(encoded.streams[stream].size()));
+        WriteBytes(_out_stream, encoded.streams[stream]);
+      }
+    }
+    else {
+      for(uint32_t tile_idx = 0; tile_idx < _num_tiles; tile_idx++) {
+        WriteU32(_out_stream, encoded.tile_num_unique[tile_idx]);
+        for(int stream = 0; stream < kNumMPTCStreams; stream++)
+          WriteU32(_out_stream, static_cast<uint32_t>(encoded.streams[tile_idx * kNumMPTCStreams + stream].size()));
+      }
+      for(size_t stream_idx = 0; stream_idx < encoded.streams.size(); stream_idx++)
+        WriteBytes(_out_stream, encoded.streams[stream_idx]);
+    }
+
+    entry.frame_size = static_cast<uint32_t>(static_cast<uint64_t>(_out_stream.tellp()) - entry.frame_offset);
+    _index.push_back(entry);
+    unique_offset += 4 * encoded.num_unique;
+  }
+
+  _palette.clear();
+  _pending.clear();
+}
+
+bool Encoder::Close() {
+  if(!_out_stream.is_open())
+    return false;
+
+  FlushInterval();
+  _stats.file_size = static_cast<uint64_t>(_out_stream.tellp());
+
+  _out_stream.seekp(0);
+  WriteHeader();
+  bool is_ok = _out_stream.good();
+  _out_stream.close();
+
+  if(is_ok && _options.write_index)
+    is_ok = SaveFrameIndex(_path, _stats.file_size, _index);
+  return is_ok;
+}
+
+}  // namespace MPTC
@@ -0,0 +1,135 @@
+#ifndef __MPTC_ENCODER_H__
+#define __MPTC_ENCODER_H__
+
+#include "decoder.h"
+#include "entropy_codec.h"
+#include "mptc_reader.h"
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace MPTC {
+
+class ThreadPool;
+class TaskGraph;
+
+struct EncoderOptions {
+  uint8_t unique_interval;  // frames sharing one dictionary
+  uint8_t search_area;      // motion search range in blocks, 1 to 63
+  uint32_t tile_rows;       // block rows per tile, 0 writes an untiled file
+  // Frames between key frames, 0 for only the first. SeekFrame decodes from
+  // the closest key frame before its target and playback only jumps to key
+  // frames a few frames ahead, so with 0 every seek starts at frame 0 and
+  // late playback always skims. The default of one key frame per unique
+  // interval costs about 1% in size on the synthetic sequence.
+  uint32_t key_interval;
+  EntropyCodecType codec;
+  bool motion_model;        // smaller but slower to decode motion, see motion_codec.h
+  bool write_index;         // also write the "<path>.idx" frame index
+  uint32_t num_threads;     // motion search workers, 0 = hardware concurrency
+
+  EncoderOptions()
+    : unique_interval(16), search_area(8), tile_rows(0), key_interval(16),
+      codec(eEntropyCodec_Arithmetic), motion_model(false), write_index(true), num_threads(0) { }
+};
+
+struct EncoderStats {
+  uint64_t num_frames;
+  uint64_t num_blocks;
+  uint64_t unique_blocks;   // blocks coded as a dictionary entry
+  uint64_t intra_blocks;    // blocks copied from the same frame
+  uint64_t inter_blocks;    // blocks copied from the previous frame
+  uint64_t clamped_coeffs;  // wavelet coefficients that didn't fit 8 bits
+  uint64_t motion_bytes;    // compressed motion streams
+  uint64_t file_size;
+  double motion_search_ms;
+};
+
+// Writes an MPTC file, see the layout in decoder.h, from a sequence of
+// DXT1 frames. The interpolation words are coded losslessly: every block
+// is either copied from a block within search_area of it, in the previous
+// frame or earlier in the same tile, or added to the dictionary of its
+// unique interval. The endpoints go through the YCoCg transform and the
+// 64x64 wavelet of the decoder, with the coefficients clamped to 8 bits,
+// which is the only loss.
+//
+// Frames are held back until their unique interval is complete, since the
+// dictionary is written ahead of them. Close() patches the header maxima.
+class Encoder {
+ public:
+  Encoder();
+  ~Encoder();
+
+  // The frame size has to be a multiple of 256 pixels in both directions
+  // and, for tiled files, tile_rows a multiple of 64.
+  bool Open(const std::string &path, uint32_t frame_height, uint32_t frame_width,
+            const EncoderOptions &options);
+
+  // Encodes the next frame of frame_height/4 x frame_width/4 blocks in
+  // raster order. If reconstruction is not NULL it receives the frame as the
+  // decoder will rebuild it.
+  void AddFrame(const PhysicalDXTBlock *frame, PhysicalDXTBlock *reconstruction = NULL);
+
+  bool Close();
+
+  const EncoderStats &Stats() const { return _stats; }
+
+ private:
+  Encoder(const Encoder &);
+  Encoder &operator=(const Encoder &);
+
+  struct EncodedFrame {
+    uint32_t num_unique;
+    std::vector<uint32_t> tile_num_unique;
+    std::vector<std::vector<uint8_t> > streams;  // num_tiles x kNumMPTCStreams
+    bool is_key;
+  };
+
+  void SearchMotion(const PhysicalDXTBlock *frame, bool allow_inter, uint8_t *motion,
+                    std::vector<uint32_t> *palette, uint32_t *tile_num_unique);
+  void SearchMotionRows(uint32_t first_row, uint32_t end_row);
+  void PreferPredictedMotion();
+  void EncodeEndpoints(const PhysicalDXTBlock *frame, int ep_number, uint8_t *wav_Y, uint8_t *wav_C,
+                       PhysicalDXTBlock *reconstruction);
+  void FlushInterval();
+  void WriteHeader();
+
+  std::ofstream _out_stream;
+  std::string _path;
+  EncoderOptions _options;
+  std::unique_ptr<EntropyCodec> _codec;
+
+  uint32_t _frame_height, _frame_width;
+  uint32_t _blocks_width, _blocks_height, _num_blocks;
+  uint32_t _num_tiles;
+  uint8_t _version, _flags;
+  uint32_t _header_size;
+
+  // Header maxima
+  uint32_t _max_unique_count, _max_compressed_palette;
+  uint32_t _max_compressed_motion_indices, _max_compressed_ep_Y, _max_compressed_ep_C;
+
+  // Interpolation words of the frame being searched and of the previous
+  // frame, packed so that a row of candidates is one vector compare
+  std::vector<uint32_t> _curr_interp, _prev_interp;
+  uint8_t *_motion;
+  bool _allow_inter;
+  bool _has_prev;
+
+  std::unique_ptr<ThreadPool> _thread_pool;
+  std::unique_ptr<TaskGraph> _search_graph;
+
+  // The unique interval being collected
+  std::vector<uint32_t> _palette;
+  std::vector<EncodedFrame> _pending;
+
+  std::vector<FrameIndexEntry> _index;
+  EncoderStats _stats;
+};
+
+}  // namespace MPTC
+
+#endif  // __MPTC_ENCODER_H__
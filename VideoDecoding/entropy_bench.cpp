@@ -0,0 +1,115 @@
+// Round trip check and throughput benchmark of the MPTC entropy codecs.
+//
+// Usage: entropy_bench <file.mpt> [num_frames] [num_iterations]
+//
+// Decodes num_frames frames of the file and re-codes the symbol planes of
+// every frame (motion indices and wavelet coefficients of both endpoints)
+// with each backend of entropy_codec.h. Every encoded stream is decoded
+// again and compared against its input; the tool exits with an error on
+// the first mismatch. Prints the coded size and the decode throughput of
+// each backend.
+
+#include "decoder.h"
+#include "entropy_codec.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+struct CodecStats {
+  uint64_t num_symbols;
+  uint64_t num_bytes;
+  double decode_ms;
+};
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <file.mpt> [num_frames] [num_iterations]" << std::endl;
+    return 1;
+  }
+
+  std::string path(argv[1]);
+  uint32_t num_frames = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 10;
+  uint32_t num_iterations = argc > 3 ? static_cast<uint32_t>(atoi(argv[3])) : 5;
+
+  std::ifstream in_stream(path.c_str(), std::ios::binary);
+  if (!in_stream.is_open()) {
+    std::cerr << "Error opening " << path << std::endl;
+    return 1;
+  }
+
+  uint32_t frame_height = 0, frame_width = 0;
+  if (!GetMPTCFrameSize(in_stream, &frame_height, &frame_width)) {
+    std::cerr << "Error reading the header of " << path << std::endl;
+    return 1;
+  }
+  const uint32_t num_blocks = (frame_height / 4) * (frame_width / 4);
+
+  // Collect the symbol planes the decoder produces
+  MPTCDecodeInfo decode_info;
+  InitDecodeInfo(&decode_info);
+  std::vector<PhysicalDXTBlock> frames[2];
+  frames[0].resize(num_blocks);
+  frames[1].resize(num_blocks);
+
+  std::vector<std::vector<uint8_t> > planes;
+  for (uint32_t frame = 0; frame < num_frames; frame++) {
+    PhysicalDXTBlock *prev_dxt = frame == 0 ? NULL : frames[(frame - 1) % 2].data();
+    GetFrame(in_stream, prev_dxt, frames[frame % 2].data(), &decode_info);
+
+    planes.push_back(std::vector<uint8_t>(decode_info.motion_indices, decode_info.motion_indices + 2 * num_blocks));
+    planes.push_back(std::vector<uint8_t>(decode_info.wav_ep1_Y, decode_info.wav_ep1_Y + num_blocks));
+    planes.push_back(std::vector<uint8_t>(decode_info.wav_ep1_C, decode_info.wav_ep1_C + 2 * num_blocks));
+    planes.push_back(std::vector<uint8_t>(decode_info.wav_ep2_Y, decode_info.wav_ep2_Y + num_blocks));
+    planes.push_back(std::vector<uint8_t>(decode_info.wav_ep2_C, decode_info.wav_ep2_C + 2 * num_blocks));
+  }
+  FreeDecodeInfo(&decode_info);
+
+  const char *codec_names[MPTC::kNumEntropyCodecs] = { "arith", "rans" };
+  for (int type = 0; type < MPTC::kNumEntropyCodecs; type++) {
+    std::unique_ptr<MPTC::EntropyCodec> codec(
+      MPTC::CreateEntropyCodec(static_cast<MPTC::EntropyCodecType>(type)));
+
+    CodecStats stats = { 0, 0, 0.0 };
+    std::vector<uint8_t> coded, decoded;
+    for (const std::vector<uint8_t> &plane : planes) {
+      codec->Encode(plane.data(), static_cast<uint32_t>(plane.size()), &coded);
+
+      // Leave room for decoders that look past the end of the stream
+      coded.resize(coded.size() + 16);
+      uint32_t coded_sz = static_cast<uint32_t>(coded.size() - 16);
+      decoded.assign(plane.size(), 0);
+
+      Clock::time_point start = Clock::now();
+      for (uint32_t iter = 0; iter < num_iterations; iter++)
+        codec->Decode(coded.data(), coded_sz, decoded.data(), static_cast<uint32_t>(decoded.size()));
+      Clock::time_point end = Clock::now();
+
+      if (decoded != plane) {
+        std::cerr << codec_names[type] << ": round trip mismatch!" << std::endl;
+        return 1;
+      }
+
+      stats.num_symbols += plane.size();
+      stats.num_bytes += coded_sz;
+      stats.decode_ms += std::chrono::duration<double, std::milli>(end - start).count() / num_iterations;
+    }
+
+    printf("%-6s symbols: %10llu  coded: %10llu bytes (%5.3f bits/sym)  decode: %8.3f ms  %8.2f MB/s\n",
+           codec_names[type],
+           static_cast<unsigned long long>(stats.num_symbols),
+           static_cast<unsigned long long>(stats.num_bytes),
+           8.0 * stats.num_bytes / stats.num_symbols,
+           stats.decode_ms,
+           stats.num_symbols / (stats.decode_ms * 1000.0));
+  }
+
+  return 0;
+}
@@ -0,0 +1,288 @@
+#include "entropy_codec.h"
+#include "arithmetic_codec.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+namespace MPTC {
+
+void EntropyCodec::Decode(const uint8_t *in, uint32_t in_sz, uint8_t *out, uint32_t out_sz) const {
+  std::unique_ptr<EntropyDecoderState> state(CreateDecoderState());
+  Decode(state.get(), in, in_sz, out, out_sz);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Arithmetic
+//
+//////////////////////////////////////////////////////////////////////////////
+
+// The model's tables are allocated once, reset() only rewrites them
+class ArithmeticDecoderState : public EntropyDecoderState {
+ public:
+  ArithmeticDecoderState() : model(257) { }
+
+  entropy::Arithmetic_Codec decoder;
+  entropy::Adaptive_Data_Model model;
+};
+
+EntropyDecoderState *ArithmeticEntropyCodec::CreateDecoderState() const {
+  return new ArithmeticDecoderState;
+}
+
+void ArithmeticEntropyCodec::Decode(EntropyDecoderState *state, const uint8_t *in, uint32_t in_sz,
+                                    uint8_t *out, uint32_t out_sz) const {
+  ArithmeticDecoderState *arith = static_cast<ArithmeticDecoderState*>(state);
+  assert(arith != NULL);
+
+  // The codec only reads from a user buffer in decoder mode, and pointing it
+  // at one frees nothing it doesn't own
+  arith->decoder.set_buffer(in_sz + 100, const_cast<uint8_t*>(in));
+  arith->model.reset();
+  arith->decoder.start_decoder();
+  for(uint32_t sym_idx = 0; sym_idx < out_sz; sym_idx++)
+    out[sym_idx] = arith->decoder.decode(arith->model);
+  arith->decoder.stop_decoder();
+}
+
+void ArithmeticEntropyCodec::Encode(const uint8_t *in, uint32_t in_sz,
+                                    std::vector<uint8_t> *out) const {
+  // An adaptive model never expands the data by more than a few percent
+  entropy::Arithmetic_Codec arith_encoder(in_sz + in_sz / 4 + 1024);
+  entropy::Adaptive_Data_Model model(257);
+  arith_encoder.start_encoder();
+  for(uint32_t sym_idx = 0; sym_idx < in_sz; sym_idx++)
+    arith_encoder.encode(in[sym_idx], model);
+  uint32_t num_bytes = arith_encoder.stop_encoder();
+
+  out->assign(arith_encoder.buffer(), arith_encoder.buffer() + num_bytes);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// rANS
+//
+//////////////////////////////////////////////////////////////////////////////
+
+static const uint32_t kRansL = 1u << 23;   // lower bound of the normalized state
+static const uint32_t kNumRansStates = 4;
+
+static void RansError(const char *msg) {
+  std::cerr << "rANS error: " << msg << std::endl;
+  exit(-1);
+}
+
+// Scales the symbol histogram so that it sums to kProbScale and no symbol
+// that occurs ends up with a zero frequency
+static void NormalizeFrequencies(const uint32_t *counts, uint32_t total, uint32_t *freqs) {
+  const uint32_t prob_scale = RansEntropyCodec::kProbScale;
+
+  uint32_t sum = 0;
+  for(uint32_t sym = 0; sym < 256; sym++) {
+    freqs[sym] = 0;
+    if(counts[sym] == 0)
+      continue;
+
+    freqs[sym] = static_cast<uint32_t>((static_cast<uint64_t>(counts[sym]) * prob_scale) / total);
+    if(freqs[sym] == 0)
+      freqs[sym] = 1;
+    sum += freqs[sym];
+  }
+
+  // Rounding down leaves slack, forcing rare symbols to 1 may overshoot.
+  // Settle the difference on the most probable symbols.
+  while(sum != prob_scale) {
+    uint32_t best = 0;
+    for(uint32_t sym = 1; sym < 256; sym++) {
+      if(freqs[sym] > freqs[best])
+        best = sym;
+    }
+
+    if(sum < prob_scale) {
+      freqs[best] += prob_scale - sum;
+      sum = prob_scale;
+    }
+    else {
+      uint32_t take = std::min(sum - prob_scale, freqs[best] - 1);
+      assert(take > 0);
+      freqs[best] -= take;
+      sum -= take;
+    }
+  }
+}
+
+void RansEntropyCodec::Encode(const uint8_t *in, uint32_t in_sz,
+                              std::vector<uint8_t> *out) const {
+  out->clear();
+  if(in_sz == 0)
+    return;
+
+  uint32_t counts[256] = { 0 };
+  for(uint32_t sym_idx = 0; sym_idx < in_sz; sym_idx++)
+    counts[in[sym_idx]]++;
+
+  uint32_t freqs[256], starts[256];
+  NormalizeFrequencies(counts, in_sz, freqs);
+
+  uint32_t num_symbols = 0, cum = 0;
+  for(uint32_t sym = 0; sym < 256; sym++) {
+    starts[sym] = cum;
+    cum += freqs[sym];
+    if(freqs[sym] != 0)
+      num_symbols++;
+  }
+
+  // Frequency table
+  out->push_back(static_cast<uint8_t>(num_symbols - 1));
+  for(uint32_t sym = 0; sym < 256; sym++) {
+    if(freqs[sym] == 0)
+      continue;
+    out->push_back(static_cast<uint8_t>(sym));
+    out->push_back(static_cast<uint8_t>(freqs[sym] & 0xFF));
+    out->push_back(static_cast<uint8_t>(freqs[sym] >> 8));
+  }
+  size_t table_sz = out->size();
+
+  // The coder runs backwards over the input and emits bytes back to front.
+  // Each symbol needs at most two renormalization bytes.
+  std::vector<uint8_t> code(2 * static_cast<size_t>(in_sz) + 4 * kNumRansStates);
+  uint8_t *ptr = code.data() + code.size();
+
+  uint32_t states[kNumRansStates];
+  for(uint32_t state_idx = 0; state_idx < kNumRansStates; state_idx++)
+    states[state_idx] = kRansL;
+
+  for(uint32_t sym_idx = in_sz; sym_idx-- > 0; ) {
+    uint32_t &x = states[sym_idx % kNumRansStates];
+    uint32_t freq = freqs[in[sym_idx]];
+
+    uint32_t x_max = ((kRansL >> kProbBits) << 8) * freq;
+    while(x >= x_max) {
+      *--ptr = static_cast<uint8_t>(x & 0xFF);
+      x >>= 8;
+    }
+    x = ((x / freq) << kProbBits) + (x % freq) + starts[in[sym_idx]];
+  }
+
+  // Flush the states so that the decoder reads state 0 first
+  for(uint32_t state_idx = kNumRansStates; state_idx-- > 0; ) {
+    ptr -= 4;
+    ptr[0] = static_cast<uint8_t>(states[state_idx] >> 0);
+    ptr[1] = static_cast<uint8_t>(states[state_idx] >> 8);
+    ptr[2] = static_cast<uint8_t>(states[state_idx] >> 16);
+    ptr[3] = static_cast<uint8_t>(states[state_idx] >> 24);
+  }
+
+  assert(ptr >= code.data());
+  out->resize(table_sz + (code.data() + code.size() - ptr));
+  memcpy(out->data() + table_sz, ptr, code.data() + code.size() - ptr);
+}
+
+// Decodes one symbol with state x, the caller refills x afterwards
+#define RANS_DECODE_SYMBOL(x, dst) do {                       \
+    uint32_t slot_entry = slots[(x) & (kProbScale - 1)];      \
+    (dst) = static_cast<uint8_t>(slot_entry & 0xFF);          \
+    (x) = ((slot_entry >> 20) + 1) * ((x) >> kProbBits) +     \
+          ((slot_entry >> 8) & 0xFFF);                        \
+  } while(0)
+
+// The slot table is rebuilt from every stream's frequencies, it lives in
+// the state rather than on the stack only to keep the stack small
+class RansDecoderState : public EntropyDecoderState {
+ public:
+  uint32_t slots[RansEntropyCodec::kProbScale];
+};
+
+EntropyDecoderState *RansEntropyCodec::CreateDecoderState() const {
+  return new RansDecoderState;
+}
+
+void RansEntropyCodec::Decode(EntropyDecoderState *state, const uint8_t *in, uint32_t in_sz,
+                              uint8_t *out, uint32_t out_sz) const {
+  if(out_sz == 0)
+    return;
+
+  const uint8_t *ptr = in;
+  const uint8_t *end = in + in_sz;
+  if(in_sz < 1)
+    RansError("empty stream");
+
+  // Frequency table, expanded to one entry per probability slot holding
+  // the symbol, freq - 1 and the slot's offset from the symbol start
+  uint32_t num_symbols = static_cast<uint32_t>(*ptr++) + 1;
+  if(static_cast<size_t>(end - ptr) < 3 * num_symbols + 4 * kNumRansStates)
+    RansError("truncated stream");
+
+  assert(state != NULL);
+  uint32_t *slots = static_cast<RansDecoderState*>(state)->slots;
+  uint32_t cum = 0;
+  for(uint32_t idx = 0; idx < num_symbols; idx++) {
+    uint32_t sym = ptr[0];
+    uint32_t freq = static_cast<uint32_t>(ptr[1]) | (static_cast<uint32_t>(ptr[2]) << 8);
+    ptr += 3;
+    if(freq == 0 || cum + freq > kProbScale)
+      RansError("invalid frequency table");
+
+    for(uint32_t slot = 0; slot < freq; slot++)
+      slots[cum + slot] = sym | (slot << 8) | ((freq - 1) << 20);
+    cum += freq;
+  }
+  if(cum != kProbScale)
+    RansError("invalid frequency table");
+
+  uint32_t states[kNumRansStates];
+  for(uint32_t state_idx = 0; state_idx < kNumRansStates; state_idx++) {
+    states[state_idx] = static_cast<uint32_t>(ptr[0]) | (static_cast<uint32_t>(ptr[1]) << 8) |
+                        (static_cast<uint32_t>(ptr[2]) << 16) | (static_cast<uint32_t>(ptr[3]) << 24);
+    ptr += 4;
+  }
+
+  // Keep the states in registers for the main loop
+  uint32_t x0 = states[0], x1 = states[1], x2 = states[2], x3 = states[3];
+
+  // Four symbols per iteration while there is room for the worst case of
+  // two refill bytes per symbol
+  uint32_t sym_idx = 0;
+  while(sym_idx + kNumRansStates <= out_sz && end - ptr >= 8) {
+    RANS_DECODE_SYMBOL(x0, out[sym_idx + 0]);
+    RANS_DECODE_SYMBOL(x1, out[sym_idx + 1]);
+    RANS_DECODE_SYMBOL(x2, out[sym_idx + 2]);
+    RANS_DECODE_SYMBOL(x3, out[sym_idx + 3]);
+
+    while(x0 < kRansL) x0 = (x0 << 8) | *ptr++;
+    while(x1 < kRansL) x1 = (x1 << 8) | *ptr++;
+    while(x2 < kRansL) x2 = (x2 << 8) | *ptr++;
+    while(x3 < kRansL) x3 = (x3 << 8) | *ptr++;
+    sym_idx += kNumRansStates;
+  }
+
+  // Tail, and anything close to the end of the input, one at a time
+  states[0] = x0; states[1] = x1; states[2] = x2; states[3] = x3;
+  for(; sym_idx < out_sz; sym_idx++) {
+    uint32_t &x = states[sym_idx % kNumRansStates];
+    RANS_DECODE_SYMBOL(x, out[sym_idx]);
+    while(x < kRansL) {
+      if(ptr >= end)
+        RansError("truncated stream");
+      x = (x << 8) | *ptr++;
+    }
+  }
+}
+
+#undef RANS_DECODE_SYMBOL
+
+EntropyCodec *CreateEntropyCodec(EntropyCodecType type) {
+  switch(type) {
+    case eEntropyCodec_Arithmetic: return new ArithmeticEntropyCodec;
+    case eEntropyCodec_Rans: return new RansEntropyCodec;
+    default:
+      assert(false && "Unknown entropy codec");
+      return NULL;
+  }
+}
+
+}  // namespace MPTC
@@ -0,0 +1,91 @@
+#ifndef __MPTC_ENTROPY_CODEC_H__
+#define __MPTC_ENTROPY_CODEC_H__
+
+#include <cstdint>
+#include <vector>
+
+namespace MPTC {
+
+enum EntropyCodecType {
+  eEntropyCodec_Arithmetic = 0,
+  eEntropyCodec_Rans,
+  kNumEntropyCodecs
+};
+
+// Models and tables a codec needs to decode one stream. Created once and
+// reset for every stream, so that decoding frame after frame never touches
+// the heap. A state must not be used by two threads at once.
+class EntropyDecoderState {
+ public:
+  virtual ~EntropyDecoderState() { }
+};
+
+// Byte stream entropy coder used for every compressed stream of an MPTC
+// file. Implementations keep no per-stream state of their own, so a single
+// instance can decode several streams from different threads at once, each
+// with its own EntropyDecoderState.
+class EntropyCodec {
+ public:
+  virtual ~EntropyCodec() { }
+
+  virtual EntropyCodecType Type() const = 0;
+
+  // Returns a new state for Decode, owned by the caller
+  virtual EntropyDecoderState *CreateDecoderState() const = 0;
+
+  // Decodes exactly out_sz symbols from the in_sz bytes at in. state has to
+  // come from CreateDecoderState of the same codec type.
+  virtual void Decode(EntropyDecoderState *state, const uint8_t *in, uint32_t in_sz,
+                      uint8_t *out, uint32_t out_sz) const = 0;
+
+  // Same for a one-off stream, with a temporary state
+  void Decode(const uint8_t *in, uint32_t in_sz, uint8_t *out, uint32_t out_sz) const;
+
+  // Replaces the contents of out with the coded symbols
+  virtual void Encode(const uint8_t *in, uint32_t in_sz,
+                      std::vector<uint8_t> *out) const = 0;
+};
+
+// The original coder: an adaptive 257 symbol model driving the arithmetic
+// coder in arithmetic_codec.h, restarted for every stream
+class ArithmeticEntropyCodec : public EntropyCodec {
+ public:
+  using EntropyCodec::Decode;
+
+  EntropyCodecType Type() const { return eEntropyCodec_Arithmetic; }
+  EntropyDecoderState *CreateDecoderState() const;
+  void Decode(EntropyDecoderState *state, const uint8_t *in, uint32_t in_sz,
+              uint8_t *out, uint32_t out_sz) const;
+  void Encode(const uint8_t *in, uint32_t in_sz, std::vector<uint8_t> *out) const;
+};
+
+// Static order-0 rANS with four interleaved states. A stream is
+//
+//   uint8  num_symbols - 1
+//   num_symbols x { uint8 symbol, uint16 freq }   freqs sum to kRansProbScale
+//   uint32 state[4]
+//   uint8  renormalization bytes
+//
+// Symbol i is coded with state i % 4, so the decoder handles four
+// independent symbols per iteration with a single table lookup each and no
+// divisions. Empty inputs code to zero bytes.
+class RansEntropyCodec : public EntropyCodec {
+ public:
+  static const uint32_t kProbBits = 12;
+  static const uint32_t kProbScale = 1 << kProbBits;
+
+  using EntropyCodec::Decode;
+
+  EntropyCodecType Type() const { return eEntropyCodec_Rans; }
+  EntropyDecoderState *CreateDecoderState() const;
+  void Decode(EntropyDecoderState *state, const uint8_t *in, uint32_t in_sz,
+              uint8_t *out, uint32_t out_sz) const;
+  void Encode(const uint8_t *in, uint32_t in_sz, std::vector<uint8_t> *out) const;
+};
+
+// Returns a new codec of the given type, owned by the caller
+EntropyCodec *CreateEntropyCodec(EntropyCodecType type);
+
+}  // namespace MPTC
+
+#endif  // __MPTC_ENTROPY_CODEC_H__
@@ -0,0 +1,258 @@
+#include "frame_archive.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace MPTC {
+
+FrameCodec FrameCodecFromSuffix(const std::string &suffix) {
+  std::string ext = suffix;
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  if (ext == ".dxt1")
+    return eFrameCodec_DXT1;
+  if (ext == ".crn")
+    return eFrameCodec_CRN;
+  if (ext == ".jpg" || ext == ".jpeg")
+    return eFrameCodec_JPG;
+  if (ext == ".bmp")
+    return eFrameCodec_BMP;
+  if (ext == ".gtc")
+    return eFrameCodec_GTC;
+  if (ext == ".mpt")
+    return eFrameCodec_MPTC;
+  return eFrameCodec_Raw;
+}
+
+const char *FrameCodecName(uint32_t codec) {
+  switch (codec) {
+  case eFrameCodec_DXT1: return "DXT1";
+  case eFrameCodec_CRN: return "CRN";
+  case eFrameCodec_JPG: return "JPG";
+  case eFrameCodec_BMP: return "BMP";
+  case eFrameCodec_GTC: return "GTC";
+  case eFrameCodec_MPTC: return "MPTC";
+  default: return "raw";
+  }
+}
+
+static uint32_t Read32(const uint8_t *src) {
+  uint32_t value;
+  memcpy(&value, src, 4);
+  return value;
+}
+
+static uint64_t Read64(const uint8_t *src) {
+  uint64_t value;
+  memcpy(&value, src, 8);
+  return value;
+}
+
+// Checks the header, and returns the frame count and where the table is
+static bool ParseHeader(const uint8_t *header, uint64_t file_size, uint32_t *num_frames, uint64_t *table_offset) {
+  uint32_t alignment = Read32(header + 12);
+  *num_frames = Read32(header + 8);
+  *table_offset = Read64(header + 16);
+  return Read32(header) == kFrameArchiveMagic && Read32(header + 4) == kFrameArchiveVersion &&
+    alignment == kFrameArchiveAlignment && Read64(header + 24) == file_size &&
+    *table_offset >= kFrameArchiveHeaderSize &&
+    *table_offset + static_cast<uint64_t>(*num_frames) * kFrameArchiveEntrySize <= file_size;
+}
+
+static bool ParseTable(const uint8_t *table, uint32_t num_frames, uint64_t table_end, uint64_t file_size,
+                       std::vector<FrameArchiveEntry> *entries) {
+  entries->resize(num_frames);
+  for (uint32_t frame = 0; frame < num_frames; frame++) {
+    const uint8_t *src = table + frame * kFrameArchiveEntrySize;
+    FrameArchiveEntry &entry = (*entries)[frame];
+    entry.offset = Read64(src);
+    entry.size = Read64(src + 8);
+    entry.aux_size = Read32(src + 16);
+    entry.codec = Read32(src + 20);
+    entry.timestamp_us = Read64(src + 24);
+    if (entry.offset % kFrameArchiveAlignment != 0 || entry.offset < table_end ||
+        entry.offset > file_size || entry.size + entry.aux_size > file_size - entry.offset) {
+      entries->clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ReadFrameArchiveTable(std::istream &in_stream, uint64_t file_size, std::vector<FrameArchiveEntry> *entries) {
+  uint8_t header[kFrameArchiveHeaderSize];
+  uint32_t num_frames;
+  uint64_t table_offset;
+  in_stream.seekg(0);
+  in_stream.read(reinterpret_cast<char*>(header), kFrameArchiveHeaderSize);
+  if (!in_stream.good() || !ParseHeader(header, file_size, &num_frames, &table_offset))
+    return false;
+
+  std::vector<uint8_t> table(static_cast<size_t>(num_frames) * kFrameArchiveEntrySize);
+  in_stream.seekg(table_offset);
+  in_stream.read(reinterpret_cast<char*>(table.data()), table.size());
+  return in_stream.good() &&
+    ParseTable(table.data(), num_frames, table_offset + table.size(), file_size, entries);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// FrameArchiveWriter
+//
+//////////////////////////////////////////////////////////////////////////////
+
+static uint64_t AlignUp(uint64_t pos) {
+  return (pos + kFrameArchiveAlignment - 1) & ~static_cast<uint64_t>(kFrameArchiveAlignment - 1);
+}
+
+bool FrameArchiveWriter::Open(const std::string &path, uint32_t num_frames) {
+  _out_stream.open(path.c_str(), std::ios::binary | std::ios::trunc);
+  if (!_out_stream.is_open())
+    return false;
+
+  // The header and table are written by Finish, the first payload starts
+  // after the room for them
+  _num_frames = num_frames;
+  _entries.clear();
+  _pos = AlignUp(kFrameArchiveHeaderSize + static_cast<uint64_t>(num_frames) * kFrameArchiveEntrySize);
+  _out_stream.seekp(_pos);
+  return _out_stream.good();
+}
+
+bool FrameArchiveWriter::AddFrame(const uint8_t *data, size_t size, FrameCodec codec, uint64_t timestamp_us,
+                                  const uint8_t *aux, uint32_t aux_size) {
+  assert(_entries.size() < _num_frames && "More frames than the archive was opened for");
+  FrameArchiveEntry entry;
+  entry.offset = _pos;
+  entry.size = size;
+  entry.aux_size = aux_size;
+  entry.codec = codec;
+  entry.timestamp_us = timestamp_us;
+  _entries.push_back(entry);
+
+  _out_stream.write(reinterpret_cast<const char*>(data), size);
+  if (aux_size != 0)
+    _out_stream.write(reinterpret_cast<const char*>(aux), aux_size);
+  _pos += size + aux_size;
+
+  static const char kZeros[kFrameArchiveAlignment] = { 0 };
+  uint64_t padding = AlignUp(_pos) - _pos;
+  _out_stream.write(kZeros, padding);
+  _pos += padding;
+  return _out_stream.good();
+}
+
+bool FrameArchiveWriter::Finish() {
+  if (_entries.size() != _num_frames) {
+    _out_stream.close();
+    return false;
+  }
+
+  uint32_t alignment = kFrameArchiveAlignment;
+  uint64_t table_offset = kFrameArchiveHeaderSize;
+  uint64_t file_size = _pos;
+  _out_stream.seekp(0);
+  _out_stream.write(reinterpret_cast<const char*>(&kFrameArchiveMagic), 4);
+  _out_stream.write(reinterpret_cast<const char*>(&kFrameArchiveVersion), 4);
+  _out_stream.write(reinterpret_cast<const char*>(&_num_frames), 4);
+  _out_stream.write(reinterpret_cast<const char*>(&alignment), 4);
+  _out_stream.write(reinterpret_cast<const char*>(&table_offset), 8);
+  _out_stream.write(reinterpret_cast<const char*>(&file_size), 8);
+  for (size_t frame = 0; frame < _entries.size(); frame++) {
+    const FrameArchiveEntry &entry = _entries[frame];
+    _out_stream.write(reinterpret_cast<const char*>(&entry.offset), 8);
+    _out_stream.write(reinterpret_cast<const char*>(&entry.size), 8);
+    _out_stream.write(reinterpret_cast<const char*>(&entry.aux_size), 4);
+    _out_stream.write(reinterpret_cast<const char*>(&entry.codec), 4);
+    _out_stream.write(reinterpret_cast<const char*>(&entry.timestamp_us), 8);
+  }
+  bool is_ok = _out_stream.good();
+  _out_stream.close();
+  return is_ok;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// FrameArchive
+//
+//////////////////////////////////////////////////////////////////////////////
+
+bool FrameArchive::Open(const std::string &path) {
+  Close();
+  if (!_file.Open(path))
+    return false;
+
+  uint32_t num_frames;
+  uint64_t table_offset;
+  if (_file.Size() < kFrameArchiveHeaderSize || !ParseHeader(_file.Data(), _file.Size(), &num_frames, &table_offset)) {
+    Close();
+    return false;
+  }
+  uint64_t table_end = table_offset + static_cast<uint64_t>(num_frames) * kFrameArchiveEntrySize;
+  if (!ParseTable(_file.Data() + table_offset, num_frames, table_end, _file.Size(), &_entries)) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void FrameArchive::Close() {
+  _file.Close();
+  _entries.clear();
+}
+
+void FrameArchive::WillNeed(uint32_t first_frame, uint32_t num_frames) const {
+  if (first_frame >= _entries.size() || num_frames == 0)
+    return;
+  uint32_t last_frame = std::min<uint32_t>(first_frame + num_frames, NumFrames()) - 1;
+  uint64_t begin = _entries[first_frame].offset;
+  uint64_t end = _entries[last_frame].offset + _entries[last_frame].size + _entries[last_frame].aux_size;
+  void *address = const_cast<uint8_t *>(_file.Data() + begin);
+#ifdef _WIN32
+#if _WIN32_WINNT >= 0x0602
+  WIN32_MEMORY_RANGE_ENTRY range;
+  range.VirtualAddress = address;
+  range.NumberOfBytes = static_cast<SIZE_T>(end - begin);
+  PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+  (void)address;
+  (void)end;
+#endif
+#else
+  // Payloads are page aligned within the mapping, which is itself page
+  // aligned, as madvise needs
+  madvise(address, static_cast<size_t>(end - begin), MADV_WILLNEED);
+#endif
+}
+
+size_t ArchiveFrameLoader::Load(uint32_t frame_idx, uint8_t *dst, size_t dst_size, FrameLoadStats *stats) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if (frame_idx >= _archive->NumFrames())
+    return 0;
+
+  // Paging the next frame in while this one is copied keeps the reads
+  // going between loads
+  _archive->WillNeed(frame_idx + 1, 1);
+  size_t size = static_cast<size_t>(_archive->Entry(frame_idx).size);
+  if (size > dst_size)
+    size = 0;
+  if (size != 0)
+    memcpy(dst, _archive->Frame(frame_idx), size);
+  stats->read_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count();
+  stats->decode_ns = 0;
+  return size;
+}
+
+}  // namespace MPTC
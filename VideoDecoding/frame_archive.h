@@ -0,0 +1,118 @@
+#ifndef __MPTC_FRAME_ARCHIVE_H__
+#define __MPTC_FRAME_ARCHIVE_H__
+
+#include "frame_streamer.h"
+#include "mptc_reader.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace MPTC {
+
+// A sequence of frame files packed into one file, so that playing it opens
+// one file instead of one per frame. Little endian:
+//
+//   u32 magic "MPFA", u32 version, u32 num_frames, u32 alignment,
+//   u64 table_offset, u64 file_size
+//   at table_offset, num_frames x
+//     u64 offset, u64 size, u32 aux_size, u32 codec, u64 timestamp_us
+//   the payloads
+//
+// Every payload starts on an alignment boundary, so that the frames can be
+// read with direct I/O or mapped page by page, and is followed by aux_size
+// bytes of side data, such as the restart points of a CRN frame. The
+// table comes right after the header and the payloads are in frame order,
+// so reading front to back streams the whole sequence.
+const uint32_t kFrameArchiveMagic = 0x4146504D;
+const uint32_t kFrameArchiveVersion = 1;
+const uint32_t kFrameArchiveAlignment = 4096;
+const uint32_t kFrameArchiveHeaderSize = 32;
+const uint32_t kFrameArchiveEntrySize = 32;
+
+// What the frames are, the file types of the texture sequences
+enum FrameCodec {
+  eFrameCodec_Raw = 0,
+  eFrameCodec_DXT1,
+  eFrameCodec_CRN,
+  eFrameCodec_JPG,
+  eFrameCodec_BMP,
+  eFrameCodec_GTC,
+  eFrameCodec_MPTC
+};
+
+// From a file extension such as ".crn", eFrameCodec_Raw if it is none of them
+FrameCodec FrameCodecFromSuffix(const std::string &suffix);
+const char *FrameCodecName(uint32_t codec);
+
+struct FrameArchiveEntry {
+  uint64_t offset;
+  uint64_t size;
+  uint32_t aux_size;
+  uint32_t codec;
+  uint64_t timestamp_us;  // presentation time from the start of the sequence
+};
+
+// Reads and checks the header and table of an archive of file_size bytes,
+// false if it is not one or the table points outside of it
+bool ReadFrameArchiveTable(std::istream &in_stream, uint64_t file_size, std::vector<FrameArchiveEntry> *entries);
+
+// Writes an archive front to back. The table is written last, over the
+// room Open leaves for it.
+class FrameArchiveWriter {
+ public:
+  FrameArchiveWriter() : _num_frames(0), _pos(0) { }
+
+  bool Open(const std::string &path, uint32_t num_frames);
+  bool AddFrame(const uint8_t *data, size_t size, FrameCodec codec, uint64_t timestamp_us,
+                const uint8_t *aux = NULL, uint32_t aux_size = 0);
+  // False if fewer frames were added than Open was told
+  bool Finish();
+
+ private:
+  std::ofstream _out_stream;
+  uint32_t _num_frames;
+  uint64_t _pos;
+  std::vector<FrameArchiveEntry> _entries;
+};
+
+// An archive mapped into memory. The frames are handed out in place.
+class FrameArchive {
+ public:
+  bool Open(const std::string &path);
+  void Close();
+
+  bool IsOpen() const { return _file.IsOpen(); }
+  uint32_t NumFrames() const { return static_cast<uint32_t>(_entries.size()); }
+  const FrameArchiveEntry &Entry(uint32_t frame_idx) const { return _entries[frame_idx]; }
+  const std::vector<FrameArchiveEntry> &Entries() const { return _entries; }
+
+  const uint8_t *Frame(uint32_t frame_idx) const { return _file.Data() + _entries[frame_idx].offset; }
+  const uint8_t *Aux(uint32_t frame_idx) const { return Frame(frame_idx) + _entries[frame_idx].size; }
+
+  // Tells the OS the frames will be read soon, so that it pages them in
+  // ahead of the first touch
+  void WillNeed(uint32_t first_frame, uint32_t num_frames) const;
+
+ private:
+  MappedFile _file;
+  std::vector<FrameArchiveEntry> _entries;
+};
+
+// Copies the frames of a mapped archive to staging memory, for frames that
+// are stored in the format they are uploaded in, such as DXT1
+class ArchiveFrameLoader : public FrameLoader {
+ public:
+  explicit ArchiveFrameLoader(const FrameArchive *archive) : _archive(archive) { }
+
+  size_t Load(uint32_t frame_idx, uint8_t *dst, size_t dst_size, FrameLoadStats *stats);
+
+ private:
+  const FrameArchive *_archive;
+};
+
+}  // namespace MPTC
+
+#endif  // __MPTC_FRAME_ARCHIVE_H__
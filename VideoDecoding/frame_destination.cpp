@@ -0,0 +1,43 @@
+#include "frame_destination.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace MPTC {
+
+MemoryDestination::MemoryDestination(uint32_t num_slots, size_t slot_size, uint32_t row_pitch)
+  : _data(NULL), _num_slots(num_slots), _slot_size(slot_size), _row_pitch(row_pitch),
+    _bytes_copied(0) {
+  assert(row_pitch % sizeof(PhysicalDXTBlock) == 0);
+
+  _data = reinterpret_cast<uint8_t*>(malloc(static_cast<size_t>(num_slots) * slot_size));
+  if (_data == NULL) {
+    std::cerr << "Error allocating " << num_slots << " frame slots!" << std::endl;
+    exit(-1);
+  }
+}
+
+MemoryDestination::~MemoryDestination() {
+  free(_data);
+}
+
+PhysicalDXTBlock *MemoryDestination::Slot(uint32_t slot) {
+  assert(slot < _num_slots);
+  return reinterpret_cast<PhysicalDXTBlock*>(_data + static_cast<size_t>(slot) * _slot_size);
+}
+
+void MemoryDestination::CopyFrame(uint32_t slot, uint32_t blocks_height, uint32_t blocks_width,
+                                  PhysicalDXTBlock *out) {
+  const size_t row_sz = blocks_width * sizeof(PhysicalDXTBlock);
+  const size_t pitch = _row_pitch == 0 ? row_sz : _row_pitch;
+  assert(blocks_height * pitch <= _slot_size);
+
+  const uint8_t *src = reinterpret_cast<const uint8_t*>(Slot(slot));
+  for (uint32_t row = 0; row < blocks_height; row++)
+    memcpy(out + static_cast<size_t>(row) * blocks_width, src + row * pitch, row_sz);
+  _bytes_copied += blocks_height * row_sz;
+}
+
+}  // namespace MPTC
@@ -0,0 +1,66 @@
+#ifndef __MPTC_FRAME_DESTINATION_H__
+#define __MPTC_FRAME_DESTINATION_H__
+
+#include "decoder.h"
+
+#include <cstdint>
+#include <cstddef>
+
+namespace MPTC {
+
+// Memory the buffered decoder reconstructs its frames in, such as a
+// persistently mapped pixel buffer, so that frames go to the GPU without
+// another copy. There is a fixed number of slots of one frame each, every
+// block row of a frame starts RowPitch() bytes after the previous one.
+//
+// The decoder reads a slot back while it decodes the frame after it and
+// while it decodes the rest of the frame itself, so slots have to stay
+// readable, and are best not write-combined.
+class FrameDestination {
+ public:
+  virtual ~FrameDestination() { }
+
+  virtual uint32_t NumSlots() const = 0;
+
+  // A multiple of sizeof(PhysicalDXTBlock), 0 packs the rows tightly
+  virtual uint32_t RowPitch() const = 0;
+
+  virtual PhysicalDXTBlock *Slot(uint32_t slot) = 0;
+};
+
+// Slots in one block of plain memory, for headless decoding and tests.
+// Consumers that need a frame somewhere else go through CopyFrame, which
+// counts the bytes it moves so that a zero copy path can be checked.
+class MemoryDestination : public FrameDestination {
+ public:
+  // slot_size is the bytes of one slot, at least the frame's block rows
+  // times row_pitch (or the frame size for tightly packed rows)
+  MemoryDestination(uint32_t num_slots, size_t slot_size, uint32_t row_pitch = 0);
+  ~MemoryDestination();
+
+  uint32_t NumSlots() const { return _num_slots; }
+  uint32_t RowPitch() const { return _row_pitch; }
+  PhysicalDXTBlock *Slot(uint32_t slot);
+
+  uint8_t *Data() { return _data; }
+  size_t SlotSize() const { return _slot_size; }
+
+  // Copies the blocks_height x blocks_width frame in slot to out, tightly
+  // packed
+  void CopyFrame(uint32_t slot, uint32_t blocks_height, uint32_t blocks_width, PhysicalDXTBlock *out);
+  uint64_t BytesCopied() const { return _bytes_copied; }
+
+ private:
+  MemoryDestination(const MemoryDestination &);
+  MemoryDestination &operator=(const MemoryDestination &);
+
+  uint8_t *_data;
+  uint32_t _num_slots;
+  size_t _slot_size;
+  uint32_t _row_pitch;
+  uint64_t _bytes_copied;
+};
+
+}  // namespace MPTC
+
+#endif  // __MPTC_FRAME_DESTINATION_H__
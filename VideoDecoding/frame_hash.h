@@ -0,0 +1,23 @@
+#ifndef __MPTC_FRAME_HASH_H__
+#define __MPTC_FRAME_HASH_H__
+
+#include "decoder.h"
+
+#include <cstdint>
+
+namespace MPTC {
+
+// FNV-1a over the 64 bit blocks of a frame, for the tools and benches that
+// check decoded frames against a reference without keeping whole frames
+inline uint64_t HashFrame(const PhysicalDXTBlock *frame, uint32_t num_blocks) {
+  uint64_t hash = 1469598103934665603ULL;
+  for (uint32_t block_idx = 0; block_idx < num_blocks; block_idx++) {
+    hash ^= frame[block_idx].dxt_block;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+}  // namespace MPTC
+
+#endif  // __MPTC_FRAME_HASH_H__
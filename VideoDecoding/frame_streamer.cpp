@@ -0,0 +1,232 @@
+#include "frame_streamer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+namespace MPTC {
+
+std::string FileSequence::Path(uint32_t frame_idx) const {
+  char number[16];
+  snprintf(number, sizeof(number), "%0*u", static_cast<int>(num_digits), first_number + frame_idx);
+  return prefix + number + suffix;
+}
+
+size_t RawFileLoader::Load(uint32_t frame_idx, uint8_t *dst, size_t dst_size, FrameLoadStats *stats) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::string path = _files.Path(frame_idx);
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp) {
+    std::cerr << "Error opening file: " << path << std::endl;
+    return 0;
+  }
+
+  // A file larger than the buffer is not a frame of this sequence
+  size_t size = fread(dst, 1, dst_size, fp);
+  bool is_truncated = (size == dst_size && fgetc(fp) != EOF);
+  fclose(fp);
+  if (size == 0 || is_truncated) {
+    std::cerr << "Frame does not fit the staging buffer: " << path << std::endl;
+    return 0;
+  }
+
+  stats->read_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count();
+  stats->decode_ns = 0;
+  return size;
+}
+
+FrameStreamer::FrameStreamer()
+  : _loader(NULL), _staging(NULL), _num_frames(0), _lookahead(0), _window_start(0), _next_load(0),
+    _shown_frame(0), _stop(false) {
+  _stats = FrameStreamerStats();
+}
+
+FrameStreamer::~FrameStreamer() {
+  Stop();
+}
+
+void FrameStreamer::Start(FrameLoader *loader, StagingBuffers *staging, uint32_t num_frames, double frame_ms,
+                          uint32_t lookahead, uint32_t num_threads, PlaybackClock::time_point start) {
+  assert(_threads.empty() && "FrameStreamer is already running");
+  assert(num_frames > 0 && frame_ms > 0.0 && staging->NumBuffers() > 0);
+  _loader = loader;
+  _staging = staging;
+  _num_frames = num_frames;
+  _frame_period = std::chrono::duration_cast<PlaybackClock::duration>(
+    std::chrono::duration<double, std::milli>(frame_ms));
+  _lookahead = std::max<uint32_t>(1, std::min(lookahead, staging->NumBuffers()));
+  _start = start;
+
+  Buffer free_buffer = { eBufferState_Free, 0, 0, { 0, 0 } };
+  _buffers.assign(staging->NumBuffers(), free_buffer);
+  _window_start = 0;
+  _next_load = 0;
+  _shown_frame = 0;
+  _stats = FrameStreamerStats();
+  _stop = false;
+
+  for (uint32_t i = 0; i < std::max<uint32_t>(1, num_threads); i++)
+    _threads.push_back(std::thread(&FrameStreamer::PrefetchLoop, this));
+}
+
+void FrameStreamer::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _cv.notify_all();
+  for (size_t i = 0; i < _threads.size(); i++)
+    _threads[i].join();
+  _threads.clear();
+}
+
+uint64_t FrameStreamer::DueFrame(PlaybackClock::time_point now) const {
+  if (now <= _start)
+    return 0;
+  return static_cast<uint64_t>((now - _start) / _frame_period);
+}
+
+void FrameStreamer::AdvanceWindow(uint64_t due) {
+  uint64_t first_wanted = due;
+  if (_stats.frames_shown > 0)
+    first_wanted = std::max(first_wanted, _shown_frame + 1);
+  _window_start = std::max(_window_start, first_wanted);
+}
+
+uint32_t FrameStreamer::FreeBuffer() const {
+  for (uint32_t i = 0; i < _buffers.size(); i++) {
+    if (_buffers[i].state == eBufferState_Free)
+      return i;
+  }
+  return kNoBuffer;
+}
+
+int FrameStreamer::GetFrame(PlaybackClock::time_point now, StagedFrame *frame) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  uint64_t due = DueFrame(now);
+  bool has_shown = _stats.frames_shown > 0;
+
+  // Take the newest loaded frame that is due, the ones before it are too late
+  uint32_t newest = kNoBuffer;
+  for (uint32_t i = 0; i < _buffers.size(); i++) {
+    const Buffer &buffer = _buffers[i];
+    if (buffer.state != eBufferState_Ready || buffer.frame_number > due)
+      continue;
+    if (has_shown && buffer.frame_number <= _shown_frame)
+      continue;
+    if (newest == kNoBuffer || buffer.frame_number > _buffers[newest].frame_number)
+      newest = i;
+  }
+
+  if (newest == kNoBuffer) {
+    if (!has_shown || due > _shown_frame)
+      _stats.late_calls++;
+    AdvanceWindow(due);
+    lock.unlock();
+    _cv.notify_all();
+    return kMPTCFrameNotReady;
+  }
+
+  uint64_t frame_number = _buffers[newest].frame_number;
+  for (uint32_t i = 0; i < _buffers.size(); i++) {
+    Buffer &buffer = _buffers[i];
+    if (buffer.state == eBufferState_Ready && buffer.frame_number < frame_number) {
+      buffer.state = eBufferState_Free;
+      _stats.frames_dropped++;
+    }
+  }
+
+  Buffer &buffer = _buffers[newest];
+  buffer.state = eBufferState_Held;
+  _shown_frame = frame_number;
+  _stats.frames_shown++;
+  AdvanceWindow(due);
+
+  frame->frame_number = frame_number;
+  frame->frame_idx = static_cast<uint32_t>(frame_number % _num_frames);
+  frame->buffer = newest;
+  frame->data = _staging->BufferData(newest);
+  frame->size = buffer.size;
+  frame->load = buffer.load;
+  lock.unlock();
+  _cv.notify_all();
+  return kMPTCFrameReady;
+}
+
+void FrameStreamer::Release(const StagedFrame &frame) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    assert(frame.buffer < _buffers.size() && _buffers[frame.buffer].state == eBufferState_Held);
+    _buffers[frame.buffer].state = eBufferState_Free;
+  }
+  _cv.notify_all();
+}
+
+void FrameStreamer::GetStats(FrameStreamerStats *stats) const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  *stats = _stats;
+  stats->buffers_held = 0;
+  for (const Buffer &buffer : _buffers)
+    stats->buffers_held += buffer.state == eBufferState_Held ? 1 : 0;
+}
+
+void FrameStreamer::PrefetchLoop() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  for (;;) {
+    // Wait for a frame inside the window and a buffer to load it into
+    uint32_t buffer = kNoBuffer;
+    bool is_waiting_for_buffer = false;
+    while (!_stop) {
+      if (_next_load < _window_start) {
+        _stats.frames_skipped += _window_start - _next_load;
+        _next_load = _window_start;
+      }
+      if (_next_load < _window_start + _lookahead) {
+        buffer = FreeBuffer();
+        if (buffer != kNoBuffer)
+          break;
+        if (!is_waiting_for_buffer)
+          _stats.loader_waits++;
+        is_waiting_for_buffer = true;
+      }
+      _cv.wait(lock);
+    }
+    if (_stop)
+      return;
+
+    uint64_t frame_number = _next_load++;
+    _buffers[buffer].state = eBufferState_Loading;
+    _buffers[buffer].frame_number = frame_number;
+    lock.unlock();
+
+    FrameLoadStats load = { 0, 0 };
+    size_t size = _loader->Load(static_cast<uint32_t>(frame_number % _num_frames),
+                                _staging->BufferData(buffer), _staging->BufferSize(), &load);
+
+    lock.lock();
+    Buffer &loaded = _buffers[buffer];
+    if (size == 0) {
+      _stats.load_failures++;
+      loaded.state = eBufferState_Free;
+      continue;
+    }
+    _stats.frames_loaded++;
+    _stats.read_ns += load.read_ns;
+    _stats.decode_ns += load.decode_ns;
+
+    // Playback may have moved past it while it was loading
+    if (_stats.frames_shown > 0 && frame_number <= _shown_frame) {
+      _stats.frames_dropped++;
+      loaded.state = eBufferState_Free;
+      continue;
+    }
+    loaded.state = eBufferState_Ready;
+    loaded.size = size;
+    loaded.load = load;
+  }
+}
+
+}  // namespace MPTC
@@ -0,0 +1,189 @@
+#ifndef __MPTC_FRAME_STREAMER_H__
+#define __MPTC_FRAME_STREAMER_H__
+
+#include "playback.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace MPTC {
+
+struct FrameLoadStats {
+  uint64_t read_ns;    // file I/O
+  uint64_t decode_ns;  // everything after it, such as unpacking a CRN
+};
+
+// Reads and decodes one frame of a sequence, such as one texture file per
+// frame, into staging memory. Runs on the prefetch threads of a
+// FrameStreamer, several frames at once, so it must not touch GL.
+class FrameLoader {
+ public:
+  virtual ~FrameLoader() { }
+
+  // Returns the bytes written to dst, 0 if the frame could not be loaded
+  virtual size_t Load(uint32_t frame_idx, uint8_t *dst, size_t dst_size, FrameLoadStats *stats) = 0;
+};
+
+// Frames stored one per file as "<prefix><number><suffix>", numbered from
+// first_number and zero padded to num_digits, as in "360MegaC4K001.crn"
+struct FileSequence {
+  std::string prefix;
+  std::string suffix;
+  uint32_t first_number;
+  uint32_t num_digits;
+
+  std::string Path(uint32_t frame_idx) const;
+};
+
+// Reads the files of a sequence straight into staging memory, for frames
+// that are stored in the format they are uploaded in, such as DXT1
+class RawFileLoader : public FrameLoader {
+ public:
+  explicit RawFileLoader(const FileSequence &files) : _files(files) { }
+
+  size_t Load(uint32_t frame_idx, uint8_t *dst, size_t dst_size, FrameLoadStats *stats);
+
+ private:
+  FileSequence _files;
+};
+
+// Memory the frames are staged in on their way to the GPU, such as the
+// slots of a persistently mapped pixel unpack buffer, so that uploads copy
+// nothing on the CPU. Every buffer holds one frame.
+class StagingBuffers {
+ public:
+  virtual ~StagingBuffers() { }
+
+  virtual uint32_t NumBuffers() const = 0;
+  virtual size_t BufferSize() const = 0;
+  virtual uint8_t *BufferData(uint32_t buffer) = 0;
+};
+
+// Buffers in plain memory, for headless streaming and tests
+class MemoryStagingBuffers : public StagingBuffers {
+ public:
+  MemoryStagingBuffers(uint32_t num_buffers, size_t buffer_size)
+    : _num_buffers(num_buffers), _buffer_size(buffer_size), _data(num_buffers * buffer_size) { }
+
+  uint32_t NumBuffers() const { return _num_buffers; }
+  size_t BufferSize() const { return _buffer_size; }
+  uint8_t *BufferData(uint32_t buffer) { return _data.data() + buffer * _buffer_size; }
+
+ private:
+  uint32_t _num_buffers;
+  size_t _buffer_size;
+  std::vector<uint8_t> _data;
+};
+
+// A frame in its staging buffer, the consumer's until it is released
+struct StagedFrame {
+  uint64_t frame_number;  // in the stream, which loops over the sequence
+  uint32_t frame_idx;     // in the sequence
+  uint32_t buffer;
+  const uint8_t *data;
+  size_t size;
+  FrameLoadStats load;
+};
+
+struct FrameStreamerStats {
+  uint64_t frames_loaded;
+  uint64_t load_failures;
+  uint64_t frames_shown;
+  uint64_t frames_dropped;   // loaded, but a newer frame was due before they were shown
+  uint64_t frames_skipped;   // never loaded, playback had passed them
+  uint64_t late_calls;       // GetFrame calls that had no frame for the due time
+  uint64_t loader_waits;     // times a prefetch thread had no free buffer to load into
+  uint64_t read_ns;          // of all frames loaded
+  uint64_t decode_ns;
+  uint32_t buffers_held;     // handed out by GetFrame and not released yet
+};
+
+// Plays a sequence of frames by wall clock with the file I/O and decoding
+// on prefetch threads, so that the render thread never waits for a file.
+// Frame n of the stream is frame n % num_frames of the sequence and is due
+// at start + n * frame_ms.
+//
+// The prefetch threads load the frames from the one due up to lookahead
+// frames ahead of it, each into a free staging buffer, and skip the frames
+// playback has passed by the time they get to them. The render thread
+// calls GetFrame whenever it draws, uploads the frame it gets from its
+// buffer and hands the buffer back with Release once the upload no longer
+// reads it, such as after a fence.
+class FrameStreamer {
+ public:
+  FrameStreamer();
+  ~FrameStreamer();
+
+  // loader and staging have to outlive the streamer. lookahead is capped
+  // by the staging buffers, and num_threads 0 picks one thread.
+  void Start(FrameLoader *loader, StagingBuffers *staging, uint32_t num_frames, double frame_ms,
+             uint32_t lookahead, uint32_t num_threads, PlaybackClock::time_point start);
+
+  // Waits for the loads in flight. Held frames stay valid, the staging
+  // buffers are the caller's.
+  void Stop();
+
+  // Returns kMPTCFrameReady with the newest loaded frame that is due and
+  // newer than the one handed out last, the older ones loaded by then are
+  // dropped. Returns kMPTCFrameNotReady when the frame held is still the
+  // one to show or the loaders are behind. Never waits for a load.
+  int GetFrame(PlaybackClock::time_point now, StagedFrame *frame);
+
+  // The buffer of frame goes back to the prefetch threads
+  void Release(const StagedFrame &frame);
+
+  void GetStats(FrameStreamerStats *stats) const;
+
+ private:
+  FrameStreamer(const FrameStreamer &);
+  FrameStreamer &operator=(const FrameStreamer &);
+
+  enum BufferState {
+    eBufferState_Free = 0,
+    eBufferState_Loading,
+    eBufferState_Ready,
+    eBufferState_Held
+  };
+
+  struct Buffer {
+    BufferState state;
+    uint64_t frame_number;
+    size_t size;
+    FrameLoadStats load;
+  };
+
+  static const uint32_t kNoBuffer = 0xFFFFFFFF;
+
+  uint64_t DueFrame(PlaybackClock::time_point now) const;
+  // First frame still wanted once due is due, with _mutex held
+  void AdvanceWindow(uint64_t due);
+  uint32_t FreeBuffer() const;
+  void PrefetchLoop();
+
+  FrameLoader *_loader;
+  StagingBuffers *_staging;
+  uint32_t _num_frames;
+  PlaybackClock::duration _frame_period;
+  uint32_t _lookahead;
+  PlaybackClock::time_point _start;
+
+  std::vector<Buffer> _buffers;
+  uint64_t _window_start;  // first frame the prefetch threads may load
+  uint64_t _next_load;     // next frame a prefetch thread takes
+  uint64_t _shown_frame;   // valid once a frame was shown
+  FrameStreamerStats _stats;
+
+  std::vector<std::thread> _threads;
+  mutable std::mutex _mutex;
+  std::condition_variable _cv;
+  bool _stop;
+};
+
+}  // namespace MPTC
+
+#endif  // __MPTC_FRAME_STREAMER_H__
@@ -0,0 +1,207 @@
+// Decodes JPG files with restart markers in bands of MCU rows on the thread
+// pool, see stbi_jpeg_bands_decode in stb_image.h.
+//
+// Usage: jpg_bench [--threads N] [--iterations N] file.jpg ...
+//
+// Every file is decoded to RGBA with stbi_load_from_memory on one thread,
+// then in bands on pools of 1, 2, 4, ... up to --threads threads (all
+// cores), two bands per thread, and once more with a band per restart
+// marker that starts a row. The bands have to write the same bytes as
+// stb. Prints the best of --iterations (5) runs of each.
+//
+// Files without restart markers are decoded by stb alone, as
+// Model::LoadTextureDataPBO does for them. jpegtran adds the markers
+// without recompressing:
+//   jpegtran -restart 1 -outfile 360MegaC4K001_rst.jpg 360MegaC4K001.jpg
+// puts one at the start of every MCU row.
+
+#include "thread_pool.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+struct Options {
+  uint32_t max_threads;
+  uint32_t num_iterations;
+};
+
+static double ElapsedMs(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// First MCU row of every band and the end of the last, about num_bands
+// bands that start on multiples of band_rows
+static std::vector<int> SplitBands(int mcu_rows, int band_rows, int num_bands) {
+  int num_units = (mcu_rows + band_rows - 1) / band_rows;
+  int units_per_band = std::max(1, (num_units + num_bands - 1) / num_bands);
+  std::vector<int> starts;
+  for (int row = 0; row < mcu_rows; row += units_per_band * band_rows)
+    starts.push_back(row);
+  starts.push_back(mcu_rows);
+  return starts;
+}
+
+// Decodes the bands between starts on pool, the pool balances them over
+// the threads
+static double DecodeBands(const stbi_jpeg_bands *bands, const std::vector<int> &starts, MPTC::ThreadPool &pool,
+                          uint32_t num_iterations, std::vector<uint8_t> *pixels, bool *failed) {
+  std::atomic<bool> band_failed(false);
+  MPTC::TaskGraph graph;
+  for (size_t band = 0; band + 1 < starts.size(); band++) {
+    int first_row = starts[band], end_row = starts[band + 1];
+    graph.AddTask([&, first_row, end_row] {
+      if (!stbi_jpeg_bands_decode(bands, pixels->data(), 4, first_row, end_row))
+        band_failed = true;
+    });
+  }
+
+  double bands_ms = 0.0;
+  for (uint32_t iter = 0; iter < num_iterations; iter++) {
+    memset(pixels->data(), 0xCD, pixels->size());
+    Clock::time_point start = Clock::now();
+    graph.Run(pool);
+    double ms = ElapsedMs(start);
+    bands_ms = iter == 0 ? ms : std::min(bands_ms, ms);
+  }
+  *failed = band_failed;
+  return bands_ms;
+}
+
+static bool RunFile(const std::string &name, const std::vector<uint8_t> &file, const Options &options) {
+  const int file_size = static_cast<int>(file.size());
+  int x = 0, y = 0, comp = 0;
+  if (!stbi_info_from_memory(file.data(), file_size, &x, &y, &comp)) {
+    std::cerr << "Error " << name << " is not an image stb reads" << std::endl;
+    return false;
+  }
+
+  std::vector<uint8_t> serial;
+  double serial_ms = 0.0;
+  for (uint32_t iter = 0; iter < options.num_iterations; iter++) {
+    Clock::time_point start = Clock::now();
+    stbi_uc *pixels = stbi_load_from_memory(file.data(), file_size, &x, &y, &comp, 4);
+    double ms = ElapsedMs(start);
+    if (pixels == NULL) {
+      std::cerr << "Error decoding " << name << ": " << stbi_failure_reason() << std::endl;
+      return false;
+    }
+    serial.assign(pixels, pixels + static_cast<size_t>(x) * y * 4);
+    stbi_image_free(pixels);
+    serial_ms = iter == 0 ? ms : std::min(serial_ms, ms);
+  }
+
+  Clock::time_point begin_start = Clock::now();
+  int mcu_rows = 0, band_rows = 0;
+  stbi_jpeg_bands *bands = stbi_jpeg_bands_begin(file.data(), file_size, &x, &y, &comp, &mcu_rows, &band_rows);
+  double begin_ms = ElapsedMs(begin_start);
+
+  printf("%s: %dx%d, %d component(s), %d bytes\n", name.c_str(), x, y, comp, file_size);
+  printf("  stb:        %8.3f ms\n", serial_ms);
+  if (bands == NULL) {
+    printf("  no restart markers to start bands on, decoded by stb alone\n");
+    return true;
+  }
+  printf("  %d MCU rows, a band can start every %d\n", mcu_rows, band_rows);
+  printf("  begin:      %8.3f ms (%.1f%% of stb)\n", begin_ms, 100.0 * begin_ms / serial_ms);
+
+  bool identical = true;
+  std::vector<uint8_t> pixels(serial.size());
+  for (uint32_t num_threads = 1; ; num_threads = std::min(2 * num_threads, options.max_threads)) {
+    MPTC::ThreadPool pool(num_threads);
+    std::vector<int> starts = SplitBands(mcu_rows, band_rows, 2 * num_threads);
+    bool failed = false;
+    double bands_ms = DecodeBands(bands, starts, pool, options.num_iterations, &pixels, &failed);
+    bool is_same = !failed && pixels == serial;
+    identical = identical && is_same;
+    printf("  %2u threads: %8.3f ms  %5.2fx stb  %3zu bands  %s\n", num_threads, bands_ms, serial_ms / bands_ms,
+           starts.size() - 1, is_same ? "identical" : "DIFFERENT");
+    if (num_threads == options.max_threads)
+      break;
+  }
+
+  // The most seams there can be
+  {
+    MPTC::ThreadPool pool(options.max_threads);
+    std::vector<int> starts = SplitBands(mcu_rows, band_rows, mcu_rows);
+    bool failed = false;
+    double bands_ms = DecodeBands(bands, starts, pool, 1, &pixels, &failed);
+    bool is_same = !failed && pixels == serial;
+    identical = identical && is_same;
+    printf("  finest:     %8.3f ms  %5.2fx stb  %3zu bands  %s\n", bands_ms, serial_ms / bands_ms,
+           starts.size() - 1, is_same ? "identical" : "DIFFERENT");
+  }
+  stbi_jpeg_bands_end(bands);
+
+  if (!identical) {
+    for (size_t i = 0; i < serial.size(); i++) {
+      if (pixels[i] != serial[i]) {
+        size_t pixel = i / 4;
+        std::cerr << "First difference at pixel " << pixel % x << "," << pixel / x << std::endl;
+        break;
+      }
+    }
+    std::cerr << "Error the bands of " << name << " don't match stb" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static void Usage(const char *program) {
+  std::cerr << "Usage: " << program << " [--threads N] [--iterations N] file.jpg ..." << std::endl;
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  options.max_threads = std::max(1U, std::thread::hardware_concurrency());
+  options.num_iterations = 5;
+
+  std::vector<std::string> paths;
+  for (int arg = 1; arg < argc; arg++) {
+    std::string option(argv[arg]);
+    bool has_value = arg + 1 < argc;
+    if (option == "--threads" && has_value) {
+      options.max_threads = std::max(1, atoi(argv[++arg]));
+    }
+    else if (option == "--iterations" && has_value) {
+      options.num_iterations = std::max(1, atoi(argv[++arg]));
+    }
+    else if (option.compare(0, 2, "--") == 0) {
+      Usage(argv[0]);
+      return 1;
+    }
+    else {
+      paths.push_back(option);
+    }
+  }
+  if (paths.empty()) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  for (const std::string &path : paths) {
+    std::ifstream in_stream(path.c_str(), std::ios::binary);
+    std::vector<uint8_t> file((std::istreambuf_iterator<char>(in_stream)), std::istreambuf_iterator<char>());
+    if (!in_stream.is_open() || file.empty()) {
+      std::cerr << "Error reading " << path << std::endl;
+      return 1;
+    }
+    if (!RunFile(path, file, options))
+      return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,160 @@
+// Bitrate and decode time of the context modelled motion streams.
+//
+// Usage: motion_bench <file.mpt> [num_iterations]
+//
+// Decodes every frame of file.mpt and encodes the frames again twice with
+// the settings of its header: "bytes" codes the motion with the entropy
+// coder of the other streams, as before, "model" with the context models
+// of motion_codec.h (kMPTCFlag_MotionModel). The files are written next to
+// the input as <file>.bytes.mpt and <file>.model.mpt and have to decode to
+// the frames the encoder reconstructed, on one thread and on the pool.
+//
+// Prints the motion bytes of each, and the best of num_iterations passes
+// over the file for skimming, which only decodes the dictionaries and the
+// motion and rebuilds the interpolation words, and for full decodes.
+
+#include "decoder.h"
+#include "encoder.h"
+#include "frame_hash.h"
+#include "mptc_reader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static bool EncodeFrames(const std::string &path, const MPTCDecodeInfo &header,
+                         const std::vector<std::vector<PhysicalDXTBlock> > &frames, bool motion_model,
+                         std::vector<uint64_t> *hashes, MPTC::EncoderStats *stats) {
+  MPTC::EncoderOptions options;
+  options.unique_interval = header.unique_interval;
+  options.search_area = header.search_area;
+  options.tile_rows = (header.flags & kMPTCFlag_Tiled) ? header.tile_rows : 0;
+  options.codec = (header.flags & kMPTCFlag_Rans) ? MPTC::eEntropyCodec_Rans : MPTC::eEntropyCodec_Arithmetic;
+  options.motion_model = motion_model;
+  options.write_index = false;
+
+  MPTC::Encoder encoder;
+  if (!encoder.Open(path, header.frame_height, header.frame_width, options))
+    return false;
+
+  std::vector<PhysicalDXTBlock> reconstruction(header.num_blocks);
+  hashes->clear();
+  for (const std::vector<PhysicalDXTBlock> &frame : frames) {
+    encoder.AddFrame(frame.data(), reconstruction.data());
+    hashes->push_back(MPTC::HashFrame(reconstruction.data(), header.num_blocks));
+  }
+  if (!encoder.Close())
+    return false;
+  *stats = encoder.Stats();
+  return true;
+}
+
+// Best time of num_iterations passes over the file in ms per frame. Full
+// decodes are checked against hashes.
+static bool TimePasses(const std::string &path, uint32_t num_iterations, bool skim, bool multi_thread,
+                       const std::vector<uint64_t> &hashes, double *ms_per_frame) {
+  *ms_per_frame = 0.0;
+  for (uint32_t iter = 0; iter < num_iterations; iter++) {
+    MPTC::MappedSource source;
+    MPTC::Decoder decoder;
+    if (!source.Open(path) || !decoder.Open(source, multi_thread ? 0 : 1))
+      return false;
+
+    std::vector<PhysicalDXTBlock> prev(decoder.NumBlocks()), curr(decoder.NumBlocks());
+    std::vector<uint64_t> decoded;
+    Clock::time_point start = Clock::now();
+    for (uint32_t frame = 0; frame < decoder.TotalFrameCount(); frame++) {
+      PhysicalDXTBlock *prev_dxt = frame == 0 ? NULL : prev.data();
+      if (skim)
+        decoder.SkimFrame(prev_dxt, curr.data());
+      else if (multi_thread)
+        decoder.DecodeFrameMultiThread(prev_dxt, curr.data());
+      else
+        decoder.DecodeFrame(prev_dxt, curr.data());
+      if (!skim)
+        decoded.push_back(MPTC::HashFrame(curr.data(), decoder.NumBlocks()));
+      std::swap(prev, curr);
+    }
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count() /
+      decoder.TotalFrameCount();
+    if (iter == 0 || ms < *ms_per_frame)
+      *ms_per_frame = ms;
+
+    if (!skim && decoded != hashes) {
+      std::cerr << "Error " << path << " does not decode to the encoded frames" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <file.mpt> [num_iterations]" << std::endl;
+    return 1;
+  }
+
+  std::string path(argv[1]);
+  uint32_t num_iterations = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 5;
+
+  MPTCDecodeInfo header;
+  std::vector<std::vector<PhysicalDXTBlock> > frames;
+  {
+    MPTC::MappedSource source;
+    MPTC::Decoder decoder;
+    if (!source.Open(path) || !decoder.Open(source)) {
+      std::cerr << "Error opening " << path << std::endl;
+      return 1;
+    }
+    header = decoder.DecodeInfo();
+    std::vector<PhysicalDXTBlock> prev(decoder.NumBlocks());
+    for (uint32_t frame = 0; frame < decoder.TotalFrameCount(); frame++) {
+      frames.push_back(std::vector<PhysicalDXTBlock>(decoder.NumBlocks()));
+      decoder.DecodeFrame(frame == 0 ? NULL : prev.data(), frames.back().data());
+      prev = frames.back();
+    }
+  }
+
+  printf("%s: %ux%u, %zu frames, search area %u, %s\n", path.c_str(), header.frame_width, header.frame_height,
+         frames.size(), static_cast<uint32_t>(header.search_area),
+         (header.flags & kMPTCFlag_Tiled) ? "tiled" : "untiled");
+
+  const char *kRunNames[] = { "bytes", "model" };
+  double bytes_skim_ms = 0.0;
+  uint64_t bytes_motion = 0;
+  for (int run = 0; run < 2; run++) {
+    std::string out_path = path + "." + kRunNames[run] + ".mpt";
+    std::vector<uint64_t> hashes;
+    MPTC::EncoderStats stats;
+    if (!EncodeFrames(out_path, header, frames, run == 1, &hashes, &stats)) {
+      std::cerr << "Error encoding " << out_path << std::endl;
+      return 1;
+    }
+
+    double skim_ms, decode_ms, pool_ms;
+    if (!TimePasses(out_path, num_iterations, true, false, hashes, &skim_ms) ||
+        !TimePasses(out_path, num_iterations, false, false, hashes, &decode_ms) ||
+        !TimePasses(out_path, num_iterations, false, true, hashes, &pool_ms))
+      return 1;
+
+    printf("%s  motion: %8llu B %6.3f bits/block", kRunNames[run],
+           static_cast<unsigned long long>(stats.motion_bytes), 8.0 * stats.motion_bytes / stats.num_blocks);
+    printf("  skim: %7.3f ms/frame  decode: %7.3f ms/frame  pool: %7.3f ms/frame", skim_ms, decode_ms, pool_ms);
+    if (run == 0) {
+      bytes_skim_ms = skim_ms;
+      bytes_motion = stats.motion_bytes;
+    }
+    else {
+      printf("  (%.1f%% of the motion bytes, skim %.2fx)", 100.0 * stats.motion_bytes / bytes_motion,
+             bytes_skim_ms / skim_ms);
+    }
+    printf("\n");
+  }
+  return 0;
+}
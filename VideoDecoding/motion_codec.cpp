@@ -0,0 +1,191 @@
+#include "motion_codec.h"
+
+#include <cassert>
+
+namespace MPTC {
+
+enum MotionMode {
+  eMotionMode_Unique = 0,
+  eMotionMode_Inter,
+  eMotionMode_Intra,
+  eMotionMode_None       // neighbour outside the tile
+};
+
+// Block symbols with the predicted vector, the others carry the difference
+// of x to the prediction
+enum MotionSymbol {
+  eMotionSymbol_Unique = 0,
+  eMotionSymbol_InterPredicted,
+  eMotionSymbol_IntraPredicted,
+  kNumPredictedSymbols
+};
+
+static inline uint32_t BlockMode(const uint8_t *code) {
+  uint32_t both = code[0] & code[1];
+  if(both == 255)
+    return eMotionMode_Unique;
+  return (both & 0x80) != 0 ? eMotionMode_Inter : eMotionMode_Intra;
+}
+
+MotionModel::MotionModel(uint8_t search_area)
+  : _range(2 * search_area + 1), _num_block_symbols(kNumPredictedSymbols + 2 * _range) {
+  assert(search_area >= 1 && search_area <= 63);
+
+  // Inter blocks default to the same spot of the previous frame, intra
+  // blocks to the block to their left
+  _default_vectors[eMotionMode_Unique][0] = _default_vectors[eMotionMode_Unique][1] = 0;
+  _default_vectors[eMotionMode_Inter][0] = search_area;
+  _default_vectors[eMotionMode_Inter][1] = search_area;
+  _default_vectors[eMotionMode_Intra][0] = search_area - 1;
+  _default_vectors[eMotionMode_Intra][1] = 2 * search_area - 1;
+  _default_vectors[eMotionMode_None][0] = _default_vectors[eMotionMode_None][1] = 0;
+
+  for(uint32_t symbol = 0; symbol < _num_block_symbols; symbol++) {
+    if(symbol < kNumPredictedSymbols) {
+      _symbol_modes[symbol] = static_cast<uint8_t>(symbol);
+      _symbol_diff_x[symbol] = 0;
+    }
+    else {
+      uint32_t diff = symbol - kNumPredictedSymbols;
+      _symbol_modes[symbol] = diff < _range ? eMotionMode_Inter : eMotionMode_Intra;
+      _symbol_diff_x[symbol] = static_cast<uint8_t>(diff < _range ? diff : diff - _range);
+    }
+  }
+
+  // The alphabets are small, finer decoder tables than the default save
+  // most of the search steps of every decode
+  for(entropy::Adaptive_Data_Model &model : _block_models)
+    model.set_alphabet(_num_block_symbols, kDecoderTableBits);
+  for(entropy::Adaptive_Data_Model &model : _y_models)
+    model.set_alphabet(_range, kDecoderTableBits);
+}
+
+void MotionModel::Reset() {
+  for(entropy::Adaptive_Data_Model &model : _block_models)
+    model.reset();
+  for(entropy::Adaptive_Data_Model &model : _y_models)
+    model.reset();
+}
+
+void MotionModel::EncodeRow(entropy::Arithmetic_Codec &encoder, const uint8_t *top, const uint8_t *row,
+                            uint32_t blocks_width) {
+  uint32_t left_mode = eMotionMode_None;
+  const uint8_t *left = _default_vectors[eMotionMode_None];
+  for(uint32_t block_x = 0; block_x < blocks_width; block_x++) {
+    const uint8_t *code = row + 2 * block_x;
+    uint32_t top_mode = eMotionMode_None;
+    const uint8_t *top_code = _default_vectors[eMotionMode_None];
+    if(top != NULL) {
+      top_code = top + 2 * block_x;
+      top_mode = BlockMode(top_code);
+    }
+
+    uint32_t mode = BlockMode(code);
+    entropy::Adaptive_Data_Model &block_model = _block_models[kNumNeighbourModes * left_mode + top_mode];
+    if(mode == eMotionMode_Unique) {
+      encoder.encode(eMotionSymbol_Unique, block_model);
+    }
+    else {
+      const uint8_t *pred = Prediction(mode, left_mode, left, top_mode, top_code);
+      uint32_t x = code[0] & 0x7f, y = code[1] & 0x7f;
+      assert(x < _range && y < _range && "Motion vector outside the search area");
+      uint32_t diff_x = (x + _range - (pred[0] & 0x7f)) % _range;
+      uint32_t diff_y = (y + _range - (pred[1] & 0x7f)) % _range;
+      if(diff_x == 0 && diff_y == 0) {
+        encoder.encode(mode, block_model);
+      }
+      else {
+        encoder.encode(kNumPredictedSymbols + (mode - 1) * _range + diff_x, block_model);
+        encoder.encode(diff_y, _y_models[2 * (mode - 1) + (diff_x == 0 ? 1 : 0)]);
+      }
+    }
+    left_mode = mode;
+    left = code;
+  }
+}
+
+void MotionModel::DecodeRow(entropy::Arithmetic_Codec &decoder, const uint8_t *top, uint8_t *row,
+                            uint32_t blocks_width) {
+  uint32_t left_mode = eMotionMode_None;
+  const uint8_t *left = _default_vectors[eMotionMode_None];
+  for(uint32_t block_x = 0; block_x < blocks_width; block_x++) {
+    uint8_t *code = row + 2 * block_x;
+    uint32_t top_mode = eMotionMode_None;
+    const uint8_t *top_code = _default_vectors[eMotionMode_None];
+    if(top != NULL) {
+      top_code = top + 2 * block_x;
+      top_mode = BlockMode(top_code);
+    }
+
+    // Unique blocks go through the same steps as the others, only their
+    // result is replaced, to keep the mode off the branches
+    uint32_t symbol = decoder.decode(_block_models[kNumNeighbourModes * left_mode + top_mode]);
+    uint32_t mode = _symbol_modes[symbol];
+    uint32_t diff_x = _symbol_diff_x[symbol];
+    const uint8_t *pred = Prediction(mode, left_mode, left, top_mode, top_code);
+    uint32_t x = (pred[0] & 0x7f) + diff_x;
+    uint32_t y = pred[1] & 0x7f;
+    if(symbol >= kNumPredictedSymbols)
+      y += decoder.decode(_y_models[2 * (mode - 1) + (diff_x == 0 ? 1 : 0)]);
+    x -= x >= _range ? _range : 0;
+    y -= y >= _range ? _range : 0;
+
+    uint8_t inter_bit = mode == eMotionMode_Inter ? 0x80 : 0;
+    code[0] = mode == eMotionMode_Unique ? 255 : static_cast<uint8_t>(x | inter_bit);
+    code[1] = mode == eMotionMode_Unique ? 255 : static_cast<uint8_t>(y | inter_bit);
+    left_mode = mode;
+    left = code;
+  }
+}
+
+void PredictMotionIndex(bool is_inter, const uint8_t *left, const uint8_t *top, uint8_t search_area,
+                        uint8_t *code) {
+  uint32_t mode = is_inter ? eMotionMode_Inter : eMotionMode_Intra;
+  const uint8_t *pred;
+  if(left != NULL && BlockMode(left) == mode)
+    pred = left;
+  else if(top != NULL && BlockMode(top) == mode)
+    pred = top;
+  else
+    pred = NULL;
+
+  uint8_t inter_bit = is_inter ? 0x80 : 0;
+  if(pred != NULL) {
+    code[0] = pred[0];
+    code[1] = pred[1];
+  }
+  else if(is_inter) {
+    code[0] = search_area | inter_bit;
+    code[1] = search_area | inter_bit;
+  }
+  else {
+    code[0] = search_area - 1;
+    code[1] = 2 * search_area - 1;
+  }
+}
+
+void EncodeMotionStream(const uint8_t *motion, uint32_t blocks_width, uint32_t num_rows,
+                        uint8_t search_area, std::vector<uint8_t> *out) {
+  // A mode and two 7 bit residuals per block at worst, the bound of the
+  // byte coder holds
+  uint32_t in_sz = 2 * blocks_width * num_rows;
+  entropy::Arithmetic_Codec encoder(in_sz + in_sz / 4 + 1024);
+  MotionModel model(search_area);
+  encoder.start_encoder();
+  for(uint32_t row = 0; row < num_rows; row++) {
+    const uint8_t *top = row == 0 ? NULL : motion + 2 * (row - 1) * blocks_width;
+    model.EncodeRow(encoder, top, motion + 2 * row * blocks_width, blocks_width);
+  }
+  uint32_t num_bytes = encoder.stop_encoder();
+
+  out->assign(encoder.buffer(), encoder.buffer() + num_bytes);
+}
+
+void MotionDecoderState::Start(const uint8_t *in, uint32_t in_sz) {
+  // As for the byte coder, a user buffer is only read in decoder mode
+  _decoder.set_buffer(in_sz + 100, const_cast<uint8_t*>(in));
+  _model.Reset();
+  _decoder.start_decoder();
+}
+
+}  // namespace MPTC
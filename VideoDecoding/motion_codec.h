@@ -0,0 +1,104 @@
+#ifndef __MPTC_MOTION_CODEC_H__
+#define __MPTC_MOTION_CODEC_H__
+
+#include "arithmetic_codec.h"
+#include "entropy_codec.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace MPTC {
+
+// Context-modelled coding of the motion indices of one tile, used instead
+// of the byte coder by files with kMPTCFlag_MotionModel.
+//
+// The vector of an inter or intra block is predicted by the vector of the
+// left neighbour if it has the same mode, else of the top neighbour, else
+// by no motion (inter) or the block to the left (intra). Every block codes
+// one symbol with a model chosen by the modes of its left and top
+// neighbours: unique, inter or intra with the predicted vector, or inter
+// or intra with the difference of x to the prediction, modulo
+// 2 * search_area + 1. Only the latter code a second symbol, the
+// difference of y, with a model chosen by the mode and whether x was
+// predicted exactly. Neighbours outside the tile don't exist.
+//
+// The stream is coded row by row, so the decoder can rebuild the
+// interpolation words of a row right after decoding its motion. Most
+// blocks cost a single decode, and the decoder only branches on whether
+// there is a second one.
+//
+// This is a size for speed trade, which is why the encoder only uses it
+// when asked. The motion streams come out about a quarter smaller (6 to
+// 6.2 instead of 8.2 to 8.3 bits per block on the test sequences), but
+// every block goes through an adaptive model, which decodes slower than
+// the byte streams. Against rANS byte motion, skimming runs at about 0.3x
+// and full frames at about 0.5x the speed, against arithmetic coded byte
+// motion at about 0.85x and 0.9x. See motion_bench.
+class MotionModel {
+ public:
+  // search_area has to be 1 to 63, see EncoderOptions
+  explicit MotionModel(uint8_t search_area);
+
+  // Back to the initial statistics, every tile starts from them
+  void Reset();
+
+  // top is the row above, NULL in the first row of the tile. Rows are
+  // blocks_width (x, y) motion index pairs.
+  void EncodeRow(entropy::Arithmetic_Codec &encoder, const uint8_t *top, const uint8_t *row,
+                 uint32_t blocks_width);
+  void DecodeRow(entropy::Arithmetic_Codec &decoder, const uint8_t *top, uint8_t *row,
+                 uint32_t blocks_width);
+
+ private:
+  MotionModel(const MotionModel &);
+  MotionModel &operator=(const MotionModel &);
+
+  static const int kNumModes = 3;
+  static const int kNumNeighbourModes = kNumModes + 1;  // and no neighbour
+  static const int kMaxBlockSymbols = kNumModes + 2 * 127;
+  static const unsigned kDecoderTableBits = 7;
+
+  const uint8_t *Prediction(uint32_t mode, uint32_t left_mode, const uint8_t *left,
+                            uint32_t top_mode, const uint8_t *top) const {
+    return left_mode == mode ? left : (top_mode == mode ? top : _default_vectors[mode]);
+  }
+
+  uint32_t _range;
+  uint32_t _num_block_symbols;
+  uint8_t _default_vectors[kNumNeighbourModes][2];
+  uint8_t _symbol_modes[kMaxBlockSymbols];
+  uint8_t _symbol_diff_x[kMaxBlockSymbols];
+  entropy::Adaptive_Data_Model _block_models[kNumNeighbourModes * kNumNeighbourModes];
+  entropy::Adaptive_Data_Model _y_models[2 * 2];
+};
+
+// The motion index MotionModel predicts for an inter or intra block from
+// its left and top neighbours, which are NULL outside the tile
+void PredictMotionIndex(bool is_inter, const uint8_t *left, const uint8_t *top, uint8_t search_area,
+                        uint8_t *code);
+
+// Replaces the contents of out with the motion indices of num_rows rows of
+// blocks_width blocks
+void EncodeMotionStream(const uint8_t *motion, uint32_t blocks_width, uint32_t num_rows,
+                        uint8_t search_area, std::vector<uint8_t> *out);
+
+// Decoder state of one tile's motion stream. Unlike the other streams it is
+// not decoded in one go: Start, then DecodeRow for every row of the tile.
+class MotionDecoderState : public EntropyDecoderState {
+ public:
+  explicit MotionDecoderState(uint8_t search_area) : _model(search_area) { }
+
+  void Start(const uint8_t *in, uint32_t in_sz);
+  void DecodeRow(const uint8_t *top, uint8_t *row, uint32_t blocks_width) {
+    _model.DecodeRow(_decoder, top, row, blocks_width);
+  }
+  void Finish() { _decoder.stop_decoder(); }
+
+ private:
+  entropy::Arithmetic_Codec _decoder;
+  MotionModel _model;
+};
+
+}  // namespace MPTC
+
+#endif  // __MPTC_MOTION_CODEC_H__
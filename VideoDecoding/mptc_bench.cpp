@@ -0,0 +1,499 @@
+// Per-frame latency benchmark for the MPTC decoder.
+//
+// Usage: mptc_bench <file.mpt> [num_frames] [num_threads]
+//
+// Decodes the same stream three ways and prints per-frame latency
+// percentiles for each:
+//   serial - GetFrame on the calling thread
+//   spawn  - GetFrameMultiThread with a pool created and joined every frame,
+//            i.e. the old spawn-threads-per-frame behaviour
+//   pool   - GetFrameMultiThread with the persistent decoder pool
+//   mapped - as pool, but decoding in place from a memory mapped file
+//
+// The frame index of the file is built once and its build time printed.
+// Every frame is then reached with SeekFrame, from a decoder that is in
+// the middle of the stream, and compared with the linear decode; the
+// frame after it is decoded with GetFrame and compared as well. Prints
+// the mean and worst seek cost.
+//
+// It then times ReconstructEndpoints on the wavelet planes of the first
+// frame against an unfused reference (three full plane inverse wavelets,
+// then a separate colour conversion sweep) and checks both agree.
+//
+// The buffered decoder is run against a MemoryDestination with a row pitch
+// wider than the frame, the stand-in for mapped upload memory. Every frame
+// has to match the linear decode, leave the padding of its rows alone and
+// reach the consumer without a copy. Going through CopyFrame instead, as
+// an upload from client memory would, shows the bytes that saves.
+//
+// The dirty maps of the single and multi-threaded decoder and of the ring
+// have to flag exactly the blocks that differ from the previous frame. The
+// share of dirty blocks and the bytes an upload of only the dirty block
+// rows would send are printed.
+//
+// That steady state decoding doesn't allocate is checked by
+// tests/allocation_test.cpp.
+
+#include "decoder.h"
+#include "frame_destination.h"
+#include "thread_pool.h"
+#include "wavelet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static void PrintPercentiles(const char *name, std::vector<double> times_ms) {
+  if (times_ms.empty())
+    return;
+
+  std::sort(times_ms.begin(), times_ms.end());
+  auto percentile = [&times_ms](double p) {
+    size_t idx = static_cast<size_t>(p * (times_ms.size() - 1) + 0.5);
+    return times_ms[idx];
+  };
+
+  double sum = 0.0;
+  for (double t : times_ms)
+    sum += t;
+
+  printf("%-8s frames: %5zu  mean: %8.3f ms  p50: %8.3f  p90: %8.3f  p99: %8.3f  max: %8.3f\n",
+         name, times_ms.size(), sum / times_ms.size(), percentile(0.5),
+         percentile(0.9), percentile(0.99), times_ms.back());
+}
+
+enum DecodeMode {
+  eDecodeMode_Serial,
+  eDecodeMode_Spawn,
+  eDecodeMode_Pool,
+  eDecodeMode_Mapped
+};
+
+static std::vector<double> RunDecode(const std::string &path, uint32_t num_frames,
+                                     uint32_t num_threads, DecodeMode mode) {
+  std::ifstream in_stream(path.c_str(), std::ios::binary);
+  if (!in_stream.is_open()) {
+    std::cerr << "Error opening " << path << std::endl;
+    exit(-1);
+  }
+
+  uint32_t frame_height = 0, frame_width = 0;
+  if (!GetMPTCFrameSize(in_stream, &frame_height, &frame_width)) {
+    std::cerr << "Error reading the header of " << path << std::endl;
+    exit(-1);
+  }
+  const uint32_t num_blocks = (frame_height / 4) * (frame_width / 4);
+
+  MPTC::MappedSource mapped_source;
+  if (mode == eDecodeMode_Mapped && !mapped_source.Open(path)) {
+    std::cerr << "Error mapping " << path << std::endl;
+    exit(-1);
+  }
+
+  MPTCDecodeInfo decode_info;
+  InitDecodeInfo(&decode_info, num_threads);
+
+  std::vector<PhysicalDXTBlock> frames[2];
+  frames[0].resize(num_blocks);
+  frames[1].resize(num_blocks);
+
+  std::vector<double> times_ms;
+  times_ms.reserve(num_frames);
+
+  for (uint32_t frame = 0; frame < num_frames; frame++) {
+    PhysicalDXTBlock *prev_dxt = frame == 0 ? NULL : frames[(frame - 1) % 2].data();
+    PhysicalDXTBlock *curr_dxt = frames[frame % 2].data();
+
+    Clock::time_point start = Clock::now();
+    switch (mode) {
+      case eDecodeMode_Serial:
+        GetFrame(in_stream, prev_dxt, curr_dxt, &decode_info);
+        break;
+
+      case eDecodeMode_Spawn: {
+        MPTC::ThreadPool frame_pool(num_threads);
+        decode_info.thread_pool = &frame_pool;
+        decode_info.owns_thread_pool = false;
+        GetFrameMultiThread(in_stream, prev_dxt, curr_dxt, &decode_info);
+        decode_info.thread_pool = NULL;
+        break;
+      }
+
+      case eDecodeMode_Pool:
+        GetFrameMultiThread(in_stream, prev_dxt, curr_dxt, &decode_info);
+        break;
+
+      case eDecodeMode_Mapped:
+        GetFrameMultiThread(mapped_source, prev_dxt, curr_dxt, &decode_info);
+        break;
+    }
+    Clock::time_point end = Clock::now();
+
+    // The first frame also reads the header and allocates, don't count it
+    if (frame > 0)
+      times_ms.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+  }
+
+  FreeDecodeInfo(&decode_info);
+  return times_ms;
+}
+
+static bool BenchSeek(const std::string &path, uint32_t num_frames) {
+  std::ifstream in_stream(path.c_str(), std::ios::binary);
+  uint32_t frame_height = 0, frame_width = 0;
+  GetMPTCFrameSize(in_stream, &frame_height, &frame_width);
+  const uint32_t num_blocks = (frame_height / 4) * (frame_width / 4);
+
+  MPTC::MappedSource source;
+  std::vector<MPTC::FrameIndexEntry> index;
+  if (!source.Open(path) || BuildFrameIndex(source, &index) != 0) {
+    std::cerr << "Error indexing " << path << std::endl;
+    return false;
+  }
+  num_frames = std::min(num_frames, static_cast<uint32_t>(index.size()));
+
+  uint32_t num_keys = 0;
+  for (const MPTC::FrameIndexEntry &entry : index)
+    num_keys += (entry.flags & MPTC::kFrameIndexFlag_Key) ? 1 : 0;
+
+  // Linear decode as the reference
+  std::vector<std::vector<PhysicalDXTBlock> > linear(num_frames, std::vector<PhysicalDXTBlock>(num_blocks));
+  MPTCDecodeInfo decode_info;
+  InitDecodeInfo(&decode_info);
+  for (uint32_t frame = 0; frame < num_frames; frame++)
+    GetFrame(source, frame == 0 ? NULL : linear[frame - 1].data(), linear[frame].data(), &decode_info);
+
+  // Seek around from wherever the previous seek left the decoder, in a
+  // shuffled order so that both directions are exercised
+  std::vector<uint32_t> order(num_frames);
+  for (uint32_t frame = 0; frame < num_frames; frame++)
+    order[frame] = frame;
+  std::mt19937 rng(1234);
+  std::shuffle(order.begin(), order.end(), rng);
+
+  std::vector<PhysicalDXTBlock> curr(num_blocks), scratch(num_blocks), next(num_blocks);
+  double total_ms = 0.0, max_ms = 0.0;
+  uint64_t total_skimmed = 0;
+  for (uint32_t frame : order) {
+
+    MPTCSeekStats stats;
+    if (SeekFrame(source, index, frame, scratch.data(), curr.data(), &decode_info, &stats) != 0) {
+      std::cerr << "Seek to frame " << frame << " failed" << std::endl;
+      return false;
+    }
+
+    bool is_equal = memcmp(curr.data(), linear[frame].data(), num_blocks * sizeof(PhysicalDXTBlock)) == 0;
+    if (is_equal && frame + 1 < num_frames) {
+      GetFrame(source, curr.data(), next.data(), &decode_info);
+      is_equal = memcmp(next.data(), linear[frame + 1].data(), num_blocks * sizeof(PhysicalDXTBlock)) == 0;
+    }
+    if (!is_equal) {
+      std::cerr << "Seek to frame " << frame << " doesn't match the linear decode" << std::endl;
+      return false;
+    }
+
+    total_ms += stats.elapsed_ms;
+    max_ms = std::max(max_ms, stats.elapsed_ms);
+    total_skimmed += stats.frames_skimmed;
+  }
+  FreeDecodeInfo(&decode_info);
+
+  printf("%-8s frames: %5u  keys: %5u  mean: %8.3f ms  max: %8.3f ms  skimmed/seek: %.1f\n", "seek",
+         num_frames, num_keys, total_ms / num_frames, max_ms,
+         static_cast<double>(total_skimmed) / num_frames);
+  return true;
+}
+
+// The endpoint reconstruction as it was before it was fused: every plane
+// is inverted into a frame sized int8 plane, then converted in a last pass
+static void ReferenceEndpoints(const MPTCDecodeInfo &decode_info, PhysicalDXTBlock *curr_dxt,
+                               int ep_number, std::vector<int8_t> planes[3]) {
+  const uint32_t width = decode_info.frame_width / 4;
+  const uint32_t height = decode_info.frame_height / 4;
+  const uint32_t num_blocks = decode_info.num_blocks;
+  const uint8_t *wav_Y = ep_number == 1 ? decode_info.wav_ep1_Y : decode_info.wav_ep2_Y;
+  const uint8_t *wav_C = ep_number == 1 ? decode_info.wav_ep1_C : decode_info.wav_ep2_C;
+  const uint8_t *wav[3] = { wav_Y, wav_C, wav_C + num_blocks };
+
+  const size_t kDim = MPTC::kMaxWaveletBlockDim;
+  std::vector<int16_t> block(kDim * kDim);
+  for (int plane = 0; plane < 3; plane++) {
+    for (size_t j = 0; j < height; j += kDim) {
+      for (size_t i = 0; i < width; i += kDim) {
+        for (size_t y = 0; y < kDim; y++)
+          for (size_t x = 0; x < kDim; x++)
+            block[y * kDim + x] = static_cast<int16_t>(wav[plane][(i + x) + width * (j + y)] - 128);
+
+        for (size_t dim = 2; dim <= kDim; dim *= 2)
+          MPTC::InverseWavelet2D(block.data(), kDim * 2, block.data(), kDim * 2, dim);
+
+        for (size_t y = 0; y < kDim; y++)
+          for (size_t x = 0; x < kDim; x++)
+            planes[plane][(i + x) + width * (j + y)] = static_cast<int8_t>(block[y * kDim + x]);
+      }
+    }
+  }
+
+  for (uint32_t idx = 0; idx < num_blocks; idx++) {
+    int8_t t = planes[0][idx] - (planes[2][idx] / 2);
+    int8_t g = planes[2][idx] + t;
+    int8_t b = (t - planes[1][idx]) / 2;
+    int8_t r = b + planes[1][idx];
+    uint16_t packed = static_cast<uint16_t>(((r & 0x1F) << 11) | ((g & 0x3F) << 5) | (b & 0x1F));
+    if (ep_number == 1)
+      curr_dxt[idx].ep1 = packed;
+    else
+      curr_dxt[idx].ep2 = packed;
+  }
+}
+
+static bool BenchEndpoints(const std::string &path, uint32_t num_iterations) {
+  std::ifstream in_stream(path.c_str(), std::ios::binary);
+  uint32_t frame_height = 0, frame_width = 0;
+  GetMPTCFrameSize(in_stream, &frame_height, &frame_width);
+  const uint32_t num_blocks = (frame_height / 4) * (frame_width / 4);
+
+  MPTCDecodeInfo decode_info;
+  InitDecodeInfo(&decode_info);
+  std::vector<PhysicalDXTBlock> fused(num_blocks), reference(num_blocks);
+  GetFrame(in_stream, NULL, fused.data(), &decode_info);
+  reference = fused;
+
+  std::vector<int8_t> planes[3];
+  for (int plane = 0; plane < 3; plane++)
+    planes[plane].resize(num_blocks);
+
+  Clock::time_point start = Clock::now();
+  for (uint32_t iter = 0; iter < num_iterations; iter++) {
+    ReferenceEndpoints(decode_info, reference.data(), 1, planes);
+    ReferenceEndpoints(decode_info, reference.data(), 2, planes);
+  }
+  double reference_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  start = Clock::now();
+  for (uint32_t iter = 0; iter < num_iterations; iter++) {
+    ReconstructEndpoints(&decode_info, fused.data(), 1, 0, num_blocks);
+    ReconstructEndpoints(&decode_info, fused.data(), 2, 0, num_blocks);
+  }
+  double fused_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  FreeDecodeInfo(&decode_info);
+
+  for (uint32_t idx = 0; idx < num_blocks; idx++) {
+    if (fused[idx].dxt_block != reference[idx].dxt_block) {
+      std::cerr << "Endpoint mismatch at block " << idx << std::endl;
+      return false;
+    }
+  }
+
+  printf("%-8s reference: %8.3f ms/frame  fused: %8.3f ms/frame  (%.1fx)\n", "endpts",
+         reference_ms / num_iterations, fused_ms / num_iterations, reference_ms / fused_ms);
+  return true;
+}
+
+static bool BenchDestination(const std::string &path, uint32_t num_frames, uint32_t num_threads) {
+  MPTC::MappedSource source;
+  MPTC::Decoder decoder;
+  if (!source.Open(path) || !decoder.Open(source, num_threads)) {
+    std::cerr << "Error opening " << path << std::endl;
+    return false;
+  }
+
+  const uint32_t blocks_width = decoder.FrameWidth() / 4;
+  const uint32_t blocks_height = decoder.FrameHeight() / 4;
+  const uint32_t num_blocks = decoder.NumBlocks();
+  std::vector<std::vector<PhysicalDXTBlock> > linear(num_frames, std::vector<PhysicalDXTBlock>(num_blocks));
+  for (uint32_t frame = 0; frame < num_frames; frame++)
+    decoder.DecodeFrame(frame == 0 ? NULL : linear[frame - 1].data(), linear[frame].data());
+  decoder.Close();
+
+  // Rows padded by 16 blocks, which the decoder must not touch
+  const uint8_t kPadding = 0xCD;
+  const size_t row_sz = blocks_width * sizeof(PhysicalDXTBlock);
+  const uint32_t row_pitch = static_cast<uint32_t>(row_sz + 16 * sizeof(PhysicalDXTBlock));
+  const double frame_mb = static_cast<double>(num_blocks * sizeof(PhysicalDXTBlock)) / (1024.0 * 1024.0);
+
+  for (int copy_out = 0; copy_out < 2; copy_out++) {
+    MPTC::MemoryDestination destination(4, static_cast<size_t>(blocks_height) * row_pitch, row_pitch);
+    memset(destination.Data(), kPadding, destination.NumSlots() * destination.SlotSize());
+
+    BufferStruct *ring = NULL;
+    source.Seek(0);
+    InitBufferedDecode(ring, source, destination, num_threads);
+
+    std::vector<PhysicalDXTBlock> upload(num_blocks);
+    Clock::time_point start = Clock::now();
+    bool is_ok = true;
+    for (uint32_t frame = 0; frame < num_frames && is_ok; frame++) {
+      PhysicalDXTBlock *curr_dxt = NULL;
+      while (GetBufferedFrame(ring, curr_dxt) != kMPTCFrameReady)
+        std::this_thread::yield();
+
+      const uint8_t *slot = reinterpret_cast<const uint8_t*>(destination.Slot(ring->curr_dxt_idx));
+      is_ok = reinterpret_cast<const uint8_t*>(curr_dxt) == slot;
+      if (copy_out)
+        destination.CopyFrame(ring->curr_dxt_idx, blocks_height, blocks_width, upload.data());
+
+      for (uint32_t row = 0; row < blocks_height && is_ok; row++) {
+        const uint8_t *src = slot + static_cast<size_t>(row) * row_pitch;
+        is_ok = memcmp(src, linear[frame].data() + row * blocks_width, row_sz) == 0;
+        for (size_t pad = row_sz; pad < row_pitch && is_ok; pad++)
+          is_ok = src[pad] == kPadding;
+      }
+      if (!is_ok)
+        std::cerr << "Frame " << frame << " in the destination doesn't match the linear decode" << std::endl;
+    }
+    double elapsed_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    DestroyBufferedDecode(ring);
+    if (!is_ok)
+      return false;
+
+    double copied_mb = static_cast<double>(destination.BytesCopied()) / (1024.0 * 1024.0);
+    printf("%-8s frames: %5u  %-6s copied: %8.2f MB (%.2f MB/frame of %.2f)  %8.3f ms/frame\n", "dest",
+           num_frames, copy_out ? "copy" : "direct", copied_mb, copied_mb / num_frames, frame_mb,
+           elapsed_ms / num_frames);
+    if (!copy_out && destination.BytesCopied() != 0)
+      return false;
+  }
+  return true;
+}
+
+// Checks the dirty maps of the single and multi-threaded decoder and of
+// the ring against a block by block comparison with the previous frame, and
+// reports how much of each frame a partial upload would skip
+static bool CheckDirtyMap(const MPTCDecodeInfo &decode_info, const uint64_t *dirty_map, uint32_t num_dirty,
+                          const PhysicalDXTBlock *prev_dxt, const PhysicalDXTBlock *curr_dxt) {
+  const uint32_t blocks_width = decode_info.frame_width / 4;
+  uint32_t num_set = 0;
+  for (uint32_t y = 0; y < decode_info.frame_height / 4; y++) {
+    for (uint32_t x = 0; x < blocks_width; x++) {
+      uint32_t idx = y * blocks_width + x;
+      bool is_dirty = prev_dxt == NULL || curr_dxt[idx].dxt_block != prev_dxt[idx].dxt_block;
+      bool is_set = (dirty_map[y * decode_info.dirty_map_pitch + x / 64] >> (x % 64)) & 1;
+      if (is_dirty != is_set)
+        return false;
+      num_set += is_set;
+    }
+  }
+  return num_set == num_dirty;
+}
+
+static bool BenchDirty(const std::string &path, uint32_t num_frames, uint32_t num_threads) {
+  MPTC::MappedSource source;
+  if (!source.Open(path)) {
+    std::cerr << "Error opening " << path << std::endl;
+    return false;
+  }
+
+  for (int multi_thread = 0; multi_thread < 2; multi_thread++) {
+    MPTC::Decoder decoder;
+    decoder.Open(source, num_threads);
+    const MPTCDecodeInfo &decode_info = decoder.DecodeInfo();
+    std::vector<uint64_t> dirty_map((decode_info.frame_height / 4) * decode_info.dirty_map_pitch);
+    decoder.SetDirtyMap(dirty_map.data());
+
+    std::vector<PhysicalDXTBlock> frames[2];
+    frames[0].resize(decoder.NumBlocks());
+    frames[1].resize(decoder.NumBlocks());
+    for (uint32_t frame = 0; frame < num_frames; frame++) {
+      PhysicalDXTBlock *prev_dxt = frame == 0 ? NULL : frames[(frame - 1) % 2].data();
+      PhysicalDXTBlock *curr_dxt = frames[frame % 2].data();
+      if (multi_thread)
+        decoder.DecodeFrameMultiThread(prev_dxt, curr_dxt);
+      else
+        decoder.DecodeFrame(prev_dxt, curr_dxt);
+
+      if (!CheckDirtyMap(decode_info, dirty_map.data(), decoder.NumDirtyBlocks(), prev_dxt, curr_dxt)) {
+        std::cerr << "Dirty map of frame " << frame << (multi_thread ? " (multi-threaded)" : "")
+                  << " is wrong" << std::endl;
+        return false;
+      }
+    }
+  }
+
+  // The ring compares every slot with the one before it
+  MPTC::Decoder decoder;
+  decoder.Open(source, num_threads);
+  const MPTCDecodeInfo decode_info = decoder.DecodeInfo();
+  decoder.Close();
+
+  BufferStruct *ring = NULL;
+  source.Seek(0);
+  InitBufferedDecode(4, ring, source, decode_info.num_blocks, num_threads);
+
+  std::vector<PhysicalDXTBlock> prev_frame(decode_info.num_blocks);
+  std::vector<MPTCDirtyRows> runs(decode_info.frame_height / 4);
+  const size_t row_sz = (decode_info.frame_width / 4) * sizeof(PhysicalDXTBlock);
+  uint64_t uploaded_bytes = 0;
+  for (uint32_t frame = 0; frame < num_frames; frame++) {
+    PhysicalDXTBlock *curr_dxt = NULL;
+    while (GetBufferedFrame(ring, curr_dxt) != kMPTCFrameReady)
+      std::this_thread::yield();
+
+    uint32_t num_dirty = 0;
+    const uint64_t *dirty_map = GetBufferedDirtyMap(ring, &num_dirty);
+    if (!CheckDirtyMap(decode_info, dirty_map, num_dirty, frame == 0 ? NULL : prev_frame.data(), curr_dxt)) {
+      std::cerr << "Dirty map of buffered frame " << frame << " is wrong" << std::endl;
+      DestroyBufferedDecode(ring);
+      return false;
+    }
+
+    uint32_t num_runs = GetDirtyRowRuns(&decode_info, dirty_map, 4, runs.data());
+    for (uint32_t run = 0; run < num_runs; run++)
+      uploaded_bytes += runs[run].num_rows * row_sz;
+    memcpy(prev_frame.data(), curr_dxt, decode_info.num_blocks * sizeof(PhysicalDXTBlock));
+  }
+
+  MPTCBufferStats stats;
+  GetBufferedDecodeStats(ring, &stats);
+  DestroyBufferedDecode(ring);
+
+  const uint64_t frame_bytes = static_cast<uint64_t>(decode_info.num_blocks) * sizeof(PhysicalDXTBlock);
+  printf("%-8s frames: %5u  dirty blocks: %6.2f%%  row upload: %8.1f KB/frame of %.1f (%.1f%% saved)\n",
+         "dirty", num_frames, 100.0 * stats.dirty_blocks / (static_cast<double>(stats.num_blocks) * num_frames),
+         uploaded_bytes / 1024.0 / num_frames, frame_bytes / 1024.0,
+         100.0 * (1.0 - static_cast<double>(uploaded_bytes) / (frame_bytes * num_frames)));
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <file.mpt> [num_frames] [num_threads]" << std::endl;
+    return 1;
+  }
+
+  std::string path(argv[1]);
+  uint32_t num_frames = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 100;
+  uint32_t num_threads = argc > 3 ? static_cast<uint32_t>(atoi(argv[3])) : 0;
+
+  PrintPercentiles("serial", RunDecode(path, num_frames, num_threads, eDecodeMode_Serial));
+  PrintPercentiles("spawn", RunDecode(path, num_frames, num_threads, eDecodeMode_Spawn));
+  PrintPercentiles("pool", RunDecode(path, num_frames, num_threads, eDecodeMode_Pool));
+  PrintPercentiles("mapped", RunDecode(path, num_frames, num_threads, eDecodeMode_Mapped));
+
+  MPTC::MappedSource mapped_source;
+  if (mapped_source.Open(path)) {
+    std::vector<MPTC::FrameIndexEntry> index;
+    Clock::time_point start = Clock::now();
+    int result = BuildFrameIndex(mapped_source, &index);
+    double index_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    printf("%-8s frames: %5zu  build: %8.3f ms%s\n", "index", index.size(), index_ms,
+           result == 0 ? "" : "  (file is truncated)");
+  }
+
+  if (!BenchSeek(path, num_frames))
+    return 1;
+  if (!BenchEndpoints(path, 10))
+    return 1;
+  if (!BenchDestination(path, num_frames, num_threads))
+    return 1;
+  return BenchDirty(path, num_frames, num_threads) ? 0 : 1;
+}
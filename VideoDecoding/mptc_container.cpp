@@ -0,0 +1,398 @@
+// Packs MPTC files into the streaming container of container.h and back.
+//
+// Usage: mptc_container pack <in.mpt> <out.mpts>
+//        mptc_container unpack <in.mpts> <out.mpt>
+//        mptc_container check <in.mpts>
+//        mptc_container verify <in.mpt> [num_threads]
+//
+// "-" reads the container from stdin or writes it to stdout, so that a
+// file can be piped or sent over a socket. Unpacking gives back the
+// original file byte for byte. check walks every packet and lists the
+// ones that fail their CRC.
+//
+// verify packs the file in memory and decodes every frame from the
+// container twice, once fed through a pipe by another thread and once
+// from a seekable copy with seeks to every frame. Both have to match
+// decoding the file directly. A byte flipped in a frame has to be caught
+// by the CRC, and by check. Prints the container overhead and how much
+// memory the reader needed.
+
+#include "container.h"
+#include "decoder.h"
+#include "frame_hash.h"
+#include "mptc_reader.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// A container held in memory, which can seek
+class MemoryInput : public MPTC::PacketInput {
+ public:
+  explicit MemoryInput(const std::string &data) : _data(data), _pos(0) { }
+
+  bool Read(void *dst, size_t sz) {
+    if (_pos + sz > _data.size())
+      return false;
+    memcpy(dst, _data.data() + _pos, sz);
+    _pos += sz;
+    return true;
+  }
+
+  bool Seek(uint64_t offset) {
+    _pos = static_cast<size_t>(offset);
+    return _pos <= _data.size();
+  }
+
+ private:
+  MemoryInput &operator=(const MemoryInput &);
+  const std::string &_data;
+  size_t _pos;
+};
+
+// Keeps std::cerr quiet while it lives, for the errors the container
+// reader reports on a file that is broken on purpose
+class MuteErrors {
+ public:
+  MuteErrors() : _buf(std::cerr.rdbuf(NULL)) { }
+  ~MuteErrors() { std::cerr.rdbuf(_buf); }
+
+ private:
+  MuteErrors(const MuteErrors &);
+  MuteErrors &operator=(const MuteErrors &);
+  std::streambuf *_buf;
+};
+
+static int OpenInput(const std::string &path) {
+#ifdef _WIN32
+  if (path == "-") {
+    _setmode(0, _O_BINARY);
+    return 0;
+  }
+  return _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+  return path == "-" ? 0 : open(path.c_str(), O_RDONLY);
+#endif
+}
+
+static void CloseInput(int fd) {
+  if (fd == 0)
+    return;
+#ifdef _WIN32
+  _close(fd);
+#else
+  close(fd);
+#endif
+}
+
+static bool Pack(const std::string &in_path, const std::string &out_path) {
+  MPTC::MappedSource source;
+  if (!source.Open(in_path)) {
+    std::cerr << "Error opening " << in_path << std::endl;
+    return false;
+  }
+
+  MPTC::ContainerHeader header;
+  bool is_ok;
+  if (out_path == "-") {
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    is_ok = MPTC::WriteContainer(source, std::cout, &header);
+    std::cout.flush();
+  }
+  else {
+    std::ofstream out_stream(out_path.c_str(), std::ios::binary);
+    is_ok = out_stream.is_open() && MPTC::WriteContainer(source, out_stream, &header);
+  }
+
+  if (!is_ok) {
+    std::cerr << "Error writing " << out_path << std::endl;
+    return false;
+  }
+  std::cerr << in_path << ": " << header.num_frames << " frames, largest packet "
+            << header.max_packet_size << " bytes" << std::endl;
+  return true;
+}
+
+static bool Unpack(const std::string &in_path, const std::string &out_path) {
+  int fd = OpenInput(in_path);
+  if (fd < 0) {
+    std::cerr << "Error opening " << in_path << std::endl;
+    return false;
+  }
+
+  MPTC::DescriptorInput input(fd);
+  MPTC::ContainerSource source;
+  std::ofstream out_stream(out_path.c_str(), std::ios::binary);
+  bool is_ok = out_stream.is_open() && source.Open(input);
+
+  // Whole packets at a time, straight out of the reader's buffer
+  std::vector<uint8_t> buffer(is_ok ? source.Header().max_packet_size : 0);
+  while (is_ok && !source.AtEnd()) {
+    uint32_t sz = source.PacketRemaining();
+    is_ok = source.Read(buffer.data(), sz);
+    out_stream.write(reinterpret_cast<const char *>(buffer.data()), sz);
+  }
+  CloseInput(fd);
+
+  is_ok = is_ok && !source.IsBroken() && out_stream.good();
+  if (is_ok && source.Header().stream_size != 0 && source.Tell() != source.Header().stream_size) {
+    std::cerr << "Error container holds " << source.Tell() << " of " << source.Header().stream_size
+              << " bytes" << std::endl;
+    is_ok = false;
+  }
+  if (!is_ok)
+    std::cerr << "Error unpacking " << in_path << std::endl;
+  return is_ok;
+}
+
+static const char *PacketTypeName(uint8_t type) {
+  switch (type) {
+  case MPTC::eContainerPacket_Header: return "header";
+  case MPTC::eContainerPacket_Dictionary: return "dictionary";
+  case MPTC::eContainerPacket_Frame: return "frame";
+  case MPTC::eContainerPacket_Toc: return "toc";
+  case MPTC::eContainerPacket_End: return "end";
+  default: return "unknown";
+  }
+}
+
+static bool Check(const std::string &in_path) {
+  int fd = OpenInput(in_path);
+  if (fd < 0) {
+    std::cerr << "Error opening " << in_path << std::endl;
+    return false;
+  }
+
+  MPTC::DescriptorInput input(fd);
+  MPTC::ContainerScan scan;
+  bool is_ok = MPTC::ScanContainer(input, &scan);
+  CloseInput(fd);
+
+  uint32_t counts[MPTC::eContainerPacket_End + 1] = { 0 };
+  uint32_t num_keys = 0;
+  for (size_t packet_idx = 0; packet_idx < scan.packets.size(); packet_idx++) {
+    const MPTC::ContainerPacket &packet = scan.packets[packet_idx];
+    if (packet.type <= MPTC::eContainerPacket_End)
+      counts[packet.type]++;
+    if (packet.flags & MPTC::kContainerPacketFlag_Key)
+      num_keys++;
+    if (packet_idx > 0 && packet.sequence != scan.packets[packet_idx - 1].sequence + 1)
+      printf("packets %u to %u are missing\n", scan.packets[packet_idx - 1].sequence + 1, packet.sequence - 1);
+  }
+
+  for (int type = MPTC::eContainerPacket_Header; type <= MPTC::eContainerPacket_End; type++)
+    printf("%-10s packets: %u\n", PacketTypeName(static_cast<uint8_t>(type)), counts[type]);
+  printf("key frames: %u\n", num_keys);
+  for (size_t broken = 0; broken < scan.broken_offsets.size(); broken++)
+    printf("broken packet at %llu\n", static_cast<unsigned long long>(scan.broken_offsets[broken]));
+  if (!scan.has_end)
+    printf("container is cut short\n");
+  printf("%s\n", is_ok ? "ok" : "broken");
+  return is_ok;
+}
+
+static bool DecodeAll(MPTC::ByteSource &source, uint32_t num_threads, std::vector<uint64_t> *hashes) {
+  MPTC::Decoder decoder;
+  if (!decoder.Open(source, num_threads))
+    return false;
+
+  std::vector<PhysicalDXTBlock> prev(decoder.NumBlocks()), curr(decoder.NumBlocks());
+  hashes->clear();
+  for (uint32_t frame = 0; frame < decoder.TotalFrameCount(); frame++) {
+    decoder.DecodeFrameMultiThread(prev.data(), curr.data());
+    hashes->push_back(MPTC::HashFrame(curr.data(), decoder.NumBlocks()));
+    std::swap(prev, curr);
+  }
+  return true;
+}
+
+// Decodes a container fed through a pipe, which the reader cannot seek in
+static bool DecodePipe(const std::string &container, uint32_t num_threads, std::vector<uint64_t> *hashes,
+                       uint64_t *bytes_read) {
+  int fds[2];
+#ifdef _WIN32
+  if (_pipe(fds, 1 << 16, _O_BINARY) != 0)
+    return false;
+#else
+  if (pipe(fds) != 0)
+    return false;
+#endif
+
+  std::thread writer([&container, &fds]() {
+    for (size_t pos = 0; pos < container.size();) {
+      size_t chunk = std::min<size_t>(container.size() - pos, 4096);
+#ifdef _WIN32
+      int written = _write(fds[1], container.data() + pos, static_cast<unsigned int>(chunk));
+#else
+      ssize_t written = write(fds[1], container.data() + pos, chunk);
+#endif
+      if (written <= 0)
+        break;
+      pos += static_cast<size_t>(written);
+    }
+#ifdef _WIN32
+    _close(fds[1]);
+#else
+    close(fds[1]);
+#endif
+  });
+
+  MPTC::DescriptorInput input(fds[0]);
+  MPTC::ContainerSource source;
+  bool is_ok = source.Open(input) && DecodeAll(source, num_threads, hashes);
+  *bytes_read = source.BytesRead();
+
+  // Drain the pipe so that the writer always finishes
+  char drain[4096];
+#ifdef _WIN32
+  while (_read(fds[0], drain, sizeof(drain)) > 0) { }
+#else
+  while (read(fds[0], drain, sizeof(drain)) > 0) { }
+#endif
+  writer.join();
+#ifdef _WIN32
+  _close(fds[0]);
+#else
+  close(fds[0]);
+#endif
+  return is_ok;
+}
+
+static bool Verify(const std::string &path, uint32_t num_threads) {
+  MPTC::MappedSource mapped_source;
+  if (!mapped_source.Open(path)) {
+    std::cerr << "Error opening " << path << std::endl;
+    return false;
+  }
+
+  std::vector<uint64_t> expected;
+  if (!DecodeAll(mapped_source, num_threads, &expected)) {
+    std::cerr << "Error decoding " << path << std::endl;
+    return false;
+  }
+
+  Clock::time_point start = Clock::now();
+  std::ostringstream out_stream(std::ios::binary);
+  MPTC::ContainerHeader header;
+  if (!MPTC::WriteContainer(mapped_source, out_stream, &header))
+    return false;
+  double pack_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  std::string container = out_stream.str();
+
+  if (!(header.flags & MPTC::kContainerFlag_Toc)) {
+    std::cerr << "Error the container in memory has no table of contents" << std::endl;
+    return false;
+  }
+
+  // Through a pipe
+  std::vector<uint64_t> hashes;
+  uint64_t bytes_read = 0;
+  start = Clock::now();
+  if (!DecodePipe(container, num_threads, &hashes, &bytes_read) || hashes != expected) {
+    std::cerr << "Error decoding the container from a pipe does not match the file" << std::endl;
+    return false;
+  }
+  double pipe_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  // Seekable, every frame in random order through an index of the stream
+  MemoryInput memory_input(container);
+  MPTC::ContainerSource memory_source;
+  MPTC::Decoder decoder;
+  std::vector<MPTC::FrameIndexEntry> index;
+  if (!memory_source.Open(memory_input) || !decoder.Open(memory_source, num_threads) ||
+      BuildFrameIndex(memory_source, &index) != 0 || index.size() != expected.size()) {
+    std::cerr << "Error indexing the container" << std::endl;
+    return false;
+  }
+
+  std::vector<PhysicalDXTBlock> scratch(decoder.NumBlocks()), curr(decoder.NumBlocks());
+  srand(1);
+  for (size_t seek = 0; seek < expected.size(); seek++) {
+    uint32_t frame = static_cast<uint32_t>(rand() % expected.size());
+    if (decoder.Seek(index, frame, scratch.data(), curr.data()) != 0 ||
+        MPTC::HashFrame(curr.data(), decoder.NumBlocks()) != expected[frame]) {
+      std::cerr << "Error seeking to frame " << frame << " of the container" << std::endl;
+      return false;
+    }
+  }
+
+  // A flipped byte in the middle of the last frame
+  std::string corrupt = container;
+  MemoryInput locate_input(container);
+  MPTC::ContainerSource locate_source;
+  locate_source.Open(locate_input);
+  locate_source.Seek(index.back().frame_offset + index.back().frame_size / 2);
+  uint8_t byte;
+  locate_source.Read(&byte, 1);
+  const MPTC::ContainerPacket &packet = locate_source.Packet();
+  uint64_t corrupt_offset = packet.packet_offset + MPTC::kContainerPacketHeaderSize +
+                            4 * packet.sections.size() + packet.payload_size / 2;
+  corrupt[static_cast<size_t>(corrupt_offset)] ^= 0x10;
+
+  // The reader reports the broken packet, which is what is checked here
+  bool is_caught;
+  MPTC::ContainerScan scan;
+  {
+    MuteErrors mute_errors;
+    MemoryInput corrupt_input(corrupt);
+    MPTC::ContainerSource corrupt_source;
+    std::vector<uint8_t> buffer(header.max_packet_size);
+    is_caught = !corrupt_source.Open(corrupt_input);
+    while (!is_caught && !corrupt_source.AtEnd())
+      corrupt_source.Read(buffer.data(), corrupt_source.PacketRemaining());
+    is_caught = is_caught || corrupt_source.IsBroken();
+
+    MemoryInput scan_input(corrupt);
+    MPTC::ScanContainer(scan_input, &scan);
+  }
+  if (!is_caught || scan.broken_offsets.size() != 1 || scan.broken_offsets[0] != packet.packet_offset ||
+      !scan.has_end) {
+    std::cerr << "Error a flipped byte at " << corrupt_offset << " went unnoticed" << std::endl;
+    return false;
+  }
+
+  uint64_t file_size = mapped_source.Size();
+  printf("%s: %u frames  file %llu bytes  container %llu bytes (+%.2f%%)\n", path.c_str(), header.num_frames,
+         static_cast<unsigned long long>(file_size), static_cast<unsigned long long>(container.size()),
+         100.0 * (static_cast<double>(container.size()) - file_size) / file_size);
+  printf("pack %8.3f ms  pipe decode %8.3f ms/frame  reader buffer %u bytes  read %llu bytes\n", pack_ms,
+         pipe_ms / expected.size(), header.max_packet_size, static_cast<unsigned long long>(bytes_read));
+  printf("ok\n");
+  return true;
+}
+
+int main(int argc, char **argv) {
+  std::string mode = argc > 1 ? argv[1] : "";
+  if (mode == "pack" && argc > 3)
+    return Pack(argv[2], argv[3]) ? 0 : 1;
+  if (mode == "unpack" && argc > 3)
+    return Unpack(argv[2], argv[3]) ? 0 : 1;
+  if (mode == "check" && argc > 2)
+    return Check(argv[2]) ? 0 : 1;
+  if (mode == "verify" && argc > 2)
+    return Verify(argv[2], argc > 3 ? static_cast<uint32_t>(atoi(argv[3])) : 0) ? 0 : 1;
+
+  std::cerr << "Usage: " << argv[0] << " pack <in.mpt> <out.mpts>" << std::endl;
+  std::cerr << "       " << argv[0] << " unpack <in.mpts> <out.mpt>" << std::endl;
+  std::cerr << "       " << argv[0] << " check <in.mpts>" << std::endl;
+  std::cerr << "       " << argv[0] << " verify <in.mpt> [num_threads]" << std::endl;
+  return 1;
+}
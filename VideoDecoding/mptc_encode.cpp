@@ -0,0 +1,287 @@
+// Encodes a sequence of DXT1 frames into an MPTC file.
+//
+// Usage: mptc_encode [options] <out.mpt> <height> <width> <frame.DXT1>...
+//        mptc_encode [options] --synthetic <num_frames> <out.mpt> <height> <width>
+//
+// Options:
+//   -u <frames>   unique interval (16)
+//   -s <blocks>   motion search area (8)
+//   -t <rows>     tile rows, a multiple of 64 block rows (untiled)
+//   -k <frames>   key frame interval, 0 for only the first frame (16)
+//   -j <threads>  motion search threads (hardware concurrency)
+//   -r            code the streams with rANS instead of the arithmetic coder
+//   -m            code the motion with the context models of motion_codec.h,
+//                 about a quarter fewer motion bytes, but the file decodes
+//                 slower, down to half the speed together with -r
+//   --verify      decode the file again and compare every frame
+//   --scaling     encode with 1, 2, 4, ... threads and report the speedup
+//
+// The .DXT1 frames are raw blocks in raster order, as loaded by the
+// renderer. --synthetic generates panning content instead, so the encoder
+// and decoder can be round tripped without any input files.
+//
+// With --verify every decoded frame has to match the encoder's own
+// reconstruction bit for bit, and seeking to every frame through the
+// written index has to give the same result; the tool exits with an error
+// otherwise. The encode and decode throughput are printed either way.
+// --scaling requires the files written with every thread count to be
+// identical.
+
+#include "decoder.h"
+#include "encoder.h"
+#include "frame_hash.h"
+#include "mptc_reader.h"
+#include "synthetic_sequence.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static bool LoadDXT1Frame(const std::string &path, PhysicalDXTBlock *frame, uint32_t num_blocks) {
+  std::ifstream in_stream(path.c_str(), std::ios::binary);
+  in_stream.read(reinterpret_cast<char*>(frame), num_blocks * sizeof(PhysicalDXTBlock));
+  return static_cast<uint32_t>(in_stream.gcount()) == num_blocks * sizeof(PhysicalDXTBlock);
+}
+
+static bool VerifyFile(const std::string &path, uint32_t num_blocks,
+                       const std::vector<uint64_t> &expected, double *decode_ms) {
+  MPTC::MappedSource source;
+  if (!source.Open(path)) {
+    std::cerr << "Error mapping " << path << std::endl;
+    return false;
+  }
+
+  std::vector<PhysicalDXTBlock> frames[2];
+  frames[0].resize(num_blocks);
+  frames[1].resize(num_blocks);
+
+  MPTCDecodeInfo decode_info;
+  InitDecodeInfo(&decode_info);
+  Clock::time_point start = Clock::now();
+  for (size_t frame = 0; frame < expected.size(); frame++) {
+    PhysicalDXTBlock *prev_dxt = frame == 0 ? NULL : frames[(frame - 1) % 2].data();
+    PhysicalDXTBlock *curr_dxt = frames[frame % 2].data();
+    GetFrame(source, prev_dxt, curr_dxt, &decode_info);
+    if (MPTC::HashFrame(curr_dxt, num_blocks) != expected[frame]) {
+      std::cerr << "Frame " << frame << " doesn't decode to the encoder's reconstruction" << std::endl;
+      return false;
+    }
+  }
+  *decode_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  std::vector<MPTC::FrameIndexEntry> index;
+  if (!MPTC::LoadFrameIndex(path, source.Size(), &index)) {
+    std::cerr << "Error loading the frame index of " << path << std::endl;
+    return false;
+  }
+  for (size_t frame = 0; frame < expected.size(); frame++) {
+    if (SeekFrame(source, index, static_cast<uint32_t>(frame), frames[1].data(), frames[0].data(), &decode_info) != 0 ||
+        MPTC::HashFrame(frames[0].data(), num_blocks) != expected[frame]) {
+      std::cerr << "Seeking to frame " << frame << " doesn't match" << std::endl;
+      return false;
+    }
+  }
+
+  FreeDecodeInfo(&decode_info);
+  return true;
+}
+
+struct EncodeRun {
+  std::vector<uint64_t> expected;  // hash of every reconstructed frame
+  uint64_t exact_endpoints;
+  double encode_ms;
+  MPTC::EncoderStats stats;
+};
+
+static bool EncodeSequence(const std::string &out_path, uint32_t frame_height, uint32_t frame_width,
+                           const MPTC::EncoderOptions &options, const std::vector<std::string> &frame_paths,
+                           uint32_t num_synthetic, EncodeRun *run) {
+  const uint32_t num_blocks = (frame_height / 4) * (frame_width / 4);
+  const uint32_t num_frames = num_synthetic != 0 ? num_synthetic : static_cast<uint32_t>(frame_paths.size());
+
+  MPTC::Encoder encoder;
+  if (!encoder.Open(out_path, frame_height, frame_width, options))
+    return false;
+
+  std::vector<PhysicalDXTBlock> frame(num_blocks), reconstruction(num_blocks);
+  std::unique_ptr<MPTC::SyntheticSequence> synthetic;
+  if (num_synthetic != 0)
+    synthetic.reset(new MPTC::SyntheticSequence(frame_height / 4, frame_width / 4));
+
+  run->expected.clear();
+  run->exact_endpoints = 0;
+  run->encode_ms = 0.0;
+  for (uint32_t frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+    if (synthetic) {
+      synthetic->Generate(frame_idx, frame.data());
+    }
+    else if (!LoadDXT1Frame(frame_paths[frame_idx], frame.data(), num_blocks)) {
+      std::cerr << "Error reading " << frame_paths[frame_idx] << std::endl;
+      return false;
+    }
+
+    Clock::time_point start = Clock::now();
+    encoder.AddFrame(frame.data(), reconstruction.data());
+    run->encode_ms += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    for (uint32_t block_idx = 0; block_idx < num_blocks; block_idx++) {
+      run->exact_endpoints += frame[block_idx].ep1 == reconstruction[block_idx].ep1;
+      run->exact_endpoints += frame[block_idx].ep2 == reconstruction[block_idx].ep2;
+    }
+    run->expected.push_back(MPTC::HashFrame(reconstruction.data(), num_blocks));
+  }
+
+  Clock::time_point start = Clock::now();
+  if (!encoder.Close()) {
+    std::cerr << "Error writing " << out_path << std::endl;
+    return false;
+  }
+  run->encode_ms += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  run->stats = encoder.Stats();
+  return true;
+}
+
+static uint64_t HashFile(const std::string &path) {
+  std::ifstream in_stream(path.c_str(), std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(in_stream)), std::istreambuf_iterator<char>());
+  uint64_t hash = 1469598103934665603ULL;
+  for (char byte : bytes) {
+    hash ^= static_cast<uint8_t>(byte);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Encodes the sequence with 1, 2, 4, ... threads up to the hardware
+// concurrency. The files have to come out identical.
+static bool RunScaling(const std::string &out_path, uint32_t frame_height, uint32_t frame_width,
+                       MPTC::EncoderOptions options, const std::vector<std::string> &frame_paths,
+                       uint32_t num_synthetic) {
+  uint32_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  uint64_t first_hash = 0;
+  double first_search_ms = 0.0;
+
+  for (uint32_t num_threads = 1; ; num_threads = std::min(2 * num_threads, max_threads)) {
+    options.num_threads = num_threads;
+    EncodeRun run;
+    if (!EncodeSequence(out_path, frame_height, frame_width, options, frame_paths, num_synthetic, &run))
+      return false;
+
+    uint64_t hash = HashFile(out_path);
+    if (num_threads == 1) {
+      first_hash = hash;
+      first_search_ms = run.stats.motion_search_ms;
+    }
+    else if (hash != first_hash) {
+      std::cerr << "Encoding with " << num_threads << " threads gives a different file" << std::endl;
+      return false;
+    }
+
+    double num_frames = static_cast<double>(run.stats.num_frames);
+    printf("threads: %3u  search: %8.3f ms/frame (%5.2fx)  encode: %8.3f ms/frame\n", num_threads,
+           run.stats.motion_search_ms / num_frames, first_search_ms / run.stats.motion_search_ms,
+           run.encode_ms / num_frames);
+
+    if (num_threads == max_threads)
+      break;
+  }
+  return true;
+}
+
+static void PrintUsage(const char *name) {
+  std::cerr << "Usage: " << name << " [options] <out.mpt> <height> <width> <frame.DXT1>..." << std::endl
+            << "       " << name << " [options] --synthetic <num_frames> <out.mpt> <height> <width>" << std::endl
+            << "Options: -u <unique interval> -s <search area> -t <tile rows> -k <key interval>" << std::endl
+            << "         -j <threads> -r -m --verify --scaling" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  MPTC::EncoderOptions options;
+  bool verify = false, scaling = false;
+  uint32_t num_synthetic = 0;
+  std::vector<std::string> args;
+
+  for (int arg = 1; arg < argc; arg++) {
+    std::string opt(argv[arg]);
+    bool has_value = arg + 1 < argc;
+    if (opt == "-u" && has_value)
+      options.unique_interval = static_cast<uint8_t>(atoi(argv[++arg]));
+    else if (opt == "-s" && has_value)
+      options.search_area = static_cast<uint8_t>(atoi(argv[++arg]));
+    else if (opt == "-t" && has_value)
+      options.tile_rows = static_cast<uint32_t>(atoi(argv[++arg]));
+    else if (opt == "-k" && has_value)
+      options.key_interval = static_cast<uint32_t>(atoi(argv[++arg]));
+    else if (opt == "-j" && has_value)
+      options.num_threads = static_cast<uint32_t>(atoi(argv[++arg]));
+    else if (opt == "-r")
+      options.codec = MPTC::eEntropyCodec_Rans;
+    else if (opt == "-m")
+      options.motion_model = true;
+    else if (opt == "--verify")
+      verify = true;
+    else if (opt == "--scaling")
+      scaling = true;
+    else if (opt == "--synthetic" && has_value)
+      num_synthetic = static_cast<uint32_t>(atoi(argv[++arg]));
+    else
+      args.push_back(opt);
+  }
+
+  if (args.size() < 3 || (num_synthetic == 0 && args.size() < 4)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  const std::string out_path = args[0];
+  const uint32_t frame_height = static_cast<uint32_t>(atoi(args[1].c_str()));
+  const uint32_t frame_width = static_cast<uint32_t>(atoi(args[2].c_str()));
+  const uint32_t num_blocks = (frame_height / 4) * (frame_width / 4);
+  const std::vector<std::string> frame_paths(args.begin() + 3, args.end());
+
+  if (scaling)
+    return RunScaling(out_path, frame_height, frame_width, options, frame_paths, num_synthetic) ? 0 : 1;
+
+  EncodeRun run;
+  if (!EncodeSequence(out_path, frame_height, frame_width, options, frame_paths, num_synthetic, &run))
+    return 1;
+
+  const MPTC::EncoderStats &stats = run.stats;
+  const uint64_t num_frames = stats.num_frames;
+  const double raw_mb = static_cast<double>(stats.num_blocks) * sizeof(PhysicalDXTBlock) / (1024.0 * 1024.0);
+  printf("frames: %llu  blocks unique: %llu  intra: %llu  inter: %llu  motion: %llu bytes (%.3f bits/block)\n",
+         static_cast<unsigned long long>(num_frames),
+         static_cast<unsigned long long>(stats.unique_blocks),
+         static_cast<unsigned long long>(stats.intra_blocks),
+         static_cast<unsigned long long>(stats.inter_blocks),
+         static_cast<unsigned long long>(stats.motion_bytes),
+         8.0 * stats.motion_bytes / stats.num_blocks);
+  printf("size: %llu bytes (%.2f:1 over DXT1)  exact endpoints: %.3f%%  clamped coefficients: %llu\n",
+         static_cast<unsigned long long>(stats.file_size),
+         raw_mb * 1024.0 * 1024.0 / stats.file_size,
+         100.0 * run.exact_endpoints / (2.0 * stats.num_blocks),
+         static_cast<unsigned long long>(stats.clamped_coeffs));
+  printf("encode: %8.3f ms/frame  %8.2f MB/s of DXT1  (motion search %.3f ms/frame)\n",
+         run.encode_ms / num_frames, raw_mb / (run.encode_ms / 1000.0),
+         stats.motion_search_ms / num_frames);
+
+  if (verify) {
+    double decode_ms = 0.0;
+    if (!VerifyFile(out_path, num_blocks, run.expected, &decode_ms))
+      return 1;
+    printf("decode: %8.3f ms/frame  %8.2f MB/s of DXT1  (verified)\n", decode_ms / num_frames,
+           raw_mb / (decode_ms / 1000.0));
+  }
+  return 0;
+}
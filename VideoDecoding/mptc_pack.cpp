@@ -0,0 +1,170 @@
+// Packs a sequence of frame files into one frame archive, see
+// frame_archive.h, and lists or checks archives.
+//
+// Usage: mptc_pack pack <out.mpfa> <prefix> <suffix> <num_frames> [frame_ms] [first_number] [num_digits]
+//        mptc_pack list <in.mpfa>
+//        mptc_pack check <in.mpfa> <prefix> <suffix> [first_number] [num_digits]
+//
+// The frames are "<prefix><number><suffix>" as the renderer names its
+// texture files, numbered from first_number (1) and zero padded to
+// num_digits (3), so "360MegaC4K" ".crn" 96 packs 360MegaC4K001.crn to
+// 360MegaC4K096.crn. The codec is taken from the suffix and the frames are
+// stamped frame_ms (70) apart. The restart points of a CRN frame, in
+// "<frame>.rst" next to it, are packed as its side data.
+//
+// check compares every frame of the archive with the file it was packed
+// from.
+
+#include "frame_archive.h"
+#include "frame_streamer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static bool ReadWholeFile(const std::string &path, std::vector<uint8_t> *data) {
+  std::ifstream is(path.c_str(), std::ios::in | std::ifstream::binary);
+  if (!is)
+    return false;
+  is.seekg(0, is.end);
+  size_t length = static_cast<size_t>(is.tellg());
+  is.seekg(0, is.beg);
+  data->resize(length);
+  is.read(reinterpret_cast<char *>(data->data()), length);
+  return static_cast<bool>(is);
+}
+
+static MPTC::FileSequence Sequence(int argc, char **argv, int first_arg) {
+  MPTC::FileSequence files;
+  files.prefix = argv[first_arg];
+  files.suffix = argv[first_arg + 1];
+  files.first_number = argc > first_arg + 2 ? static_cast<uint32_t>(atoi(argv[first_arg + 2])) : 1;
+  files.num_digits = argc > first_arg + 3 ? static_cast<uint32_t>(atoi(argv[first_arg + 3])) : 3;
+  return files;
+}
+
+static int Pack(const std::string &out_path, const MPTC::FileSequence &files, uint32_t num_frames,
+                double frame_ms) {
+  MPTC::FrameCodec codec = MPTC::FrameCodecFromSuffix(files.suffix);
+  MPTC::FrameArchiveWriter writer;
+  if (!writer.Open(out_path, num_frames)) {
+    std::cerr << "Error opening " << out_path << std::endl;
+    return 1;
+  }
+
+  std::vector<uint8_t> frame, aux;
+  uint64_t frame_bytes = 0, aux_bytes = 0;
+  for (uint32_t frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+    std::string path = files.Path(frame_idx);
+    if (!ReadWholeFile(path, &frame) || frame.empty()) {
+      std::cerr << "Error reading " << path << std::endl;
+      return 1;
+    }
+    aux.clear();
+    if (codec == MPTC::eFrameCodec_CRN)
+      ReadWholeFile(path + ".rst", &aux);
+
+    uint64_t timestamp_us = static_cast<uint64_t>(frame_idx * frame_ms * 1000.0 + 0.5);
+    if (!writer.AddFrame(frame.data(), frame.size(), codec, timestamp_us,
+                         aux.empty() ? NULL : aux.data(), static_cast<uint32_t>(aux.size()))) {
+      std::cerr << "Error writing " << out_path << std::endl;
+      return 1;
+    }
+    frame_bytes += frame.size();
+    aux_bytes += aux.size();
+  }
+  if (!writer.Finish()) {
+    std::cerr << "Error writing " << out_path << std::endl;
+    return 1;
+  }
+
+  std::ifstream is(out_path.c_str(), std::ios::in | std::ifstream::binary);
+  is.seekg(0, is.end);
+  uint64_t file_size = static_cast<uint64_t>(is.tellg());
+  printf("%u %s frames, %llu bytes and %llu bytes of side data in %llu bytes (%.2f%% overhead)\n",
+         num_frames, MPTC::FrameCodecName(codec), (unsigned long long)frame_bytes,
+         (unsigned long long)aux_bytes, (unsigned long long)file_size,
+         100.0 * (file_size - frame_bytes - aux_bytes) / (frame_bytes + aux_bytes));
+  return 0;
+}
+
+static int List(const std::string &path) {
+  MPTC::FrameArchive archive;
+  if (!archive.Open(path)) {
+    std::cerr << "Error opening " << path << ", not a frame archive" << std::endl;
+    return 1;
+  }
+  printf("%u frames\n", archive.NumFrames());
+  printf("%6s %12s %10s %6s %6s %12s\n", "frame", "offset", "size", "aux", "codec", "time ms");
+  for (uint32_t frame_idx = 0; frame_idx < archive.NumFrames(); frame_idx++) {
+    const MPTC::FrameArchiveEntry &entry = archive.Entry(frame_idx);
+    printf("%6u %12llu %10llu %6u %6s %12.3f\n", frame_idx, (unsigned long long)entry.offset,
+           (unsigned long long)entry.size, entry.aux_size, MPTC::FrameCodecName(entry.codec),
+           entry.timestamp_us / 1000.0);
+  }
+  return 0;
+}
+
+static int Check(const std::string &path, const MPTC::FileSequence &files) {
+  MPTC::FrameArchive archive;
+  if (!archive.Open(path)) {
+    std::cerr << "Error opening " << path << ", not a frame archive" << std::endl;
+    return 1;
+  }
+
+  std::vector<uint8_t> frame, aux;
+  uint32_t num_bad = 0;
+  for (uint32_t frame_idx = 0; frame_idx < archive.NumFrames(); frame_idx++) {
+    const MPTC::FrameArchiveEntry &entry = archive.Entry(frame_idx);
+    std::string frame_path = files.Path(frame_idx);
+    if (!ReadWholeFile(frame_path, &frame)) {
+      std::cerr << "Error reading " << frame_path << std::endl;
+      return 1;
+    }
+    if (!ReadWholeFile(frame_path + ".rst", &aux) || entry.codec != MPTC::eFrameCodec_CRN)
+      aux.clear();
+
+    bool is_same = entry.size == frame.size() && entry.aux_size == aux.size() &&
+      memcmp(archive.Frame(frame_idx), frame.data(), frame.size()) == 0 &&
+      (aux.empty() || memcmp(archive.Aux(frame_idx), aux.data(), aux.size()) == 0);
+    if (!is_same) {
+      std::cerr << "Frame " << frame_idx << " differs from " << frame_path << std::endl;
+      num_bad++;
+    }
+  }
+  printf("%u frames checked, %u differ\n", archive.NumFrames(), num_bad);
+  return num_bad == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  std::string mode = argc > 1 ? argv[1] : "";
+  if (mode == "pack" && argc > 5) {
+    uint32_t num_frames = static_cast<uint32_t>(atoi(argv[5]));
+    double frame_ms = argc > 6 ? atof(argv[6]) : 70.0;
+    MPTC::FileSequence files;
+    files.prefix = argv[3];
+    files.suffix = argv[4];
+    files.first_number = argc > 7 ? static_cast<uint32_t>(atoi(argv[7])) : 1;
+    files.num_digits = argc > 8 ? static_cast<uint32_t>(atoi(argv[8])) : 3;
+    if (num_frames == 0) {
+      std::cerr << "No frames to pack" << std::endl;
+      return 1;
+    }
+    return Pack(argv[2], files, num_frames, frame_ms);
+  }
+  if (mode == "list" && argc > 2)
+    return List(argv[2]);
+  if (mode == "check" && argc > 4)
+    return Check(argv[2], Sequence(argc, argv, 3));
+
+  std::cerr << "Usage: " << argv[0] << " pack <out.mpfa> <prefix> <suffix> <num_frames> [frame_ms] "
+            << "[first_number] [num_digits]" << std::endl;
+  std::cerr << "       " << argv[0] << " list <in.mpfa>" << std::endl;
+  std::cerr << "       " << argv[0] << " check <in.mpfa> <prefix> <suffix> [first_number] [num_digits]"
+            << std::endl;
+  return 1;
+}
@@ -0,0 +1,258 @@
+#include "mptc_reader.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace MPTC {
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// StreamSource
+//
+//////////////////////////////////////////////////////////////////////////////
+
+bool StreamSource::Read(void *dst, uint32_t sz) {
+  _in_stream.read(reinterpret_cast<char*>(dst), sz);
+  return static_cast<uint32_t>(_in_stream.gcount()) == sz;
+}
+
+const uint8_t *StreamSource::Borrow(uint32_t sz, uint8_t *staging) {
+  if (!Read(staging, sz))
+    return NULL;
+  return staging;
+}
+
+void StreamSource::Seek(uint64_t offset) {
+  _in_stream.clear();
+  _in_stream.seekg(static_cast<std::streamoff>(offset), _in_stream.beg);
+}
+
+uint64_t StreamSource::Tell() {
+  return static_cast<uint64_t>(_in_stream.tellg());
+}
+
+bool StreamSource::AtEnd() {
+  return _in_stream.eof();
+}
+
+uint64_t StreamSource::Size() {
+  std::streampos pos = _in_stream.tellg();
+  _in_stream.seekg(0, _in_stream.end);
+  uint64_t size = static_cast<uint64_t>(_in_stream.tellg());
+  _in_stream.seekg(pos);
+  return size;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// MappedFile
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifdef _WIN32
+
+MappedFile::MappedFile() : _data(NULL), _size(0), _file_handle(NULL), _mapping_handle(NULL) { }
+
+bool MappedFile::Open(const std::string &path) {
+  Close();
+
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping == NULL) {
+    CloseHandle(file);
+    return false;
+  }
+
+  const void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (data == NULL) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+
+  _file_handle = file;
+  _mapping_handle = mapping;
+  _data = reinterpret_cast<const uint8_t *>(data);
+  _size = static_cast<uint64_t>(file_size.QuadPart);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (_data != NULL)
+    UnmapViewOfFile(_data);
+  if (_mapping_handle != NULL)
+    CloseHandle(reinterpret_cast<HANDLE>(_mapping_handle));
+  if (_file_handle != NULL)
+    CloseHandle(reinterpret_cast<HANDLE>(_file_handle));
+
+  _data = NULL;
+  _size = 0;
+  _file_handle = NULL;
+  _mapping_handle = NULL;
+}
+
+#else
+
+MappedFile::MappedFile() : _data(NULL), _size(0) { }
+
+bool MappedFile::Open(const std::string &path) {
+  Close();
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  void *data = mmap(NULL, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps its own reference to the file
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+
+  // Frames are read front to back
+  madvise(data, static_cast<size_t>(file_stat.st_size), MADV_SEQUENTIAL);
+
+  _data = reinterpret_cast<const uint8_t *>(data);
+  _size = static_cast<uint64_t>(file_stat.st_size);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (_data != NULL)
+    munmap(const_cast<uint8_t *>(_data), static_cast<size_t>(_size));
+  _data = NULL;
+  _size = 0;
+}
+
+#endif
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// MappedSource
+//
+//////////////////////////////////////////////////////////////////////////////
+
+bool MappedSource::Read(void *dst, uint32_t sz) {
+  if (_pos + sz > _file.Size()) {
+    _pos = _file.Size();
+    return false;
+  }
+
+  memcpy(dst, _file.Data() + _pos, sz);
+  _pos += sz;
+  return true;
+}
+
+const uint8_t *MappedSource::Borrow(uint32_t sz, uint8_t *staging) {
+  if (_pos + sz > _file.Size()) {
+    _pos = _file.Size();
+    return NULL;
+  }
+
+  const uint8_t *data = _file.Data() + _pos;
+  _pos += sz;
+
+  // Streams at the very end of the file don't have the padding behind them
+  if (_pos + kStreamPadding > _file.Size()) {
+    memcpy(staging, data, sz);
+    memset(staging + sz, 0, kStreamPadding);
+    return staging;
+  }
+  return data;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Frame index
+//
+//////////////////////////////////////////////////////////////////////////////
+
+std::string FrameIndexPath(const std::string &path) {
+  return path + ".idx";
+}
+
+bool SaveFrameIndex(const std::string &path, uint64_t file_size,
+                    const std::vector<FrameIndexEntry> &index) {
+  std::ofstream out_stream(FrameIndexPath(path).c_str(), std::ios::binary);
+  if (!out_stream.is_open())
+    return false;
+
+  uint32_t num_frames = static_cast<uint32_t>(index.size());
+  out_stream.write(reinterpret_cast<const char*>(&kFrameIndexMagic), 4);
+  out_stream.write(reinterpret_cast<const char*>(&kFrameIndexVersion), 4);
+  out_stream.write(reinterpret_cast<const char*>(&file_size), 8);
+  out_stream.write(reinterpret_cast<const char*>(&num_frames), 4);
+  for (size_t frame = 0; frame < index.size(); frame++) {
+    const FrameIndexEntry &entry = index[frame];
+    out_stream.write(reinterpret_cast<const char*>(&entry.frame_offset), 8);
+    out_stream.write(reinterpret_cast<const char*>(&entry.palette_offset), 8);
+    out_stream.write(reinterpret_cast<const char*>(&entry.unique_offset), 4);
+    out_stream.write(reinterpret_cast<const char*>(&entry.frame_size), 4);
+    out_stream.write(reinterpret_cast<const char*>(&entry.flags), 4);
+  }
+  return out_stream.good();
+}
+
+bool LoadFrameIndex(const std::string &path, uint64_t file_size,
+                    std::vector<FrameIndexEntry> *index) {
+  std::ifstream in_stream(FrameIndexPath(path).c_str(), std::ios::binary);
+  if (!in_stream.is_open())
+    return false;
+
+  uint32_t magic = 0, version = 0, num_frames = 0;
+  uint64_t indexed_size = 0;
+  in_stream.read(reinterpret_cast<char*>(&magic), 4);
+  in_stream.read(reinterpret_cast<char*>(&version), 4);
+  in_stream.read(reinterpret_cast<char*>(&indexed_size), 8);
+  in_stream.read(reinterpret_cast<char*>(&num_frames), 4);
+  if (!in_stream.good() || magic != kFrameIndexMagic ||
+      version != kFrameIndexVersion || indexed_size != file_size)
+    return false;
+
+  index->resize(num_frames);
+  for (uint32_t frame = 0; frame < num_frames; frame++) {
+    FrameIndexEntry &entry = (*index)[frame];
+    in_stream.read(reinterpret_cast<char*>(&entry.frame_offset), 8);
+    in_stream.read(reinterpret_cast<char*>(&entry.palette_offset), 8);
+    in_stream.read(reinterpret_cast<char*>(&entry.unique_offset), 4);
+    in_stream.read(reinterpret_cast<char*>(&entry.frame_size), 4);
+    in_stream.read(reinterpret_cast<char*>(&entry.flags), 4);
+    if (!in_stream.good() || entry.frame_offset + entry.frame_size > file_size) {
+      index->clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace MPTC
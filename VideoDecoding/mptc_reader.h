@@ -0,0 +1,136 @@
+#ifndef __MPTC_READER_H__
+#define __MPTC_READER_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace MPTC {
+
+// Entropy decoders may look this many bytes past the end of a stream, so
+// every stream handed to them needs that much readable memory behind it
+const uint32_t kStreamPadding = 16;
+
+// Where the decoder reads an MPTC file from
+class ByteSource {
+ public:
+  virtual ~ByteSource() { }
+
+  // Copies the next sz bytes to dst, false if the file ends first
+  virtual bool Read(void *dst, uint32_t sz) = 0;
+
+  // Returns the next sz bytes, followed by kStreamPadding readable bytes.
+  // The bytes are either borrowed from the source, valid until it is
+  // closed or, for sources that stream, at least until AtEnd is called or
+  // a Read or Borrow goes past the current frame record, or copied to
+  // staging, which must hold sz + kStreamPadding bytes. NULL if the file
+  // ends first.
+  virtual const uint8_t *Borrow(uint32_t sz, uint8_t *staging) = 0;
+
+  virtual void Seek(uint64_t offset) = 0;
+  virtual uint64_t Tell() = 0;
+  virtual bool AtEnd() = 0;
+  virtual uint64_t Size() = 0;
+
+  void Skip(uint64_t sz) { Seek(Tell() + sz); }
+};
+
+// Reads through an std::ifstream, Borrow always copies to staging
+class StreamSource : public ByteSource {
+ public:
+  explicit StreamSource(std::ifstream &in_stream) : _in_stream(in_stream) { }
+
+  bool Read(void *dst, uint32_t sz);
+  const uint8_t *Borrow(uint32_t sz, uint8_t *staging);
+  void Seek(uint64_t offset);
+  uint64_t Tell();
+  bool AtEnd();
+  uint64_t Size();
+
+ private:
+  StreamSource &operator=(const StreamSource &);
+  std::ifstream &_in_stream;
+};
+
+// A read only mapping of a whole file
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  bool Open(const std::string &path);
+  void Close();
+
+  bool IsOpen() const { return _data != NULL; }
+  const uint8_t *Data() const { return _data; }
+  uint64_t Size() const { return _size; }
+
+ private:
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+
+  const uint8_t *_data;
+  uint64_t _size;
+#ifdef _WIN32
+  void *_file_handle;
+  void *_mapping_handle;
+#endif
+};
+
+// Decodes straight from a mapped file. Streams are only copied when they
+// end too close to the end of the mapping to be padded.
+class MappedSource : public ByteSource {
+ public:
+  MappedSource() : _pos(0) { }
+
+  bool Open(const std::string &path) { _pos = 0; return _file.Open(path); }
+  void Close() { _file.Close(); }
+  bool IsOpen() const { return _file.IsOpen(); }
+  const MappedFile &File() const { return _file; }
+
+  bool Read(void *dst, uint32_t sz);
+  const uint8_t *Borrow(uint32_t sz, uint8_t *staging);
+  void Seek(uint64_t offset) { _pos = offset; }
+  uint64_t Tell() { return _pos; }
+  bool AtEnd() { return _pos >= _file.Size(); }
+  uint64_t Size() { return _file.Size(); }
+
+ private:
+  MappedFile _file;
+  uint64_t _pos;
+};
+
+// Where a frame starts in the file and which dictionary it decodes with.
+// Seeking to palette_offset, reading the dictionary and then jumping to
+// frame_offset decodes a key frame without touching the frames before it.
+struct FrameIndexEntry {
+  uint64_t frame_offset;
+  uint64_t palette_offset;  // dictionary of the frame's unique interval
+  uint32_t unique_offset;   // byte offset into that dictionary
+  uint32_t frame_size;      // bytes from frame_offset to the next frame
+  uint32_t flags;
+};
+
+// The frame has no inter blocks, it decodes without the previous frame
+const uint32_t kFrameIndexFlag_Key = 0x01;
+
+// Sidecar index next to the file, "<path>.idx":
+//   u32 magic "MPTI", u32 version, u64 size of the indexed file,
+//   u32 num_frames, num_frames x FrameIndexEntry
+const uint32_t kFrameIndexMagic = 0x4954504D;
+const uint32_t kFrameIndexVersion = 2;
+
+std::string FrameIndexPath(const std::string &path);
+
+// Loading fails when the sidecar is missing, broken or doesn't match
+// file_size, the caller then rebuilds the index with BuildFrameIndex
+bool SaveFrameIndex(const std::string &path, uint64_t file_size,
+                    const std::vector<FrameIndexEntry> &index);
+bool LoadFrameIndex(const std::string &path, uint64_t file_size,
+                    std::vector<FrameIndexEntry> *index);
+
+}  // namespace MPTC
+
+#endif  // __MPTC_READER_H__
@@ -0,0 +1,376 @@
+// Dumps where the time of decoding an MPTC file goes, frame by frame.
+//
+// Usage: mptc_stats [options] <file.mpt | file.mpts | ->
+//   --mode serial|pool|ring  decode on the calling thread, on the worker
+//                            pool, or through a buffered decode ring as
+//                            the renderer does (default)
+//   --threads N              workers of the pool, 0 sizes it from the hardware
+//   --frames N               frames to decode, the whole file by default
+//   --fps F                  ring only: play at F frames per second through
+//                            a PlaybackScheduler, which skims and jumps when
+//                            decoding falls behind, instead of taking every
+//                            frame as soon as it is ready
+//   --json                   JSON instead of CSV
+//   -o <path>                write to path instead of stdout
+//
+// Files ending in .mpts, and "-" for stdin, are read as the streaming
+// container of container.h, so captures of production streams can be
+// profiled offline. Rings decode ahead and wrap around to the first frame,
+// so they can't read from stdin.
+//
+// Every row is one frame handed out: the time of each decode stage in ms
+// (see MPTCDecodeStage, summed over tiles and threads), the compressed
+// bytes of every stream and the dictionary, and for rings how many frames
+// were waiting once it was published. Frames skimmed on the way to a
+// frame are counted in its row. A summary goes to stderr.
+
+#include "container.h"
+#include "decoder.h"
+#include "mptc_reader.h"
+#include "playback.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+static const uint8_t kBufferSize = 4;
+
+struct Options {
+  std::string mode;
+  uint32_t num_threads;
+  uint32_t num_frames;  // 0 for the whole file
+  double fps;
+  bool is_json;
+  std::string out_path;
+  std::string in_path;
+};
+
+// The file directly, or the MPTC file inside a container
+class Input {
+ public:
+  Input() : _fd(-1) { }
+  ~Input() {
+    _container.reset();
+    _descriptor.reset();
+#ifdef _WIN32
+    if (_fd > 0)
+      _close(_fd);
+#else
+    if (_fd > 0)
+      close(_fd);
+#endif
+  }
+
+  bool Open(const std::string &path) {
+    bool is_container = path == "-" || (path.size() > 5 && path.compare(path.size() - 5, 5, ".mpts") == 0);
+    if (!is_container) {
+      std::unique_ptr<MPTC::MappedSource> mapped(new MPTC::MappedSource);
+      if (!mapped->Open(path))
+        return false;
+      _source.reset(mapped.release());
+      return true;
+    }
+
+#ifdef _WIN32
+    if (path == "-")
+      _setmode(0, _O_BINARY);
+    _fd = path == "-" ? 0 : _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    _fd = path == "-" ? 0 : open(path.c_str(), O_RDONLY);
+#endif
+    if (_fd < 0)
+      return false;
+    _descriptor.reset(new MPTC::DescriptorInput(_fd));
+    _container.reset(new MPTC::ContainerSource);
+    return _container->Open(*_descriptor);
+  }
+
+  MPTC::ByteSource &Source() {
+    return _container ? static_cast<MPTC::ByteSource&>(*_container) : *_source;
+  }
+
+ private:
+  int _fd;
+  std::unique_ptr<MPTC::ByteSource> _source;
+  std::unique_ptr<MPTC::DescriptorInput> _descriptor;
+  std::unique_ptr<MPTC::ContainerSource> _container;
+};
+
+// Decodes with a Decoder on the calling thread or its pool
+static bool RunDecoder(const Options &options, MPTC::ByteSource &source,
+                       std::vector<MPTCBufferedFrameStats> *records) {
+  MPTC::Decoder decoder;
+  if (!decoder.Open(source, options.num_threads)) {
+    std::cerr << "Error reading the MPTC header" << std::endl;
+    return false;
+  }
+
+  uint32_t num_frames = options.num_frames == 0 ? decoder.TotalFrameCount() : options.num_frames;
+  std::vector<PhysicalDXTBlock> prev(decoder.NumBlocks()), curr(decoder.NumBlocks());
+  Clock::time_point start = Clock::now();
+  for (uint32_t frame = 0; frame < num_frames; frame++) {
+    MPTCBufferedFrameStats record;
+    memset(&record, 0, sizeof(record));
+    record.frame_number = frame;
+    record.start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+    decoder.SetFrameStats(&record.decode);
+    PhysicalDXTBlock *prev_dxt = frame == 0 ? NULL : prev.data();
+    if (options.mode == "pool")
+      decoder.DecodeFrameMultiThread(prev_dxt, curr.data());
+    else if (decoder.DecodeFrame(prev_dxt, curr.data()) != 0)
+      return false;
+    decoder.SetFrameStats(NULL);
+
+    records->push_back(record);
+    std::swap(prev, curr);
+  }
+  return true;
+}
+
+// Moves the records of the frames published so far to records
+static void DrainRing(BufferStruct *ring, std::vector<MPTCBufferedFrameStats> *records) {
+  MPTCBufferedFrameStats batch[16];
+  uint32_t num_read;
+  while ((num_read = ReadBufferedFrameStats(ring, batch, 16)) > 0)
+    records->insert(records->end(), batch, batch + num_read);
+}
+
+// Plays the file through a buffered decode ring. Only the records of the
+// frames handed out are kept, the ring decodes ahead of the consumer.
+static bool RunRing(const Options &options, MPTC::ByteSource &source, std::vector<MPTCBufferedFrameStats> *records,
+                    MPTCBufferStats *ring_stats) {
+  uint32_t num_blocks, total_frame_count;
+  {
+    // The ring reads the header again from the same position
+    MPTCDecodeInfo decode_info;
+    InitDecodeInfo(&decode_info);
+    uint64_t start = source.Tell();
+    OpenDecodeInfo(source, &decode_info);
+    num_blocks = decode_info.num_blocks;
+    total_frame_count = decode_info.total_frame_count;
+    FreeDecodeInfo(&decode_info);
+    source.Seek(start);
+  }
+  uint32_t num_frames = options.num_frames == 0 ? total_frame_count : options.num_frames;
+
+  BufferStruct *ring = NULL;
+  InitBufferedDecode(kBufferSize, ring, source, num_blocks, options.num_threads);
+
+  std::vector<MPTCBufferedFrameStats> published;
+  std::vector<uint64_t> shown;
+  if (options.fps > 0.0) {
+    MPTC::PlaybackScheduler scheduler;
+    scheduler.Init(ring, MPTC::DefaultPlaybackPolicy(1000.0 / options.fps));
+    Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / options.fps));
+    Clock::time_point vsync = Clock::now();
+    scheduler.Start(vsync);
+    while (shown.empty() || shown.back() + 1 < num_frames) {
+      std::this_thread::sleep_until(vsync);
+      PhysicalDXTBlock *frame;
+      if (scheduler.GetFrame(vsync, frame) == kMPTCFrameReady)
+        shown.push_back(scheduler.FrameNumber());
+      DrainRing(ring, &published);
+      vsync += period;
+    }
+  }
+  else {
+    while (shown.size() < num_frames) {
+      PhysicalDXTBlock *frame;
+      if (GetBufferedFrame(ring, frame) == kMPTCFrameReady)
+        shown.push_back(GetBufferedFrameNumber(ring));
+      else
+        std::this_thread::yield();
+      DrainRing(ring, &published);
+    }
+  }
+
+  DrainRing(ring, &published);
+  GetBufferedDecodeStats(ring, ring_stats);
+  DestroyBufferedDecode(ring);
+
+  // Records and shown frames are both in frame order
+  size_t record_idx = 0;
+  for (uint64_t frame_number : shown) {
+    while (record_idx < published.size() && published[record_idx].frame_number < frame_number)
+      record_idx++;
+    if (record_idx < published.size() && published[record_idx].frame_number == frame_number)
+      records->push_back(published[record_idx]);
+  }
+  return true;
+}
+
+static double Ms(uint64_t ns) {
+  return ns / 1.0e6;
+}
+
+static void WriteCsv(FILE *out, const std::vector<MPTCBufferedFrameStats> &records) {
+  fprintf(out, "frame,start_ms,decode_ms");
+  for (int stage = 0; stage < kNumDecodeStages; stage++)
+    fprintf(out, ",%s_ms", GetDecodeStageName(stage));
+  for (int stream = 0; stream < kNumMPTCStreams; stream++)
+    fprintf(out, ",%s_bytes", GetDecodeStageName(eDecodeStage_Motion + stream));
+  fprintf(out, ",palette_bytes,frames_decoded,frames_skimmed,palettes_decoded,occupancy,key_jump\n");
+
+  for (const MPTCBufferedFrameStats &record : records) {
+    const MPTCFrameStats &stats = record.decode;
+    fprintf(out, "%llu,%.4f,%.4f", (unsigned long long)record.frame_number, Ms(record.start_ns), Ms(stats.decode_ns));
+    for (int stage = 0; stage < kNumDecodeStages; stage++)
+      fprintf(out, ",%.4f", Ms(stats.stage_ns[stage]));
+    for (int stream = 0; stream < kNumMPTCStreams; stream++)
+      fprintf(out, ",%llu", (unsigned long long)stats.stream_bytes[stream]);
+    fprintf(out, ",%llu,%u,%u,%u,%u,%d\n", (unsigned long long)stats.palette_bytes, stats.frames_decoded,
+            stats.frames_skimmed, stats.palettes_decoded, static_cast<uint32_t>(record.occupancy),
+            record.is_key_jump ? 1 : 0);
+  }
+}
+
+static void WriteJson(FILE *out, const Options &options, const std::vector<MPTCBufferedFrameStats> &records) {
+  fprintf(out, "{\n  \"mode\": \"%s\",\n  \"frames\": [\n", options.mode.c_str());
+  for (size_t record_idx = 0; record_idx < records.size(); record_idx++) {
+    const MPTCBufferedFrameStats &record = records[record_idx];
+    const MPTCFrameStats &stats = record.decode;
+    fprintf(out, "    {\"frame\": %llu, \"start_ms\": %.4f, \"decode_ms\": %.4f, \"stage_ms\": {",
+            (unsigned long long)record.frame_number, Ms(record.start_ns), Ms(stats.decode_ns));
+    for (int stage = 0; stage < kNumDecodeStages; stage++)
+      fprintf(out, "%s\"%s\": %.4f", stage == 0 ? "" : ", ", GetDecodeStageName(stage), Ms(stats.stage_ns[stage]));
+    fprintf(out, "}, \"bytes\": {");
+    for (int stream = 0; stream < kNumMPTCStreams; stream++) {
+      fprintf(out, "\"%s\": %llu, ", GetDecodeStageName(eDecodeStage_Motion + stream),
+              (unsigned long long)stats.stream_bytes[stream]);
+    }
+    fprintf(out, "\"palette\": %llu}, \"frames_decoded\": %u, \"frames_skimmed\": %u, \"palettes_decoded\": %u, "
+            "\"occupancy\": %u, \"key_jump\": %s}%s\n", (unsigned long long)stats.palette_bytes,
+            stats.frames_decoded, stats.frames_skimmed, stats.palettes_decoded,
+            static_cast<uint32_t>(record.occupancy), record.is_key_jump ? "true" : "false",
+            record_idx + 1 < records.size() ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+}
+
+// Averages per frame handed out
+static void PrintSummary(const Options &options, const std::vector<MPTCBufferedFrameStats> &records,
+                         const MPTCBufferStats *ring_stats) {
+  MPTCFrameStats total;
+  memset(&total, 0, sizeof(total));
+  for (const MPTCBufferedFrameStats &record : records) {
+    for (int stage = 0; stage < kNumDecodeStages; stage++)
+      total.stage_ns[stage] += record.decode.stage_ns[stage];
+    for (int stream = 0; stream < kNumMPTCStreams; stream++)
+      total.stream_bytes[stream] += record.decode.stream_bytes[stream];
+    total.decode_ns += record.decode.decode_ns;
+    total.palette_bytes += record.decode.palette_bytes;
+    total.frames_decoded += record.decode.frames_decoded;
+    total.frames_skimmed += record.decode.frames_skimmed;
+  }
+
+  double num_records = records.empty() ? 1.0 : static_cast<double>(records.size());
+  fprintf(stderr, "%s: %zu frames, %s, %u decoded, %u skimmed, %.3f ms/frame\n", options.in_path.c_str(),
+          records.size(), options.mode.c_str(), total.frames_decoded, total.frames_skimmed,
+          Ms(total.decode_ns) / num_records);
+  for (int stage = 0; stage < kNumDecodeStages; stage++) {
+    double share = total.decode_ns == 0 ? 0.0 : 100.0 * total.stage_ns[stage] / total.decode_ns;
+    fprintf(stderr, "  %-10s %8.3f ms/frame %6.1f%%\n", GetDecodeStageName(stage), Ms(total.stage_ns[stage]) / num_records,
+            share);
+  }
+  for (int stream = 0; stream < kNumMPTCStreams; stream++) {
+    fprintf(stderr, "  %-10s %10.0f bytes/frame\n", GetDecodeStageName(eDecodeStage_Motion + stream),
+            total.stream_bytes[stream] / num_records);
+  }
+  fprintf(stderr, "  %-10s %10.0f bytes/frame\n", "palette", total.palette_bytes / num_records);
+  if (ring_stats != NULL) {
+    fprintf(stderr, "  ring: %llu underruns, %llu producer waits, %llu records dropped\n",
+            (unsigned long long)ring_stats->underruns, (unsigned long long)ring_stats->producer_waits,
+            (unsigned long long)ring_stats->stats_dropped);
+  }
+}
+
+static void PrintUsage(const char *name) {
+  std::cerr << "Usage: " << name << " [--mode serial|pool|ring] [--threads N] [--frames N] [--fps F] [--json]"
+            << " [-o out] <file.mpt | file.mpts | ->" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  options.mode = "ring";
+  options.num_threads = 0;
+  options.num_frames = 0;
+  options.fps = 0.0;
+  options.is_json = false;
+
+  for (int arg = 1; arg < argc; arg++) {
+    std::string name(argv[arg]);
+    bool has_value = arg + 1 < argc;
+    if (name == "--mode" && has_value)
+      options.mode = argv[++arg];
+    else if (name == "--threads" && has_value)
+      options.num_threads = static_cast<uint32_t>(atoi(argv[++arg]));
+    else if (name == "--frames" && has_value)
+      options.num_frames = static_cast<uint32_t>(atoi(argv[++arg]));
+    else if (name == "--fps" && has_value)
+      options.fps = atof(argv[++arg]);
+    else if (name == "--json")
+      options.is_json = true;
+    else if (name == "-o" && has_value)
+      options.out_path = argv[++arg];
+    else if (options.in_path.empty() && (name == "-" || name[0] != '-'))
+      options.in_path = name;
+    else {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (options.in_path.empty() || (options.mode != "serial" && options.mode != "pool" && options.mode != "ring")) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  if (options.mode == "ring" && options.in_path == "-") {
+    std::cerr << "Error a ring can't read from stdin, use --mode serial or pool" << std::endl;
+    return 1;
+  }
+
+  Input input;
+  if (!input.Open(options.in_path)) {
+    std::cerr << "Error opening " << options.in_path << std::endl;
+    return 1;
+  }
+
+  std::vector<MPTCBufferedFrameStats> records;
+  MPTCBufferStats ring_stats;
+  bool is_ok = options.mode == "ring" ?
+    RunRing(options, input.Source(), &records, &ring_stats) :
+    RunDecoder(options, input.Source(), &records);
+  if (!is_ok)
+    return 1;
+
+  FILE *out = options.out_path.empty() ? stdout : fopen(options.out_path.c_str(), "w");
+  if (out == NULL) {
+    std::cerr << "Error opening " << options.out_path << std::endl;
+    return 1;
+  }
+  if (options.is_json)
+    WriteJson(out, options, records);
+  else
+    WriteCsv(out, records);
+  if (out != stdout)
+    fclose(out);
+
+  PrintSummary(options, records, options.mode == "ring" ? &ring_stats : NULL);
+  return 0;
+}
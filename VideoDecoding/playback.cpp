@@ -0,0 +1,136 @@
+#include "playback.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace MPTC {
+
+PlaybackPolicy DefaultPlaybackPolicy(double frame_ms) {
+  PlaybackPolicy policy;
+  policy.frame_ms = frame_ms;
+  policy.skim_budget_ms = frame_ms;
+  policy.jump_budget_ms = 4 * frame_ms;
+  return policy;
+}
+
+PlaybackScheduler::PlaybackScheduler()
+  : _ring(NULL), _is_started(false), _is_holding(false), _is_contiguous(false), _shown_frame(0),
+    _requested_frame(0), _frames_shown(0), _frames_dropped(0), _late_calls(0), _catch_ups(0), _num_calls(0),
+    _lag_ms(0.0), _max_lag_ms(0.0), _total_lag_ms(0.0) { }
+
+void PlaybackScheduler::Init(BufferStruct *ring, const PlaybackPolicy &policy,
+                             const std::vector<FrameIndexEntry> *index) {
+  assert(policy.frame_ms > 0.0);
+  _ring = ring;
+  _policy = policy;
+  _frame_period = std::chrono::duration_cast<PlaybackClock::duration>(
+    std::chrono::duration<double, std::milli>(policy.frame_ms));
+  SetBufferedFrameIndex(ring, index);
+}
+
+void PlaybackScheduler::Start(PlaybackClock::time_point start) {
+  _start = start;
+  _is_started = true;
+}
+
+uint64_t PlaybackScheduler::DueFrame(PlaybackClock::time_point now) const {
+  if (now <= _start)
+    return 0;
+  return static_cast<uint64_t>((now - _start) / _frame_period);
+}
+
+bool PlaybackScheduler::IsFrameDue(PlaybackClock::time_point now) const {
+  assert(_ring != NULL && "PlaybackScheduler is not initialized");
+  // Before the first GetFrame the clock starts at now, frame 0 is due
+  uint64_t due_frame = _is_started ? DueFrame(now) : 0;
+  uint64_t frame;
+  return PeekBufferedFrame(_ring, &frame) && frame <= due_frame;
+}
+
+int PlaybackScheduler::GetFrame(PlaybackClock::time_point now, PhysicalDXTBlock * &curr_dxt) {
+  assert(_ring != NULL && "PlaybackScheduler is not initialized");
+  if (!_is_started)
+    Start(now);
+
+  // Take the newest frame that is due, the ones before it are too late
+  uint64_t due_frame = DueFrame(now);
+  uint64_t frame;
+  bool is_new = false;
+  uint64_t prev_frame = _shown_frame;
+  bool was_holding = _is_holding;
+  while (PeekBufferedFrame(_ring, &frame) && frame <= due_frame) {
+    GetBufferedFrame(_ring, curr_dxt);
+    if (is_new)
+      _frames_dropped++;
+    is_new = true;
+    _shown_frame = frame;
+    _is_holding = true;
+  }
+
+  if (is_new) {
+    _frames_shown++;
+    _is_contiguous = was_holding && _shown_frame == prev_frame + 1;
+  }
+  else {
+    curr_dxt = _is_holding ? _ring->buffered_dxts[_ring->curr_dxt_idx] : NULL;
+  }
+
+  // How long the frame after the one shown has been due
+  uint64_t next_frame = _is_holding ? _shown_frame + 1 : 0;
+  _lag_ms = 0.0;
+  if (next_frame <= due_frame) {
+    _lag_ms = std::chrono::duration<double, std::milli>(now - (_start + _frame_period * next_frame)).count();
+    if (!is_new)
+      _late_calls++;
+  }
+  _max_lag_ms = std::max(_max_lag_ms, _lag_ms);
+  _total_lag_ms += _lag_ms;
+  _num_calls++;
+
+  CatchUp(due_frame, _lag_ms);
+  return is_new ? kMPTCFrameReady : kMPTCFrameNotReady;
+}
+
+void PlaybackScheduler::CatchUp(uint64_t due_frame, double lag_ms) {
+  if (_policy.skim_budget_ms < 0.0 || lag_ms <= _policy.skim_budget_ms)
+    return;
+
+  // Aim for the frame that will be due once the decoder has finished it
+  MPTCBufferStats ring_stats;
+  GetBufferedDecodeStats(_ring, &ring_stats);
+  double decode_ms = ring_stats.decode_ms > 0.0 ? ring_stats.decode_ms : _policy.frame_ms;
+  uint64_t target = due_frame + 1 + static_cast<uint64_t>(std::ceil(decode_ms / _policy.frame_ms));
+  if (target <= _requested_frame || target <= _ring->next_frame.load(std::memory_order_relaxed))
+    return;
+
+  bool to_key = _policy.jump_budget_ms >= 0.0 && lag_ms > _policy.jump_budget_ms &&
+    _ring->frame_index.load(std::memory_order_relaxed) != NULL;
+  RequestBufferedSkip(_ring, to_key ? (target | kMPTCSkipToKey) : target);
+  _requested_frame = target;
+  _catch_ups++;
+}
+
+const uint64_t *PlaybackScheduler::GetDirtyMap(uint32_t *num_dirty_blocks) {
+  if (!_is_contiguous)
+    return NULL;
+  return GetBufferedDirtyMap(_ring, num_dirty_blocks);
+}
+
+void PlaybackScheduler::GetStats(PlaybackStats *stats) const {
+  MPTCBufferStats ring_stats;
+  GetBufferedDecodeStats(_ring, &ring_stats);
+
+  stats->frames_shown = _frames_shown;
+  stats->frames_dropped = _frames_dropped;
+  stats->frames_skimmed = ring_stats.frames_skimmed;
+  stats->frames_jumped = ring_stats.frames_jumped;
+  stats->key_jumps = ring_stats.key_jumps;
+  stats->late_calls = _late_calls;
+  stats->catch_ups = _catch_ups;
+  stats->lag_ms = _lag_ms;
+  stats->max_lag_ms = _max_lag_ms;
+  stats->avg_lag_ms = _num_calls == 0 ? 0.0 : _total_lag_ms / _num_calls;
+}
+
+}  // namespace MPTC
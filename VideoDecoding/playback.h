@@ -0,0 +1,99 @@
+#ifndef __MPTC_PLAYBACK_H__
+#define __MPTC_PLAYBACK_H__
+
+#include "decoder.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace MPTC {
+
+typedef std::chrono::steady_clock PlaybackClock;
+
+// How far playback may lag behind the wall clock before the scheduler asks
+// the decoder to catch up. A negative budget never triggers.
+struct PlaybackPolicy {
+  double frame_ms;        // presentation time of one frame
+  double skim_budget_ms;  // lag past which frames that won't be shown are only skimmed
+  double jump_budget_ms;  // lag past which decoding jumps to a key frame close to the target
+};
+
+// Skims after one frame of lag and jumps after four
+PlaybackPolicy DefaultPlaybackPolicy(double frame_ms);
+
+struct PlaybackStats {
+  uint64_t frames_shown;
+  uint64_t frames_dropped;   // decoded, but already late when they came out of the ring
+  uint64_t frames_skimmed;   // interpolation data only, see SkimFrame
+  uint64_t frames_jumped;    // passed over by key frame jumps without decoding them
+  uint64_t key_jumps;
+  uint64_t late_calls;       // GetFrame calls that had no frame for the due time
+  uint64_t catch_ups;        // skips requested from the decoder
+  double lag_ms;             // of the last GetFrame call
+  double max_lag_ms, avg_lag_ms;
+};
+
+// Paces a buffered decode ring by wall clock. Frame n of the ring is due
+// at Start() + n * frame_ms. GetFrame hands out the newest frame that is
+// due, frames that came out of the ring too late are dropped on the spot.
+// Once the frame shown lags more than the policy allows, the decoder is
+// told to carry on with the frame that will be due by the time it is
+// decoded, skimming the frames in between or jumping to a key frame.
+//
+// The lag is how long ago the frame that is shown should have been
+// replaced by a newer one; it is 0 as long as playback keeps up.
+//
+// The scheduler is the consumer of the ring, no one else may call
+// GetBufferedFrame on it.
+class PlaybackScheduler {
+ public:
+  PlaybackScheduler();
+
+  // The ring has to outlive the scheduler. index, see
+  // SetBufferedFrameIndex, enables key frame jumps.
+  void Init(BufferStruct *ring, const PlaybackPolicy &policy,
+            const std::vector<FrameIndexEntry> *index = NULL);
+
+  // Frame 0 is due at start. GetFrame starts the clock on its first call
+  // otherwise.
+  void Start(PlaybackClock::time_point start);
+
+  // Returns kMPTCFrameReady with a new frame in curr_dxt, or
+  // kMPTCFrameNotReady when the frame held is still the one to show or the
+  // decoder is behind, curr_dxt then stays on the held frame (NULL if none).
+  int GetFrame(PlaybackClock::time_point now, PhysicalDXTBlock * &curr_dxt);
+
+  // True if GetFrame would hand out a new frame at now, and so give the slot
+  // of the frame held back to the decoder. Does not move the ring.
+  bool IsFrameDue(PlaybackClock::time_point now) const;
+
+  // As GetBufferedDirtyMap, but NULL whenever frames were dropped or
+  // skipped since the last frame handed out, the whole frame changed then
+  const uint64_t *GetDirtyMap(uint32_t *num_dirty_blocks);
+
+  // Number of the frame handed out last
+  uint64_t FrameNumber() const { return _shown_frame; }
+
+  void GetStats(PlaybackStats *stats) const;
+
+ private:
+  uint64_t DueFrame(PlaybackClock::time_point now) const;
+  void CatchUp(uint64_t due_frame, double lag_ms);
+
+  BufferStruct *_ring;
+  PlaybackPolicy _policy;
+  PlaybackClock::duration _frame_period;
+  bool _is_started, _is_holding, _is_contiguous;
+  PlaybackClock::time_point _start;
+  uint64_t _shown_frame;
+  uint64_t _requested_frame;
+
+  uint64_t _frames_shown, _frames_dropped, _late_calls, _catch_ups;
+  uint64_t _num_calls;
+  double _lag_ms, _max_lag_ms, _total_lag_ms;
+};
+
+}  // namespace MPTC
+
+#endif  // __MPTC_PLAYBACK_H__
@@ -0,0 +1,200 @@
+// Plays an MPTC file against the wall clock faster than it decodes, headless.
+//
+// Usage: playback_bench <file.mpt> [seconds] [num_threads] [fps]
+//
+// A consumer asks for a frame at every vsync of fps, 0 picks one and a
+// half times the rate the file decodes at so that decoding falls behind.
+// "in order" takes the frames out of the ring one after the other, as the
+// renderer did before the scheduler. The other runs go through a
+// PlaybackScheduler: "drop late" only drops frames that are late when they
+// come out of the ring, "skim" also skims ahead once playback lags a frame,
+// "skim+jump" jumps to a key frame after four. Every frame shown has to
+// match decoding the file on one thread.
+
+#include "decoder.h"
+#include "frame_hash.h"
+#include "mptc_reader.h"
+#include "playback.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef MPTC::PlaybackClock Clock;
+
+static const uint8_t kBufferSize = 4;
+
+// Hashes of every frame of the file, and how long one takes to decode
+static bool ReferenceHashes(const std::string &path, uint32_t *num_blocks, std::vector<uint64_t> *hashes,
+                            double *decode_ms) {
+  MPTC::MappedSource source;
+  MPTC::Decoder decoder;
+  if (!source.Open(path) || !decoder.Open(source))
+    return false;
+
+  *num_blocks = decoder.NumBlocks();
+  std::vector<PhysicalDXTBlock> prev(decoder.NumBlocks()), curr(decoder.NumBlocks());
+  Clock::time_point start = Clock::now();
+  for (uint32_t frame = 0; frame < decoder.TotalFrameCount(); frame++) {
+    decoder.DecodeFrame(frame == 0 ? NULL : prev.data(), curr.data());
+    hashes->push_back(MPTC::HashFrame(curr.data(), decoder.NumBlocks()));
+    std::swap(prev, curr);
+  }
+  *decode_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / hashes->size();
+  return true;
+}
+
+struct RunResult {
+  MPTC::PlaybackStats stats;
+  uint64_t vsyncs;
+};
+
+static bool CheckFrame(const PhysicalDXTBlock *frame, uint64_t frame_number, uint32_t num_blocks,
+                       const std::vector<uint64_t> &reference) {
+  if (MPTC::HashFrame(frame, num_blocks) == reference[frame_number % reference.size()])
+    return true;
+  std::cerr << "Error frame " << frame_number << " differs from a serial decode" << std::endl;
+  return false;
+}
+
+// Hands out the frames in order, one per vsync if there is one
+static bool PlayInOrder(BufferStruct *ring, uint32_t num_blocks, double seconds, double fps,
+                        const std::vector<uint64_t> &reference, RunResult *result) {
+  MPTC::PlaybackStats &stats = result->stats;
+  memset(&stats, 0, sizeof(stats));
+  result->vsyncs = 0;
+
+  Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps));
+  Clock::time_point start = Clock::now();
+  Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+  double total_lag_ms = 0.0;
+  uint64_t next_frame = 0;
+  for (Clock::time_point vsync = start; vsync < end; vsync += period) {
+    std::this_thread::sleep_until(vsync);
+    result->vsyncs++;
+
+    PhysicalDXTBlock *frame;
+    bool is_new = GetBufferedFrame(ring, frame) == kMPTCFrameReady;
+    if (is_new) {
+      uint64_t frame_number = GetBufferedFrameNumber(ring);
+      if (!CheckFrame(frame, frame_number, num_blocks, reference))
+        return false;
+      stats.frames_shown++;
+      next_frame = frame_number + 1;
+    }
+    else if (start + period * next_frame <= vsync) {
+      stats.late_calls++;
+    }
+
+    // As PlaybackScheduler measures it
+    Clock::time_point next_due = start + period * next_frame;
+    stats.lag_ms = vsync >= next_due ? std::chrono::duration<double, std::milli>(vsync - next_due).count() : 0.0;
+    stats.max_lag_ms = std::max(stats.max_lag_ms, stats.lag_ms);
+    total_lag_ms += stats.lag_ms;
+  }
+  stats.avg_lag_ms = total_lag_ms / std::max<uint64_t>(1, result->vsyncs);
+  return true;
+}
+
+static bool PlayScheduled(BufferStruct *ring, const MPTC::PlaybackPolicy &policy,
+                          const std::vector<MPTC::FrameIndexEntry> *index, uint32_t num_blocks, double seconds,
+                          const std::vector<uint64_t> &reference, RunResult *result) {
+  MPTC::PlaybackScheduler scheduler;
+  scheduler.Init(ring, policy, index);
+  result->vsyncs = 0;
+
+  Clock::duration period = std::chrono::duration_cast<Clock::duration>(
+    std::chrono::duration<double, std::milli>(policy.frame_ms));
+  Clock::time_point start = Clock::now();
+  Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+  scheduler.Start(start);
+  for (Clock::time_point vsync = start; vsync < end; vsync += period) {
+    std::this_thread::sleep_until(vsync);
+    result->vsyncs++;
+
+    PhysicalDXTBlock *frame;
+    if (scheduler.GetFrame(vsync, frame) == kMPTCFrameReady &&
+        !CheckFrame(frame, scheduler.FrameNumber(), num_blocks, reference))
+      return false;
+  }
+  scheduler.GetStats(&result->stats);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <file.mpt> [seconds] [num_threads] [fps]" << std::endl;
+    return 1;
+  }
+
+  std::string path(argv[1]);
+  double seconds = argc > 2 ? atof(argv[2]) : 3.0;
+  uint32_t num_threads = argc > 3 ? static_cast<uint32_t>(atoi(argv[3])) : 0;
+  double fps = argc > 4 ? atof(argv[4]) : 0.0;
+
+  uint32_t num_blocks;
+  std::vector<uint64_t> reference;
+  double decode_ms;
+  if (!ReferenceHashes(path, &num_blocks, &reference, &decode_ms)) {
+    std::cerr << "Error decoding " << path << std::endl;
+    return 1;
+  }
+  if (fps <= 0.0)
+    fps = 1.5 * 1000.0 / decode_ms;
+
+  // Key frame jumps need the index, built on a source of its own
+  std::vector<MPTC::FrameIndexEntry> index;
+  {
+    MPTC::MappedSource source;
+    if (!source.Open(path) || BuildFrameIndex(source, &index) != 0) {
+      std::cerr << "Error indexing " << path << std::endl;
+      return 1;
+    }
+  }
+  uint32_t num_keys = 0;
+  for (const MPTC::FrameIndexEntry &entry : index)
+    num_keys += (entry.flags & MPTC::kFrameIndexFlag_Key) ? 1 : 0;
+
+  printf("%s: %zu frames, %u key frames, %.2f ms/frame on one thread, playing at %.1f fps\n", path.c_str(),
+         reference.size(), num_keys, decode_ms, fps);
+
+  const char *kRunNames[] = { "in order", "drop late", "skim", "skim+jump" };
+  for (int run = 0; run < 4; run++) {
+    MPTC::MappedSource source;
+    if (!source.Open(path)) {
+      std::cerr << "Error opening " << path << std::endl;
+      return 1;
+    }
+    BufferStruct *ring = NULL;
+    InitBufferedDecode(kBufferSize, ring, source, num_blocks, num_threads);
+
+    MPTC::PlaybackPolicy policy = MPTC::DefaultPlaybackPolicy(1000.0 / fps);
+    if (run == 1)
+      policy.skim_budget_ms = -1.0;
+    if (run <= 2)
+      policy.jump_budget_ms = -1.0;
+
+    RunResult result;
+    bool is_ok = run == 0 ?
+      PlayInOrder(ring, num_blocks, seconds, fps, reference, &result) :
+      PlayScheduled(ring, policy, run == 3 ? &index : NULL, num_blocks, seconds, reference, &result);
+    DestroyBufferedDecode(ring);
+    if (!is_ok)
+      return 1;
+
+    const MPTC::PlaybackStats &stats = result.stats;
+    printf("%-10s shown %5llu dropped %5llu skimmed %5llu jumped %5llu (%3llu jumps)  late %5.1f%%"
+           "  lag avg %7.1f ms max %7.1f ms end %7.1f ms\n", kRunNames[run],
+           (unsigned long long)stats.frames_shown, (unsigned long long)stats.frames_dropped,
+           (unsigned long long)stats.frames_skimmed, (unsigned long long)stats.frames_jumped,
+           (unsigned long long)stats.key_jumps, 100.0 * stats.late_calls / std::max<uint64_t>(1, result.vsyncs),
+           stats.avg_lag_ms, stats.max_lag_ms, stats.lag_ms);
+  }
+  return 0;
+}
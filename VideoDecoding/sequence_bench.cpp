@@ -0,0 +1,233 @@
+// Reads a sequence of frame files in order, the way the renderer loads its
+// texture files, and through a SequenceReader.
+//
+// Usage: sequence_bench [dir] [num_frames] [frame_kb] [work_ms] [read_ahead]
+//
+// Writes num_frames files of frame_kb KiB to dir, 3136 KiB by default as a
+// 3584x1792 DXT1 frame, and reads them back one after the other, spending
+// work_ms on every frame as a decode would. "per file" opens every file,
+// seeks to its end for the size and back and reads it, as RenderModel
+// does, the other runs keep read_ahead files in flight on I/O threads, the
+// last one with at most two frames' worth of bytes read ahead.
+// Before every run the files are evicted from the page cache, where the OS
+// allows, so that every run reads from the disk. Reports the throughput of
+// the whole run and of the reads alone, and how long the consumer stalled
+// waiting for a file.
+
+#include "sequence_reader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+static uint8_t PatternByte(uint32_t frame_idx, size_t offset) {
+  return static_cast<uint8_t>((frame_idx * 131 + offset * 7 + (offset >> 12)) & 0xFF);
+}
+
+static bool WriteFrames(const MPTC::FileSequence &files, uint32_t num_frames, size_t frame_size) {
+  std::vector<uint8_t> frame(frame_size);
+  for (uint32_t frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+    for (size_t i = 0; i < frame.size(); i++)
+      frame[i] = PatternByte(frame_idx, i);
+    std::string path = files.Path(frame_idx);
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp || fwrite(frame.data(), 1, frame.size(), fp) != frame.size()) {
+      std::cerr << "Error writing " << path << std::endl;
+      if (fp)
+        fclose(fp);
+      return false;
+    }
+    fclose(fp);
+  }
+  return true;
+}
+
+// Drops the files from the page cache so that the next run reads the disk
+static bool EvictFrames(const MPTC::FileSequence &files, uint32_t num_frames) {
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+  for (uint32_t frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+    int fd = open(files.Path(frame_idx).c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+  return true;
+#else
+  (void)files;
+  (void)num_frames;
+  return false;
+#endif
+}
+
+// Samples a page apart, a full compare would cost more than the reads
+static bool CheckFrame(uint32_t frame_idx, const uint8_t *data, size_t size, size_t frame_size) {
+  if (size != frame_size) {
+    std::cerr << "Error frame " << frame_idx << " has " << size << " bytes" << std::endl;
+    return false;
+  }
+  for (size_t i = 0; i < size; i += 4093) {
+    if (data[i] != PatternByte(frame_idx, i)) {
+      std::cerr << "Error frame " << frame_idx << " differs at byte " << i << std::endl;
+      return false;
+    }
+  }
+  if (data[size - 1] != PatternByte(frame_idx, size - 1)) {
+    std::cerr << "Error frame " << frame_idx << " differs at its end" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+struct RunResult {
+  double total_ms;
+  double stall_ms;
+  double max_stall_ms;
+  uint64_t stalls;
+  uint64_t bytes;
+  double read_ms;  // 0 when the reads are the stalls
+};
+
+static double Ms(Clock::duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+static void Work(double work_ms) {
+  if (work_ms > 0.0)
+    std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(work_ms));
+}
+
+static bool ReadPerFile(const MPTC::FileSequence &files, uint32_t num_frames, size_t frame_size, double work_ms,
+                        RunResult *result) {
+  std::vector<char> buffer;
+  Clock::time_point start = Clock::now();
+  for (uint32_t frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+    Clock::time_point read_start = Clock::now();
+    std::ifstream is(files.Path(frame_idx).c_str(), std::ios::in | std::ifstream::binary);
+    if (!is) {
+      std::cerr << "Error opening " << files.Path(frame_idx) << std::endl;
+      return false;
+    }
+    is.seekg(0, is.end);
+    size_t length = static_cast<size_t>(is.tellg());
+    is.seekg(0, is.beg);
+    buffer.resize(length);
+    is.read(buffer.data(), length);
+    double stall_ms = Ms(Clock::now() - read_start);
+    result->stall_ms += stall_ms;
+    result->max_stall_ms = std::max(result->max_stall_ms, stall_ms);
+    result->stalls++;
+    result->bytes += length;
+
+    if (!CheckFrame(frame_idx, reinterpret_cast<const uint8_t *>(buffer.data()), length, frame_size))
+      return false;
+    Work(work_ms);
+  }
+  result->total_ms = Ms(Clock::now() - start);
+  result->read_ms = result->stall_ms;
+  return true;
+}
+
+static bool ReadSequence(const MPTC::FileSequence &files, uint32_t num_frames, size_t frame_size, double work_ms,
+                         const MPTC::SequenceReaderOptions &options, RunResult *result) {
+  MPTC::SequenceReader reader;
+  Clock::time_point start = Clock::now();
+  if (!reader.Open(files, num_frames, options))
+    return false;
+  for (uint32_t frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+    Clock::time_point acquire_start = Clock::now();
+    MPTC::SequenceFrame frame;
+    if (!reader.Acquire(frame_idx, &frame)) {
+      std::cerr << "Error reading " << files.Path(frame_idx) << std::endl;
+      return false;
+    }
+    result->max_stall_ms = std::max(result->max_stall_ms, Ms(Clock::now() - acquire_start));
+
+    bool is_ok = CheckFrame(frame_idx, frame.data, frame.size, frame_size);
+    reader.Release(frame);
+    if (!is_ok)
+      return false;
+    Work(work_ms);
+  }
+  result->total_ms = Ms(Clock::now() - start);
+  reader.Close();
+
+  MPTC::SequenceReaderStats stats;
+  reader.GetStats(&stats);
+  result->stall_ms = stats.stall_ns / 1e6;
+  result->stalls = stats.stalls;
+  result->bytes = stats.bytes_read;
+  result->read_ms = stats.read_ns / 1e6 / options.num_threads;
+  if (stats.direct_fallbacks != 0)
+    printf("  (%llu files fell back to the page cache)\n", (unsigned long long)stats.direct_fallbacks);
+  if (options.max_ahead_bytes != 0)
+    printf("  (at most %.1f MB read ahead)\n", stats.peak_ahead_bytes / (1024.0 * 1024.0));
+  return true;
+}
+
+int main(int argc, char **argv) {
+  std::string dir = argc > 1 ? argv[1] : ".";
+  uint32_t num_frames = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 48;
+  size_t frame_size = (argc > 3 ? static_cast<size_t>(atoi(argv[3])) : 3136) << 10;
+  double work_ms = argc > 4 ? atof(argv[4]) : 10.0;
+  uint32_t read_ahead = argc > 5 ? static_cast<uint32_t>(atoi(argv[5])) : 4;
+  if (num_frames == 0 || frame_size == 0) {
+    std::cerr << "Usage: " << argv[0] << " [dir] [num_frames] [frame_kb] [work_ms] [read_ahead]" << std::endl;
+    return 1;
+  }
+
+  MPTC::FileSequence files;
+  files.prefix = dir + "/sequence_bench_frame";
+  files.suffix = ".DXT1";
+  files.first_number = 1;
+  files.num_digits = 3;
+  if (!WriteFrames(files, num_frames, frame_size))
+    return 1;
+
+  bool is_cold = EvictFrames(files, num_frames);
+  printf("%u frames of %zu KiB, %.1f ms of work per frame, %s\n", num_frames, frame_size >> 10, work_ms,
+         is_cold ? "read from the disk" : "the page cache can't be dropped, reads may be warm");
+
+  const char *kRunNames[] = { "per file", "read ahead", "drop behind", "direct", "2 threads", "2 frames" };
+  bool is_ok = true;
+  for (int run = 0; run < 6 && is_ok; run++) {
+    EvictFrames(files, num_frames);
+    MPTC::SequenceReaderOptions options = MPTC::DefaultSequenceReaderOptions();
+    options.read_ahead = read_ahead;
+    options.drop_behind = run == 2;
+    options.bypass_cache = run == 3;
+    options.num_threads = run == 4 ? 2 : 1;
+    options.max_ahead_bytes = run == 5 ? 2 * frame_size : 0;
+
+    RunResult result = RunResult();
+    is_ok = run == 0 ?
+      ReadPerFile(files, num_frames, frame_size, work_ms, &result) :
+      ReadSequence(files, num_frames, frame_size, work_ms, options, &result);
+    if (!is_ok)
+      break;
+
+    double mb = result.bytes / (1024.0 * 1024.0);
+    printf("%-12s %8.1f ms %7.1f MB/s overall  reads %7.1f MB/s  stalls %3llu, %7.1f ms total, %6.2f ms max\n",
+           kRunNames[run], result.total_ms, mb / (result.total_ms / 1000.0),
+           result.read_ms > 0.0 ? mb / (result.read_ms / 1000.0) : 0.0,
+           (unsigned long long)result.stalls, result.stall_ms, result.max_stall_ms);
+  }
+
+  for (uint32_t frame_idx = 0; frame_idx < num_frames; frame_idx++)
+    remove(files.Path(frame_idx).c_str());
+  return is_ok ? 0 : 1;
+}
@@ -0,0 +1,554 @@
+#include "sequence_reader.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace MPTC {
+
+// Direct I/O reads whole pages into page aligned memory
+static const size_t kDirectAlignment = 4096;
+// Entries past the window, for the frames acquired while it is full
+static const uint32_t kHeldEntries = 4;
+
+static size_t AlignUp(size_t size) {
+  return (size + kDirectAlignment - 1) & ~(kDirectAlignment - 1);
+}
+
+static void EnsureCapacity(size_t size, size_t *capacity, std::vector<uint8_t> *storage, uint8_t **data) {
+  if (*capacity >= AlignUp(size))
+    return;
+  storage->assign(AlignUp(size) + kDirectAlignment, 0);
+  uintptr_t address = reinterpret_cast<uintptr_t>(storage->data());
+  *data = storage->data() + (AlignUp(address) - address);
+  *capacity = AlignUp(size);
+}
+
+static uint64_t ElapsedNS(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+SequenceReaderOptions DefaultSequenceReaderOptions() {
+  SequenceReaderOptions options;
+  options.read_ahead = 4;
+  options.max_ahead_bytes = 0;
+  options.advise_ahead = 4;
+  options.num_threads = 1;
+  options.bypass_cache = false;
+  options.drop_behind = false;
+  return options;
+}
+
+SequenceReader::SequenceReader()
+  : _num_frames(0), _is_archive_direct(false),
+#ifdef _WIN32
+    _archive_handle(NULL),
+#else
+    _archive_fd(-1),
+#endif
+    _cursor(0), _advised_end(0), _stop(false) {
+  _options = DefaultSequenceReaderOptions();
+  _stats = SequenceReaderStats();
+}
+
+SequenceReader::~SequenceReader() {
+  Close();
+}
+
+bool SequenceReader::Open(const FileSequence &files, uint32_t num_frames, const SequenceReaderOptions &options) {
+  Close();
+  if (num_frames == 0)
+    return false;
+
+  _files = files;
+  Start(num_frames, options);
+  return true;
+}
+
+bool SequenceReader::OpenArchive(const std::string &path, const SequenceReaderOptions &options) {
+  Close();
+  std::ifstream in_stream(path.c_str(), std::ios::binary);
+  if (!in_stream.is_open())
+    return false;
+  in_stream.seekg(0, in_stream.end);
+  uint64_t file_size = static_cast<uint64_t>(in_stream.tellg());
+  if (!ReadFrameArchiveTable(in_stream, file_size, &_archive_entries) || _archive_entries.empty())
+    return false;
+
+  _options = options;
+  if (!OpenArchiveFile(path)) {
+    _archive_entries.clear();
+    return false;
+  }
+  _files = FileSequence();
+  _files.prefix = path;
+  Start(static_cast<uint32_t>(_archive_entries.size()), options);
+  return true;
+}
+
+void SequenceReader::Start(uint32_t num_frames, const SequenceReaderOptions &options) {
+  _num_frames = num_frames;
+  _options = options;
+  _options.read_ahead = std::max<uint32_t>(1, options.read_ahead);
+  _options.num_threads = std::max<uint32_t>(1, options.num_threads);
+
+  _entries.clear();
+  _entries.resize(_options.read_ahead + kHeldEntries);
+  for (size_t i = 0; i < _entries.size(); i++) {
+    Entry &entry = _entries[i];
+    entry.state = eEntryState_Free;
+    entry.position = 0;
+    entry.refs = 0;
+    entry.is_ok = false;
+    entry.size = 0;
+    entry.aux_size = 0;
+    entry.data = NULL;
+    entry.capacity = 0;
+  }
+  _requests.clear();
+  _cursor = 0;
+  _advised_end = 0;
+  _stats = SequenceReaderStats();
+  _stop = false;
+
+  for (uint32_t i = 0; i < _options.num_threads; i++)
+    _threads.push_back(std::thread(&SequenceReader::IOLoop, this));
+}
+
+void SequenceReader::Close() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _read_cv.notify_all();
+  _ready_cv.notify_all();
+  for (size_t i = 0; i < _threads.size(); i++)
+    _threads[i].join();
+  _threads.clear();
+  CloseArchiveFile();
+  _archive_entries.clear();
+}
+
+uint64_t SequenceReader::Position(uint32_t frame_idx) const {
+  assert(frame_idx < _num_frames);
+  uint64_t ahead = (frame_idx + _num_frames - _cursor % _num_frames) % _num_frames;
+  uint64_t behind = _num_frames - ahead;
+  if (ahead <= _num_frames / 2 || behind > _cursor)
+    return _cursor + ahead;
+  return _cursor - behind;
+}
+
+uint32_t SequenceReader::FindEntry(uint64_t position) const {
+  for (uint32_t i = 0; i < _entries.size(); i++) {
+    if (_entries[i].state != eEntryState_Free && _entries[i].position == position)
+      return i;
+  }
+  return kNoEntry;
+}
+
+uint64_t SequenceReader::AheadBytes() const {
+  uint64_t average_size = _stats.files_read == 0 ? 0 : _stats.bytes_read / _stats.files_read;
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < _entries.size(); i++) {
+    const Entry &entry = _entries[i];
+    if (entry.state == eEntryState_Free || entry.position < _cursor)
+      continue;
+    bytes += entry.state == eEntryState_Ready ? entry.size + entry.aux_size : average_size;
+  }
+  return bytes;
+}
+
+bool SequenceReader::NextToRead(uint64_t *position) const {
+  // Frames waited for come first, then the window in order
+  for (size_t i = 0; i < _requests.size(); i++) {
+    if (FindEntry(_requests[i]) == kNoEntry) {
+      *position = _requests[i];
+      return true;
+    }
+  }
+  // Past the byte limit only the frame at the cursor is read
+  bool is_over = _options.max_ahead_bytes != 0 && AheadBytes() >= _options.max_ahead_bytes;
+  for (uint64_t pos = _cursor; pos < _cursor + _options.read_ahead; pos++) {
+    if (FindEntry(pos) == kNoEntry) {
+      *position = pos;
+      return pos == _cursor || !is_over;
+    }
+  }
+  return false;
+}
+
+uint32_t SequenceReader::TakeEntry(uint64_t position) {
+  uint32_t behind = kNoEntry, furthest = kNoEntry;
+  for (uint32_t i = 0; i < _entries.size(); i++) {
+    const Entry &entry = _entries[i];
+    if (entry.state == eEntryState_Free)
+      return i;
+    if (entry.state != eEntryState_Ready || entry.refs != 0)
+      continue;
+    if (entry.position < _cursor && (behind == kNoEntry || entry.position < _entries[behind].position))
+      behind = i;
+    if (entry.position > position && (furthest == kNoEntry || entry.position > _entries[furthest].position))
+      furthest = i;
+  }
+
+  // Frames playback has passed go first. A frame waited for may also take
+  // the one furthest ahead, which is read again later.
+  uint32_t taken = behind;
+  bool is_requested = std::find(_requests.begin(), _requests.end(), position) != _requests.end();
+  if (taken == kNoEntry && is_requested)
+    taken = furthest;
+  if (taken != kNoEntry && _entries[taken].position < _cursor && _entries[taken].is_ok)
+    _stats.files_dropped++;
+  return taken;
+}
+
+bool SequenceReader::Acquire(uint32_t frame_idx, SequenceFrame *frame) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(_mutex);
+  assert(!_threads.empty() && "SequenceReader is not open");
+  _stats.acquires++;
+
+  // A frame past the window moves it there
+  uint64_t position = Position(frame_idx);
+  _cursor = std::max(_cursor, position);
+
+  uint32_t entry_idx = FindEntry(position);
+  if (entry_idx == kNoEntry || _entries[entry_idx].state != eEntryState_Ready) {
+    _stats.stalls++;
+    _requests.push_back(position);
+    _read_cv.notify_all();
+    for (;;) {
+      entry_idx = FindEntry(position);
+      if (_stop || (entry_idx != kNoEntry && _entries[entry_idx].state == eEntryState_Ready))
+        break;
+      _ready_cv.wait(lock);
+    }
+    _requests.erase(std::find(_requests.begin(), _requests.end(), position));
+    _stats.stall_ns += ElapsedNS(start);
+    if (_stop)
+      return false;
+  }
+
+  Entry &entry = _entries[entry_idx];
+  if (!entry.is_ok) {
+    // Read it again the next time it is asked for
+    if (entry.refs == 0)
+      entry.state = eEntryState_Free;
+    _read_cv.notify_all();
+    return false;
+  }
+
+  entry.refs++;
+  _cursor = std::max(_cursor, position + 1);
+  _read_cv.notify_all();
+
+  frame->frame_idx = frame_idx;
+  frame->buffer = entry_idx;
+  frame->data = entry.data;
+  frame->size = entry.size;
+  frame->aux = entry.data + entry.size;
+  frame->aux_size = entry.aux_size;
+  return true;
+}
+
+void SequenceReader::Release(const SequenceFrame &frame) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    assert(frame.buffer < _entries.size() && _entries[frame.buffer].refs > 0);
+    Entry &entry = _entries[frame.buffer];
+    if (--entry.refs == 0)
+      entry.state = eEntryState_Free;
+  }
+  _read_cv.notify_all();
+}
+
+void SequenceReader::GetStats(SequenceReaderStats *stats) const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  *stats = _stats;
+}
+
+void SequenceReader::IOLoop() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  for (;;) {
+    uint64_t position = 0;
+    uint32_t entry_idx = kNoEntry;
+    while (!_stop) {
+      if (NextToRead(&position)) {
+        entry_idx = TakeEntry(position);
+        if (entry_idx != kNoEntry)
+          break;
+      }
+      _read_cv.wait(lock);
+    }
+    if (_stop)
+      return;
+
+    Entry &entry = _entries[entry_idx];
+    entry.state = eEntryState_Reading;
+    entry.position = position;
+    entry.refs = 0;
+
+    // Let the OS start on the files past the window
+    uint64_t advise_begin = std::max(_advised_end, _cursor + _options.read_ahead);
+    uint64_t advise_end = _cursor + _options.read_ahead + _options.advise_ahead;
+    if (_options.bypass_cache)
+      advise_end = advise_begin;
+    _advised_end = std::max(_advised_end, advise_end);
+    lock.unlock();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool is_direct = _options.bypass_cache;
+    uint32_t frame_idx = static_cast<uint32_t>(position % _num_frames);
+    if (!_archive_entries.empty()) {
+      for (uint64_t pos = advise_begin; pos < advise_end; pos++) {
+        const FrameArchiveEntry &frame = _archive_entries[pos % _num_frames];
+        AdviseArchive(frame.offset, frame.offset + frame.size + frame.aux_size);
+      }
+      is_direct = _is_archive_direct;
+      entry.is_ok = ReadArchiveEntry(_archive_entries[frame_idx], &entry);
+    }
+    else {
+      for (uint64_t pos = advise_begin; pos < advise_end; pos++)
+        AdviseFile(_files.Path(static_cast<uint32_t>(pos % _num_frames)));
+      entry.is_ok = ReadEntry(_files.Path(frame_idx), &entry, &is_direct);
+    }
+    uint64_t read_ns = ElapsedNS(start);
+
+    lock.lock();
+    entry.state = eEntryState_Ready;
+    _stats.files_read += entry.is_ok ? 1 : 0;
+    _stats.read_failures += entry.is_ok ? 0 : 1;
+    _stats.bytes_read += entry.is_ok ? entry.size : 0;
+    _stats.read_ns += read_ns;
+    _stats.direct_fallbacks += (_options.bypass_cache && !is_direct) ? 1 : 0;
+    _stats.files_advised += advise_end - advise_begin;
+    _stats.peak_ahead_bytes = std::max(_stats.peak_ahead_bytes, AheadBytes());
+    _ready_cv.notify_all();
+  }
+}
+
+#ifdef _WIN32
+
+bool SequenceReader::ReadEntry(const std::string &path, Entry *entry, bool *is_direct) {
+  DWORD flags = FILE_FLAG_SEQUENTIAL_SCAN | (*is_direct ? FILE_FLAG_NO_BUFFERING : 0);
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+
+  size_t size = static_cast<size_t>(file_size.QuadPart);
+  size_t read_size = *is_direct ? AlignUp(size) : size;
+  EnsureCapacity(size, &entry->capacity, &entry->storage, &entry->data);
+
+  size_t done = 0;
+  while (done < size) {
+    DWORD num_read = 0;
+    DWORD chunk = static_cast<DWORD>(std::min<size_t>(read_size - done, 1 << 30));
+    if (!::ReadFile(file, entry->data + done, chunk, &num_read, NULL) || num_read == 0)
+      break;
+    done += num_read;
+  }
+  CloseHandle(file);
+  entry->size = size;
+  entry->aux_size = 0;
+  return done >= size;
+}
+
+// Windows has no advice for files that are not mapped, FILE_FLAG_SEQUENTIAL_SCAN
+// already reads ahead within a file
+void SequenceReader::AdviseFile(const std::string &) { }
+
+bool SequenceReader::OpenArchiveFile(const std::string &path) {
+  DWORD flags = FILE_FLAG_SEQUENTIAL_SCAN | (_options.bypass_cache ? FILE_FLAG_NO_BUFFERING : 0);
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  _archive_handle = file;
+  _is_archive_direct = _options.bypass_cache;
+  return true;
+}
+
+void SequenceReader::CloseArchiveFile() {
+  if (_archive_handle != NULL)
+    CloseHandle(reinterpret_cast<HANDLE>(_archive_handle));
+  _archive_handle = NULL;
+}
+
+bool SequenceReader::ReadArchiveEntry(const FrameArchiveEntry &frame, Entry *entry) {
+  size_t size = static_cast<size_t>(frame.size) + frame.aux_size;
+  size_t read_size = _is_archive_direct ? AlignUp(size) : size;
+  EnsureCapacity(size, &entry->capacity, &entry->storage, &entry->data);
+
+  // Positioned reads, the I/O threads share the handle
+  size_t done = 0;
+  while (done < size) {
+    OVERLAPPED overlapped;
+    memset(&overlapped, 0, sizeof(overlapped));
+    uint64_t offset = frame.offset + done;
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD num_read = 0;
+    DWORD chunk = static_cast<DWORD>(std::min<size_t>(read_size - done, 1 << 30));
+    if (!::ReadFile(reinterpret_cast<HANDLE>(_archive_handle), entry->data + done, chunk, &num_read, &overlapped) ||
+        num_read == 0)
+      break;
+    done += num_read;
+  }
+  entry->size = static_cast<size_t>(frame.size);
+  entry->aux_size = frame.aux_size;
+  return done >= size;
+}
+
+void SequenceReader::AdviseArchive(uint64_t, uint64_t) { }
+
+#else
+
+bool SequenceReader::ReadEntry(const std::string &path, Entry *entry, bool *is_direct) {
+  int fd = -1;
+#ifdef O_DIRECT
+  if (*is_direct)
+    fd = open(path.c_str(), O_RDONLY | O_DIRECT);
+#endif
+  // Not every file system can read without the page cache
+  if (fd < 0) {
+    *is_direct = false;
+    fd = open(path.c_str(), O_RDONLY);
+  }
+  if (fd < 0)
+    return false;
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  size_t size = static_cast<size_t>(file_stat.st_size);
+  size_t read_size = *is_direct ? AlignUp(size) : size;
+  EnsureCapacity(size, &entry->capacity, &entry->storage, &entry->data);
+
+  size_t done = 0;
+  while (done < size) {
+    ssize_t num_read = read(fd, entry->data + done, read_size - done);
+    if (num_read < 0 && errno == EINTR)
+      continue;
+    if (num_read <= 0)
+      break;
+    done += static_cast<size_t>(num_read);
+  }
+
+#ifdef POSIX_FADV_DONTNEED
+  if (_options.drop_behind && !*is_direct)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+  close(fd);
+  entry->size = size;
+  entry->aux_size = 0;
+  return done >= size;
+}
+
+void SequenceReader::AdviseFile(const std::string &path) {
+#ifdef POSIX_FADV_WILLNEED
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  close(fd);
+#else
+  (void)path;
+#endif
+}
+
+bool SequenceReader::OpenArchiveFile(const std::string &path) {
+  _archive_fd = -1;
+  _is_archive_direct = false;
+#ifdef O_DIRECT
+  if (_options.bypass_cache) {
+    _archive_fd = open(path.c_str(), O_RDONLY | O_DIRECT);
+    _is_archive_direct = _archive_fd >= 0;
+  }
+#endif
+  if (_archive_fd < 0)
+    _archive_fd = open(path.c_str(), O_RDONLY);
+  return _archive_fd >= 0;
+}
+
+void SequenceReader::CloseArchiveFile() {
+  if (_archive_fd >= 0)
+    close(_archive_fd);
+  _archive_fd = -1;
+}
+
+bool SequenceReader::ReadArchiveEntry(const FrameArchiveEntry &frame, Entry *entry) {
+  size_t size = static_cast<size_t>(frame.size) + frame.aux_size;
+  size_t read_size = _is_archive_direct ? AlignUp(size) : size;
+  EnsureCapacity(size, &entry->capacity, &entry->storage, &entry->data);
+
+  // Positioned reads, the I/O threads share the file. Payloads are aligned
+  // and padded, so direct reads of whole pages stay inside the archive.
+  size_t done = 0;
+  while (done < size) {
+    ssize_t num_read = pread(_archive_fd, entry->data + done, read_size - done,
+                             static_cast<off_t>(frame.offset + done));
+    if (num_read < 0 && errno == EINTR)
+      continue;
+    if (num_read <= 0)
+      break;
+    done += static_cast<size_t>(num_read);
+  }
+
+#ifdef POSIX_FADV_DONTNEED
+  if (_options.drop_behind && !_is_archive_direct)
+    posix_fadvise(_archive_fd, static_cast<off_t>(frame.offset), static_cast<off_t>(size), POSIX_FADV_DONTNEED);
+#endif
+  entry->size = static_cast<size_t>(frame.size);
+  entry->aux_size = frame.aux_size;
+  return done >= size;
+}
+
+void SequenceReader::AdviseArchive(uint64_t begin, uint64_t end) {
+#ifdef POSIX_FADV_WILLNEED
+  posix_fadvise(_archive_fd, static_cast<off_t>(begin), static_cast<off_t>(end - begin), POSIX_FADV_WILLNEED);
+#else
+  (void)begin;
+  (void)end;
+#endif
+}
+
+#endif
+
+size_t SequenceFileLoader::Load(uint32_t frame_idx, uint8_t *dst, size_t dst_size, FrameLoadStats *stats) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  SequenceFrame frame;
+  if (!_reader->Acquire(frame_idx, &frame))
+    return 0;
+
+  size_t size = frame.size <= dst_size ? frame.size : 0;
+  if (size != 0)
+    memcpy(dst, frame.data, size);
+  _reader->Release(frame);
+  stats->read_ns = ElapsedNS(start);
+  stats->decode_ns = 0;
+  return size;
+}
+
+}  // namespace MPTC
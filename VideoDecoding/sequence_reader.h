@@ -0,0 +1,177 @@
+#ifndef __MPTC_SEQUENCE_READER_H__
+#define __MPTC_SEQUENCE_READER_H__
+
+#include "frame_archive.h"
+#include "frame_streamer.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace MPTC {
+
+struct SequenceReaderOptions {
+  uint32_t read_ahead;    // files read ahead of the newest one acquired
+  uint64_t max_ahead_bytes;  // of those, 0 for no limit, see SequenceReader
+  uint32_t advise_ahead;  // files past those the OS is told to start reading
+  uint32_t num_threads;   // reading at once, 0 picks one
+  bool bypass_cache;      // O_DIRECT, FILE_FLAG_NO_BUFFERING on Windows
+  bool drop_behind;       // evict every file from the page cache once read
+};
+
+// Reads ahead four files on one thread through the page cache, without a
+// byte limit
+SequenceReaderOptions DefaultSequenceReaderOptions();
+
+// A whole file of the sequence, the reader's until it is released
+struct SequenceFrame {
+  uint32_t frame_idx;
+  uint32_t buffer;
+  const uint8_t *data;
+  size_t size;
+  const uint8_t *aux;  // side data of a frame of an archive, such as CRN restart points
+  uint32_t aux_size;
+};
+
+struct SequenceReaderStats {
+  uint64_t files_read;
+  uint64_t read_failures;
+  uint64_t bytes_read;
+  uint64_t read_ns;          // spent opening and reading, summed over the threads
+  uint64_t files_advised;    // the OS was asked to read ahead
+  uint64_t files_dropped;    // read but never acquired, playback passed them
+  uint64_t direct_fallbacks; // opened through the cache, the file system has no direct I/O
+  uint64_t acquires;
+  uint64_t stalls;           // acquires that had to wait for the read
+  uint64_t stall_ns;
+  uint64_t peak_ahead_bytes; // most read ahead of the newest frame acquired at once
+};
+
+// Reads a sequence of frame files in order on I/O threads, a window of
+// read_ahead files ahead of the newest one acquired, so that the files are
+// in memory by the time they are decoded. Past the window the OS is asked
+// to start reading advise_ahead more files with posix_fadvise(WILLNEED),
+// and with drop_behind every file is evicted from the page cache once read
+// so that playing a sequence larger than memory does not push everything
+// else out. Reading with bypass_cache skips the page cache altogether.
+//
+// max_ahead_bytes caps the memory and I/O the window takes for large
+// frames: once the frames read ahead, the ones being read counted at the
+// average size so far, reach it only the frame right after the newest one
+// acquired is still read. The read that crosses it completes.
+//
+// Frames are acquired roughly in order, by any number of threads. A frame
+// far ahead of the window moves the window there, one behind it is read
+// before the window continues. The sequence loops: frame indices are taken
+// as the nearest position to the window, ahead or behind.
+//
+// The frames can also come from a packed archive, see frame_archive.h,
+// which is read through one open file and advised range by range.
+class SequenceReader {
+ public:
+  SequenceReader();
+  ~SequenceReader();
+
+  // Starts reading at frame 0. Returns false without any thread started if
+  // there are no frames.
+  bool Open(const FileSequence &files, uint32_t num_frames, const SequenceReaderOptions &options);
+  // Reads the frames of an archive, false if it can't be opened or is not
+  // one
+  bool OpenArchive(const std::string &path, const SequenceReaderOptions &options);
+  // Waits for the reads in flight. Acquired frames have to be released
+  // first.
+  void Close();
+
+  // Waits for frame_idx to be read and hands it out, false if the file could
+  // not be read. Every frame acquired has to be released.
+  bool Acquire(uint32_t frame_idx, SequenceFrame *frame);
+  void Release(const SequenceFrame &frame);
+
+  const FileSequence &Files() const { return _files; }
+  uint32_t NumFrames() const { return _num_frames; }
+  void GetStats(SequenceReaderStats *stats) const;
+
+ private:
+  SequenceReader(const SequenceReader &);
+  SequenceReader &operator=(const SequenceReader &);
+
+  enum EntryState {
+    eEntryState_Free = 0,
+    eEntryState_Reading,
+    eEntryState_Ready
+  };
+
+  struct Entry {
+    EntryState state;
+    uint64_t position;  // in the looping sequence
+    uint32_t refs;      // acquired by this many
+    bool is_ok;
+    size_t size;
+    uint32_t aux_size;  // read right after the frame
+    uint8_t *data;      // aligned for direct I/O
+    size_t capacity;
+    std::vector<uint8_t> storage;
+  };
+
+  static const uint32_t kNoEntry = 0xFFFFFFFF;
+
+  void Start(uint32_t num_frames, const SequenceReaderOptions &options);
+
+  // All with _mutex held
+  uint64_t Position(uint32_t frame_idx) const;
+  uint32_t FindEntry(uint64_t position) const;
+  uint64_t AheadBytes() const;
+  bool NextToRead(uint64_t *position) const;
+  uint32_t TakeEntry(uint64_t position);
+  void IOLoop();
+  bool ReadEntry(const std::string &path, Entry *entry, bool *is_direct);
+  void AdviseFile(const std::string &path);
+  bool OpenArchiveFile(const std::string &path);
+  void CloseArchiveFile();
+  bool ReadArchiveEntry(const FrameArchiveEntry &frame, Entry *entry);
+  void AdviseArchive(uint64_t begin, uint64_t end);
+
+  FileSequence _files;
+  uint32_t _num_frames;
+  SequenceReaderOptions _options;
+
+  // Of the archive, when the frames come from one
+  std::vector<FrameArchiveEntry> _archive_entries;
+  bool _is_archive_direct;
+#ifdef _WIN32
+  void *_archive_handle;
+#else
+  int _archive_fd;
+#endif
+
+  std::vector<Entry> _entries;
+  std::vector<uint64_t> _requests;  // positions acquires wait for
+  uint64_t _cursor;                 // the window starts here
+  uint64_t _advised_end;            // files before it were advised
+  SequenceReaderStats _stats;
+
+  std::vector<std::thread> _threads;
+  mutable std::mutex _mutex;
+  std::condition_variable _read_cv;   // I/O threads wait for work
+  std::condition_variable _ready_cv;  // acquires wait for reads
+  bool _stop;
+};
+
+// Copies the files of a sequence reader to staging memory, for frames that
+// are stored in the format they are uploaded in, such as DXT1
+class SequenceFileLoader : public FrameLoader {
+ public:
+  explicit SequenceFileLoader(SequenceReader *reader) : _reader(reader) { }
+
+  size_t Load(uint32_t frame_idx, uint8_t *dst, size_t dst_size, FrameLoadStats *stats);
+
+ private:
+  SequenceReader *_reader;
+};
+
+}  // namespace MPTC
+
+#endif  // __MPTC_SEQUENCE_READER_H__
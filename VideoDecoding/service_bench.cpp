@@ -0,0 +1,270 @@
+// Plays 1, 4 and 16 copies of an MPTC file at once, headless.
+//
+// Usage: service_bench <file.mpt> [seconds] [num_threads] [fps]
+//
+// Every stream count runs with both setups. "shared" decodes all streams on one
+// DecodeService, whose pool has num_threads workers. "separate" gives
+// each stream its own buffered decoder thread and pool of num_threads
+// workers, as every ring did before the service. A consumer thread
+// presents a frame of every stream at fps, first stream at a higher
+// priority, and counts the vsyncs a stream had no new frame for. Then
+// the streams are consumed as fast as they decode to measure throughput.
+// The frames handed out by the service have to match decoding the file
+// on one thread.
+
+#include "decode_service.h"
+#include "decoder.h"
+#include "frame_hash.h"
+#include "mptc_reader.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef MPTC::ServiceClock Clock;
+
+static const uint8_t kBufferSize = 4;
+
+// Hashes of the first num_frames frames, wrapping around like the rings
+static bool ReferenceHashes(const std::string &path, uint32_t num_frames, uint32_t *num_blocks,
+                            std::vector<uint64_t> *hashes) {
+  MPTC::MappedSource source;
+  MPTC::Decoder decoder;
+  if (!source.Open(path) || !decoder.Open(source))
+    return false;
+
+  *num_blocks = decoder.NumBlocks();
+  std::vector<PhysicalDXTBlock> prev(decoder.NumBlocks()), curr(decoder.NumBlocks());
+  for (uint32_t frame = 0; frame < num_frames; frame++) {
+    decoder.DecodeFrame(frame == 0 ? NULL : prev.data(), curr.data());
+    hashes->push_back(MPTC::HashFrame(curr.data(), decoder.NumBlocks()));
+    std::swap(prev, curr);
+  }
+  return true;
+}
+
+struct RunResult {
+  uint64_t frames_decoded;
+  uint64_t misses, priority_misses;
+  uint64_t vsyncs;
+  double elapsed_s;
+  uint64_t steals;
+};
+
+// Interface over both ways of running the streams
+class Player {
+ public:
+  virtual ~Player() { }
+  virtual void SetDeadline(uint32_t stream, Clock::time_point deadline) = 0;
+  virtual bool GetFrame(uint32_t stream, PhysicalDXTBlock * &frame) = 0;
+  virtual uint64_t FramesDecoded() = 0;
+  virtual uint64_t Steals() = 0;
+};
+
+class SharedPlayer : public Player {
+ public:
+  SharedPlayer(std::vector<std::unique_ptr<MPTC::MappedSource> > &sources, uint32_t num_threads)
+    : _service(num_threads) {
+    for (size_t stream = 0; stream < sources.size(); stream++)
+      _ids.push_back(_service.AddStream(*sources[stream], kBufferSize, stream == 0 ? 1 : 0));
+    for (size_t stream = 0; stream < sources.size(); stream++)
+      _service.WaitForFrames(_ids[stream], kBufferSize - 1);
+  }
+
+  void SetDeadline(uint32_t stream, Clock::time_point deadline) { _service.SetDeadline(_ids[stream], deadline); }
+
+  bool GetFrame(uint32_t stream, PhysicalDXTBlock * &frame) {
+    return _service.GetFrame(_ids[stream], frame) == kMPTCFrameReady;
+  }
+
+  uint64_t FramesDecoded() {
+    MPTC::ServiceStats stats;
+    _service.GetStats(&stats);
+    return stats.frames_decoded;
+  }
+
+  uint64_t Steals() { return _service.Pool().NumSteals(); }
+
+ private:
+  MPTC::DecodeService _service;
+  std::vector<MPTC::DecodeService::StreamId> _ids;
+};
+
+class SeparatePlayer : public Player {
+ public:
+  SeparatePlayer(std::vector<std::unique_ptr<MPTC::MappedSource> > &sources, uint32_t num_blocks,
+                 uint32_t num_threads) : _rings(sources.size(), NULL) {
+    for (size_t stream = 0; stream < sources.size(); stream++)
+      InitBufferedDecode(kBufferSize, _rings[stream], *sources[stream], num_blocks, num_threads);
+  }
+
+  ~SeparatePlayer() {
+    for (auto &ring : _rings)
+      DestroyBufferedDecode(ring);
+  }
+
+  void SetDeadline(uint32_t, Clock::time_point) { }
+
+  bool GetFrame(uint32_t stream, PhysicalDXTBlock * &frame) {
+    return GetBufferedFrame(_rings[stream], frame) == kMPTCFrameReady;
+  }
+
+  uint64_t FramesDecoded() {
+    uint64_t frames_decoded = 0;
+    for (auto &ring : _rings)
+      frames_decoded += ring->frames_decoded.load(std::memory_order_relaxed);
+    return frames_decoded;
+  }
+
+  uint64_t Steals() { return 0; }
+
+ private:
+  std::vector<BufferStruct *> _rings;
+};
+
+// Presents a frame of every stream at fps, or as fast as they come with
+// fps == 0. Checks the frames against the reference while it goes.
+static bool Play(Player &player, uint32_t num_streams, uint32_t num_blocks, double seconds, double fps,
+                 const std::vector<uint64_t> &reference, RunResult *result) {
+  std::vector<uint64_t> frames_shown(num_streams, 0);
+  result->misses = 0;
+  result->priority_misses = 0;
+  result->vsyncs = 0;
+
+  uint64_t decoded_at_start = player.FramesDecoded();
+  Clock::time_point start = Clock::now();
+  Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+  Clock::duration period = fps > 0.0 ?
+    std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps)) : Clock::duration(0);
+
+  Clock::time_point vsync = start + period;
+  while (vsync < end) {
+    for (uint32_t stream = 0; stream < num_streams; stream++)
+      player.SetDeadline(stream, vsync);
+    if (fps > 0.0)
+      std::this_thread::sleep_until(vsync);
+
+    uint32_t num_ready = 0;
+    for (uint32_t stream = 0; stream < num_streams; stream++) {
+      PhysicalDXTBlock *frame;
+      if (!player.GetFrame(stream, frame)) {
+        if (fps > 0.0) {
+          result->misses++;
+          if (stream == 0)
+            result->priority_misses++;
+        }
+        continue;
+      }
+
+      num_ready++;
+      uint64_t frame_idx = frames_shown[stream]++;
+      if (frame_idx < reference.size() && MPTC::HashFrame(frame, num_blocks) != reference[frame_idx]) {
+        std::cerr << "Error stream " << stream << " frame " << frame_idx << " differs from a serial decode"
+                  << std::endl;
+        return false;
+      }
+    }
+
+    if (fps > 0.0) {
+      vsync += period;
+      result->vsyncs++;
+    }
+    else {
+      if (num_ready == 0)
+        std::this_thread::yield();
+      vsync = Clock::now();
+    }
+  }
+
+  result->elapsed_s = std::chrono::duration<double>(Clock::now() - start).count();
+  result->frames_decoded = player.FramesDecoded() - decoded_at_start;
+  result->steals = player.Steals();
+  return true;
+}
+
+static bool RunStreams(const std::string &path, uint32_t num_streams, double seconds, uint32_t num_threads,
+                       double fps, uint32_t num_blocks, uint64_t frame_pixels,
+                       const std::vector<uint64_t> &reference) {
+  for (int is_shared = 1; is_shared >= 0; is_shared--) {
+    for (int is_paced = 1; is_paced >= 0; is_paced--) {
+      std::vector<std::unique_ptr<MPTC::MappedSource> > sources;
+      for (uint32_t stream = 0; stream < num_streams; stream++) {
+        sources.push_back(std::unique_ptr<MPTC::MappedSource>(new MPTC::MappedSource));
+        if (!sources.back()->Open(path)) {
+          std::cerr << "Error opening " << path << std::endl;
+          return false;
+        }
+      }
+
+      std::unique_ptr<Player> player;
+      if (is_shared)
+        player.reset(new SharedPlayer(sources, num_threads));
+      else
+        player.reset(new SeparatePlayer(sources, num_blocks, num_threads));
+
+      RunResult result;
+      if (!Play(*player, num_streams, num_blocks, seconds, is_paced ? fps : 0.0, reference, &result))
+        return false;
+
+      double frames_per_second = result.frames_decoded / result.elapsed_s;
+      printf("%2u streams %-8s %-6s %8.1f frames/s  %8.1f Mpix/s", num_streams, is_shared ? "shared" : "separate",
+             is_paced ? "paced" : "max", frames_per_second, frames_per_second * frame_pixels / 1.0e6);
+      if (is_paced) {
+        printf("  missed %5.1f%% (priority stream %5.1f%%)",
+               100.0 * result.misses / std::max<uint64_t>(1, result.vsyncs * num_streams),
+               100.0 * result.priority_misses / std::max<uint64_t>(1, result.vsyncs));
+      }
+      if (is_shared)
+        printf("  steals %llu", static_cast<unsigned long long>(result.steals));
+      printf("\n");
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <file.mpt> [seconds] [num_threads] [fps]" << std::endl;
+    return 1;
+  }
+
+  std::string path(argv[1]);
+  double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+  uint32_t num_threads = argc > 3 ? static_cast<uint32_t>(atoi(argv[3])) : 0;
+  double fps = argc > 4 ? atof(argv[4]) : 30.0;
+
+  MPTC::MappedSource source;
+  MPTC::Decoder decoder;
+  if (!source.Open(path) || !decoder.Open(source)) {
+    std::cerr << "Error opening " << path << std::endl;
+    return 1;
+  }
+  uint32_t total_frames = decoder.TotalFrameCount();
+  uint32_t frame_height = decoder.FrameHeight(), frame_width = decoder.FrameWidth();
+  uint64_t frame_pixels = static_cast<uint64_t>(frame_height) * frame_width;
+  decoder.Close();
+
+  // The rings loop over the file, one lap is checked
+  uint32_t num_blocks;
+  std::vector<uint64_t> reference;
+  if (!ReferenceHashes(path, total_frames, &num_blocks, &reference)) {
+    std::cerr << "Error decoding " << path << std::endl;
+    return 1;
+  }
+
+  uint32_t hardware_threads = num_threads != 0 ? num_threads : std::thread::hardware_concurrency();
+  printf("%s: %ux%u, %u frames, %u threads per pool, %.0f fps\n", path.c_str(), frame_width, frame_height,
+         total_frames, hardware_threads, fps);
+
+  const uint32_t kStreamCounts[] = { 1, 4, 16 };
+  for (uint32_t num_streams : kStreamCounts) {
+    if (!RunStreams(path, num_streams, seconds, num_threads, fps, num_blocks, frame_pixels, reference))
+      return 1;
+  }
+  return 0;
+}
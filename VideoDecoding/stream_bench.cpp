@@ -0,0 +1,299 @@
+// Streams a sequence of texture files through a FrameStreamer, headless.
+//
+// Usage: stream_bench [seconds] [num_threads] [decode_ms] [lookahead]
+//
+// Writes a sequence of frame files, each filled with a pattern of its
+// index, and plays it at one frame per 70 ms, as RenderModel does, to a
+// consumer that asks for a frame at every 90 Hz vsync. Time comes from a
+// fake clock that advances by exactly one vsync per call, so the frames due
+// do not depend on how well the consumer keeps its schedule. The loader
+// reads a file and then sleeps decode_ms for the decode, such as a CRN
+// unpack. A fake upload sink takes the frames, checks every byte and
+// releases each buffer two vsyncs later, as a fence would.
+//
+// A run fails, and the bench exits with 1, when a frame has a wrong byte,
+// when the streamer holds a different number of buffers than the sink has
+// in flight, or when a buffer is still held after the sink let go of all
+// of them.
+//
+// "inline" loads the due frame on the render thread, as RenderModel did
+// before the streamer, the other runs go through a FrameStreamer. The
+// render thread time is what the consumer spends per vsync outside of the
+// sink's checks, a vsync is missed when that is longer than the vsync.
+
+#include "frame_streamer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef MPTC::PlaybackClock Clock;
+
+static const uint32_t kNumFrames = 24;
+static const size_t kFrameSize = 1 << 20;
+static const double kFrameMs = 70.0;
+static const double kVsyncHz = 90.0;
+static const uint32_t kFenceVsyncs = 2;
+
+static uint8_t PatternByte(uint32_t frame_idx, size_t offset) {
+  return static_cast<uint8_t>((frame_idx * 131 + offset * 7 + (offset >> 12)) & 0xFF);
+}
+
+static bool WriteFrames(const MPTC::FileSequence &files) {
+  std::vector<uint8_t> frame(kFrameSize);
+  for (uint32_t frame_idx = 0; frame_idx < kNumFrames; frame_idx++) {
+    for (size_t i = 0; i < frame.size(); i++)
+      frame[i] = PatternByte(frame_idx, i);
+    std::string path = files.Path(frame_idx);
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp || fwrite(frame.data(), 1, frame.size(), fp) != frame.size()) {
+      std::cerr << "Error writing " << path << std::endl;
+      if (fp)
+        fclose(fp);
+      return false;
+    }
+    fclose(fp);
+  }
+  return true;
+}
+
+// Reads the file and stands in for decoding it
+class SlowLoader : public MPTC::FrameLoader {
+ public:
+  SlowLoader(const MPTC::FileSequence &files, double decode_ms) : _reader(files), _decode_ms(decode_ms) { }
+
+  size_t Load(uint32_t frame_idx, uint8_t *dst, size_t dst_size, MPTC::FrameLoadStats *stats) {
+    size_t size = _reader.Load(frame_idx, dst, dst_size, stats);
+    if (size == 0)
+      return 0;
+    Clock::time_point start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(_decode_ms));
+    stats->decode_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    return size;
+  }
+
+ private:
+  MPTC::RawFileLoader _reader;
+  double _decode_ms;
+};
+
+// Takes the frames the render thread would upload and hands their buffers
+// back once the fake fence of the upload has passed
+class UploadSink {
+ public:
+  UploadSink() : _is_ok(true), _frames(0) { }
+
+  void Upload(const MPTC::StagedFrame &frame, uint64_t vsync) {
+    _is_ok = _is_ok && CheckFrame(frame.frame_idx, frame.data, frame.size);
+    _frames++;
+    _in_flight.push_back(std::make_pair(frame, vsync + kFenceVsyncs));
+  }
+
+  void Retire(MPTC::FrameStreamer *streamer, uint64_t vsync) {
+    while (!_in_flight.empty() && _in_flight.front().second <= vsync) {
+      streamer->Release(_in_flight.front().first);
+      _in_flight.pop_front();
+    }
+  }
+
+  // Every buffer the streamer handed out has to be in flight here
+  bool CheckHeld(const MPTC::FrameStreamer &streamer, uint64_t vsync) {
+    MPTC::FrameStreamerStats stats;
+    streamer.GetStats(&stats);
+    if (stats.buffers_held != _in_flight.size()) {
+      std::cerr << "Error the streamer holds " << stats.buffers_held << " buffers at vsync " << vsync << ", "
+                << _in_flight.size() << " are in flight" << std::endl;
+      _is_ok = false;
+    }
+    return _is_ok;
+  }
+
+  bool CheckFrame(uint32_t frame_idx, const uint8_t *data, size_t size) {
+    if (size != kFrameSize) {
+      std::cerr << "Error frame " << frame_idx << " has " << size << " bytes" << std::endl;
+      return false;
+    }
+    for (size_t i = 0; i < size; i++) {
+      if (data[i] != PatternByte(frame_idx, i)) {
+        std::cerr << "Error frame " << frame_idx << " differs at byte " << i << std::endl;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool IsOk() const { return _is_ok; }
+  uint64_t Frames() const { return _frames; }
+
+ private:
+  bool _is_ok;
+  uint64_t _frames;
+  std::deque<std::pair<MPTC::StagedFrame, uint64_t> > _in_flight;
+};
+
+struct RunResult {
+  MPTC::FrameStreamerStats stats;
+  uint64_t vsyncs;
+  double render_ms;
+  double max_render_ms;
+  uint64_t missed_vsyncs;
+};
+
+static Clock::duration Period(double ms) {
+  return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(ms));
+}
+
+static double Ms(Clock::duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+static uint64_t DueFrame(Clock::time_point now, Clock::time_point start) {
+  return now <= start ? 0 : static_cast<uint64_t>((now - start) / Period(kFrameMs));
+}
+
+// Loads every frame that comes due on the render thread
+static bool PlayInline(MPTC::FrameLoader *loader, double seconds, RunResult *result) {
+  MPTC::FrameStreamerStats &stats = result->stats;
+  stats = MPTC::FrameStreamerStats();
+  UploadSink sink;
+  std::vector<uint8_t> buffer(kFrameSize);
+  uint64_t num_vsyncs = static_cast<uint64_t>(seconds * kVsyncHz);
+  Clock::time_point real_start = Clock::now();
+  Clock::time_point fake_start = Clock::time_point();
+  bool has_shown = false;
+  uint64_t shown_frame = 0;
+  for (uint64_t vsync = 0; vsync < num_vsyncs; vsync++) {
+    std::this_thread::sleep_until(real_start + Period(1000.0 * vsync / kVsyncHz));
+    Clock::time_point now = fake_start + Period(1000.0 * vsync / kVsyncHz);
+
+    Clock::time_point render_start = Clock::now();
+    uint64_t due = DueFrame(now, fake_start);
+    size_t size = 0;
+    uint32_t frame_idx = static_cast<uint32_t>(due % kNumFrames);
+    if (!has_shown || due > shown_frame) {
+      if (has_shown)
+        stats.frames_skipped += due - shown_frame - 1;
+      MPTC::FrameLoadStats load = { 0, 0 };
+      size = loader->Load(frame_idx, buffer.data(), buffer.size(), &load);
+      stats.frames_loaded++;
+      stats.read_ns += load.read_ns;
+      stats.decode_ns += load.decode_ns;
+      stats.frames_shown++;
+      has_shown = true;
+      shown_frame = due;
+    }
+    double render_ms = Ms(Clock::now() - render_start);
+    result->render_ms += render_ms;
+    result->max_render_ms = std::max(result->max_render_ms, render_ms);
+    result->missed_vsyncs += render_ms > 1000.0 / kVsyncHz ? 1 : 0;
+    result->vsyncs++;
+
+    if (size > 0 && !sink.CheckFrame(frame_idx, buffer.data(), size))
+      return false;
+  }
+  return true;
+}
+
+static bool PlayStreamed(MPTC::FrameLoader *loader, double seconds, uint32_t num_threads, uint32_t lookahead,
+                         RunResult *result) {
+  // Room for the lookahead, the frame shown and the uploads still in flight
+  MPTC::MemoryStagingBuffers staging(lookahead + 1 + kFenceVsyncs, kFrameSize);
+  MPTC::FrameStreamer streamer;
+  UploadSink sink;
+  Clock::time_point fake_start = Clock::time_point();
+  streamer.Start(loader, &staging, kNumFrames, kFrameMs, lookahead, num_threads, fake_start);
+
+  uint64_t num_vsyncs = static_cast<uint64_t>(seconds * kVsyncHz);
+  Clock::time_point real_start = Clock::now();
+  for (uint64_t vsync = 0; vsync < num_vsyncs; vsync++) {
+    std::this_thread::sleep_until(real_start + Period(1000.0 * vsync / kVsyncHz));
+    Clock::time_point now = fake_start + Period(1000.0 * vsync / kVsyncHz);
+
+    Clock::time_point render_start = Clock::now();
+    sink.Retire(&streamer, vsync);
+    MPTC::StagedFrame frame;
+    bool is_new = streamer.GetFrame(now, &frame) == kMPTCFrameReady;
+    double render_ms = Ms(Clock::now() - render_start);
+    result->render_ms += render_ms;
+    result->max_render_ms = std::max(result->max_render_ms, render_ms);
+    result->missed_vsyncs += render_ms > 1000.0 / kVsyncHz ? 1 : 0;
+    result->vsyncs++;
+
+    if (is_new)
+      sink.Upload(frame, vsync);
+    if (!sink.CheckHeld(streamer, vsync))
+      break;
+  }
+  streamer.Stop();
+
+  // Let the last uploads finish, after which nothing may be held
+  sink.Retire(&streamer, num_vsyncs + kFenceVsyncs);
+  streamer.GetStats(&result->stats);
+  if (result->stats.buffers_held != 0) {
+    std::cerr << "Error " << result->stats.buffers_held << " buffers were never released" << std::endl;
+    return false;
+  }
+  if (result->stats.frames_shown == 0) {
+    std::cerr << "Error no frame was shown" << std::endl;
+    return false;
+  }
+  return sink.IsOk() && sink.Frames() == result->stats.frames_shown;
+}
+
+int main(int argc, char **argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 3.0;
+  uint32_t num_threads = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 2;
+  double decode_ms = argc > 3 ? atof(argv[3]) : 40.0;
+  uint32_t lookahead = argc > 4 ? static_cast<uint32_t>(atoi(argv[4])) : 4;
+
+  MPTC::FileSequence files;
+  files.prefix = "stream_bench_frame";
+  files.suffix = ".bin";
+  files.first_number = 1;
+  files.num_digits = 3;
+  if (!WriteFrames(files))
+    return 1;
+  SlowLoader loader(files, decode_ms);
+
+  printf("%u frames of %zu KiB every %.0f ms, %.1f ms decode, %.0f Hz vsync\n", kNumFrames, kFrameSize >> 10,
+         kFrameMs, decode_ms, kVsyncHz);
+
+  bool is_ok = true;
+  for (int run = 0; run < 3 && is_ok; run++) {
+    RunResult result = RunResult();
+    char name[64];
+    if (run == 0) {
+      snprintf(name, sizeof(name), "inline");
+      is_ok = PlayInline(&loader, seconds, &result);
+    }
+    else {
+      // The second streamed run has a single thread and no lookahead
+      uint32_t run_threads = run == 1 ? num_threads : 1;
+      uint32_t run_lookahead = run == 1 ? lookahead : 1;
+      snprintf(name, sizeof(name), "stream %ut/%u", run_threads, run_lookahead);
+      is_ok = PlayStreamed(&loader, seconds, run_threads, run_lookahead, &result);
+    }
+    if (!is_ok)
+      break;
+
+    const MPTC::FrameStreamerStats &stats = result.stats;
+    double loads = static_cast<double>(std::max<uint64_t>(1, stats.frames_loaded));
+    printf("%-12s shown %4llu dropped %3llu skipped %3llu late %5.1f%%  render thread avg %6.3f ms max %6.2f ms"
+           " missed %3llu vsyncs  read %5.2f ms decode %5.2f ms per load\n", name,
+           (unsigned long long)stats.frames_shown, (unsigned long long)stats.frames_dropped,
+           (unsigned long long)stats.frames_skipped, 100.0 * stats.late_calls / std::max<uint64_t>(1, result.vsyncs),
+           result.render_ms / std::max<uint64_t>(1, result.vsyncs), result.max_render_ms,
+           (unsigned long long)result.missed_vsyncs,
+           stats.read_ns / loads / 1e6, stats.decode_ns / loads / 1e6);
+  }
+
+  for (uint32_t frame_idx = 0; frame_idx < kNumFrames; frame_idx++)
+    remove(files.Path(frame_idx).c_str());
+  return is_ok ? 0 : 1;
+}
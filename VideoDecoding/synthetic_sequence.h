@@ -0,0 +1,62 @@
+#ifndef __MPTC_SYNTHETIC_SEQUENCE_H__
+#define __MPTC_SYNTHETIC_SEQUENCE_H__
+
+#include "decoder.h"
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace MPTC {
+
+// Frames to encode when there are no files at hand, as mptc_encode
+// --synthetic and the tests do: a striped world of smooth endpoints and a
+// small set of interpolation words that pans one block per frame, with 1/64
+// of the interpolation words replaced at random in every frame, so that
+// both the motion search and the dictionaries have work to do. The same
+// sizes always give the same frames.
+class SyntheticSequence {
+ public:
+  SyntheticSequence(uint32_t blocks_height, uint32_t blocks_width)
+    : _blocks_height(blocks_height), _blocks_width(blocks_width),
+      _world_width(blocks_width + 256), _rng(1234) {
+    std::uniform_int_distribution<uint32_t> interp_dist;
+    std::vector<uint32_t> interps(64);
+    for (uint32_t &interp : interps)
+      interp = interp_dist(_rng);
+
+    _world.resize(_world_width * blocks_height);
+    for (uint32_t y = 0; y < blocks_height; y++) {
+      for (uint32_t x = 0; x < _world_width; x++) {
+        PhysicalDXTBlock &block = _world[y * _world_width + x];
+        uint32_t r = (x / 8 + y / 16) % 32, g = (x / 4 + y / 8) % 64, b = (y / 4) % 32;
+        block.ep1 = static_cast<uint16_t>((r << 11) | (g << 5) | b);
+        block.ep2 = static_cast<uint16_t>(((31 - r) << 11) | ((63 - g) << 5) | (31 - b));
+        block.interp = interps[(x / 3 + y / 5) % interps.size()];
+      }
+    }
+  }
+
+  // Frames have to be generated in order, the changed blocks come from one
+  // random sequence
+  void Generate(uint32_t frame_idx, PhysicalDXTBlock *frame) {
+    uint32_t offset = frame_idx % (_world_width - _blocks_width);
+    for (uint32_t y = 0; y < _blocks_height; y++)
+      memcpy(frame + y * _blocks_width, &_world[y * _world_width + offset], _blocks_width * sizeof(PhysicalDXTBlock));
+
+    std::uniform_int_distribution<uint32_t> block_dist(0, _blocks_height * _blocks_width - 1);
+    std::uniform_int_distribution<uint32_t> interp_dist;
+    for (uint32_t change = 0; change < _blocks_height * _blocks_width / 64; change++)
+      frame[block_dist(_rng)].interp = interp_dist(_rng);
+  }
+
+ private:
+  uint32_t _blocks_height, _blocks_width, _world_width;
+  std::vector<PhysicalDXTBlock> _world;
+  std::mt19937 _rng;
+};
+
+}  // namespace MPTC
+
+#endif  // __MPTC_SYNTHETIC_SEQUENCE_H__
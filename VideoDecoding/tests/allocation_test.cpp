@@ -0,0 +1,139 @@
+// Steady state decoding has to run without heap allocations. The test
+// replaces the global operator new to count allocations, which is why it
+// is an executable of its own, and checks that an MPTC::Decoder, once
+// warmed up, decodes and seeks without any, on one thread and on the pool,
+// from a stream and from a mapped file.
+
+#include "mptc_test_util.h"
+
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+
+// Allocation counting hook, every C++ allocation of the process goes
+// through here. The decoder itself only mallocs when it opens a file.
+static std::atomic<uint64_t> g_num_allocations(0);
+
+// Once the replacements are inlined GCC sees free() on memory from
+// operator new, which is what they are meant to do
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(size_t sz) {
+  g_num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void *ptr = malloc(sz == 0 ? 1 : sz);
+  if (ptr == NULL)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void *operator new[](size_t sz) {
+  return operator new(sz);
+}
+
+void operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+  free(ptr);
+}
+
+namespace {
+
+const uint32_t kNumFrames = 40;
+const uint32_t kUniqueInterval = 8;
+const uint32_t kNumThreads = 4;
+
+// Decodes every frame after a warm up of one unique interval, then seeks to
+// every key frame, and returns the number of allocations made after the
+// warm up
+uint64_t CountDecodeAllocations(MPTC::ByteSource &source, bool multi_thread) {
+  std::vector<MPTC::FrameIndexEntry> index;
+  EXPECT_EQ(0, BuildFrameIndex(source, &index));
+
+  MPTC::Decoder decoder;
+  EXPECT_TRUE(decoder.Open(source, multi_thread ? kNumThreads : 1));
+
+  MPTC::test::Frame frames[2] = { MPTC::test::Frame(decoder.NumBlocks()), MPTC::test::Frame(decoder.NumBlocks()) };
+  uint32_t warm_up = decoder.DecodeInfo().unique_interval;
+  uint64_t num_allocations = 0;
+  for (uint32_t frame = 0; frame < decoder.TotalFrameCount(); frame++) {
+    if (frame == warm_up)
+      num_allocations = g_num_allocations.load();
+
+    PhysicalDXTBlock *prev_dxt = frame == 0 ? NULL : frames[(frame - 1) % 2].data();
+    PhysicalDXTBlock *curr_dxt = frames[frame % 2].data();
+    if (multi_thread)
+      decoder.DecodeFrameMultiThread(prev_dxt, curr_dxt);
+    else
+      decoder.DecodeFrame(prev_dxt, curr_dxt);
+  }
+
+  for (uint32_t frame = 0; frame < index.size(); frame++) {
+    if (index[frame].flags & MPTC::kFrameIndexFlag_Key)
+      decoder.Seek(index, frame, frames[0].data(), frames[1].data());
+  }
+  return g_num_allocations.load() - num_allocations;
+}
+
+class AllocationTest : public ::testing::TestWithParam<MPTC::EntropyCodecType> {
+ protected:
+  void SetUp() {
+    MPTC::EncoderOptions options;
+    options.unique_interval = kUniqueInterval;
+    options.tile_rows = 64;
+    options.codec = GetParam();
+    options.key_interval = 5;
+    options.write_index = false;
+    std::string path = GetParam() == MPTC::eEntropyCodec_Rans ? "allocation_rans.mpt" : "allocation_arith.mpt";
+    ASSERT_TRUE(_clip.Encode(path, 512, 256, kNumFrames, options));
+  }
+
+  MPTC::test::EncodedClip _clip;
+};
+
+TEST_P(AllocationTest, Serial) {
+  std::ifstream in_stream(_clip.path.c_str(), std::ios::binary);
+  ASSERT_TRUE(in_stream.is_open());
+  MPTC::StreamSource source(in_stream);
+  EXPECT_EQ(0u, CountDecodeAllocations(source, false));
+}
+
+TEST_P(AllocationTest, Pool) {
+  std::ifstream in_stream(_clip.path.c_str(), std::ios::binary);
+  ASSERT_TRUE(in_stream.is_open());
+  MPTC::StreamSource source(in_stream);
+  EXPECT_EQ(0u, CountDecodeAllocations(source, true));
+}
+
+TEST_P(AllocationTest, Mapped) {
+  MPTC::MappedSource source;
+  ASSERT_TRUE(source.Open(_clip.path));
+  EXPECT_EQ(0u, CountDecodeAllocations(source, true));
+}
+
+// The hook has to see the allocations, or the tests above prove nothing
+TEST(AllocationHookTest, CountsAllocations) {
+  uint64_t num_allocations = g_num_allocations.load();
+  void *ptr = operator new(16);
+  EXPECT_EQ(num_allocations + 1, g_num_allocations.load());
+  operator delete(ptr);
+}
+
+INSTANTIATE_TEST_CASE_P(Codecs, AllocationTest,
+                        ::testing::Values(MPTC::eEntropyCodec_Arithmetic, MPTC::eEntropyCodec_Rans));
+
+}  // namespace
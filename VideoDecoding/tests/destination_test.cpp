@@ -0,0 +1,93 @@
+// The buffered decoder against a MemoryDestination with a row pitch wider
+// than the frame, the stand-in for mapped upload memory. Every frame has
+// to match the linear decode, leave the padding of its rows alone and
+// reach the consumer without a copy.
+
+#include "frame_destination.h"
+#include "mptc_test_util.h"
+
+#include "gtest/gtest.h"
+
+#include <thread>
+
+namespace {
+
+const uint32_t kNumFrames = 20;
+const uint32_t kNumSlots = 4;
+const uint32_t kPaddingBlocks = 16;
+const uint8_t kPadding = 0xCD;
+
+class DestinationTest : public ::testing::TestWithParam<uint32_t> {
+ protected:
+  void SetUp() {
+    MPTC::EncoderOptions options;
+    options.unique_interval = 8;
+    options.tile_rows = 64;
+    options.codec = MPTC::eEntropyCodec_Rans;
+    options.write_index = false;
+    ASSERT_TRUE(_clip.Encode("destination.mpt", 512, 256, kNumFrames, options));
+    ASSERT_TRUE(_source.Open(_clip.path));
+
+    _blocks_height = _clip.frame_height / 4;
+    _blocks_width = _clip.frame_width / 4;
+    _row_sz = _blocks_width * sizeof(PhysicalDXTBlock);
+    _row_pitch = static_cast<uint32_t>(_row_sz + kPaddingBlocks * sizeof(PhysicalDXTBlock));
+  }
+
+  MPTC::test::EncodedClip _clip;
+  MPTC::MappedSource _source;
+  uint32_t _blocks_height, _blocks_width;
+  size_t _row_sz;
+  uint32_t _row_pitch;
+};
+
+TEST_P(DestinationTest, DirectDecodeCopiesNothing) {
+  MPTC::MemoryDestination destination(kNumSlots, static_cast<size_t>(_blocks_height) * _row_pitch, _row_pitch);
+  memset(destination.Data(), kPadding, destination.NumSlots() * destination.SlotSize());
+
+  BufferStruct *ring = NULL;
+  ASSERT_EQ(0, InitBufferedDecode(ring, _source, destination, GetParam()));
+  for (uint32_t frame = 0; frame < kNumFrames; frame++) {
+    PhysicalDXTBlock *curr_dxt = NULL;
+    while (GetBufferedFrame(ring, curr_dxt) != kMPTCFrameReady)
+      std::this_thread::yield();
+
+    // The frame is handed out where it was decoded, in the destination
+    const uint8_t *slot = reinterpret_cast<const uint8_t*>(destination.Slot(ring->curr_dxt_idx));
+    ASSERT_EQ(slot, reinterpret_cast<const uint8_t*>(curr_dxt)) << "frame " << frame;
+
+    for (uint32_t row = 0; row < _blocks_height; row++) {
+      const uint8_t *src = slot + static_cast<size_t>(row) * _row_pitch;
+      ASSERT_EQ(0, memcmp(src, _clip.reconstructions[frame].data() + row * _blocks_width, _row_sz))
+        << "frame " << frame << " row " << row;
+      for (size_t pad = _row_sz; pad < _row_pitch; pad++)
+        ASSERT_EQ(kPadding, src[pad]) << "frame " << frame << " row " << row << " byte " << pad;
+    }
+  }
+  DestroyBufferedDecode(ring);
+  EXPECT_EQ(0u, destination.BytesCopied());
+}
+
+TEST_P(DestinationTest, CopyFrameCountsBytes) {
+  MPTC::MemoryDestination destination(kNumSlots, static_cast<size_t>(_blocks_height) * _row_pitch, _row_pitch);
+
+  BufferStruct *ring = NULL;
+  ASSERT_EQ(0, InitBufferedDecode(ring, _source, destination, GetParam()));
+  MPTC::test::Frame upload(_clip.NumBlocks());
+  for (uint32_t frame = 0; frame < kNumFrames; frame++) {
+    PhysicalDXTBlock *curr_dxt = NULL;
+    while (GetBufferedFrame(ring, curr_dxt) != kMPTCFrameReady)
+      std::this_thread::yield();
+
+    destination.CopyFrame(ring->curr_dxt_idx, _blocks_height, _blocks_width, upload.data());
+    ASSERT_EQ(-1, MPTC::test::FirstDifference(upload.data(), _clip.reconstructions[frame].data(), _clip.NumBlocks()))
+      << "frame " << frame;
+  }
+  DestroyBufferedDecode(ring);
+  EXPECT_EQ(static_cast<uint64_t>(kNumFrames) * _clip.NumBlocks() * sizeof(PhysicalDXTBlock),
+            destination.BytesCopied());
+}
+
+INSTANTIATE_TEST_CASE_P(Threads, DestinationTest, ::testing::Values(1u, 4u));
+
+}  // namespace
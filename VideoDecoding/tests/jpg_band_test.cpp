@@ -0,0 +1,171 @@
+// Band decoding of baseline JPGs with restart markers, see
+// stbi_jpeg_bands_decode in stb_image.h, against stbi_load. The images in
+// tests/data are small baseline JPGs written by libjpeg, named after their
+// restart interval and chroma subsampling: a marker at the start of every
+// MCU row, every 2 rows, or every N MCUs, which doesn't line up with the
+// rows, so that bands only start every few rows. Sizes are odd so that the
+// last MCU row and column are partial. no_rst_420.jpg has no DRI at all
+// and can't be split, it goes through stb alone.
+
+#include "thread_pool.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct JPGCase {
+  const char *file;
+  int comp;
+  int band_rows;  // rows between the MCU rows a band can start on, 0 if the image can't be split
+};
+
+std::ostream &operator<<(std::ostream &os, const JPGCase &jpg) {
+  return os << jpg.file;
+}
+
+const JPGCase kJPGCases[] = {
+  { "rst_row_444.jpg",     3, 1 },
+  { "rst_row_422.jpg",     3, 1 },
+  { "rst_row_420_odd.jpg", 3, 1 },
+  { "rst_row_grey.jpg",    1, 1 },
+  { "rst_row_tiny.jpg",    3, 1 },
+  { "rst_2rows_420.jpg",   3, 2 },
+  { "rst_4mcu_420.jpg",    3, 2 },  // 10 MCUs per row
+  { "rst_15mcu_420.jpg",   3, 3 },
+  { "rst_5mcu_444.jpg",    3, 5 },  // 17 MCUs per row
+  { "rst_6mcu_422.jpg",    3, 3 },  // 10 MCUs per row
+  { "rst_3mcu_grey.jpg",   1, 3 },  // 13 MCUs per row
+  { "no_rst_420.jpg",      3, 0 },
+};
+
+class JPGBandTest : public ::testing::TestWithParam<JPGCase> {
+ protected:
+  void SetUp() {
+    std::string path = std::string(MPTC_TEST_DATA_DIR) + "/" + GetParam().file;
+    std::ifstream in_stream(path.c_str(), std::ios::binary);
+    ASSERT_TRUE(in_stream.is_open()) << path;
+    _file.assign(std::istreambuf_iterator<char>(in_stream), std::istreambuf_iterator<char>());
+    ASSERT_FALSE(_file.empty());
+  }
+
+  int Size() const { return static_cast<int>(_file.size()); }
+
+  // What stb decodes on its own
+  std::vector<stbi_uc> Reference(int req_comp, int *x, int *y) {
+    int comp;
+    stbi_uc *pixels = stbi_load_from_memory(_file.data(), Size(), x, y, &comp, req_comp);
+    EXPECT_TRUE(pixels != NULL) << stbi_failure_reason();
+    EXPECT_EQ(GetParam().comp, comp);
+    std::vector<stbi_uc> reference;
+    if (pixels)
+      reference.assign(pixels, pixels + *x * *y * req_comp);
+    stbi_image_free(pixels);
+    return reference;
+  }
+
+  std::vector<stbi_uc> _file;
+};
+
+TEST_P(JPGBandTest, BandsMatchStb) {
+  const JPGCase &jpg = GetParam();
+  int x, y, comp, mcu_rows, band_rows;
+  stbi_jpeg_bands *bands = stbi_jpeg_bands_begin(_file.data(), Size(), &x, &y, &comp, &mcu_rows, &band_rows);
+  if (jpg.band_rows == 0) {
+    EXPECT_TRUE(bands == NULL);
+    return;
+  }
+  ASSERT_TRUE(bands != NULL);
+  EXPECT_EQ(jpg.comp, comp);
+  EXPECT_EQ(jpg.band_rows, band_rows);
+
+  for (int req_comp = 1; req_comp <= 4; req_comp++) {
+    int ref_x, ref_y;
+    std::vector<stbi_uc> reference = Reference(req_comp, &ref_x, &ref_y);
+    ASSERT_EQ(ref_x, x);
+    ASSERT_EQ(ref_y, y);
+
+    // One band for every place a band can start, in reverse so that no band
+    // relies on the one before it, then the whole image as one band
+    std::vector<stbi_uc> pixels(reference.size(), 0xCD);
+    for (int first_row = (mcu_rows - 1) / band_rows * band_rows; first_row >= 0; first_row -= band_rows)
+      ASSERT_TRUE(stbi_jpeg_bands_decode(bands, pixels.data(), req_comp, first_row,
+                                         std::min(first_row + band_rows, mcu_rows))) << "band at " << first_row;
+    EXPECT_TRUE(pixels == reference) << "finest bands, " << req_comp << " components";
+
+    std::fill(pixels.begin(), pixels.end(), 0xCD);
+    ASSERT_TRUE(stbi_jpeg_bands_decode(bands, pixels.data(), req_comp, 0, mcu_rows));
+    EXPECT_TRUE(pixels == reference) << "one band, " << req_comp << " components";
+  }
+
+  // A band that doesn't start on a restart marker is refused
+  if (band_rows > 1) {
+    std::vector<stbi_uc> pixels(x * y * 4);
+    EXPECT_FALSE(stbi_jpeg_bands_decode(bands, pixels.data(), 4, 1, mcu_rows));
+  }
+  stbi_jpeg_bands_end(bands);
+}
+
+// The split Model.cpp's DecodeJPG uses, about two bands per thread, on a pool
+TEST_P(JPGBandTest, PoolMatchesStb) {
+  const JPGCase &jpg = GetParam();
+  int x, y, comp, mcu_rows, band_rows;
+  stbi_jpeg_bands *bands = stbi_jpeg_bands_begin(_file.data(), Size(), &x, &y, &comp, &mcu_rows, &band_rows);
+  int ref_x, ref_y;
+  std::vector<stbi_uc> reference = Reference(4, &ref_x, &ref_y);
+  std::vector<stbi_uc> pixels(reference.size(), 0xCD);
+  if (bands == NULL) {
+    // Without restart markers the frame goes through stb into dst
+    ASSERT_EQ(0, jpg.band_rows);
+    ASSERT_TRUE(stbi_load_from_memory_into_dst(pixels.data(), _file.data(), Size(), &x, &y, &comp, 4) != 0);
+    EXPECT_TRUE(pixels == reference);
+    return;
+  }
+
+  for (uint32_t num_threads = 1; num_threads <= 4; num_threads *= 2) {
+    MPTC::ThreadPool pool(num_threads);
+    const int num_units = (mcu_rows + band_rows - 1) / band_rows;
+    const int num_bands = std::max(1U, pool.NumThreads() * 2);
+    const int rows_per_band = std::max(1, (num_units + num_bands - 1) / num_bands) * band_rows;
+    std::atomic<bool> decoded(true);
+    MPTC::TaskGraph graph;
+    for (int first_row = 0; first_row < mcu_rows; first_row += rows_per_band) {
+      const int end_row = std::min(first_row + rows_per_band, mcu_rows);
+      graph.AddTask([&, first_row, end_row] {
+        if (!stbi_jpeg_bands_decode(bands, pixels.data(), 4, first_row, end_row))
+          decoded = false;
+      });
+    }
+    std::fill(pixels.begin(), pixels.end(), 0xCD);
+    graph.Run(pool);
+    EXPECT_TRUE(decoded) << num_threads << " threads";
+    EXPECT_TRUE(pixels == reference) << num_threads << " threads";
+  }
+  stbi_jpeg_bands_end(bands);
+}
+
+// A truncated file must fail cleanly on both paths rather than crash
+TEST_P(JPGBandTest, TruncatedFails) {
+  _file.resize(_file.size() / 2);
+  int x, y, comp, mcu_rows, band_rows;
+  stbi_jpeg_bands *bands = stbi_jpeg_bands_begin(_file.data(), Size(), &x, &y, &comp, &mcu_rows, &band_rows);
+  EXPECT_TRUE(bands == NULL);
+  stbi_jpeg_bands_end(bands);
+
+  ASSERT_TRUE(stbi_info_from_memory(_file.data(), Size(), &x, &y, &comp) != 0);
+  std::vector<stbi_uc> pixels(x * y * 4);
+  EXPECT_EQ(0, stbi_load_from_memory_into_dst(pixels.data(), _file.data(), Size(), &x, &y, &comp, 4));
+}
+
+INSTANTIATE_TEST_CASE_P(Images, JPGBandTest, ::testing::ValuesIn(kJPGCases));
+
+}  // namespace
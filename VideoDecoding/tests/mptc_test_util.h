@@ -0,0 +1,78 @@
+#ifndef __MPTC_TEST_UTIL_H__
+#define __MPTC_TEST_UTIL_H__
+
+#include "decoder.h"
+#include "encoder.h"
+#include "mptc_reader.h"
+#include "synthetic_sequence.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace MPTC {
+namespace test {
+
+typedef std::vector<PhysicalDXTBlock> Frame;
+
+// A synthetic sequence encoded into a file of the working directory. Holds
+// the frames given to the encoder and the reconstructions it returned,
+// which is what every decode path has to produce. The file and its index
+// are removed again when the clip goes away.
+class EncodedClip {
+ public:
+  EncodedClip() : frame_height(0), frame_width(0) { }
+  ~EncodedClip() {
+    if (!path.empty()) {
+      remove(path.c_str());
+      remove(FrameIndexPath(path).c_str());
+    }
+  }
+
+  bool Encode(const std::string &clip_path, uint32_t height, uint32_t width, uint32_t num_frames,
+              const EncoderOptions &options) {
+    path = clip_path;
+    frame_height = height;
+    frame_width = width;
+    frames.clear();
+    reconstructions.clear();
+
+    Encoder encoder;
+    if (!encoder.Open(path, frame_height, frame_width, options))
+      return false;
+    SyntheticSequence synthetic(frame_height / 4, frame_width / 4);
+    for (uint32_t frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+      frames.push_back(Frame(NumBlocks()));
+      reconstructions.push_back(Frame(NumBlocks()));
+      synthetic.Generate(frame_idx, frames.back().data());
+      encoder.AddFrame(frames.back().data(), reconstructions.back().data());
+    }
+    return encoder.Close();
+  }
+
+  uint32_t NumBlocks() const { return frame_height / 4 * frame_width / 4; }
+
+  std::string path;
+  uint32_t frame_height, frame_width;
+  std::vector<Frame> frames;
+  std::vector<Frame> reconstructions;
+
+ private:
+  EncodedClip(const EncodedClip &);
+  EncodedClip &operator=(const EncodedClip &);
+};
+
+// Index of the first block that differs, or -1
+inline int64_t FirstDifference(const PhysicalDXTBlock *a, const PhysicalDXTBlock *b, uint32_t num_blocks) {
+  for (uint32_t block_idx = 0; block_idx < num_blocks; block_idx++) {
+    if (a[block_idx].dxt_block != b[block_idx].dxt_block)
+      return block_idx;
+  }
+  return -1;
+}
+
+}  // namespace test
+}  // namespace MPTC
+
+#endif  // __MPTC_TEST_UTIL_H__
@@ -0,0 +1,221 @@
+// Encode -> decode round trips over every layout the encoder writes. Each
+// file has to decode, on one thread and on the pool, to exactly the frames
+// the encoder reconstructed, and its sidecar index has to match the one
+// rebuilt from the file.
+
+#include "mptc_test_util.h"
+
+#include "gtest/gtest.h"
+
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+struct LayoutCase {
+  const char *name;
+  uint32_t frame_height, frame_width;
+  uint32_t tile_rows;
+  MPTC::EntropyCodecType codec;
+  bool motion_model;
+  uint32_t key_interval;
+  uint8_t version, flags;
+};
+
+std::ostream &operator<<(std::ostream &os, const LayoutCase &layout) {
+  return os << layout.name;
+}
+
+const LayoutCase kLayouts[] = {
+  { "legacy",       256, 512,  0, MPTC::eEntropyCodec_Arithmetic, false, 0,
+    kMPTCVersionLegacy, 0 },
+  { "tiled",        512, 256, 64, MPTC::eEntropyCodec_Arithmetic, false, 0,
+    kMPTCVersionTiled, kMPTCFlag_Tiled },
+  { "rans",         512, 256, 64, MPTC::eEntropyCodec_Rans, false, 0,
+    kMPTCVersionTiled, kMPTCFlag_Tiled | kMPTCFlag_Rans },
+  { "rans_untiled", 256, 512,  0, MPTC::eEntropyCodec_Rans, false, 0,
+    kMPTCVersionTiled, kMPTCFlag_Rans },
+  { "motion_model", 512, 256, 64, MPTC::eEntropyCodec_Arithmetic, true, 0,
+    kMPTCVersionTiled, kMPTCFlag_Tiled | kMPTCFlag_MotionModel },
+  { "motion_model_rans", 512, 256, 64, MPTC::eEntropyCodec_Rans, true, 0,
+    kMPTCVersionTiled, kMPTCFlag_Tiled | kMPTCFlag_Rans | kMPTCFlag_MotionModel },
+  { "key_frames",   512, 256, 64, MPTC::eEntropyCodec_Rans, false, 5,
+    kMPTCVersionTiled, kMPTCFlag_Tiled | kMPTCFlag_Rans },
+  { "legacy_key_frames", 256, 512, 0, MPTC::eEntropyCodec_Arithmetic, false, 4,
+    kMPTCVersionLegacy, 0 },
+};
+
+const uint32_t kNumFrames = 20;
+const uint32_t kUniqueInterval = 8;
+
+uint64_t FileSize(const std::string &path) {
+  std::ifstream in_stream(path.c_str(), std::ios::binary | std::ios::ate);
+  return static_cast<uint64_t>(in_stream.tellg());
+}
+
+class RoundTripTest : public ::testing::TestWithParam<LayoutCase> {
+ protected:
+  void SetUp() {
+    const LayoutCase &layout = GetParam();
+    MPTC::EncoderOptions options;
+    options.unique_interval = kUniqueInterval;
+    options.tile_rows = layout.tile_rows;
+    options.codec = layout.codec;
+    options.motion_model = layout.motion_model;
+    options.key_interval = layout.key_interval;
+    ASSERT_TRUE(_clip.Encode(std::string("round_trip_") + layout.name + ".mpt", layout.frame_height,
+                             layout.frame_width, kNumFrames, options));
+  }
+
+  MPTC::test::EncodedClip _clip;
+};
+
+TEST_P(RoundTripTest, Header) {
+  const LayoutCase &layout = GetParam();
+  MPTC::MappedSource source;
+  MPTC::Decoder decoder;
+  ASSERT_TRUE(source.Open(_clip.path));
+  ASSERT_TRUE(decoder.Open(source, 1));
+
+  const MPTCDecodeInfo &info = decoder.DecodeInfo();
+  EXPECT_EQ(layout.version, info.version);
+  EXPECT_EQ(layout.flags, info.flags);
+  EXPECT_EQ(layout.frame_height, decoder.FrameHeight());
+  EXPECT_EQ(layout.frame_width, decoder.FrameWidth());
+  EXPECT_EQ(kNumFrames, decoder.TotalFrameCount());
+  EXPECT_EQ(kUniqueInterval, info.unique_interval);
+  if (layout.tile_rows != 0) {
+    EXPECT_EQ(layout.tile_rows, info.tile_rows);
+  }
+}
+
+TEST_P(RoundTripTest, Interpolation) {
+  // The endpoints go through the lossy wavelet, the interpolation words
+  // are coded losslessly
+  ASSERT_EQ(kNumFrames, _clip.reconstructions.size());
+  for (uint32_t frame = 0; frame < kNumFrames; frame++) {
+    for (uint32_t block_idx = 0; block_idx < _clip.NumBlocks(); block_idx++)
+      ASSERT_EQ(_clip.frames[frame][block_idx].interp, _clip.reconstructions[frame][block_idx].interp)
+        << "frame " << frame << " block " << block_idx;
+  }
+}
+
+TEST_P(RoundTripTest, StreamDecode) {
+  std::ifstream in_stream(_clip.path.c_str(), std::ios::binary);
+  ASSERT_TRUE(in_stream.is_open());
+  MPTC::StreamSource source(in_stream);
+
+  MPTCDecodeInfo decode_info;
+  InitDecodeInfo(&decode_info, 1);
+  MPTC::test::Frame frames[2] = { MPTC::test::Frame(_clip.NumBlocks()), MPTC::test::Frame(_clip.NumBlocks()) };
+  for (uint32_t frame = 0; frame < kNumFrames; frame++) {
+    PhysicalDXTBlock *prev_dxt = frame == 0 ? NULL : frames[(frame + 1) % 2].data();
+    PhysicalDXTBlock *curr_dxt = frames[frame % 2].data();
+    GetFrame(source, prev_dxt, curr_dxt, &decode_info);
+    ASSERT_EQ(-1, MPTC::test::FirstDifference(curr_dxt, _clip.reconstructions[frame].data(), _clip.NumBlocks()))
+      << "frame " << frame;
+  }
+  FreeDecodeInfo(&decode_info);
+}
+
+TEST_P(RoundTripTest, MappedMultiThreadDecode) {
+  MPTC::MappedSource source;
+  MPTC::Decoder decoder;
+  ASSERT_TRUE(source.Open(_clip.path));
+  ASSERT_TRUE(decoder.Open(source, 4));
+
+  MPTC::test::Frame prev(_clip.NumBlocks()), curr(_clip.NumBlocks());
+  for (uint32_t frame = 0; frame < kNumFrames; frame++) {
+    decoder.DecodeFrameMultiThread(frame == 0 ? NULL : prev.data(), curr.data());
+    ASSERT_EQ(-1, MPTC::test::FirstDifference(curr.data(), _clip.reconstructions[frame].data(), _clip.NumBlocks()))
+      << "frame " << frame;
+    std::swap(prev, curr);
+  }
+}
+
+TEST_P(RoundTripTest, FrameIndex) {
+  const LayoutCase &layout = GetParam();
+  MPTC::MappedSource source;
+  ASSERT_TRUE(source.Open(_clip.path));
+  std::vector<MPTC::FrameIndexEntry> built;
+  ASSERT_EQ(0, BuildFrameIndex(source, &built));
+  ASSERT_EQ(kNumFrames, built.size());
+
+  for (uint32_t frame = 0; frame < kNumFrames; frame++) {
+    // The first frame has nothing to predict from, with a key interval
+    // every key_interval-th frame is coded without inter blocks too
+    bool is_key = frame == 0 || (layout.key_interval != 0 && frame % layout.key_interval == 0);
+    if (is_key) {
+      EXPECT_TRUE((built[frame].flags & MPTC::kFrameIndexFlag_Key) != 0) << "frame " << frame;
+    }
+    // Frames follow each other, with a dictionary in between at the start
+    // of each unique interval
+    if (frame > 0) {
+      uint64_t prev_end = built[frame - 1].frame_offset + built[frame - 1].frame_size;
+      if (frame % kUniqueInterval == 0) {
+        EXPECT_EQ(prev_end, built[frame].palette_offset) << "frame " << frame;
+      }
+      else {
+        EXPECT_EQ(prev_end, built[frame].frame_offset) << "frame " << frame;
+      }
+    }
+  }
+
+  // The encoder wrote the same index next to the file
+  uint64_t file_size = FileSize(_clip.path);
+  std::vector<MPTC::FrameIndexEntry> loaded;
+  ASSERT_TRUE(MPTC::LoadFrameIndex(_clip.path, file_size, &loaded));
+  ASSERT_EQ(built.size(), loaded.size());
+  for (uint32_t frame = 0; frame < kNumFrames; frame++) {
+    EXPECT_EQ(built[frame].frame_offset, loaded[frame].frame_offset) << "frame " << frame;
+    EXPECT_EQ(built[frame].palette_offset, loaded[frame].palette_offset) << "frame " << frame;
+    EXPECT_EQ(built[frame].unique_offset, loaded[frame].unique_offset) << "frame " << frame;
+    EXPECT_EQ(built[frame].frame_size, loaded[frame].frame_size) << "frame " << frame;
+    EXPECT_EQ(built[frame].flags, loaded[frame].flags) << "frame " << frame;
+  }
+
+  // An index of another version of the file is rejected
+  EXPECT_FALSE(MPTC::LoadFrameIndex(_clip.path, file_size + 1, &loaded));
+}
+
+TEST_P(RoundTripTest, OversizedMotionStream) {
+  std::ifstream in_stream(_clip.path.c_str(), std::ios::binary);
+  ASSERT_TRUE(in_stream.is_open());
+  std::vector<char> file((std::istreambuf_iterator<char>(in_stream)), std::istreambuf_iterator<char>());
+
+  MPTC::MappedSource source;
+  MPTC::Decoder decoder;
+  ASSERT_TRUE(source.Open(_clip.path));
+  ASSERT_TRUE(decoder.Open(source, 1));
+  std::vector<MPTC::FrameIndexEntry> index;
+  ASSERT_EQ(0, BuildFrameIndex(source, &index));
+
+  // The motion indices come first, their size follows the number of unique
+  // blocks of the frame, and of the first tile in tiled files. The size is
+  // one byte more than the header allows for a frame, but still inside the
+  // file. Frame 0 has no earlier frame whose buffer could be decoded instead.
+  const uint32_t oversized = decoder.DecodeInfo().comp_frame_sz + 1;
+  const std::string bad_path = _clip.path + ".bad";
+  const uint32_t bad_frames[] = { 0, 1 };
+  for (uint32_t bad_frame : bad_frames) {
+    std::vector<char> bad_file = file;
+    uint64_t offset = index[bad_frame].frame_offset + ((GetParam().flags & kMPTCFlag_Tiled) ? 8 : 4);
+    ASSERT_LT(offset + 4 + oversized, bad_file.size());
+    memcpy(&bad_file[offset], &oversized, 4);
+    {
+      std::ofstream out_stream(bad_path.c_str(), std::ios::binary);
+      out_stream.write(bad_file.data(), bad_file.size());
+    }
+
+    MPTC::MappedSource bad_source;
+    ASSERT_TRUE(bad_source.Open(bad_path));
+    std::vector<MPTC::FrameIndexEntry> bad_index;
+    EXPECT_EQ(-1, BuildFrameIndex(bad_source, &bad_index)) << "frame " << bad_frame;
+    EXPECT_EQ(bad_frame, bad_index.size());
+  }
+  remove(bad_path.c_str());
+}
+
+INSTANTIATE_TEST_CASE_P(Layouts, RoundTripTest, ::testing::ValuesIn(kLayouts));
+
+}  // namespace
@@ -0,0 +1,130 @@
+// SeekFrame against the linear decode. Every frame is reached from
+// wherever the previous seek left the decoder, in a shuffled order so that
+// seeks go both ways, and has to match the frame the linear decode
+// produced, as does the frame decoded after it.
+
+#include "mptc_test_util.h"
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <random>
+
+namespace {
+
+struct SeekCase {
+  const char *name;
+  uint32_t tile_rows;
+  MPTC::EntropyCodecType codec;
+  bool motion_model;
+  uint32_t key_interval;
+};
+
+std::ostream &operator<<(std::ostream &os, const SeekCase &seek) {
+  return os << seek.name;
+}
+
+const SeekCase kSeekCases[] = {
+  { "legacy_no_keys",    0, MPTC::eEntropyCodec_Arithmetic, false, 0 },
+  { "legacy_keys",       0, MPTC::eEntropyCodec_Arithmetic, false, 4 },
+  { "rans_keys",        64, MPTC::eEntropyCodec_Rans,       false, 5 },
+  { "motion_model_keys", 64, MPTC::eEntropyCodec_Rans,      true,  6 },
+};
+
+const uint32_t kNumFrames = 24;
+
+class SeekTest : public ::testing::TestWithParam<SeekCase> {
+ protected:
+  void SetUp() {
+    const SeekCase &seek = GetParam();
+    MPTC::EncoderOptions options;
+    options.unique_interval = 8;
+    options.tile_rows = seek.tile_rows;
+    options.codec = seek.codec;
+    options.motion_model = seek.motion_model;
+    options.key_interval = seek.key_interval;
+    ASSERT_TRUE(_clip.Encode(std::string("seek_") + seek.name + ".mpt", 256, 512, kNumFrames, options));
+
+    ASSERT_TRUE(_source.Open(_clip.path));
+    ASSERT_EQ(0, BuildFrameIndex(_source, &_index));
+    ASSERT_EQ(kNumFrames, _index.size());
+
+    _order.resize(kNumFrames);
+    for (uint32_t frame = 0; frame < kNumFrames; frame++)
+      _order[frame] = frame;
+    std::mt19937 rng(1234);
+    std::shuffle(_order.begin(), _order.end(), rng);
+  }
+
+  MPTC::test::EncodedClip _clip;
+  MPTC::MappedSource _source;
+  std::vector<MPTC::FrameIndexEntry> _index;
+  std::vector<uint32_t> _order;
+};
+
+TEST_P(SeekTest, SeekFrameMatchesLinearDecode) {
+  const uint32_t num_blocks = _clip.NumBlocks();
+  MPTCDecodeInfo decode_info;
+  InitDecodeInfo(&decode_info, 1);
+
+  // Start in the middle of the stream
+  MPTC::test::Frame curr(num_blocks), scratch(num_blocks), next(num_blocks);
+  for (uint32_t frame = 0; frame < kNumFrames / 2; frame++) {
+    GetFrame(_source, frame == 0 ? NULL : scratch.data(), curr.data(), &decode_info);
+    std::swap(curr, scratch);
+  }
+
+  for (uint32_t frame : _order) {
+    MPTCSeekStats stats;
+    ASSERT_EQ(0, SeekFrame(_source, _index, frame, scratch.data(), curr.data(), &decode_info, &stats))
+      << "frame " << frame;
+    EXPECT_EQ(frame, stats.target_frame);
+    EXPECT_LE(stats.start_frame, frame);
+    EXPECT_TRUE((_index[stats.start_frame].flags & MPTC::kFrameIndexFlag_Key) != 0) << "frame " << frame;
+    ASSERT_EQ(-1, MPTC::test::FirstDifference(curr.data(), _clip.reconstructions[frame].data(), num_blocks))
+      << "seek to frame " << frame;
+
+    if (frame + 1 < kNumFrames) {
+      GetFrame(_source, curr.data(), next.data(), &decode_info);
+      ASSERT_EQ(-1, MPTC::test::FirstDifference(next.data(), _clip.reconstructions[frame + 1].data(), num_blocks))
+        << "frame after the seek to frame " << frame;
+    }
+  }
+  FreeDecodeInfo(&decode_info);
+}
+
+TEST_P(SeekTest, DecoderSeekMatchesLinearDecode) {
+  const uint32_t num_blocks = _clip.NumBlocks();
+  MPTC::Decoder decoder;
+  ASSERT_TRUE(decoder.Open(_source, 4));
+
+  MPTC::test::Frame curr(num_blocks), scratch(num_blocks), next(num_blocks);
+  for (uint32_t frame : _order) {
+    ASSERT_EQ(0, decoder.Seek(_index, frame, scratch.data(), curr.data())) << "frame " << frame;
+    ASSERT_EQ(-1, MPTC::test::FirstDifference(curr.data(), _clip.reconstructions[frame].data(), num_blocks))
+      << "seek to frame " << frame;
+
+    if (frame + 1 < kNumFrames) {
+      decoder.DecodeFrameMultiThread(curr.data(), next.data());
+      ASSERT_EQ(-1, MPTC::test::FirstDifference(next.data(), _clip.reconstructions[frame + 1].data(), num_blocks))
+        << "frame after the seek to frame " << frame;
+    }
+  }
+}
+
+TEST_P(SeekTest, OutOfRange) {
+  const uint32_t num_blocks = _clip.NumBlocks();
+  MPTCDecodeInfo decode_info;
+  InitDecodeInfo(&decode_info, 1);
+  MPTC::test::Frame curr(num_blocks), scratch(num_blocks);
+  EXPECT_EQ(-1, SeekFrame(_source, _index, kNumFrames, scratch.data(), curr.data(), &decode_info));
+
+  // An index that doesn't belong to the file
+  std::vector<MPTC::FrameIndexEntry> short_index(_index.begin(), _index.end() - 1);
+  EXPECT_EQ(-1, SeekFrame(_source, short_index, 0, scratch.data(), curr.data(), &decode_info));
+  FreeDecodeInfo(&decode_info);
+}
+
+INSTANTIATE_TEST_CASE_P(Layouts, SeekTest, ::testing::ValuesIn(kSeekCases));
+
+}  // namespace
@@ -0,0 +1,207 @@
+#include "thread_pool.h"
+
+#include <cassert>
+#include <chrono>
+
+namespace MPTC {
+
+// The pool and queue of the worker running on this thread, if any
+static thread_local const ThreadPool *t_worker_pool = NULL;
+static thread_local size_t t_worker_queue = 0;
+
+ThreadPool::ThreadPool(uint32_t num_threads) : _num_queued(0), _num_steals(0), _stop(false) {
+  if (num_threads == 0) {
+    num_threads = std::thread::hardware_concurrency();
+    // hardware_concurrency is allowed to return 0 if it cannot tell
+    if (num_threads == 0)
+      num_threads = 4;
+  }
+
+  // Workers look at every queue as soon as they start
+  _num_workers = num_threads;
+  for (uint32_t idx = 0; idx <= num_threads; idx++) {
+    std::unique_ptr<TaskQueue> queue(new TaskQueue);
+    queue->tasks.resize(64);
+    queue->head = 0;
+    queue->num_tasks = 0;
+    _queues.push_back(std::move(queue));
+  }
+
+  for (uint32_t idx = 0; idx < num_threads; idx++)
+    _workers.push_back(std::thread(&ThreadPool::WorkerLoop, this, idx));
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _cv.notify_all();
+
+  for (auto &worker : _workers) {
+    if (worker.joinable())
+      worker.join();
+  }
+}
+
+bool ThreadPool::IsWorkerThread() const {
+  return t_worker_pool == this;
+}
+
+void ThreadPool::Enqueue(const std::function<void()> &task) {
+  TaskQueue &queue = *_queues[IsWorkerThread() ? t_worker_queue : _num_workers];
+  {
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    if (queue.num_tasks == queue.tasks.size()) {
+      // Unroll the ring into a twice as large one
+      std::vector<std::function<void()> > tasks(2 * queue.tasks.size());
+      for (size_t idx = 0; idx < queue.num_tasks; idx++)
+        tasks[idx] = std::move(queue.tasks[(queue.head + idx) % queue.tasks.size()]);
+      queue.tasks.swap(tasks);
+      queue.head = 0;
+    }
+    queue.tasks[(queue.head + queue.num_tasks) % queue.tasks.size()] = task;
+    queue.num_tasks++;
+    _num_queued.fetch_add(1, std::memory_order_release);
+  }
+
+  // Taking the lock orders the count before a worker that is just about
+  // to sleep checks it
+  { std::unique_lock<std::mutex> lock(_mutex); }
+  _cv.notify_one();
+}
+
+bool ThreadPool::TakeTask(TaskQueue &queue, bool is_newest, std::function<void()> *task) {
+  std::unique_lock<std::mutex> lock(queue.mutex);
+  if (queue.num_tasks == 0)
+    return false;
+
+  size_t slot = queue.head;
+  if (is_newest)
+    slot = (queue.head + queue.num_tasks - 1) % queue.tasks.size();
+  else
+    queue.head = (queue.head + 1) % queue.tasks.size();
+  *task = std::move(queue.tasks[slot]);
+  queue.tasks[slot] = nullptr;
+  queue.num_tasks--;
+  _num_queued.fetch_sub(1, std::memory_order_relaxed);
+  return true;
+}
+
+// A worker takes the newest task of its own queue, everything else is
+// taken oldest first: the shared queue, then the other workers' queues
+bool ThreadPool::PopTask(size_t queue_idx, std::function<void()> *task) {
+  if (_num_queued.load(std::memory_order_acquire) == 0)
+    return false;
+
+  size_t num_workers = _num_workers;
+  bool is_worker = queue_idx < num_workers;
+  if (is_worker && TakeTask(*_queues[queue_idx], true, task))
+    return true;
+  if (TakeTask(*_queues[num_workers], false, task))
+    return true;
+
+  for (size_t offset = is_worker ? 1 : 0; offset < num_workers; offset++) {
+    if (TakeTask(*_queues[(queue_idx + offset) % num_workers], false, task)) {
+      _num_steals.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::RunPendingTask() {
+  std::function<void()> task;
+  if (!PopTask(IsWorkerThread() ? t_worker_queue : _num_workers, &task))
+    return false;
+  task();
+  return true;
+}
+
+void ThreadPool::WorkerLoop(size_t queue_idx) {
+  t_worker_pool = this;
+  t_worker_queue = queue_idx;
+
+  for (;;) {
+    std::function<void()> task;
+    if (PopTask(queue_idx, &task)) {
+      task();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock, [this] { return _stop || _num_queued.load(std::memory_order_acquire) != 0; });
+    if (_stop && _num_queued.load(std::memory_order_acquire) == 0)
+      return;
+  }
+}
+
+TaskGraph::TaskGraph() : _pool(NULL), _remaining(0) { }
+
+TaskGraph::TaskHandle TaskGraph::AddTask(const std::function<void()> &fn) {
+  std::unique_ptr<Node> node(new Node);
+  node->fn = fn;
+  node->num_deps = 0;
+  node->pending = 0;
+  _nodes.push_back(std::move(node));
+  return _nodes.size() - 1;
+}
+
+void TaskGraph::AddDependency(TaskHandle before, TaskHandle after) {
+  assert(before < _nodes.size() && after < _nodes.size());
+  _nodes[before]->successors.push_back(after);
+  _nodes[after]->num_deps++;
+}
+
+void TaskGraph::Execute(TaskHandle handle) {
+  Node &node = *_nodes[handle];
+  node.fn();
+
+  for (TaskHandle succ : node.successors) {
+    // The last dependency to finish releases the successor
+    if (_nodes[succ]->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      _pool->Enqueue([this, succ] { Execute(succ); });
+  }
+
+  // Decrement under the lock so that Run() cannot return (and the graph
+  // cannot go away) while we are still touching it
+  std::unique_lock<std::mutex> lock(_done_mutex);
+  if (_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    _done_cv.notify_all();
+}
+
+void TaskGraph::Run(ThreadPool &pool) {
+  if (_nodes.empty())
+    return;
+
+  for (auto &node : _nodes)
+    node->pending.store(node->num_deps, std::memory_order_relaxed);
+  _pool = &pool;
+  _remaining.store(_nodes.size(), std::memory_order_release);
+
+  // The tasks capture two words so they are stored inline in the queue
+  for (TaskHandle handle = 0; handle < _nodes.size(); handle++) {
+    if (_nodes[handle]->num_deps == 0)
+      pool.Enqueue([this, handle] { Execute(handle); });
+  }
+
+  // A worker that blocked here could hold up the very tasks it waits for,
+  // so it helps with whatever is queued instead
+  if (pool.IsWorkerThread()) {
+    while (_remaining.load(std::memory_order_acquire) != 0) {
+      if (pool.RunPendingTask())
+        continue;
+      std::unique_lock<std::mutex> lock(_done_mutex);
+      _done_cv.wait_for(lock, std::chrono::microseconds(100), [this] {
+        return _remaining.load(std::memory_order_acquire) == 0;
+      });
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(_done_mutex);
+  _done_cv.wait(lock, [this] {
+    return _remaining.load(std::memory_order_acquire) == 0;
+  });
+}
+
+}  // namespace MPTC
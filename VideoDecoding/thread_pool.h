@@ -0,0 +1,108 @@
+#ifndef __MPTC_THREAD_POOL_H__
+#define __MPTC_THREAD_POOL_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace MPTC {
+
+// A fixed set of long-lived worker threads. Created once so that no
+// threads are spawned per frame, and can be shared by any number of
+// decoders. Every worker has its own queue: tasks enqueued by a worker go
+// to its own queue and it runs them newest first, idle workers steal the
+// oldest tasks of the others. Tasks from other threads go to a shared
+// queue. The queues are rings that only grow, so once they have seen the
+// largest burst of tasks, enqueueing tasks that fit std::function's inline
+// storage (two pointers) no longer allocates.
+class ThreadPool {
+ public:
+  // num_threads == 0 sizes the pool from std::thread::hardware_concurrency()
+  explicit ThreadPool(uint32_t num_threads = 0);
+  ~ThreadPool();
+
+  uint32_t NumThreads() const { return static_cast<uint32_t>(_workers.size()); }
+
+  void Enqueue(const std::function<void()> &task);
+
+  // Runs one queued task on the calling thread, a worker takes its own
+  // tasks first. Returns false if there was none.
+  bool RunPendingTask();
+
+  // True if the calling thread is one of the pool's workers
+  bool IsWorkerThread() const;
+
+  // Tasks a worker took from another worker's queue
+  uint64_t NumSteals() const { return _num_steals.load(std::memory_order_relaxed); }
+
+ private:
+  ThreadPool(const ThreadPool &);
+  ThreadPool &operator=(const ThreadPool &);
+
+  struct TaskQueue {
+    std::vector<std::function<void()> > tasks;
+    size_t head, num_tasks;
+    std::mutex mutex;
+  };
+
+  bool TakeTask(TaskQueue &queue, bool is_newest, std::function<void()> *task);
+  bool PopTask(size_t queue_idx, std::function<void()> *task);
+  void WorkerLoop(size_t queue_idx);
+
+  std::vector<std::thread> _workers;
+  size_t _num_workers;
+  // One per worker, then the one of all other threads
+  std::vector<std::unique_ptr<TaskQueue> > _queues;
+  std::atomic<size_t> _num_queued;
+  std::atomic<uint64_t> _num_steals;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  bool _stop;
+};
+
+// A small dependency graph of tasks. The graph is built once and can be
+// run any number of times; every Run() executes each task exactly once,
+// a task only starts after all of its dependencies have finished, and
+// Run() returns when the whole graph is done. Run() may be called from a
+// task of the same pool, the worker then runs queued tasks while it waits.
+class TaskGraph {
+ public:
+  typedef size_t TaskHandle;
+
+  TaskGraph();
+
+  TaskHandle AddTask(const std::function<void()> &fn);
+
+  // 'after' will not start until 'before' has finished
+  void AddDependency(TaskHandle before, TaskHandle after);
+
+  void Run(ThreadPool &pool);
+
+  size_t NumTasks() const { return _nodes.size(); }
+
+ private:
+  struct Node {
+    std::function<void()> fn;
+    std::vector<TaskHandle> successors;
+    uint32_t num_deps;
+    std::atomic<uint32_t> pending;
+  };
+
+  void Execute(TaskHandle handle);
+
+  std::vector<std::unique_ptr<Node> > _nodes;
+  ThreadPool *_pool;  // of the current Run()
+  std::atomic<size_t> _remaining;
+  std::mutex _done_mutex;
+  std::condition_variable _done_cv;
+};
+
+}  // namespace MPTC
+
+#endif  // __MPTC_THREAD_POOL_H__
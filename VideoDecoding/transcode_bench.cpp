@@ -0,0 +1,178 @@
+// Correctness check and benchmark of the DXT1 block transcoders.
+//
+// Usage: transcode_bench [file.mpt] [num_frames] [num_threads]
+//
+// Transcodes the frames of an MPTC file, or random DXT1 frames without
+// one, to every format. The SIMD RGBA8 unpacker has to match the scalar
+// DXT1 reference decoder exactly. ETC2 and BC7 blocks have to decode with
+// the scalar reference decoders, four colour blocks have to come out of
+// BC7 within a few levels of the DXT1 texels, and the PSNR of both against
+// DXT1 is printed. The FrameTranscoder has to match a single threaded
+// transcode of the same rows, from a frame with padded rows. Prints the
+// time per frame of the pool.
+
+#include "block_transcoder.h"
+#include "decoder.h"
+#include "mptc_reader.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static const uint32_t kRandomHeight = 512;
+static const uint32_t kRandomWidth = 1024;
+
+static void RandomFrames(uint32_t num_frames, std::vector<std::vector<PhysicalDXTBlock> > *frames) {
+  std::mt19937 rng(7);
+  uint32_t num_blocks = kRandomHeight / 4 * kRandomWidth / 4;
+  frames->assign(num_frames, std::vector<PhysicalDXTBlock>(num_blocks));
+  for (auto &frame : *frames) {
+    for (auto &block : frame) {
+      block.ep1 = static_cast<uint16_t>(rng());
+      block.ep2 = static_cast<uint16_t>(rng());
+      block.interp = rng();
+      // Every fourth block in three colour mode
+      if ((rng() & 3) == 0 && block.ep1 > block.ep2)
+        std::swap(block.ep1, block.ep2);
+    }
+  }
+}
+
+static bool LoadFrames(const std::string &path, uint32_t num_frames, uint32_t *frame_height,
+                       uint32_t *frame_width, std::vector<std::vector<PhysicalDXTBlock> > *frames) {
+  MPTC::MappedSource source;
+  MPTC::Decoder decoder;
+  if (!source.Open(path) || !decoder.Open(source)) {
+    std::cerr << "Error opening " << path << std::endl;
+    return false;
+  }
+
+  *frame_height = decoder.FrameHeight();
+  *frame_width = decoder.FrameWidth();
+  frames->assign(num_frames, std::vector<PhysicalDXTBlock>(decoder.NumBlocks()));
+  for (uint32_t frame = 0; frame < num_frames; frame++)
+    decoder.DecodeFrame(frame == 0 ? NULL : (*frames)[frame - 1].data(), (*frames)[frame].data());
+  return true;
+}
+
+// Decodes block (x, y) of a transcoded frame to 16 RGBA texels
+static bool DecodeTranscoded(MPTC::TranscodeFormat format, const uint8_t *frame, size_t pitch,
+                             uint32_t x, uint32_t y, uint8_t *rgba) {
+  const uint8_t *block = frame + y * pitch + x * MPTC::TranscodedBlockSize(format);
+  switch (format) {
+  case MPTC::eTranscodeFormat_RGBA8:
+    for (uint32_t row = 0; row < 4; row++)
+      memcpy(rgba + 16 * row, frame + y * pitch + row * (pitch / 4) + 16 * x, 16);
+    return true;
+  case MPTC::eTranscodeFormat_ETC2_RGB:
+    return MPTC::DecodeETC2BlockReference(block, rgba);
+  case MPTC::eTranscodeFormat_BC7:
+    return MPTC::DecodeBC7BlockReference(block, rgba);
+  default:
+    return false;
+  }
+}
+
+static bool BenchFormat(MPTC::TranscodeFormat format, uint32_t frame_height, uint32_t frame_width,
+                        const std::vector<std::vector<PhysicalDXTBlock> > &frames, uint32_t num_threads) {
+  const char *name = MPTC::TranscodeFormatName(format);
+  const uint32_t blocks_height = frame_height / 4, blocks_width = frame_width / 4;
+  const uint32_t src_pitch = blocks_width + 8;
+
+  MPTC::FrameTranscoder transcoder(format, frame_height, frame_width, num_threads);
+  std::unique_ptr<MPTC::BlockTranscoder> reference(MPTC::CreateBlockTranscoder(format));
+  std::vector<uint8_t> output(transcoder.OutputSize()), expected(transcoder.OutputSize());
+  std::vector<PhysicalDXTBlock> padded(static_cast<size_t>(blocks_height) * src_pitch);
+
+  double elapsed_ms = 0.0, squared_error = 0.0;
+  uint64_t num_texels = 0;
+  int max_four_colour_error = 0;
+  for (size_t frame = 0; frame < frames.size(); frame++) {
+    for (uint32_t y = 0; y < blocks_height; y++)
+      memcpy(&padded[y * src_pitch], &frames[frame][y * blocks_width], blocks_width * sizeof(PhysicalDXTBlock));
+
+    Clock::time_point start = Clock::now();
+    transcoder.Transcode(padded.data(), src_pitch, 0, blocks_height, output.data());
+    elapsed_ms += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    reference->TranscodeRows(frames[frame].data(), blocks_width, blocks_width, 0, blocks_height,
+                             expected.data(), transcoder.OutputPitch());
+    if (output != expected) {
+      std::cerr << name << ": frame " << frame << " differs between the pool and one thread" << std::endl;
+      return false;
+    }
+
+    for (uint32_t y = 0; y < blocks_height; y++) {
+      for (uint32_t x = 0; x < blocks_width; x++) {
+        const PhysicalDXTBlock &block = frames[frame][y * blocks_width + x];
+        uint8_t dxt1[64], rgba[64];
+        MPTC::DecodeDXT1BlockReference(block, dxt1);
+        if (!DecodeTranscoded(format, output.data(), transcoder.OutputPitch(), x, y, rgba)) {
+          std::cerr << name << ": block (" << x << ", " << y << ") of frame " << frame
+                    << " does not decode" << std::endl;
+          return false;
+        }
+
+        for (int i = 0; i < 64; i++) {
+          if (i % 4 == 3)
+            continue;
+          int diff = rgba[i] - dxt1[i];
+          squared_error += diff * diff;
+          if (block.ep1 > block.ep2)
+            max_four_colour_error = std::max(max_four_colour_error, std::abs(diff));
+        }
+        num_texels += 16;
+      }
+    }
+  }
+
+  if (format == MPTC::eTranscodeFormat_RGBA8 && squared_error != 0.0) {
+    std::cerr << name << ": does not match the DXT1 reference decoder" << std::endl;
+    return false;
+  }
+  if (format == MPTC::eTranscodeFormat_BC7 && max_four_colour_error > 3) {
+    std::cerr << name << ": four colour blocks are off by up to " << max_four_colour_error << std::endl;
+    return false;
+  }
+
+  double mse = squared_error / (3.0 * num_texels);
+  double mpix = static_cast<double>(frame_width) * frame_height / 1.0e6;
+  printf("%-6s frames: %4u  %8.3f ms/frame  %8.1f Mpix/s  ", name, static_cast<uint32_t>(frames.size()),
+         elapsed_ms / frames.size(), mpix * frames.size() / (elapsed_ms / 1000.0));
+  if (mse == 0.0)
+    printf("exact\n");
+  else
+    printf("PSNR %6.2f dB\n", 10.0 * log10(255.0 * 255.0 / mse));
+  return true;
+}
+
+int main(int argc, char **argv) {
+  std::string path;
+  int arg = 1;
+  if (arg < argc && !isdigit(static_cast<unsigned char>(argv[arg][0])))
+    path = argv[arg++];
+  uint32_t num_frames = arg < argc ? static_cast<uint32_t>(atoi(argv[arg++])) : 8;
+  uint32_t num_threads = arg < argc ? static_cast<uint32_t>(atoi(argv[arg++])) : 0;
+
+  uint32_t frame_height = kRandomHeight, frame_width = kRandomWidth;
+  std::vector<std::vector<PhysicalDXTBlock> > frames;
+  if (path.empty())
+    RandomFrames(num_frames, &frames);
+  else if (!LoadFrames(path, num_frames, &frame_height, &frame_width, &frames))
+    return 1;
+
+  printf("%s: %ux%u\n", path.empty() ? "random blocks" : path.c_str(), frame_width, frame_height);
+  for (int format = 0; format < MPTC::kNumTranscodeFormats; format++) {
+    if (!BenchFormat(static_cast<MPTC::TranscodeFormat>(format), frame_height, frame_width, frames, num_threads))
+      return 1;
+  }
+  return 0;
+}
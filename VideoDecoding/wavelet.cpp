@@ -1,5 +1,7 @@
 #include "wavelet.h"
 
+#include <algorithm>
+#include <cassert>
 #include <vector>
 
 // Returns a normalized index in the given range by ping-ponging
@@ -155,3 +157,297 @@ extern void InverseWavelet2D(const int16_t *src, size_t src_rowbytes,
 }
 
 }
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Fused multi-level transforms
+//
+// Every level is written as two lifting steps per direction,
+//
+//   predict: out[i] = a[i] +/- (b[i] + c[i]) / 2
+//   update:  out[i] = a[i] +/- (b[i] + c[i] + 2) / 4
+//
+// over whole rows of the block, with the mirrored boundary samples of
+// ForwardWavelet1D / InverseWavelet1D resolved once per row or column
+// instead of per sample. Columns are transformed with rows as vectors, the
+// rows of a level through small padded line buffers, so there are no
+// transposes. The arithmetic is done in 32 bits and truncated to 16 bits
+// wherever the reference stores a sample, which keeps the results bit
+// exact for every input.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#if defined(__AVX2__)
+#define MPTC_WAVELET_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MPTC_WAVELET_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+static const size_t kMaxDim = MPTC::kMaxWaveletBlockDim;
+
+// out = a + kSign * trunc((b + c + kRound) >> kShift), stored to 16 bits
+template<int kSign, int kShift>
+static inline int16_t LiftSample(int16_t a, int16_t b, int16_t c) {
+  const int round = kShift == 2 ? 2 : 0;
+  const int delta = (static_cast<int>(b) + static_cast<int>(c) + round) / (1 << kShift);
+  return static_cast<int16_t>(kSign > 0 ? a + delta : a - delta);
+}
+
+#if defined(MPTC_WAVELET_AVX2)
+
+template<int kSign, int kShift>
+static inline __m256i LiftHalf(__m256i a, __m256i b, __m256i c) {
+  __m256i sum = _mm256_add_epi32(b, c);
+  if (kShift == 2)
+    sum = _mm256_add_epi32(sum, _mm256_set1_epi32(2));
+
+  // Round toward zero like the integer division of the reference
+  const __m256i bias = _mm256_and_si256(_mm256_srai_epi32(sum, 31), _mm256_set1_epi32((1 << kShift) - 1));
+  const __m256i delta = _mm256_srai_epi32(_mm256_add_epi32(sum, bias), kShift);
+  __m256i out = kSign > 0 ? _mm256_add_epi32(a, delta) : _mm256_sub_epi32(a, delta);
+
+  // Wrap to 16 bits so the saturating pack below is exact
+  return _mm256_srai_epi32(_mm256_slli_epi32(out, 16), 16);
+}
+
+template<int kSign, int kShift>
+static void Lift(int16_t *out, const int16_t *a, const int16_t *b, const int16_t *c, size_t len) {
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+    const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+    const __m256i vc = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(c + i));
+
+    const __m256i lo = LiftHalf<kSign, kShift>(
+      _mm256_cvtepi16_epi32(_mm256_castsi256_si128(va)),
+      _mm256_cvtepi16_epi32(_mm256_castsi256_si128(vb)),
+      _mm256_cvtepi16_epi32(_mm256_castsi256_si128(vc)));
+    const __m256i hi = LiftHalf<kSign, kShift>(
+      _mm256_cvtepi16_epi32(_mm256_extracti128_si256(va, 1)),
+      _mm256_cvtepi16_epi32(_mm256_extracti128_si256(vb, 1)),
+      _mm256_cvtepi16_epi32(_mm256_extracti128_si256(vc, 1)));
+
+    // packs works within 128 bit lanes, put the quadwords back in order
+    const __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), packed);
+  }
+
+  for (; i < len; ++i)
+    out[i] = LiftSample<kSign, kShift>(a[i], b[i], c[i]);
+}
+
+#elif defined(MPTC_WAVELET_SSE2)
+
+template<int kSign, int kShift>
+static inline __m128i LiftHalf(__m128i a, __m128i b, __m128i c) {
+  __m128i sum = _mm_add_epi32(b, c);
+  if (kShift == 2)
+    sum = _mm_add_epi32(sum, _mm_set1_epi32(2));
+
+  // Round toward zero like the integer division of the reference
+  const __m128i bias = _mm_and_si128(_mm_srai_epi32(sum, 31), _mm_set1_epi32((1 << kShift) - 1));
+  const __m128i delta = _mm_srai_epi32(_mm_add_epi32(sum, bias), kShift);
+  __m128i out = kSign > 0 ? _mm_add_epi32(a, delta) : _mm_sub_epi32(a, delta);
+
+  // Wrap to 16 bits so the saturating pack below is exact
+  return _mm_srai_epi32(_mm_slli_epi32(out, 16), 16);
+}
+
+// Sign extends the low or high four 16 bit values to 32 bits
+static inline __m128i WidenLo(__m128i v) { return _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16); }
+static inline __m128i WidenHi(__m128i v) { return _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16); }
+
+template<int kSign, int kShift>
+static void Lift(int16_t *out, const int16_t *a, const int16_t *b, const int16_t *c, size_t len) {
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+    const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+    const __m128i vc = _mm_loadu_si128(reinterpret_cast<const __m128i *>(c + i));
+
+    const __m128i lo = LiftHalf<kSign, kShift>(WidenLo(va), WidenLo(vb), WidenLo(vc));
+    const __m128i hi = LiftHalf<kSign, kShift>(WidenHi(va), WidenHi(vb), WidenHi(vc));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(lo, hi));
+  }
+
+  for (; i < len; ++i)
+    out[i] = LiftSample<kSign, kShift>(a[i], b[i], c[i]);
+}
+
+#else
+
+// Plain loop, simple enough for the compiler to vectorize on its own
+template<int kSign, int kShift>
+static void Lift(int16_t *out, const int16_t *a, const int16_t *b, const int16_t *c, size_t len) {
+  for (size_t i = 0; i < len; ++i)
+    out[i] = LiftSample<kSign, kShift>(a[i], b[i], c[i]);
+}
+
+#endif
+
+// Splits a row into its even and odd samples
+static void Deinterleave(const int16_t *src, int16_t *even, int16_t *odd, size_t half) {
+  size_t k = 0;
+#if defined(MPTC_WAVELET_SSE2) || defined(MPTC_WAVELET_AVX2)
+  for (; k + 8 <= half; k += 8) {
+    const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * k));
+    const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * k + 8));
+    const __m128i e0 = _mm_srai_epi32(_mm_slli_epi32(v0, 16), 16);
+    const __m128i e1 = _mm_srai_epi32(_mm_slli_epi32(v1, 16), 16);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(even + k), _mm_packs_epi32(e0, e1));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(odd + k),
+                     _mm_packs_epi32(_mm_srai_epi32(v0, 16), _mm_srai_epi32(v1, 16)));
+  }
+#endif
+  for (; k < half; ++k) {
+    even[k] = src[2 * k];
+    odd[k] = src[2 * k + 1];
+  }
+}
+
+// Merges even and odd samples back into a row
+static void Interleave(const int16_t *even, const int16_t *odd, int16_t *dst, size_t half) {
+  size_t k = 0;
+#if defined(MPTC_WAVELET_SSE2) || defined(MPTC_WAVELET_AVX2)
+  for (; k + 8 <= half; k += 8) {
+    const __m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i *>(even + k));
+    const __m128i o = _mm_loadu_si128(reinterpret_cast<const __m128i *>(odd + k));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 2 * k), _mm_unpacklo_epi16(e, o));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 2 * k + 8), _mm_unpackhi_epi16(e, o));
+  }
+#endif
+  for (; k < half; ++k) {
+    dst[2 * k] = even[k];
+    dst[2 * k + 1] = odd[k];
+  }
+}
+
+// Forward transform of the first len samples of every row, src and dst
+// may not overlap. Mirrors ForwardWavelet1D.
+static void ForwardRows(const int16_t *src, size_t src_stride,
+                        int16_t *dst, size_t dst_stride, size_t len, size_t num_rows) {
+  const size_t half = len / 2;
+  int16_t even[kMaxDim / 2 + 1], odd[kMaxDim / 2], high[kMaxDim / 2 + 1];
+
+  for (size_t row = 0; row < num_rows; ++row) {
+    const int16_t *s = src + row * src_stride;
+    int16_t *d = dst + row * dst_stride;
+
+    // x[len] mirrors to x[len - 2]
+    Deinterleave(s, even, odd, half);
+    even[half] = even[half - 1];
+
+    // high[k] = odd[k] - (even[k] + even[k + 1]) / 2
+    Lift<-1, 1>(high + 1, odd, even, even + 1, half);
+
+    // The high band at k - 1 mirrors to 0 for k == 0
+    high[0] = high[1];
+    Lift<+1, 2>(d, even, high, high + 1, half);
+    memcpy(d + half, high + 1, half * sizeof(int16_t));
+  }
+}
+
+// Inverse transform of the first len samples of every row, src and dst
+// may not overlap. Mirrors InverseWavelet1D.
+static void InverseRows(const int16_t *src, size_t src_stride,
+                        int16_t *dst, size_t dst_stride, size_t len, size_t num_rows) {
+  const size_t half = len / 2;
+  int16_t even[kMaxDim / 2 + 1], odd[kMaxDim / 2], high[kMaxDim / 2 + 1];
+
+  for (size_t row = 0; row < num_rows; ++row) {
+    const int16_t *s = src + row * src_stride;
+    int16_t *d = dst + row * dst_stride;
+
+    high[0] = s[half];
+    memcpy(high + 1, s + half, half * sizeof(int16_t));
+
+    // even[k] = low[k] - (high[k - 1] + high[k] + 2) / 4
+    Lift<-1, 2>(even, s, high, high + 1, half);
+
+    // odd[k] = high[k] + (even[k] + even[k + 1]) / 2
+    even[half] = even[half - 1];
+    Lift<+1, 1>(odd, s + half, even, even + 1, half);
+
+    Interleave(even, odd, d, half);
+  }
+}
+
+// Forward transform down the first len rows of num_cols columns, with the
+// rows as vectors. src and dst may not overlap.
+static void ForwardCols(const int16_t *src, size_t src_stride,
+                        int16_t *dst, size_t dst_stride, size_t len, size_t num_cols) {
+  const size_t half = len / 2;
+
+  for (size_t k = 0; k < half; ++k) {
+    const size_t next = std::min(2 * k + 2, len - 2);
+    Lift<-1, 1>(dst + (half + k) * dst_stride, src + (2 * k + 1) * src_stride,
+                src + (2 * k) * src_stride, src + next * src_stride, num_cols);
+  }
+
+  for (size_t k = 0; k < half; ++k) {
+    const size_t prev = k == 0 ? 0 : k - 1;
+    Lift<+1, 2>(dst + k * dst_stride, src + (2 * k) * src_stride,
+                dst + (half + prev) * dst_stride, dst + (half + k) * dst_stride, num_cols);
+  }
+}
+
+// Inverse transform down the first len rows of num_cols columns, with the
+// rows as vectors. src and dst may not overlap.
+static void InverseCols(const int16_t *src, size_t src_stride,
+                        int16_t *dst, size_t dst_stride, size_t len, size_t num_cols) {
+  const size_t half = len / 2;
+
+  for (size_t k = 0; k < half; ++k) {
+    const size_t prev = k == 0 ? 0 : k - 1;
+    Lift<-1, 2>(dst + (2 * k) * dst_stride, src + k * src_stride,
+                src + (half + prev) * src_stride, src + (half + k) * src_stride, num_cols);
+  }
+
+  for (size_t k = 0; k < half; ++k) {
+    const size_t next = std::min(k + 1, half - 1);
+    Lift<+1, 1>(dst + (2 * k + 1) * dst_stride, src + (half + k) * src_stride,
+                dst + (2 * k) * dst_stride, dst + (2 * next) * dst_stride, num_cols);
+  }
+}
+
+#ifndef NDEBUG
+static bool IsValidBlockDim(size_t dim) {
+  return dim >= 2 && dim <= kMaxDim && (dim & (dim - 1)) == 0;
+}
+#endif
+
+}  // namespace
+
+namespace MPTC {
+
+void ForwardWaveletBlock(int16_t *block, size_t rowbytes, size_t dim) {
+  assert(IsValidBlockDim(dim));
+  assert(rowbytes % sizeof(int16_t) == 0);
+  const size_t stride = rowbytes / sizeof(int16_t);
+  int16_t scratch[kMaxDim * kMaxDim];
+
+  // Like ForwardWavelet2D: columns, then rows, for dim, dim / 2, ... 2
+  for (size_t len = dim; len >= 2; len /= 2) {
+    ForwardCols(block, stride, scratch, kMaxDim, len, len);
+    ForwardRows(scratch, kMaxDim, block, stride, len, len);
+  }
+}
+
+void InverseWaveletBlock(int16_t *block, size_t rowbytes, size_t dim) {
+  assert(IsValidBlockDim(dim));
+  assert(rowbytes % sizeof(int16_t) == 0);
+  const size_t stride = rowbytes / sizeof(int16_t);
+  int16_t scratch[kMaxDim * kMaxDim];
+
+  // Like InverseWavelet2D: rows, then columns, for 2, 4, ... dim
+  for (size_t len = 2; len <= dim; len *= 2) {
+    InverseRows(block, stride, scratch, kMaxDim, len, len);
+    InverseCols(scratch, kMaxDim, block, stride, len, len);
+  }
+}
+
+}  // namespace MPTC
@@ -21,6 +21,17 @@ extern void ForwardWavelet2D(const int16_t *src, size_t src_rowbytes,
 extern void InverseWavelet2D(const int16_t *src, size_t src_rowbytes,
                              int16_t *dst, size_t dst_rowbytes, size_t dim);
 
+const size_t kMaxWaveletBlockDim = 64;
+
+// Runs every level of the 2D transform of a dim x dim block in place, i.e.
+// ForwardWavelet2D for dim, dim / 2, ..., 2 and InverseWavelet2D for
+// 2, 4, ..., dim. Bit exact with those, but vectorized (SSE2 or AVX2 when
+// the compiler targets them) and without any heap allocation. dim must be
+// a power of two no larger than kMaxWaveletBlockDim.
+extern void ForwardWaveletBlock(int16_t *block, size_t rowbytes, size_t dim);
+
+extern void InverseWaveletBlock(int16_t *block, size_t rowbytes, size_t dim);
+
 }  // namespace GenTC
 
 #endif  // __TCAR_WAVELET_H__
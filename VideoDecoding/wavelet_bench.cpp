@@ -0,0 +1,98 @@
+// Bit exactness check and benchmark of the fused wavelet transforms.
+//
+// Usage: wavelet_bench [num_blocks]
+//
+// Runs ForwardWaveletBlock and InverseWaveletBlock against the per level
+// ForwardWavelet2D / InverseWavelet2D reference on random blocks of every
+// supported size, both with small MPTC-like coefficients and with the full
+// 16 bit range. Exits with an error on the first mismatch, then times both
+// versions of the 64x64 inverse used by the decoder.
+
+#include "wavelet.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static const size_t kDim = MPTC::kMaxWaveletBlockDim;
+static const size_t kRowBytes = kDim * sizeof(int16_t);
+
+static void ReferenceForward(int16_t *block, size_t dim) {
+  for (size_t level = dim; level >= 2; level /= 2)
+    MPTC::ForwardWavelet2D(block, kRowBytes, block, kRowBytes, level);
+}
+
+static void ReferenceInverse(int16_t *block, size_t dim) {
+  for (size_t level = 2; level <= dim; level *= 2)
+    MPTC::InverseWavelet2D(block, kRowBytes, block, kRowBytes, level);
+}
+
+static bool CheckBlocks(std::mt19937 &rng, uint32_t num_blocks, int lo, int hi) {
+  std::uniform_int_distribution<int> dist(lo, hi);
+  std::vector<int16_t> input(kDim * kDim), expected(kDim * kDim), actual(kDim * kDim);
+
+  for (size_t dim = 2; dim <= kDim; dim *= 2) {
+    for (uint32_t block = 0; block < num_blocks; block++) {
+      for (int16_t &v : input)
+        v = static_cast<int16_t>(dist(rng));
+
+      expected = input;
+      actual = input;
+      ReferenceForward(expected.data(), dim);
+      MPTC::ForwardWaveletBlock(actual.data(), kRowBytes, dim);
+      if (expected != actual) {
+        std::cerr << "Forward mismatch, dim " << dim << " range [" << lo << ", " << hi << "]" << std::endl;
+        return false;
+      }
+
+      expected = input;
+      actual = input;
+      ReferenceInverse(expected.data(), dim);
+      MPTC::InverseWaveletBlock(actual.data(), kRowBytes, dim);
+      if (expected != actual) {
+        std::cerr << "Inverse mismatch, dim " << dim << " range [" << lo << ", " << hi << "]" << std::endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  uint32_t num_blocks = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 200;
+  std::mt19937 rng(1234);
+
+  if (!CheckBlocks(rng, num_blocks, -128, 127) ||
+      !CheckBlocks(rng, num_blocks, -32768, 32767)) {
+    return 1;
+  }
+  printf("bit exact on %u blocks per size\n", num_blocks);
+
+  // Timing of the decoder's case, a full 64x64 inverse on small coefficients
+  std::uniform_int_distribution<int> dist(-128, 127);
+  std::vector<int16_t> blocks(num_blocks * kDim * kDim);
+  for (int16_t &v : blocks)
+    v = static_cast<int16_t>(dist(rng));
+  std::vector<int16_t> work(blocks);
+
+  Clock::time_point start = Clock::now();
+  for (uint32_t block = 0; block < num_blocks; block++)
+    ReferenceInverse(work.data() + block * kDim * kDim, kDim);
+  double reference_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  work = blocks;
+  start = Clock::now();
+  for (uint32_t block = 0; block < num_blocks; block++)
+    MPTC::InverseWaveletBlock(work.data() + block * kDim * kDim, kRowBytes, kDim);
+  double fused_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  printf("64x64 inverse  reference: %8.2f us/block  fused: %8.2f us/block  (%.1fx)\n",
+         1000.0 * reference_ms / num_blocks, 1000.0 * fused_ms / num_blocks,
+         reference_ms / fused_ms);
+  return 0;
+}
@@ -38,8 +38,13 @@ namespace crnd
    typedef unsigned int       uint;
    typedef signed int         int32;
 #ifndef PLATFORM_NACL
+#ifdef _MSC_VER
    typedef unsigned __int64   uint64;
    typedef signed __int64     int64;
+#else
+   typedef unsigned long long uint64;
+   typedef signed long long   int64;
+#endif
 #endif
 
    // The crnd library assumes all allocation blocks have at least CRND_MIN_ALLOC_ALIGNMENT alignment.
@@ -173,6 +178,43 @@ namespace crnd
       void** ppDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
       uint32 level_index);
 
+   // Parallel unpacking of DXT1 levels.
+   // The chunks (2x2 DXT blocks) of a level are coded in one stream, row by row, the chunk rows of all faces one after the other.
+   // A restart point holds the state of the decoder at the start of a chunk row, so a level can be unpacked in bands of chunk rows
+   // that each start at a restart point, on any number of threads at once. The points only depend on the file: build them once
+   // with crnd_get_restart_points() and store them with it. They are plain data, but not endian-swapped.
+   struct crn_restart_point
+   {
+      uint32 m_chunk_row;                    // counted over all faces
+      uint32 m_byte_ofs;                     // of the next byte the decoder reads, from the start of the level's data
+      uint32 m_bit_buf;
+      int32  m_bit_count;
+      uint32 m_chunk_encoding_bits;
+      uint32 m_prev_color_endpoint_index;
+      uint32 m_prev_color_selector_index;
+   };
+
+   // crnd_get_restart_points() - Decodes the level's stream without writing any blocks, and records a restart point at the start of
+   // every rows_per_point'th chunk row, the first one at row 0. Decoding stops at the last point.
+   // A level has m_faces * ((m_blocks_y + 1) / 2) chunk rows, see crnd_get_level_info().
+   // Returns the number of points written to pPoints, at most max_points, or 0 if the level isn't DXT1, the file is segmented,
+   // or any of the input parameters are invalid.
+   // This function does not allocate any memory.
+   uint32 crnd_get_restart_points(
+      crnd_unpack_context pContext,
+      uint32 level_index, uint32 rows_per_point,
+      crn_restart_point* pPoints, uint32 max_points);
+
+   // crnd_unpack_level_rows() - Unpacks the chunk rows of a DXT1 level from start_point.m_chunk_row up to end_chunk_row, which is
+   // exclusive and clamped to the level (usually the next point's row, or UINT32_MAX). The other parameters are those of crnd_unpack_level(),
+   // ppDst still points to the start of the level, and the blocks written are identical to the ones crnd_unpack_level() writes.
+   // Any number of threads may call this function at once on the same context.
+   // This function does not allocate any memory.
+   bool crnd_unpack_level_rows(
+      crnd_unpack_context pContext,
+      void** ppDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
+      uint32 level_index, const crn_restart_point& start_point, uint32 end_chunk_row);
+
    // crnd_unpack_end() - Frees the decompress tables and unpacked palettes associated with the specified context.
    // Returns false if the context is NULL, or if it points to an invalid context.
    // This function frees all memory associated with the context.
@@ -319,6 +361,14 @@ namespace crnd
 #include <stdarg.h>
 #include <new> // needed for placement new, _msize, _expand
 
+// Outside of MSVC the block size comes from malloc_usable_size(), and blocks are never resized in place
+#if defined(PLATFORM_NACL) || !defined(_MSC_VER)
+#define CRND_MALLOC_USABLE_SIZE 1
+#endif
+#if !defined(_MSC_VER) && !defined(PLATFORM_NACL)
+#include <malloc.h>
+#endif
+
 #define CRND_RESTRICT __restrict
 
 #ifdef _MSC_VER
@@ -370,7 +420,7 @@ namespace crnd
 
    const uint32 cIntBits = 32U;
 
-#ifdef _WIN64
+#if defined(_WIN64) || defined(__LP64__)
    typedef uint64 ptr_bits;
 #else
    typedef uint32 ptr_bits;
@@ -532,8 +582,13 @@ namespace crnd
    CRND_DEFINE_BUILT_IN_TYPE(long)
    CRND_DEFINE_BUILT_IN_TYPE(unsigned long)
 #ifndef PLATFORM_NACL
+#ifdef _MSC_VER
    CRND_DEFINE_BUILT_IN_TYPE(__int64)
    CRND_DEFINE_BUILT_IN_TYPE(unsigned __int64)
+#else
+   CRND_DEFINE_BUILT_IN_TYPE(long long)
+   CRND_DEFINE_BUILT_IN_TYPE(unsigned long long)
+#endif
 #endif
    CRND_DEFINE_BUILT_IN_TYPE(float)
    CRND_DEFINE_BUILT_IN_TYPE(double)
@@ -2421,7 +2476,7 @@ namespace crnd
          p_new = ::malloc(size);
 
          if (pActual_size)
-#ifdef PLATFORM_NACL
+#ifdef CRND_MALLOC_USABLE_SIZE
             *pActual_size = p_new ? malloc_usable_size(p_new) : 0;
 #else
             *pActual_size = p_new ? ::_msize(p_new) : 0; 
@@ -2438,10 +2493,12 @@ namespace crnd
       else
       {
          void* p_final_block = p;
-#ifdef PLATFORM_NACL
+#if defined(PLATFORM_NACL)
          p_new = ::realloc(p, size);
-#else
+#elif defined(_MSC_VER)
          p_new = ::_expand(p, size);
+#else
+         p_new = NULL;
 #endif
 
          if (p_new)
@@ -2455,7 +2512,7 @@ namespace crnd
          }
 
          if (pActual_size)
-#ifdef PLATFORM_NACL
+#ifdef CRND_MALLOC_USABLE_SIZE
             *pActual_size = ::malloc_usable_size(p_final_block);
 #else
             *pActual_size = ::_msize(p_final_block);
@@ -2468,7 +2525,7 @@ namespace crnd
    static size_t crnd_default_msize(void* p, void* pUser_data)
    {
       pUser_data;
-#ifdef PLATFORM_NACL
+#ifdef CRND_MALLOC_USABLE_SIZE
       return p ? malloc_usable_size(p) : 0;
 #else
       return p ? _msize(p) : 0;
@@ -2524,7 +2581,7 @@ namespace crnd
          return NULL;
       }
 
-      CRND_ASSERT(((uint32)p_new & (CRND_MIN_ALLOC_ALIGNMENT - 1)) == 0);
+      CRND_ASSERT(((uint32)reinterpret_cast<ptr_bits>(p_new) & (CRND_MIN_ALLOC_ALIGNMENT - 1)) == 0);
 
       return p_new;
    }
@@ -2549,7 +2606,7 @@ namespace crnd
       if (pActual_size)
          *pActual_size = actual_size;
 
-      CRND_ASSERT(((uint32)p_new & (CRND_MIN_ALLOC_ALIGNMENT - 1)) == 0);
+      CRND_ASSERT(((uint32)reinterpret_cast<ptr_bits>(p_new) & (CRND_MIN_ALLOC_ALIGNMENT - 1)) == 0);
 
       return p_new;
    }
@@ -2815,15 +2872,15 @@ namespace crnd
          *pSize = 0;
 
       if ((!pData) || (data_size < cCRNHeaderMinSize))
-         return false;
+         return NULL;
 
       crn_header tmp_header;
       const crn_header* pHeader = crnd_get_header(tmp_header, pData, data_size);
       if (!pHeader)
-         return false;
+         return NULL;
 
       if (level_index >= pHeader->m_levels)
-         return false;
+         return NULL;
 
       uint32 cur_level_ofs = pHeader->m_level_ofs[level_index];
 
@@ -3774,6 +3831,59 @@ namespace crnd
          return true;
       }
 
+      uint32 get_restart_points(uint32 level_index, uint32 rows_per_point, crn_restart_point* pPoints, uint32 max_points) const
+      {
+         const uint8* pSrc;
+         uint32 src_size_in_bytes, row_pitch_in_bytes = 0, blocks_x, blocks_y;
+         if ((!pPoints) || (!max_points) || (!rows_per_point) ||
+             (!get_dxt1_level(level_index, cUINT32_MAX, row_pitch_in_bytes, pSrc, src_size_in_bytes, blocks_x, blocks_y)))
+            return 0;
+
+         const uint32 chunks_x = (blocks_x + 1) >> 1;
+         const uint32 chunks_y = (blocks_y + 1) >> 1;
+
+         symbol_codec codec;
+         if (!codec.start_decoding(pSrc, src_size_in_bytes))
+            return 0;
+
+         return scan_dxt1_rows(codec, chunks_x, m_pHeader->m_faces * chunks_y, rows_per_point, pPoints, max_points);
+      }
+
+      bool unpack_level_rows(
+         void** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
+         uint32 level_index, const crn_restart_point& start_point, uint32 end_chunk_row) const
+      {
+#ifdef CRND_BUILD_DEBUG
+         for (uint32 f = 0; f < m_pHeader->m_faces; f++)
+            if (!pDst[f])
+               return false;
+#endif
+
+         const uint8* pSrc;
+         uint32 src_size_in_bytes, blocks_x, blocks_y;
+         if (!get_dxt1_level(level_index, dst_size_in_bytes, row_pitch_in_bytes, pSrc, src_size_in_bytes, blocks_x, blocks_y))
+            return false;
+
+         const uint32 chunks_x = (blocks_x + 1) >> 1;
+         const uint32 chunks_y = (blocks_y + 1) >> 1;
+
+         end_chunk_row = math::minimum(end_chunk_row, m_pHeader->m_faces * chunks_y);
+         if ((start_point.m_chunk_row > end_chunk_row) || (start_point.m_byte_ofs > src_size_in_bytes) ||
+             (start_point.m_bit_count < 0) || (start_point.m_bit_count > (int32)symbol_codec::cBitBufSize))
+            return false;
+
+         // A codec of its own, so that bands don't share any state
+         symbol_codec codec;
+         if (!codec.start_decoding(pSrc, src_size_in_bytes))
+            return false;
+         codec.m_pDecode_buf_next = pSrc + start_point.m_byte_ofs;
+         codec.m_bit_buf = start_point.m_bit_buf;
+         codec.m_bit_count = start_point.m_bit_count;
+
+         crn_restart_point state = start_point;
+         return unpack_dxt1_rows(codec, state, (uint8**)pDst, row_pitch_in_bytes, blocks_x, blocks_y, chunks_x, chunks_y, end_chunk_row);
+      }
+
       inline const void* get_data() const { return m_pData; }
       inline uint32 get_data_size() const { return m_data_size; }
 
@@ -4145,25 +4255,139 @@ namespace crnd
          x = (x & msk) | (v & ~msk);
       }
 
-      bool unpack_dxt1(uint8** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes, uint32 blocks_x, uint32 blocks_y, uint32 chunks_x, uint32 chunks_y)
+      // The level's data and layout, checked as unpack_level() checks them. row_pitch_in_bytes 0 is the minimal pitch.
+      bool get_dxt1_level(uint32 level_index, uint32 dst_size_in_bytes, uint32& row_pitch_in_bytes,
+         const uint8*& pSrc, uint32& src_size_in_bytes, uint32& blocks_x, uint32& blocks_y) const
       {
-         dst_size_in_bytes;
+         if ((level_index >= m_pHeader->m_levels) || (m_pHeader->m_format != cCRNFmtDXT1) || (m_pHeader->m_flags & cCRNHeaderFlagSegmented))
+            return false;
 
-         uint32 chunk_encoding_bits = 1;
+         const uint32 cur_level_ofs = m_pHeader->m_level_ofs[level_index];
 
+         uint32 next_level_ofs = m_data_size;
+         if ((level_index + 1) < (m_pHeader->m_levels))
+            next_level_ofs = m_pHeader->m_level_ofs[level_index + 1];
+
+         if ((next_level_ofs <= cur_level_ofs) || (next_level_ofs > m_data_size))
+            return false;
+
+         pSrc = m_pData + cur_level_ofs;
+         src_size_in_bytes = next_level_ofs - cur_level_ofs;
+
+         const uint32 width = math::maximum(m_pHeader->m_width >> level_index, 1U);
+         const uint32 height = math::maximum(m_pHeader->m_height >> level_index, 1U);
+         blocks_x = (width + 3U) >> 2U;
+         blocks_y = (height + 3U) >> 2U;
+
+         const uint32 minimal_row_pitch = 8 * blocks_x;
+         if (!row_pitch_in_bytes)
+            row_pitch_in_bytes = minimal_row_pitch;
+         else if ((row_pitch_in_bytes < minimal_row_pitch) || (row_pitch_in_bytes & 3))
+            return false;
+         if (dst_size_in_bytes < row_pitch_in_bytes * blocks_y)
+            return false;
+
+         return true;
+      }
+
+      // Decodes the first chunk rows of a DXT1 level like unpack_dxt1_rows(), without writing any blocks, and records the
+      // state at the start of every rows_per_point'th row. Returns the number of points recorded.
+      uint32 scan_dxt1_rows(symbol_codec& codec, uint32 chunks_x, uint32 num_chunk_rows,
+         uint32 rows_per_point, crn_restart_point* pPoints, uint32 max_points) const
+      {
          const uint32 num_color_endpoints = m_color_endpoints.size();
          const uint32 num_color_selectors = m_color_selectors.size();
 
+         uint32 chunk_encoding_bits = 1;
          uint32 prev_color_endpoint_index = 0;
          uint32 prev_color_selector_index = 0;
 
-         const uint32 num_faces = m_pHeader->m_faces;
+         uint32 num_points = 0;
+
+         CRND_HUFF_DECODE_BEGIN(codec);
+
+         for (uint32 chunk_row = 0; chunk_row < num_chunk_rows; chunk_row++)
+         {
+            if ((chunk_row % rows_per_point) == 0)
+            {
+               crn_restart_point& point = pPoints[num_points++];
+               point.m_chunk_row = chunk_row;
+               point.m_byte_ofs = (uint32)(codec.m_pDecode_buf_next - codec.m_pDecode_buf);
+               point.m_bit_buf = codec.m_bit_buf;
+               point.m_bit_count = codec.m_bit_count;
+               point.m_chunk_encoding_bits = chunk_encoding_bits;
+               point.m_prev_color_endpoint_index = prev_color_endpoint_index;
+               point.m_prev_color_selector_index = prev_color_selector_index;
+
+               if ((num_points == max_points) || ((chunk_row + rows_per_point) >= num_chunk_rows))
+                  break;
+            }
+
+            // Every chunk codes its 4 selectors, whether all of its blocks are written or not, and the direction of the
+            // row doesn't matter either
+            for (uint32 x = 0; x < chunks_x; x++)
+            {
+               if (chunk_encoding_bits == 1)
+               {
+                  CRND_HUFF_DECODE(codec, m_chunk_encoding_dm, chunk_encoding_bits);
+                  chunk_encoding_bits |= 512;
+               }
+
+               const uint32 num_tiles = g_crnd_chunk_encoding_num_tiles[chunk_encoding_bits & 7];
+               chunk_encoding_bits >>= 3;
+
+               for (uint32 i = 0; i < num_tiles; i++)
+               {
+                  uint32 delta;
+                  CRND_HUFF_DECODE(codec, m_endpoint_delta_dm[0], delta);
+                  prev_color_endpoint_index += delta;
+                  limit(prev_color_endpoint_index, num_color_endpoints);
+               }
+
+               for (uint32 i = 0; i < 4; i++)
+               {
+                  uint32 delta;
+                  CRND_HUFF_DECODE(codec, m_selector_delta_dm[0], delta);
+                  prev_color_selector_index += delta;
+                  limit(prev_color_selector_index, num_color_selectors);
+               }
+            }
+         }
+
+         CRND_HUFF_DECODE_END(codec);
+
+         return num_points;
+      }
+
+      bool unpack_dxt1(uint8** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes, uint32 blocks_x, uint32 blocks_y, uint32 chunks_x, uint32 chunks_y)
+      {
+         dst_size_in_bytes;
+
+         crn_restart_point state;
+         utils::zero_object(state);
+         state.m_chunk_encoding_bits = 1;
+
+         return unpack_dxt1_rows(m_codec, state, pDst, row_pitch_in_bytes, blocks_x, blocks_y, chunks_x, chunks_y, m_pHeader->m_faces * chunks_y);
+      }
+
+      // Unpacks the chunk rows from state.m_chunk_row up to end_chunk_row with codec, which has to be at that row,
+      // and leaves the state at end_chunk_row in state
+      bool unpack_dxt1_rows(symbol_codec& codec, crn_restart_point& state, uint8** pDst, uint32 row_pitch_in_bytes,
+         uint32 blocks_x, uint32 blocks_y, uint32 chunks_x, uint32 chunks_y, uint32 end_chunk_row) const
+      {
+         uint32 chunk_encoding_bits = state.m_chunk_encoding_bits;
+
+         const uint32 num_color_endpoints = m_color_endpoints.size();
+         const uint32 num_color_selectors = m_color_selectors.size();
+
+         uint32 prev_color_endpoint_index = state.m_prev_color_endpoint_index;
+         uint32 prev_color_selector_index = state.m_prev_color_selector_index;
 
          const uint32 row_pitch_in_dwords = row_pitch_in_bytes >> 2U;
 
          const int32 cBytesPerBlock = 8;
 
-         CRND_HUFF_DECODE_BEGIN(m_codec);
+         CRND_HUFF_DECODE_BEGIN(codec);
 
 #if CRND_CREATE_BYTE_STREAMS
          vector<uint8> tile_encoding_stream;
@@ -4171,156 +4395,161 @@ namespace crnd
          vector<uint8> selector_indices_stream;
 #endif
 
-         for (uint32 f = 0; f < num_faces; f++)
+         for (uint32 chunk_row = state.m_chunk_row; chunk_row < end_chunk_row; chunk_row++)
          {
-            uint8* CRND_RESTRICT pRow = pDst[f];
+            const uint32 f = chunk_row / chunks_y;
+            const uint32 y = chunk_row - f * chunks_y;
 
-            for (uint32 y = 0; y < chunks_y; y++)
+            uint8* CRND_RESTRICT pRow = pDst[f] + row_pitch_in_bytes * 2 * y;
+
+            int32 start_x = 0;
+            int32 end_x = chunks_x;
+            int32 dir_x = 1;
+            int32 block_delta = cBytesPerBlock*2;
+            uint8* CRND_RESTRICT pBlock = pRow;
+
+            if (y & 1)
             {
-               int32 start_x = 0;
-               int32 end_x = chunks_x;
-               int32 dir_x = 1;
-               int32 block_delta = cBytesPerBlock*2;
-               uint8* CRND_RESTRICT pBlock = pRow;
+               start_x = chunks_x - 1;
+               end_x = -1;
+               dir_x = -1;
+               block_delta = -cBytesPerBlock*2;
+               pBlock += (chunks_x - 1) * cBytesPerBlock * 2;
+            }
 
-               if (y & 1)
-               {
-                  start_x = chunks_x - 1;
-                  end_x = -1;
-                  dir_x = -1;
-                  block_delta = -cBytesPerBlock*2;
-                  pBlock += (chunks_x - 1) * cBytesPerBlock * 2;
-               }
+            const bool skip_bottom_row = (y == (chunks_y - 1)) && (blocks_y & 1);
 
-               const bool skip_bottom_row = (y == (chunks_y - 1)) && (blocks_y & 1);
+            for (int32 x = start_x; x != end_x; x += dir_x)
+            {
+               uint32 color_endpoints[4];
 
-               for (int32 x = start_x; x != end_x; x += dir_x)
+               if (chunk_encoding_bits == 1)
                {
-                  uint32 color_endpoints[4];
-
-                  if (chunk_encoding_bits == 1)
-                  {
-                     CRND_HUFF_DECODE(m_codec, m_chunk_encoding_dm, chunk_encoding_bits);
+                  CRND_HUFF_DECODE(codec, m_chunk_encoding_dm, chunk_encoding_bits);
 #if CRND_CREATE_BYTE_STREAMS
-                     tile_encoding_stream.push_back(chunk_encoding_bits & 7);
-                     tile_encoding_stream.push_back((chunk_encoding_bits >> 3) & 7);
-                     tile_encoding_stream.push_back((chunk_encoding_bits >> 6) & 7);
+                  tile_encoding_stream.push_back(chunk_encoding_bits & 7);
+                  tile_encoding_stream.push_back((chunk_encoding_bits >> 3) & 7);
+                  tile_encoding_stream.push_back((chunk_encoding_bits >> 6) & 7);
 #endif
-                     chunk_encoding_bits |= 512;
-                  }
+                  chunk_encoding_bits |= 512;
+               }
 
-                  const uint32 chunk_encoding_index = chunk_encoding_bits & 7;
-                  chunk_encoding_bits >>= 3;
+               const uint32 chunk_encoding_index = chunk_encoding_bits & 7;
+               chunk_encoding_bits >>= 3;
 
-                  const uint32 num_tiles = g_crnd_chunk_encoding_num_tiles[chunk_encoding_index];
+               const uint32 num_tiles = g_crnd_chunk_encoding_num_tiles[chunk_encoding_index];
 
-                  for (uint32 i = 0; i < num_tiles; i++)
-                  {
-                     uint32 delta;
-                     CRND_HUFF_DECODE(m_codec, m_endpoint_delta_dm[0], delta);
+               for (uint32 i = 0; i < num_tiles; i++)
+               {
+                  uint32 delta;
+                  CRND_HUFF_DECODE(codec, m_endpoint_delta_dm[0], delta);
 #if CRND_CREATE_BYTE_STREAMS
-                     endpoint_indices_stream.push_back(delta);
+                  endpoint_indices_stream.push_back(delta);
 #endif
-                     prev_color_endpoint_index += delta;
-                     limit(prev_color_endpoint_index, num_color_endpoints);
-                     color_endpoints[i] = m_color_endpoints[prev_color_endpoint_index];
-                  }
+                  prev_color_endpoint_index += delta;
+                  limit(prev_color_endpoint_index, num_color_endpoints);
+                  color_endpoints[i] = m_color_endpoints[prev_color_endpoint_index];
+               }
 
-                  const uint8* pTile_indices = g_crnd_chunk_encoding_tiles[chunk_encoding_index].m_tiles;
+               const uint8* pTile_indices = g_crnd_chunk_encoding_tiles[chunk_encoding_index].m_tiles;
 
-                  const bool skip_right_col = (blocks_x & 1) && (x == ((int32)chunks_x - 1));
+               const bool skip_right_col = (blocks_x & 1) && (x == ((int32)chunks_x - 1));
 
-                  uint32* CRND_RESTRICT pD = (uint32*)pBlock;
+               uint32* CRND_RESTRICT pD = (uint32*)pBlock;
 
-                  if ((!skip_bottom_row) && (!skip_right_col))
-                  {
-                     //CRND_ASSERT( ((uint8*)&pD[4 + row_pitch_in_dwords] - pDst) <= dst_size_in_bytes );
+               if ((!skip_bottom_row) && (!skip_right_col))
+               {
+                  //CRND_ASSERT( ((uint8*)&pD[4 + row_pitch_in_dwords] - pDst) <= dst_size_in_bytes );
 
-                     pD[0] = color_endpoints[pTile_indices[0]];
-                     CRND_WRITE_BARRIER
-                     uint32 delta0;
-                     CRND_HUFF_DECODE(m_codec, m_selector_delta_dm[0], delta0);
+                  pD[0] = color_endpoints[pTile_indices[0]];
+                  CRND_WRITE_BARRIER
+                  uint32 delta0;
+                  CRND_HUFF_DECODE(codec, m_selector_delta_dm[0], delta0);
 #if CRND_CREATE_BYTE_STREAMS
-                     selector_indices_stream.push_back(delta0);
+                  selector_indices_stream.push_back(delta0);
 #endif
-                     prev_color_selector_index += delta0;
-                     limit(prev_color_selector_index, num_color_selectors);
-                     pD[1] = m_color_selectors[prev_color_selector_index];
-                     CRND_WRITE_BARRIER
-
-                     pD[2] = color_endpoints[pTile_indices[1]];
-                     CRND_WRITE_BARRIER
-                     uint32 delta1;
-                     CRND_HUFF_DECODE(m_codec, m_selector_delta_dm[0], delta1);
+                  prev_color_selector_index += delta0;
+                  limit(prev_color_selector_index, num_color_selectors);
+                  pD[1] = m_color_selectors[prev_color_selector_index];
+                  CRND_WRITE_BARRIER
+
+                  pD[2] = color_endpoints[pTile_indices[1]];
+                  CRND_WRITE_BARRIER
+                  uint32 delta1;
+                  CRND_HUFF_DECODE(codec, m_selector_delta_dm[0], delta1);
 #if CRND_CREATE_BYTE_STREAMS
-                     selector_indices_stream.push_back(delta1);
+                  selector_indices_stream.push_back(delta1);
 #endif
-                     prev_color_selector_index += delta1;
-                     limit(prev_color_selector_index, num_color_selectors);
-                     pD[3] = m_color_selectors[prev_color_selector_index];
-                     CRND_WRITE_BARRIER
-
-                     pD[0 + row_pitch_in_dwords] = color_endpoints[pTile_indices[2]];
-                     CRND_WRITE_BARRIER
-                     uint32 delta2;
-                     CRND_HUFF_DECODE(m_codec, m_selector_delta_dm[0], delta2);
+                  prev_color_selector_index += delta1;
+                  limit(prev_color_selector_index, num_color_selectors);
+                  pD[3] = m_color_selectors[prev_color_selector_index];
+                  CRND_WRITE_BARRIER
+
+                  pD[0 + row_pitch_in_dwords] = color_endpoints[pTile_indices[2]];
+                  CRND_WRITE_BARRIER
+                  uint32 delta2;
+                  CRND_HUFF_DECODE(codec, m_selector_delta_dm[0], delta2);
 #if CRND_CREATE_BYTE_STREAMS
-                     selector_indices_stream.push_back(delta2);
+                  selector_indices_stream.push_back(delta2);
 #endif
-                     prev_color_selector_index += delta2;
-                     limit(prev_color_selector_index, num_color_selectors);
-                     pD[1 + row_pitch_in_dwords] = m_color_selectors[prev_color_selector_index];
-                     CRND_WRITE_BARRIER
-
-                     pD[2 + row_pitch_in_dwords] = color_endpoints[pTile_indices[3]];
-                     CRND_WRITE_BARRIER
-                     uint32 delta3;
-                     CRND_HUFF_DECODE(m_codec, m_selector_delta_dm[0], delta3);
+                  prev_color_selector_index += delta2;
+                  limit(prev_color_selector_index, num_color_selectors);
+                  pD[1 + row_pitch_in_dwords] = m_color_selectors[prev_color_selector_index];
+                  CRND_WRITE_BARRIER
+
+                  pD[2 + row_pitch_in_dwords] = color_endpoints[pTile_indices[3]];
+                  CRND_WRITE_BARRIER
+                  uint32 delta3;
+                  CRND_HUFF_DECODE(codec, m_selector_delta_dm[0], delta3);
 #if CRND_CREATE_BYTE_STREAMS
-                     selector_indices_stream.push_back(delta3);
+                  selector_indices_stream.push_back(delta3);
 #endif
-                     prev_color_selector_index += delta3;
-                     limit(prev_color_selector_index, num_color_selectors);
-                     pD[3 + row_pitch_in_dwords] = m_color_selectors[prev_color_selector_index];
-                     CRND_WRITE_BARRIER
-                  }
-                  else
+                  prev_color_selector_index += delta3;
+                  limit(prev_color_selector_index, num_color_selectors);
+                  pD[3 + row_pitch_in_dwords] = m_color_selectors[prev_color_selector_index];
+                  CRND_WRITE_BARRIER
+               }
+               else
+               {
+                  for (uint32 by = 0; by < 2; by++)
                   {
-                     for (uint32 by = 0; by < 2; by++)
+                     pD = (uint32*)((uint8*)pBlock + row_pitch_in_bytes * by);
+                     for (uint32 bx = 0; bx < 2; bx++, pD += 2)
                      {
-                        pD = (uint32*)((uint8*)pBlock + row_pitch_in_bytes * by);
-                        for (uint32 bx = 0; bx < 2; bx++, pD += 2)
-                        {
-                           uint32 delta;
-                           CRND_HUFF_DECODE(m_codec, m_selector_delta_dm[0], delta);
+                        uint32 delta;
+                        CRND_HUFF_DECODE(codec, m_selector_delta_dm[0], delta);
 #if CRND_CREATE_BYTE_STREAMS
-                           selector_indices_stream.push_back(delta);
+                        selector_indices_stream.push_back(delta);
 #endif
-                           prev_color_selector_index += delta;
-                           limit(prev_color_selector_index, num_color_selectors);
-
-                           if (!((bx && skip_right_col) || (by && skip_bottom_row)))
-                           {
-                              pD[0] = color_endpoints[pTile_indices[bx + by * 2]];
-                              CRND_WRITE_BARRIER
-                              pD[1] = m_color_selectors[prev_color_selector_index];
-                              CRND_WRITE_BARRIER
-                           }
+                        prev_color_selector_index += delta;
+                        limit(prev_color_selector_index, num_color_selectors);
+
+                        if (!((bx && skip_right_col) || (by && skip_bottom_row)))
+                        {
+                           pD[0] = color_endpoints[pTile_indices[bx + by * 2]];
+                           CRND_WRITE_BARRIER
+                           pD[1] = m_color_selectors[prev_color_selector_index];
+                           CRND_WRITE_BARRIER
                         }
                      }
                   }
+               }
 
-                  pBlock += block_delta;
+               pBlock += block_delta;
 
-               } // x
+            } // x
 
-               pRow += row_pitch_in_bytes * 2;
+         } // chunk_row
 
-            } // y
+         state.m_chunk_row = end_chunk_row;
+         state.m_byte_ofs = (uint32)(codec.m_pDecode_buf_next - codec.m_pDecode_buf);
+         state.m_bit_buf = codec.m_bit_buf;
+         state.m_bit_count = codec.m_bit_count;
+         state.m_chunk_encoding_bits = chunk_encoding_bits;
+         state.m_prev_color_endpoint_index = prev_color_endpoint_index;
+         state.m_prev_color_selector_index = prev_color_selector_index;
 
-         } // f
-
-         CRND_HUFF_DECODE_END(m_codec);
+         CRND_HUFF_DECODE_END(codec);
 
 #if CRND_CREATE_BYTE_STREAMS
          write_array_to_file(L"tile_encodings.bin", tile_encoding_stream);
@@ -4803,6 +5032,38 @@ namespace crnd
       return pUnpacker->unpack_level(pSrc, src_size_in_bytes, pDst, dst_size_in_bytes, row_pitch_in_bytes, level_index);
    }
 
+   uint32 crnd_get_restart_points(
+      crnd_unpack_context pContext,
+      uint32 level_index, uint32 rows_per_point,
+      crn_restart_point* pPoints, uint32 max_points)
+   {
+      if ((!pContext) || (level_index >= cCRNMaxLevels))
+         return 0;
+
+      crn_unpacker* pUnpacker = static_cast<crn_unpacker*>(pContext);
+
+      if (!pUnpacker->is_valid())
+         return 0;
+
+      return pUnpacker->get_restart_points(level_index, rows_per_point, pPoints, max_points);
+   }
+
+   bool crnd_unpack_level_rows(
+      crnd_unpack_context pContext,
+      void** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
+      uint32 level_index, const crn_restart_point& start_point, uint32 end_chunk_row)
+   {
+      if ((!pContext) || (!pDst) || (dst_size_in_bytes < 8U) || (level_index >= cCRNMaxLevels))
+         return false;
+
+      const crn_unpacker* pUnpacker = static_cast<const crn_unpacker*>(pContext);
+
+      if (!pUnpacker->is_valid())
+         return false;
+
+      return pUnpacker->unpack_level_rows(pDst, dst_size_in_bytes, row_pitch_in_bytes, level_index, start_point, end_chunk_row);
+   }
+
    bool crnd_unpack_end(crnd_unpack_context pContext)
    {
       if (!pContext)
@@ -441,10 +441,25 @@ typedef struct
 
 STBIDEF stbi_uc *stbi_load               (char              const *filename,           int *x, int *y, int *comp, int req_comp);
 STBIDEF stbi_uc *stbi_load_from_memory   (stbi_uc           const *buffer, int len   , int *x, int *y, int *comp, int req_comp);
-STBIDEF void stbi_load_from_memory_into_dst(unsigned char *dst, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp);
+// Returns 0 if the image could not be decoded, dst is then only partly written
+STBIDEF int stbi_load_from_memory_into_dst(unsigned char *dst, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp);
 STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk  , void *user, int *x, int *y, int *comp, int req_comp);
 STBIDEF void stbi_load_into_dst(unsigned char *dst, char const *filename, int *x, int *y, int *comp, int req_comp);
 
+// Decodes a baseline JPEG with restart markers (DRI) in bands of MCU rows,
+// each band from the restart marker it starts on, so that the bands can be
+// decoded on several threads at once. The output is the same as
+// stbi_load_from_memory's. stbi_jpeg_bands_begin parses the headers and
+// finds the restart markers, it returns NULL for images it can't split,
+// such as progressive ones or ones without restart markers. Bands have to
+// start on a multiple of *band_rows of the *mcu_rows MCU rows, and every
+// call writes the pixel rows of its band to dst, which holds the whole
+// image. The buffer has to outlive the bands.
+typedef struct stbi__jpeg_bands stbi_jpeg_bands;
+STBIDEF stbi_jpeg_bands *stbi_jpeg_bands_begin(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int *mcu_rows, int *band_rows);
+STBIDEF int stbi_jpeg_bands_decode(stbi_jpeg_bands const *bands, unsigned char *dst, int req_comp, int first_mcu_row, int end_mcu_row);
+STBIDEF void stbi_jpeg_bands_end(stbi_jpeg_bands *bands);
+
 #ifndef STBI_NO_STDIO
 STBIDEF stbi_uc *stbi_load_from_file  (FILE *f,                  int *x, int *y, int *comp, int req_comp);
 // for stbi_load_from_file, file pointer is left pointing immediately after image
@@ -836,7 +851,7 @@ static void stbi__rewind(stbi__context *s)
 static int      stbi__jpeg_test(stbi__context *s);
 static stbi_uc *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp);
 static int      stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp);
-static void stbi__jpeg_load_into_dst(unsigned char *dst, stbi__context *s, int *x, int *y, int *comp, int req_comp);
+static int stbi__jpeg_load_into_dst(unsigned char *dst, stbi__context *s, int *x, int *y, int *comp, int req_comp);
 #endif
 
 #ifndef STBI_NO_PNG
@@ -1006,9 +1021,10 @@ static unsigned char *stbi__load_flip(stbi__context *s, int *x, int *y, int *com
    return result;
 }
 
-static void stbi__load_flip_into_dst(unsigned char *result, stbi__context *s, int *x, int *y, int *comp, int req_comp)
+static int stbi__load_flip_into_dst(unsigned char *result, stbi__context *s, int *x, int *y, int *comp, int req_comp)
 {
-	 stbi__jpeg_load_into_dst(result,s, x, y, comp, req_comp);
+	if (!stbi__jpeg_load_into_dst(result,s, x, y, comp, req_comp))
+		return 0;
 
 	if (stbi__vertically_flip_on_load && result != NULL) {
 		int w = *x, h = *y;
@@ -1028,7 +1044,7 @@ static void stbi__load_flip_into_dst(unsigned char *result, stbi__context *s, in
 		}
 	}
 
-	
+	return 1;
 }
 
 
@@ -1127,11 +1143,11 @@ STBIDEF stbi_uc *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, i
    return stbi__load_flip(&s,x,y,comp,req_comp);
 }
 
-STBIDEF void stbi_load_from_memory_into_dst(unsigned char *dst, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+STBIDEF int stbi_load_from_memory_into_dst(unsigned char *dst, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
 {
 	stbi__context s;
 	stbi__start_mem(&s, buffer, len);
-	stbi__load_flip_into_dst(dst, &s, x, y, comp, req_comp);
+	return stbi__load_flip_into_dst(dst, &s, x, y, comp, req_comp);
 }
 
 STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
@@ -3471,16 +3487,16 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    }
 }
 
-static void load_jpeg_image_into_dst(stbi_uc *output,stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+static int load_jpeg_image_into_dst(stbi_uc *output,stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
 {
 	int n, decode_n;
 	z->s->img_n = 0; // make stbi__cleanup_jpeg safe
 
 	// validate req_comp
-	if (req_comp < 0 || req_comp > 4)  stbi__errpuc("bad req_comp", "Internal error");
+	if (req_comp < 0 || req_comp > 4)  return stbi__err("bad req_comp", "Internal error");
 
 	// load a jpeg image from whichever source, but leave in YCbCr format
-	if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z);  NULL; }
+	if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z);  return 0; }
 
 	// determine actual number of components to generate
 	n = req_comp ? req_comp : z->s->img_n;
@@ -3505,7 +3521,7 @@ static void load_jpeg_image_into_dst(stbi_uc *output,stbi__jpeg *z, int *out_x,
 			// allocate line buffer big enough for upsampling off the edges
 			// with upsample factor of 4
 			z->img_comp[k].linebuf = (stbi_uc *)stbi__malloc(z->s->img_x + 3);
-			if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z);  stbi__errpuc("outofmem", "Out of memory"); }
+			if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z);  return stbi__err("outofmem", "Out of memory"); }
 
 			r->hs = z->img_h_max / z->img_comp[k].h;
 			r->vs = z->img_v_max / z->img_comp[k].v;
@@ -3524,7 +3540,7 @@ static void load_jpeg_image_into_dst(stbi_uc *output,stbi__jpeg *z, int *out_x,
 		// can't error after this so, this is safe
 		// memory is already allocated in PBO
 		//output = (stbi_uc *)stbi__malloc(n * z->s->img_x * z->s->img_y + 1);
-		if (!output) { stbi__cleanup_jpeg(z);  stbi__errpuc("outofmem", "Out of memory"); }
+		if (!output) { stbi__cleanup_jpeg(z);  return stbi__err("outofmem", "Out of memory"); }
 
 		// now go ahead and resample
 		for (j = 0; j < z->s->img_y; ++j) {
@@ -3567,7 +3583,7 @@ static void load_jpeg_image_into_dst(stbi_uc *output,stbi__jpeg *z, int *out_x,
 		*out_x = z->s->img_x;
 		*out_y = z->s->img_y;
 		if (comp) *comp = z->s->img_n; // report original components, not output
-		
+		return 1;
 	}
 }
 
@@ -3579,7 +3595,7 @@ static unsigned char *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *com
    return load_jpeg_image(&j, x,y,comp,req_comp);
 }
 
-static void stbi__jpeg_load_into_dst(unsigned char *dst, stbi__context *s, int *x, int *y, int *comp, int req_comp)
+static int stbi__jpeg_load_into_dst(unsigned char *dst, stbi__context *s, int *x, int *y, int *comp, int req_comp)
 {
 	stbi__jpeg j;
 	j.s = s;
@@ -3616,6 +3632,272 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
    j.s = s;
    return stbi__jpeg_info_raw(&j, x, y, comp);
 }
+
+struct stbi__jpeg_bands
+{
+   stbi__jpeg jpeg;             // headers and tables, no component data
+   stbi__context s;
+   stbi_uc const *buffer;
+   int len;
+   int band_rows;               // MCU rows from one restart marker that starts a row to the next
+   int num_intervals;
+   int *interval_offsets;       // where the entropy coded data of every restart interval starts
+};
+
+// Decodes the MCU rows [first,end) of a single interleaved scan, or of the
+// only component of a grey image, starting right after a restart marker.
+// The component data holds those rows only.
+static int stbi__jpeg_decode_mcu_rows(stbi__jpeg *z, int first, int end)
+{
+   int i,j,k,x,y;
+   STBI_SIMD_ALIGN(short, data[64]);
+   stbi__jpeg_reset(z);
+   for (j=first; j < end; ++j) {
+      for (i=0; i < z->img_mcu_x; ++i) {
+         for (k=0; k < z->scan_n; ++k) {
+            int n = z->order[k];
+            for (y=0; y < z->img_comp[n].v; ++y) {
+               for (x=0; x < z->img_comp[n].h; ++x) {
+                  int x2 = (i*z->img_comp[n].h + x)*8;
+                  int y2 = ((j-first)*z->img_comp[n].v + y)*8;
+                  int ha = z->img_comp[n].ha;
+                  if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                  z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+               }
+            }
+         }
+         if (--z->todo <= 0) {
+            if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+            // only the last interval of the band may end without a marker
+            if (!STBI__RESTART(z->marker)) return j == end-1 && i == z->img_mcu_x-1;
+            stbi__jpeg_reset(z);
+         }
+      }
+   }
+   return 1;
+}
+
+STBIDEF stbi_jpeg_bands *stbi_jpeg_bands_begin(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int *mcu_rows, int *band_rows)
+{
+   stbi_jpeg_bands *b;
+   stbi__jpeg *z;
+   int m, i, a, c, h_max=1, v_max=1, pos, next;
+
+   b = (stbi_jpeg_bands *) stbi__malloc(sizeof(*b));
+   if (!b) return NULL;
+   b->buffer = buffer;
+   b->len = len;
+   b->interval_offsets = NULL;
+   z = &b->jpeg;
+   stbi__start_mem(&b->s, buffer, len);
+   z->s = &b->s;
+   stbi__setup_jpeg(z);
+   z->restart_interval = 0;
+   if (!stbi__decode_jpeg_header(z, STBI__SCAN_header) || z->progressive) goto fail;
+   if ((1 << 30) / z->s->img_x / z->s->img_n < z->s->img_y) goto fail;
+
+   // the interleaved MCUs, as stbi__process_frame_header lays them out
+   for (i=0; i < z->s->img_n; ++i) {
+      if (z->img_comp[i].h > h_max) h_max = z->img_comp[i].h;
+      if (z->img_comp[i].v > v_max) v_max = z->img_comp[i].v;
+   }
+   z->img_h_max = h_max;
+   z->img_v_max = v_max;
+   z->img_mcu_w = h_max * 8;
+   z->img_mcu_h = v_max * 8;
+   z->img_mcu_x = (z->s->img_x + z->img_mcu_w-1) / z->img_mcu_w;
+   z->img_mcu_y = (z->s->img_y + z->img_mcu_h-1) / z->img_mcu_h;
+   for (i=0; i < z->s->img_n; ++i) {
+      z->img_comp[i].x = (z->s->img_x * z->img_comp[i].h + h_max-1) / h_max;
+      z->img_comp[i].y = (z->s->img_y * z->img_comp[i].v + v_max-1) / v_max;
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      z->img_comp[i].raw_data = z->img_comp[i].raw_coeff = NULL;
+      z->img_comp[i].data = z->img_comp[i].linebuf = NULL;
+      z->img_comp[i].coeff = NULL;
+   }
+
+   // tables up to the first scan, which has to hold every component
+   m = stbi__get_marker(z);
+   while (!stbi__SOS(m)) {
+      if (stbi__EOI(m) || !stbi__process_marker(z, m)) goto fail;
+      m = stbi__get_marker(z);
+      while (m == STBI__MARKER_none) {
+         if (stbi__at_eof(z->s)) goto fail;
+         m = stbi__get_marker(z);
+      }
+   }
+   if (!stbi__process_scan_header(z)) goto fail;
+   if (z->scan_n != z->s->img_n || z->restart_interval == 0) goto fail;
+   if (z->s->img_n == 1 && (z->img_comp[0].h != 1 || z->img_comp[0].v != 1)) goto fail;
+
+   // find every restart marker, they count up modulo 8
+   b->num_intervals = (z->img_mcu_x * z->img_mcu_y + z->restart_interval-1) / z->restart_interval;
+   b->interval_offsets = (int *) stbi__malloc(b->num_intervals * sizeof(int));
+   if (!b->interval_offsets) goto fail;
+   pos = (int) (z->s->img_buffer - buffer);
+   b->interval_offsets[0] = pos;
+   next = 1;
+   while (next < b->num_intervals) {
+      stbi_uc const *p = (stbi_uc const *) memchr(buffer + pos, 0xff, len - pos);
+      if (!p || p + 1 >= buffer + len) break;
+      pos = (int) (p - buffer);
+      c = buffer[pos+1];
+      if (c == 0xff) { ++pos; continue; } // fill byte
+      if (c == 0) { pos += 2; continue; } // stuffed zero
+      if (!STBI__RESTART(c) || (c & 7) != ((next-1) & 7)) break;
+      pos += 2;
+      b->interval_offsets[next++] = pos;
+   }
+   if (next < b->num_intervals) goto fail;
+
+   // a row starts on a marker every restart_interval / gcd(restart_interval, img_mcu_x) rows
+   a = z->restart_interval;
+   c = z->img_mcu_x;
+   while (c) { m = a % c; a = c; c = m; }
+   b->band_rows = z->restart_interval / a;
+
+   *x = z->s->img_x;
+   *y = z->s->img_y;
+   if (comp) *comp = z->s->img_n;
+   *mcu_rows = z->img_mcu_y;
+   *band_rows = b->band_rows;
+   return b;
+
+fail:
+   stbi_jpeg_bands_end(b);
+   return NULL;
+}
+
+STBIDEF int stbi_jpeg_bands_decode(stbi_jpeg_bands const *bands, unsigned char *dst, int req_comp, int first_mcu_row, int end_mcu_row)
+{
+   stbi__jpeg *z;
+   stbi__context s;
+   stbi__resample res_comp[4];
+   stbi_uc *coutput[4];
+   stbi_uc *last_row = NULL;
+   int n, decode_n, k, dec_first, dec_end, offset, is_ok = 1;
+   unsigned int i, j, y_first, y_end;
+
+   if (req_comp < 1 || req_comp > 4 || first_mcu_row < 0 || first_mcu_row >= end_mcu_row ||
+       end_mcu_row > bands->jpeg.img_mcu_y || first_mcu_row % bands->band_rows != 0)
+      return 0;
+
+   // a copy of the tables for this band, it is too large for some stacks
+   z = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+   if (!z) return 0;
+   memcpy(z, &bands->jpeg, sizeof(stbi__jpeg));
+   s = bands->s;
+   z->s = &s;
+
+   n = req_comp;
+   decode_n = (z->s->img_n == 3 && n < 3) ? 1 : z->s->img_n;
+
+   // upsampling vertically blends in the chroma rows next to the band, so
+   // decode from the marker before it and the MCU row after it
+   dec_first = first_mcu_row;
+   dec_end = end_mcu_row;
+   for (k=0; k < decode_n; ++k) {
+      if (z->img_comp[k].v < z->img_v_max) {
+         if (first_mcu_row > 0) dec_first = first_mcu_row - bands->band_rows;
+         if (end_mcu_row < z->img_mcu_y) dec_end = end_mcu_row + 1;
+      }
+   }
+
+   for (k=0; k < z->s->img_n; ++k) {
+      z->img_comp[k].raw_data = stbi__malloc(z->img_comp[k].w2 * (dec_end - dec_first) * z->img_comp[k].v * 8 + 15);
+      z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
+      if (!z->img_comp[k].raw_data || !z->img_comp[k].linebuf) is_ok = 0;
+      z->img_comp[k].data = (stbi_uc*) (((size_t) z->img_comp[k].raw_data + 15) & ~15);
+   }
+
+   if (is_ok) {
+      offset = bands->interval_offsets[dec_first * z->img_mcu_x / z->restart_interval];
+      stbi__start_mem(&s, bands->buffer + offset, bands->len - offset);
+      is_ok = stbi__jpeg_decode_mcu_rows(z, dec_first, dec_end);
+   }
+
+   if (is_ok) {
+      for (k=0; k < decode_n; ++k) {
+         stbi__resample *r = &res_comp[k];
+         r->hs      = z->img_h_max / z->img_comp[k].h;
+         r->vs      = z->img_v_max / z->img_comp[k].v;
+         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
+
+         if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+         else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+         else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+         else                               r->resample = stbi__resample_row_generic;
+      }
+
+      y_first = first_mcu_row * z->img_mcu_h;
+      y_end = end_mcu_row * z->img_mcu_h;
+      if (y_end > z->s->img_y) y_end = z->s->img_y;
+      // the 3 component converters write a 4th byte after every pixel, the
+      // one after the band's last row belongs to the next band
+      if (n == 3) {
+         last_row = (stbi_uc *) stbi__malloc(z->s->img_x * 4);
+         if (!last_row) { y_end = y_first; is_ok = 0; }
+      }
+      for (j=y_first; j < y_end; ++j) {
+         stbi_uc *out = (n == 3 && j == y_end-1) ? last_row : dst + n * z->s->img_x * j;
+         for (k=0; k < decode_n; ++k) {
+            // the rows load_jpeg_image's resampler is on by output row j
+            stbi__resample *r = &res_comp[k];
+            int plane_first = dec_first * z->img_comp[k].v * 8;
+            int plane_last = dec_end * z->img_comp[k].v * 8 - 1;
+            int t = j + (r->vs >> 1);
+            int ystep = t % r->vs, wraps = t / r->vs;
+            int row0 = wraps > 0 ? wraps-1 : 0, row1 = wraps;
+            int y_bot = ystep >= (r->vs >> 1);
+            stbi_uc *line0, *line1;
+            if (row0 > z->img_comp[k].y-1) row0 = z->img_comp[k].y-1;
+            if (row1 > z->img_comp[k].y-1) row1 = z->img_comp[k].y-1;
+            // rows past the band are only passed to resamplers that don't read them
+            row0 = row0 < plane_first ? plane_first : row0 > plane_last ? plane_last : row0;
+            row1 = row1 < plane_first ? plane_first : row1 > plane_last ? plane_last : row1;
+            line0 = z->img_comp[k].data + (row0 - plane_first) * z->img_comp[k].w2;
+            line1 = z->img_comp[k].data + (row1 - plane_first) * z->img_comp[k].w2;
+            coutput[k] = r->resample(z->img_comp[k].linebuf,
+                                     y_bot ? line1 : line0,
+                                     y_bot ? line0 : line1,
+                                     r->w_lores, r->hs);
+         }
+         if (n >= 3) {
+            stbi_uc *y = coutput[0];
+            if (z->s->img_n == 3) {
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            } else
+               for (i=0; i < z->s->img_x; ++i) {
+                  out[0] = out[1] = out[2] = y[i];
+                  out[3] = 255; // not used if n==3
+                  out += n;
+               }
+         } else {
+            stbi_uc *y = coutput[0];
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+            else
+               for (i=0; i < z->s->img_x; ++i) *out++ = y[i], *out++ = 255;
+         }
+         if (n == 3 && j == y_end-1)
+            memcpy(dst + n * z->s->img_x * j, last_row, n * z->s->img_x);
+      }
+   }
+
+   STBI_FREE(last_row);
+   stbi__cleanup_jpeg(z);
+   STBI_FREE(z);
+   return is_ok;
+}
+
+STBIDEF void stbi_jpeg_bands_end(stbi_jpeg_bands *bands)
+{
+   if (!bands) return;
+   STBI_FREE(bands->interval_offsets);
+   STBI_FREE(bands);
+}
 #endif
 
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18